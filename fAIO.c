@@ -22,38 +22,183 @@
 #include <errno.h>
 
 #include "fTypes.h"
+#include "fHisto.h"
 #include "fAIO.h"
+#include "fProfile.h"
+
+// fProfile slots of the write thread
+#define FAIO_PROFILE_KICK		0
+#define FAIO_PROFILE_UPDATE		1
+#define FAIO_PROFILE_WRITE		2
 
 //-----------------------------------------------------------------------------------------------
 
 static void* fAIO_WriteThread(void* User);
+static void fAIO_BlockReserve(fAIO_t* A, u32 BlockSize);
+static void fAIO_EventSignal(int fd);
+static void fAIO_Wake(fAIO_t* A);
 
 //-----------------------------------------------------------------------------------------------
 
-fAIO_t* fAIO_Open(int fd)
+fAIOConfig_t g_fAIOConfig =
 {
-	fAIO_t* A = (fAIO_t*)malloc(sizeof(fAIO_t));
-	assert(A != NULL);
-	memset(A, 0, sizeof(fAIO_t));
+	.Engine				= FAIO_ENGINE_LIBAIO,
+	.SQPoll				= false,
+	.BlockSize			= FAIO_BLOCK_DEFAULT,
+	.QueueDepth			= FAIO_DEPTH_DEFAULT,
+	.Adaptive			= false,
+	.BlockMax			= FAIO_BLOCK_MAX,
+	.GatherMax			= FAIO_GATHER_MAX,
+	.SpinUS				= FAIO_SPIN_US,
+};
+
+//-----------------------------------------------------------------------------------------------
+// fill in unset fields and clamp to what the write queue supports
+
+void fAIO_ConfigDefault(fAIOConfig_t* Config)
+{
+	if (Config->BlockSize	== 0) Config->BlockSize		= FAIO_BLOCK_DEFAULT;
+	if (Config->QueueDepth	== 0) Config->QueueDepth	= FAIO_DEPTH_DEFAULT;
+	if (Config->BlockMax	== 0) Config->BlockMax		= FAIO_BLOCK_MAX;
+	if (Config->GatherMax	== 0) Config->GatherMax		= FAIO_GATHER_MAX;
+
+	Config->BlockSize	= (Config->BlockSize + 4095) & ~4095;
+	Config->BlockSize	= (Config->BlockSize < FAIO_BLOCK_MIN) ? FAIO_BLOCK_MIN : Config->BlockSize;
+	Config->BlockSize	= (Config->BlockSize > FAIO_BLOCK_MAX) ? FAIO_BLOCK_MAX : Config->BlockSize;
+	Config->BlockMax	= (Config->BlockMax + 4095) & ~4095;
+	Config->BlockMax	= (Config->BlockMax < Config->BlockSize) ? Config->BlockSize : Config->BlockMax;
+	Config->BlockMax	= (Config->BlockMax > FAIO_BLOCK_MAX) ? FAIO_BLOCK_MAX : Config->BlockMax;
+	Config->QueueDepth	= (Config->QueueDepth > FAIO_QUEUE_MAX - 2) ? FAIO_QUEUE_MAX - 2 : Config->QueueDepth;
+	Config->GatherMax	= (Config->GatherMax > FAIO_GATHER_MAX) ? FAIO_GATHER_MAX : Config->GatherMax;
+}
+
+//-----------------------------------------------------------------------------------------------
+// setup io_uring, map the rings and register the write buffers + output fd 
+static bool fAIO_RingOpen(fAIO_t* A, fAIOConfig_t* Config)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	if (Config->SQPoll)
+	{
+		p.flags				|= IORING_SETUP_SQPOLL;
+		p.sq_thread_idle	= 2000;						// msec before the kernel poll thread sleeps
+	}
+
+	// op free list bounds the number of in-flight ops, so never overflows the rings 
+	A->RingFD = io_uring_setup(A->AIOOpMax, &p);
+	if (A->RingFD < 0)
+	{
+		fprintf(stderr, "io_uring_setup failed %i (%s)\n", errno, strerror(errno));
+		return false;
+	}
+	A->RingFlags		= p.flags;
+
+	A->RingSQSize		= p.sq_off.array + p.sq_entries * sizeof(u32);
+	A->RingCQSize		= p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		A->RingSQSize	= (A->RingSQSize > A->RingCQSize) ? A->RingSQSize : A->RingCQSize;
+		A->RingCQSize	= A->RingSQSize;
+	}
+
+	A->RingSQ = mmap(0, A->RingSQSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, A->RingFD, IORING_OFF_SQ_RING);
+	assert(A->RingSQ != MAP_FAILED);
+
+	A->RingCQ = A->RingSQ;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		A->RingCQ = mmap(0, A->RingCQSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, A->RingFD, IORING_OFF_CQ_RING);
+		assert(A->RingCQ != MAP_FAILED);
+	}
 
-	A->afd = eventfd(0);
-	//printf("AFD: %08x\n", A->afd);
+	A->RingSQECnt		= p.sq_entries;
+	A->RingSQE			= mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, A->RingFD, IORING_OFF_SQES);
+	assert(A->RingSQE != MAP_FAILED);
+
+	A->RingSQHead		= (u32*)(A->RingSQ + p.sq_off.head);
+	A->RingSQTail		= (u32*)(A->RingSQ + p.sq_off.tail);
+	A->RingSQFlags		= (u32*)(A->RingSQ + p.sq_off.flags);
+	A->RingSQArray		= (u32*)(A->RingSQ + p.sq_off.array);
+	A->RingSQMask		= *(u32*)(A->RingSQ + p.sq_off.ring_mask);
+	A->RingSQTailLocal	= *A->RingSQTail;
+
+	A->RingCQHead		= (u32*)(A->RingCQ + p.cq_off.head);
+	A->RingCQTail		= (u32*)(A->RingCQ + p.cq_off.tail);
+	A->RingCQE			= (struct io_uring_cqe*)(A->RingCQ + p.cq_off.cqes);
+	A->RingCQMask		= *(u32*)(A->RingCQ + p.cq_off.ring_mask);
+
+	// register the staging arena, kernel skips the page pinning on every write
+	struct iovec BufferList[1];
+	BufferList[0].iov_base	= A->Arena;
+	BufferList[0].iov_len	= A->ArenaSize;
+	if (io_uring_register(A->RingFD, IORING_REGISTER_BUFFERS, BufferList, 1) == 0)
+	{
+		A->RingFixedBuffer	= true;
+	}
+	else
+	{
+		fprintf(stderr, "io_uring register buffers failed %i (%s)\n", errno, strerror(errno));
+	}
 
-	// non blocking
+	// register output file, skips the fd lookup on every write
+	if (A->WriteFD >= 0)
+	{
+		int FileList[1] = { A->WriteFD };
+		if (io_uring_register(A->RingFD, IORING_REGISTER_FILES, FileList, 1) == 0)
+		{
+			A->RingFixedFile = true;
+		}
+		else
+		{
+			fprintf(stderr, "io_uring register file failed %i (%s)\n", errno, strerror(errno));
+		}
+	}
 
-	fcntl(A->afd, F_SETFL, fcntl(A->afd, F_GETFL, 0) | O_NONBLOCK);
-	if (io_setup(4*1024, &A->ctx))
+	// completions signal afd so the write thread can block 
+	if (io_uring_register(A->RingFD, IORING_REGISTER_EVENTFD, &A->afd, 1) == 0)
+	{
+		A->RingEventFD = true;
+	}
+	else
 	{
-		printf("io_setup failed");
-		return NULL;
+		fprintf(stderr, "io_uring register eventfd failed %i (%s)\n", errno, strerror(errno));
 	}
-	
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fAIO_t* fAIO_Open(int fd)
+{
+	return fAIO_OpenConfig(fd, &g_fAIOConfig);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fAIO_t* fAIO_OpenConfig(int fd, fAIOConfig_t* _Config)
+{
+	fAIOConfig_t Config_ = *_Config;
+	fAIOConfig_t* Config = &Config_;
+	fAIO_ConfigDefault(Config);
+
+	fAIO_t* A = (fAIO_t*)malloc(sizeof(fAIO_t));
+	assert(A != NULL);
+	memset(A, 0, sizeof(fAIO_t));
+
 	A->IOEventMax	= 128*1024;
 	A->IOEvent		= malloc(A->IOEventMax * sizeof(io_event_t));
 	assert(A->IOEvent != NULL);
 	memset(A->IOEvent, 0, A->IOEventMax * sizeof(io_event_t));
 
-	A->AIOOpMax		= 256;
+	// write queue slots, 2 spare as the ring never fills
+	A->QueueDepthMax	= Config->QueueDepth;
+	A->QueueDepth		= Config->QueueDepth;
+	A->WriteQueueMax	= 128;
+	while (A->WriteQueueMax < A->QueueDepthMax + 2) A->WriteQueueMax *= 2;
+
+	// ops for the write queue plus direct fAIO_Queue callers
+	A->AIOOpMax		= 2 * A->WriteQueueMax;
 	A->AIOOpList	= malloc(A->AIOOpMax * sizeof(fAIOOp_t));
 	assert(A->AIOOpList != NULL);
 	memset(A->AIOOpList, 0, A->AIOOpMax * sizeof(fAIOOp_t));
@@ -74,36 +219,72 @@ fAIO_t* fAIO_Open(int fd)
 	assert(A->IOList != NULL);
 	memset(A->IOList, 0, sizeof(iocb_t*)*A->IOListMax);
 
-	A->HistoBin			= 1e6;
-	A->HistoMax			= 1e6;
-	A->HistoRd			= (u32*)(malloc(A->HistoMax * sizeof(u32)));
-	assert(A->HistoRd != NULL);
-	memset(A->HistoRd, 0, A->HistoMax * sizeof(u32));
+	A->IOSubmit		= (iocb_t**)malloc(sizeof(iocb_t*)*A->IOListMax);
+	assert(A->IOSubmit != NULL);
 
-	A->HistoWr			= (u32*)(malloc(A->HistoMax * sizeof(u32)));
-	assert(A->HistoWr != NULL);
-	memset(A->HistoWr, 0, A->HistoMax * sizeof(u32));
+	fHisto_Reset(&A->HistoRd);
+	fHisto_Reset(&A->HistoWr);
 
 	A->WriteFD			= fd;
 
-	// allocate write buffer
-	A->WritePos			= 0; 
-	A->WriteMax			= kKB(256);
-	A->WriteUnaligned	= malloc( A->WriteMax * 3);
-
 	// write queue
 	A->WriteQueuePut	= 0;
 	A->WriteQueueGet	= 0;
-	A->WriteQueueMax	= 128;
 	A->WriteQueueMsk	= A->WriteQueueMax - 1;
-	for (int i=0; i < A->WriteQueueMax; i++)
+
+	// staging arena holds a full queue of blocks, at least 8 of the largest
+	// so the controller can grow the block size
+	A->BlockSize		= Config->BlockSize;
+	A->BlockSizeNext	= Config->BlockSize;
+	A->BlockMax			= Config->Adaptive ? Config->BlockMax : Config->BlockSize;
+	A->ArenaSize		= (u64)A->QueueDepthMax * A->BlockSize;
+	A->ArenaSize		= (A->ArenaSize < 8ULL * A->BlockMax) ? 8ULL * A->BlockMax : A->ArenaSize;
+	A->ArenaSize		= (A->ArenaSize < FAIO_STAGE_MIN) ? FAIO_STAGE_MIN : A->ArenaSize;
+	A->ArenaSize		= (A->ArenaSize > kGB(1)) ? kGB(1) : A->ArenaSize;
+	A->Arena			= memalign(4096, A->ArenaSize);
+	assert(A->Arena != NULL);
+
+	// initialize the first write block 
+	fAIO_BlockReserve(A, A->BlockSize);
+
+	A->GatherMax		= Config->GatherMax;
+	A->SpinUS			= Config->SpinUS;
+
+	// completion + submit doorbell of the write thread, and the writers space doorbell
+	A->afd				= eventfd(0);
+	A->SpaceFD			= eventfd(0);
+	fcntl(A->afd,		F_SETFL, fcntl(A->afd,		F_GETFL, 0) | O_NONBLOCK);
+	fcntl(A->SpaceFD,	F_SETFL, fcntl(A->SpaceFD,	F_GETFL, 0) | O_NONBLOCK);
+
+	// controller starts low and doubles up
+	A->Adaptive			= Config->Adaptive;
+	if (A->Adaptive)
 	{
-		A->WriteQueueBuffer[i] = memalign(4096, kKB(256));
-		assert(A->WriteQueueBuffer[i] != NULL); 
+		A->AdaptState	= FAIO_ADAPT_DEPTH;
+		A->QueueDepth	= (A->QueueDepthMax < 4) ? A->QueueDepthMax : 4;
+		A->AdaptSettle	= true;
+		A->AdaptTSC		= rdtsc();
 	}
 
-	// initialize the first wirte buffer 
-	A->Write			= A->WriteQueueBuffer[A->WriteQueuePut]; 
+	// io engine, io_uring falls back to libaio on older kernels
+	A->Engine			= Config->Engine;
+	A->RingFD			= -1;
+	if (A->Engine == FAIO_ENGINE_URING)
+	{
+		if (!fAIO_RingOpen(A, Config))
+		{
+			fprintf(stderr, "io_uring unavailable, using libaio\n");
+			A->Engine = FAIO_ENGINE_LIBAIO;
+		}
+	}
+	if (A->Engine == FAIO_ENGINE_LIBAIO)
+	{
+		if (io_setup(A->AIOOpMax, &A->ctx))
+		{
+			printf("io_setup failed");
+			return NULL;
+		}
+	}
 
 	// shutdown 
 	A->IsExit			= false;
@@ -125,14 +306,89 @@ void fAIO_Close(fAIO_t* A)
 	fAIO_WriteFlush(A);
 
 	A->IsExit = true;
+	fAIO_EventSignal(A->afd);
 	pthread_join(A->WriteThread, NULL); 
 
-	fprintf(stderr, "AIO Close Complete\n");
+	// release the io engine
+	if (A->Engine == FAIO_ENGINE_URING)
+	{
+		munmap(A->RingSQE, A->RingSQECnt * sizeof(struct io_uring_sqe));
+		if (A->RingCQ != A->RingSQ) munmap(A->RingCQ, A->RingCQSize);
+		munmap(A->RingSQ, A->RingSQSize);
+		close(A->RingFD);
+	}
+	else
+	{
+		io_destroy(A->ctx);
+	}
+	close(A->afd);
+	close(A->SpaceFD);
+
+	fprintf(stderr, "AIO Close Complete Engine:%s Ops:%lli Syscalls:%lli Writev:%lli (%.2f per) Depth:%i Block:%iKB%s\n", 
+			fAIO_EngineName(A), 
+			A->StatOp, 
+			A->StatSyscall, 
+			A->StatGatherOp, 
+			A->StatGatherSeg * inverse(A->StatGatherOp), 
+			A->QueueDepth, 
+			A->BlockSizeNext / 1024, 
+			A->Adaptive ? " (adaptive)" : "");
+	fprintf(stderr, "AIO Write Thread CPU %.3f Sec %.3f Sec/GB | Sleeps %lli Writer Waits %lli\n", 
+			A->StatCPU / 1e9, 
+			A->StatCPU * inverse(A->StatWriteByte), 
+			A->StatSleep, 
+			A->StatSpaceWait);
+
+	free(A->Arena);
+	free(A->IOList);
+	free(A->IOSubmit);
+	free(A->AIOOpList);
+	free(A->IOEvent);
+	free(A);
 }
 
 //-----------------------------------------------------------------------------------------------
 
-fAIOOp_t* fAIO_Queue(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u64 SectorSize)
+// fill the next submission queue entry. called with WriteQueueLock held
+static void fAIO_RingPrep(fAIO_t* A, fAIOOp_t* Op, int fd, u32 FileOp, void* Buffer, u64 Offset, u64 Length, s32 BufferIndex, u32 VecCnt)
+{
+	u32 Tail					= A->RingSQTailLocal;
+	u32 Index					= Tail & A->RingSQMask;
+
+	struct io_uring_sqe* sqe	= &A->RingSQE[Index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	switch (FileOp)
+	{
+	case IOCB_CMD_PWRITE: sqe->opcode = ((BufferIndex >= 0) && A->RingFixedBuffer) ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE; break;
+	case IOCB_CMD_PWRITEV: sqe->opcode = IORING_OP_WRITEV; break;
+	case IOCB_CMD_PREAD : sqe->opcode = ((BufferIndex >= 0) && A->RingFixedBuffer) ? IORING_OP_READ_FIXED : IORING_OP_READ; break;
+	default: assert(false);
+	}
+
+	sqe->fd						= fd;
+	if ((fd == A->WriteFD) && A->RingFixedFile)
+	{
+		sqe->fd					= 0;
+		sqe->flags				|= IOSQE_FIXED_FILE;
+	}
+	sqe->addr					= (u64)Buffer;
+	sqe->len					= (FileOp == IOCB_CMD_PWRITEV) ? VecCnt : Length;
+	sqe->off					= Offset;
+	sqe->buf_index				= (BufferIndex >= 0) ? BufferIndex : 0;
+	sqe->user_data				= (u64)Op;
+
+	A->RingSQArray[Index]		= Index;
+	A->RingSQTailLocal			= Tail + 1;
+
+	// publish to the kernel 
+	__atomic_store_n(A->RingSQTail, A->RingSQTailLocal, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------------------------
+// BufferIndex is the registered buffer or -1 for any other buffer. a
+// PWRITEV Buffer is an iovec list of VecCnt entries, SectorSize their total
+static fAIOOp_t* fAIO_QueueOp(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u64 SectorSize, s32 BufferIndex, u32 VecCnt)
 {
 	fAIOOp_t* Op = NULL;
 	sync_lock(&A->WriteQueueLock, 100);
@@ -143,21 +399,38 @@ fAIOOp_t* fAIO_Queue(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u6
 		A->AIOOpFree		= A->AIOOpFree->NextFree;
 		assert(A->AIOOpFree != NULL);
 
-		iocb_t* iocb		= &Op->iocb;
-		memset(iocb, 0, sizeof(iocb_t));
-
-		iocb->aio_fildes	= fd;
-		iocb->aio_lio_opcode= FileOp; //IOCB_CMD_PWRITE;
-		iocb->aio_reqprio	= 0;
-		iocb->aio_buf		= (u_int64_t)Buffer;
-		iocb->aio_nbytes	= SectorSize; 
-		iocb->aio_offset	= Offset;
-		iocb->aio_flags		= IOCB_FLAG_RESFD;
-		iocb->aio_resfd		= A->afd;
-		iocb->aio_data		= (u64)Op;
+		if (A->Engine == FAIO_ENGINE_URING)
+		{
+			fAIO_RingPrep(A, Op, fd, FileOp, Buffer, Offset, SectorSize, BufferIndex, VecCnt);
+			A->IOCount++;
+		}
+		else if (FileOp == IOCB_CMD_PWRITEV)
+		{
+			iocb_t* iocb		= &Op->iocb;
+			asyio_prep_pwritev(iocb, fd, (struct iovec*)Buffer, VecCnt, Offset, A->afd);
+			iocb->aio_data		= (u64)Op;
 
-		A->IOList[A->IOCount++]	= iocb;
+			A->IOList[A->IOCount++]	= iocb;
+		}
+		else
+		{
+			iocb_t* iocb		= &Op->iocb;
+			memset(iocb, 0, sizeof(iocb_t));
+
+			iocb->aio_fildes	= fd;
+			iocb->aio_lio_opcode= FileOp; //IOCB_CMD_PWRITE;
+			iocb->aio_reqprio	= 0;
+			iocb->aio_buf		= (u_int64_t)Buffer;
+			iocb->aio_nbytes	= SectorSize; 
+			iocb->aio_offset	= Offset;
+			iocb->aio_flags		= IOCB_FLAG_RESFD;
+			iocb->aio_resfd		= A->afd;
+			iocb->aio_data		= (u64)Op;
+
+			A->IOList[A->IOCount++]	= iocb;
+		}
 		A->IOPending++;
+		A->StatOp++;
 
 		Op->KickTS			= rdtsc();
 		Op->Offset			= Offset;
@@ -174,10 +447,66 @@ fAIOOp_t* fAIO_Queue(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u6
 
 //-----------------------------------------------------------------------------------------------
 
+fAIOOp_t* fAIO_Queue(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u64 SectorSize)
+{
+	fAIOOp_t* Op = fAIO_QueueOp(A, fd, FileOp, Buffer, Offset, SectorSize, -1, 0);
+	fAIO_Wake(A);
+	return Op;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+// io_uring submit, entries are already in the ring so only a single enter is needed 
+static int fAIO_RingKick(fAIO_t* A)
+{
+	u32 IOCount;
+	sync_lock(&A->WriteQueueLock, 100);
+	{
+		IOCount 	= A->IOCount;
+		A->IOCount	= 0;
+	}
+	sync_unlock(&A->WriteQueueLock);	
+
+	if (IOCount == 0) return true;
+
+	u32 Flags = 0;
+	if (A->RingFlags & IORING_SETUP_SQPOLL)
+	{
+		// kernel thread picks up the new tail on its own, 
+		// syscall only when its gone idle 
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((*A->RingSQFlags & IORING_SQ_NEED_WAKEUP) == 0) return true;
+
+		Flags |= IORING_ENTER_SQ_WAKEUP;
+	}
+
+	int ret = io_uring_enter(A->RingFD, IOCount, 0, Flags);
+	A->StatSyscall++;
+
+	// anything not consumed gets retried on the next kick
+	u32 Submit = (ret < 0) ? 0 : ret;
+	if ((Submit < IOCount) && !(A->RingFlags & IORING_SETUP_SQPOLL))
+	{
+		sync_lock(&A->WriteQueueLock, 100);
+		A->IOCount += IOCount - Submit;
+		sync_unlock(&A->WriteQueueLock);	
+	}
+	if (ret < 0)
+	{
+		printf("io_uring_enter failed %i Pending:%i Errno:%i (%s)\n", ret, A->IOPending, errno, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+
 int  fAIO_Kick(fAIO_t* A)
 {
+	if (A->Engine == FAIO_ENGINE_URING) return fAIO_RingKick(A);
+
 	u32					IOCount;
-	static iocb_t*		IOList[1024*1024];
+	iocb_t**			IOList = A->IOSubmit;
 
 	// make copy of the IO list to submit
 	sync_lock(&A->WriteQueueLock, 100);
@@ -191,6 +520,7 @@ int  fAIO_Kick(fAIO_t* A)
 
 	// io_submit takes a long time, so dont block the queue process
 	int ret = io_submit(A->ctx, IOCount, IOList);
+	A->StatSyscall++;
 	if (ret < 0)
 	{
 		printf("io submit failed %i Pending:%i Errno:%i (%s)\n", ret, A->IOPending, errno, strerror(errno));
@@ -223,12 +553,77 @@ int fAIO_Flush(fAIO_t* A)
 	assert(Done == true);
 }
 
+//-----------------------------------------------------------------------------------------------
+// common completion handling for both engines 
+static void fAIO_OpComplete(fAIO_t* A, fAIOOp_t* O, s64 Res, u64 TSC)
+{
+	//printf("Complete %p, %016llx %08x %i : %i\n", O, O->Offset, O->State, O->FileOp, Res);
+
+	// mark as complete
+	O->Res			= Res;
+	sfence();
+	O->State		= AIO_OP_STATE_COMPLETE;
+
+	// update histogram
+	u64 dTS			= tsc2ns(TSC - O->KickTS);
+	switch (O->FileOp)
+	{
+	case IOCB_CMD_PWRITE:
+	case IOCB_CMD_PWRITEV: fHisto_Record(&A->HistoWr, dTS); A->StatWriteByte += (Res > 0) ? Res : 0; break;
+	case IOCB_CMD_PREAD : fHisto_Record(&A->HistoRd, dTS); break;
+	}
+
+	// short read is the end of the file
+	bool ReadEnd	= (O->FileOp == IOCB_CMD_PREAD) && (Res >= 0);
+	if ((Res != O->Length) && !ReadEnd)
+	{
+		printf("error: %lli %lli : %p : %016llx FileOp:%x Engine:%s (%s)\n", Res, O->Length, O, O->Offset, O->FileOp, fAIO_EngineName(A), strerror(-Res) );
+	}
+
+	if (Res < 0)
+	{
+		printf("aio event %016llx %016lli\n", (u64)O, Res);
+		printf("Offset: %016llx Lenght:%016llx\n", O->Offset, O->Length);
+		//assert(false);
+	}
+	A->IOPending--;
+
+	// wake a reader blocked on it
+	if (O->FileOp == IOCB_CMD_PREAD)
+	{
+		__sync_synchronize();
+		if (A->SpaceWait) fAIO_EventSignal(A->SpaceFD);
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// reap the io_uring completion ring, no syscall required 
+static int fAIO_RingUpdate(fAIO_t* A)
+{
+	u32 Head = *A->RingCQHead;
+	u32 Tail = __atomic_load_n(A->RingCQTail, __ATOMIC_ACQUIRE);
+	if (Head == Tail) return 0;
+
+	u64 TSC = rdtsc();
+	for (; Head != Tail; Head++)
+	{
+		struct io_uring_cqe* cqe = &A->RingCQE[Head & A->RingCQMask];
+		fAIO_OpComplete(A, (fAIOOp_t*)cqe->user_data, cqe->res, TSC);
+	}
+	__atomic_store_n(A->RingCQHead, Head, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
 //-----------------------------------------------------------------------------------------------
 // checks system for async io`s that have completed
 int fAIO_Update(fAIO_t* A)
 {
+	if (A->Engine == FAIO_ENGINE_URING) return fAIO_RingUpdate(A);
+
 	u64 eval = 0;
 	read(A->afd, &eval, sizeof(eval));
+	A->StatSyscall++;
 
 	if (eval > 0)
 	{
@@ -237,7 +632,9 @@ int fAIO_Update(fAIO_t* A)
 		tmo.tv_sec 	= 0;
 		tmo.tv_nsec = 0;
 
-		int r = io_getevents(A->ctx, 0, 128, A->IOEvent, &tmo);
+		// everything in flight, anything left behind would not signal afd again
+		int r = io_getevents(A->ctx, 0, A->AIOOpMax, A->IOEvent, &tmo);
+		A->StatSyscall++;
 		for (int i=0; i < r; i++)
 		{
 			io_event_t* e = &A->IOEvent[i];
@@ -245,40 +642,7 @@ int fAIO_Update(fAIO_t* A)
 			// recycle
 			fAIOOp_t* O	 = (fAIOOp_t*)e->data;
 
-			iocb_t* iocb = (iocb_t*)e->obj;
-			//printf("Complete %p, %016llx %08x %i %016llx : %i\n", O, O->Offset, O->State, O->FileOp, iocb->aio_offset, e->res);
-
-			// mark as complete
-			O->State		= AIO_OP_STATE_COMPLETE;
-
-			// update histogram
-			u64 dTS			= tsc2ns(TSC - O->KickTS);
-			u32 Index		= dTS / A->HistoBin;
-			Index			= (Index >= A->HistoMax) ? A->HistoMax - 1 : Index;
-			switch (O->FileOp)
-			{
-			case IOCB_CMD_PWRITE: A->HistoWr[Index]++; break;
-			case IOCB_CMD_PREAD : A->HistoRd[Index]++; break;
-			}
-
-			if (e->res != O->Length)
-			{
-				printf("error: %lli %lli : %i %i : %p : %016llx FileOp:%x fd:%i (%s)\n", e->res, O->Length, i, r, O, O->Offset, O->FileOp, iocb->aio_fildes, strerror(-e->res) );
-				/*
-				printf("%lli %lli %lli %lli\n", e->data, e->obj, e->res, e->res2);
-
-				printf("Buffer: %p\n", O->Buffer);
-				assert(false);
-				*/
-			}
-
-			if (e->res < 0)
-			{
-				printf("aio %i event %016llx %016llx %016lli %016lli\n", i, e->data, e->obj, e->res, e->res2);
-				printf("Offset: %016llx Lenght:%016llx\n", O->Offset, O->Length);
-				//assert(false);
-			}
-			A->IOPending--;
+			fAIO_OpComplete(A, O, e->res, TSC);
 		}
 	}
 	return 0;
@@ -329,64 +693,476 @@ int fAIO_NumPending(fAIO_t*A)
 }
 
 //-----------------------------------------------------------------------------------------------
-// write a blob of data
-s32 fAIO_Write(fAIO_t* A, u8* Buffer, u32 Length)
+// eventfd doorbells. the waiter sets its flag, fences and rechecks before
+// blocking, the signaller fences after publishing and only rings when the
+// flag is set, so a wakeup is never lost and a busy peer costs no syscall
+
+static void fAIO_EventSignal(int fd)
+{
+	u64 eval = 1;
+	write(fd, &eval, sizeof(eval));
+}
+
+// block until fd is signalled or TimeoutMS, Reset clears the count
+static void fAIO_EventWait(int fd, u32 TimeoutMS, bool Reset)
+{
+	struct pollfd pfd;
+	pfd.fd		= fd;
+	pfd.events	= POLLIN;
+	pfd.revents	= 0;
+	poll(&pfd, 1, TimeoutMS);
+
+	u64 eval = 0;
+	if (Reset) read(fd, &eval, sizeof(eval));
+}
+
+// writes were queued, wake the write thread if its blocked
+static void fAIO_Wake(fAIO_t* A)
+{
+	__sync_synchronize();
+	if (A->ThreadSleep) fAIO_EventSignal(A->afd);
+}
+
+// head of the write queue has completed and can be released
+static bool fAIO_WriteReady(fAIO_t* A)
+{
+	if (A->WriteQueueGet == A->WriteQueuePut) return false;
+
+	fAIOOp_t* Op = (fAIOOp_t*)A->WriteQueue[ A->WriteQueueGet & A->WriteQueueMsk ];
+	return Op->State == AIO_OP_STATE_COMPLETE;
+}
+
+// write thread has nothing to do, block until a completion, queued writes
+// or the timeout. libaio completions stay counted in afd for fAIO_Update
+static void fAIO_ThreadSleep(fAIO_t* A)
 {
-	// theres space in the output queue
-	// NOTE: need +2 as Write output gets written using the +1 WriteBuffer 
-	if (((A->WriteQueuePut + 2) & A->WriteQueueMsk) == (A->WriteQueueGet & A->WriteQueueMsk))
+	bool Ring = (A->Engine == FAIO_ENGINE_URING);
+
+	A->ThreadSleep = true;
+	__sync_synchronize();
+
+	bool Idle = (A->IOCount == 0) && !fAIO_WriteReady(A) && !A->IsExit;
+	if (Ring) Idle &= (*A->RingCQHead == __atomic_load_n(A->RingCQTail, __ATOMIC_ACQUIRE));
+	if (Idle)
 	{
-		return -1;	
+		// completions cant wake it without the eventfd, poll instead
+		u32 TimeoutMS = (Ring && !A->RingEventFD && (A->IOPending > 0)) ? 1 : FAIO_WAIT_MS;
+
+		fAIO_EventWait(A->afd, TimeoutMS, Ring);
+		A->StatSleep++;
+		A->StatSyscall += Ring ? 2 : 1;
 	}
+	A->ThreadSleep = false;
+}
 
-	// copy write buffer
-	memcpy(A->Write + A->WritePos, Buffer, Length);
-	A->WritePos += Length;
+//-----------------------------------------------------------------------------------------------
+// block a refused writer until the write thread releases a queued write,
+// spinning SpinUS first. returns on the timeout too, the caller retries.
+// FAIO_SPIN_FOREVER spins until the release and never blocks
 
-	// flush ?
-	if (A->WritePos >= A->WriteMax)
+void fAIO_WriteWait(fAIO_t* A)
+{
+	bool Forever	= (A->SpinUS == FAIO_SPIN_FOREVER);
+	u64 SpinTSC		= rdtsc() + ns2tsc(A->SpinUS * 1000ULL);
+	while ((A->WriteQueueGet == A->SpaceGet) && (Forever || (rdtsc() < SpinTSC)))
 	{
-		u32 QueueIndex = A->WriteQueuePut & A->WriteQueueMsk;
+		usleep(0);
+	}
+	if (A->WriteQueueGet != A->SpaceGet) return;
+
+	A->SpaceWait = true;
+	__sync_synchronize();
+	if (A->WriteQueueGet == A->SpaceGet)
+	{
+		fAIO_EventWait(A->SpaceFD, FAIO_WAIT_MS, true);
+		A->StatSpaceWait++;
+	}
+	A->SpaceWait = false;
+}
+
+//-----------------------------------------------------------------------------------------------
+// start staging the next block in the arena. a block never wraps, the
+// tail of the arena is skipped and freed with the block instead
+static void fAIO_BlockReserve(fAIO_t* A, u32 BlockSize)
+{
+	u64 Pos			= A->ArenaPut % A->ArenaSize;
+	u32 Pad			= (Pos + BlockSize > A->ArenaSize) ? A->ArenaSize - Pos : 0;
 
-		u8* WriteBuffer = A->WriteQueueBuffer[ QueueIndex ];
-		assert(WriteBuffer != NULL);
+	A->Write		= A->Arena + (Pos + Pad) % A->ArenaSize;
+	A->WriteReserve	= Pad + BlockSize;
+	A->ArenaPut		+= A->WriteReserve;
 
-		fAIOOp_t* Op = fAIO_Queue(A, A->WriteFD, IOCB_CMD_PWRITE, WriteBuffer, A->WriteOffset, kKB(256));	
+	A->BlockSize	= BlockSize;
+	A->WritePos		= 0;
+}
 
-		A->WriteQueue[ QueueIndex ] = Op;
-		A->WriteQueuePut++; 
+//-----------------------------------------------------------------------------------------------
+// room for SlotCnt more queued writes, BlockCnt of them staged blocks that
+// each reserve a BlockNext block after them
+static bool fAIO_WriteSpace(fAIO_t* A, u32 SlotCnt, u32 BlockCnt, u32 BlockNext)
+{
+	if (SlotCnt == 0) return true;
+
+	// fAIO_WriteWait waits for a release after this
+	u32 Get			= A->WriteQueueGet;
+	A->SpaceGet		= Get;
 
-		A->WriteOffset += kKB(256);
-/*
-		s32 Remain = A->WritePos - kKB(256);
-		if (Remain > 0)
+	if ((u32)(A->WriteQueuePut - Get) + SlotCnt > A->QueueDepth)
+	{
+		A->StatQueueFull++;
+		return false;
+	}
+
+	// at most one of the new blocks wraps
+	u64 Need = (u64)BlockCnt * BlockNext;
+	if ((A->ArenaPut % A->ArenaSize) + Need > A->ArenaSize) Need += BlockNext;
+	if (A->ArenaPut - A->ArenaGet + Need > A->ArenaSize)
+	{
+		A->StatQueueFull++;
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+// queue Length bytes of the staged block and start the next one
+static void fAIO_BlockQueue(fAIO_t* A, u32 Length, u32 BlockNext)
+{
+	u32 QueueIndex = A->WriteQueuePut & A->WriteQueueMsk;
+
+	fAIOOp_t* Op = fAIO_QueueOp(A, A->WriteFD, IOCB_CMD_PWRITE, A->Write, A->WriteOffset, Length, 0, 0);
+
+	A->WriteQueue		[ QueueIndex ] = Op;
+	A->WriteQueueArena	[ QueueIndex ] = A->WriteReserve;
+	sfence();
+	A->WriteQueuePut++;
+	fAIO_Wake(A);
+
+	A->WriteOffset += Length;
+
+	fAIO_BlockReserve(A, BlockNext);
+}
+
+//-----------------------------------------------------------------------------------------------
+// write a blob of data. all or nothing, -1 when the blocks it would
+// complete do not fit the queue. a write spanning more blocks than the
+// queue depth can never fit, it waits for space block by block instead
+s32 fAIO_Write(fAIO_t* A, u8* Buffer, u32 Length)
+{
+	// staged data goes after the gathered zero copy writes
+	fAIO_WriteSubmit(A);
+
+	u32 BlockNext	= A->BlockSizeNext;
+	u64 Fill		= A->WritePos + Length;
+	u32 BlockCnt	= (Fill >= A->BlockSize) ? 1 + (Fill - A->BlockSize) / BlockNext : 0;
+	bool Wait		= (BlockCnt > A->QueueDepth);
+	if (!Wait && !fAIO_WriteSpace(A, BlockCnt, BlockCnt, BlockNext))
+	{
+		return -1;
+	}
+
+	u32 Remain = Length;
+	while (Remain > 0)
+	{
+		u32 Copy = A->BlockSize - A->WritePos;
+		Copy = (Copy > Remain) ? Remain : Copy;
+
+		// block completes with this copy
+		if (Wait && (A->WritePos + Copy == A->BlockSize))
+		{
+			while (!fAIO_WriteSpace(A, 1, 1, BlockNext)) fAIO_WriteWait(A);
+		}
+
+		// copy write buffer
+		memcpy(A->Write + A->WritePos, Buffer, Copy);
+		A->WritePos	+= Copy;
+		Buffer		+= Copy;
+		Remain		-= Copy;
+
+		// flush ?
+		if (A->WritePos == A->BlockSize) fAIO_BlockQueue(A, A->BlockSize, BlockNext);
+	}
+	return Length;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+// write a caller owned buffer without copying. Buffer must be 4KB aligned,
+// Length a multiple of 4KB, anything staged goes out first and must be 4KB
+// aligned too. consecutive calls are gathered into one vectored write of
+// up to GatherMax buffers, queued when full or on fAIO_WriteSubmit.
+// Release(User) is called from the write thread once the write has completed
+s32 fAIO_WriteZC(fAIO_t* A, u8* Buffer, u32 Length, void (*Release)(void* User), void* User)
+{
+	assert((A->WritePos & 4095) == 0);
+	assert(((u64)Buffer & 4095) == 0);
+	assert((Length & 4095) == 0);
+
+	// first write of a gather needs a queue slot
+	if (A->GatherCnt == 0)
+	{
+		u32 Staged		= (A->WritePos > 0) ? 1 : 0;
+		u32 BlockNext	= A->BlockSizeNext;
+		if (!fAIO_WriteSpace(A, Staged + 1, Staged, BlockNext))
 		{
-			assert(false);
+			return -1;
 		}
-*/
-		// set next write buffer
-		A->Write  	= A->WriteQueueBuffer[ A->WriteQueuePut & A->WriteQueueMsk ];
-		A->WritePos = 0;			
+		if (Staged) fAIO_BlockQueue(A, A->WritePos, BlockNext);
+
+		A->GatherOffset = A->WriteOffset;
 	}
+
+	u32 QueueIndex	= A->WriteQueuePut & A->WriteQueueMsk;
+	u32 Index		= A->GatherCnt++;
+
+	A->WriteQueueVec	[ QueueIndex ][ Index ].iov_base	= Buffer;
+	A->WriteQueueVec	[ QueueIndex ][ Index ].iov_len		= Length;
+	A->WriteQueueUser	[ QueueIndex ][ Index ]				= User;
+	A->WriteQueueRelease[ QueueIndex ][ Index ]				= Release;
+
+	A->WriteOffset += Length;
+
+	if (A->GatherCnt == A->GatherMax) fAIO_WriteSubmit(A);
+
 	return Length;
 }
 
+//-----------------------------------------------------------------------------------------------
+// queue the zero copy writes gathered so far. a single buffer is a plain
+// write so io_uring can still use the registered region
+void fAIO_WriteSubmit(fAIO_t* A)
+{
+	if (A->GatherCnt == 0) return;
+
+	u32 QueueIndex		= A->WriteQueuePut & A->WriteQueueMsk;
+	struct iovec* Vec	= A->WriteQueueVec[ QueueIndex ];
+	u64 Length			= A->WriteOffset - A->GatherOffset;
+
+	fAIOOp_t* Op = NULL;
+	if (A->GatherCnt == 1)
+	{
+		u8* Buffer		= (u8*)Vec[0].iov_base;
+
+		// use the registered region if its in range
+		s32 BufferIndex = -1;
+		if ((Buffer >= A->RingExtBase) && (Buffer + Length <= A->RingExtBase + A->RingExtLength))
+		{
+			BufferIndex = 1;
+		}
+		Op = fAIO_QueueOp(A, A->WriteFD, IOCB_CMD_PWRITE, Buffer, A->GatherOffset, Length, BufferIndex, 0);
+	}
+	else
+	{
+		Op = fAIO_QueueOp(A, A->WriteFD, IOCB_CMD_PWRITEV, Vec, A->GatherOffset, Length, -1, A->GatherCnt);
+
+		A->StatGatherOp++;
+		A->StatGatherSeg += A->GatherCnt;
+	}
+
+	A->WriteQueue		[ QueueIndex ] = Op;
+	A->WriteQueueArena	[ QueueIndex ] = 0;
+	A->WriteQueueVecCnt	[ QueueIndex ] = A->GatherCnt;
+	sfence();
+	A->WriteQueuePut++;
+	fAIO_Wake(A);
+
+	A->GatherCnt = 0;
+}
+
+//-----------------------------------------------------------------------------------------------
+// adaptive depth + block size. runs on the write thread once per window.
+// only windows where the writer was refused (queue or arena full) say
+// anything about the device, otherwise the current setting keeps up.
+// depth doubles while it adds throughput and goes back one step when it
+// stops, giving the smallest depth that saturates. then block size does
+// the same, which pays off when per IO overhead dominates the latency
+
+static void fAIO_AdaptSteady(fAIO_t* A)
+{
+	A->AdaptState	= FAIO_ADAPT_STEADY;
+	A->AdaptSteady	= 0;
+
+	fprintf(stderr, "AIO Adapt Depth:%i Block:%iKB %.3f Gbps\n", A->QueueDepth, A->BlockSizeNext / 1024, A->AdaptBps / 1e9);
+}
+
+static void fAIO_AdaptBlock(fAIO_t* A)
+{
+	u32 Block = A->BlockSizeNext;
+	if (Block * 2 > A->BlockMax)
+	{
+		fAIO_AdaptSteady(A);
+		return;
+	}
+	A->AdaptState		= FAIO_ADAPT_BLOCK;
+	A->AdaptBlockLast	= Block;
+	A->BlockSizeNext	= Block * 2;
+	A->AdaptSettle		= true;
+	A->StatAdapt++;
+}
+
+static void fAIO_Adapt(fAIO_t* A)
+{
+	u64 TSC = rdtsc();
+	if (TSC - A->AdaptTSC < ns2tsc(FAIO_ADAPT_WINDOW_NS)) return;
+
+	double dT		= tsc2ns(TSC - A->AdaptTSC) / 1e9;
+	double Bps		= (A->StatWriteByte - A->AdaptByte) * 8.0 / dT;
+	bool Saturated	= (A->StatQueueFull != A->AdaptFull);
+
+	A->AdaptTSC		= TSC;
+	A->AdaptByte	= A->StatWriteByte;
+	A->AdaptFull	= A->StatQueueFull;
+
+	// first window after a change still completes writes from before it
+	if (A->AdaptSettle)
+	{
+		A->AdaptSettle = false;
+		return;
+	}
+
+	switch (A->AdaptState)
+	{
+	case FAIO_ADAPT_DEPTH:
+		// device keeps up with the writer at this depth
+		if (!Saturated)
+		{
+			A->AdaptBps = (Bps > A->AdaptBps) ? Bps : A->AdaptBps;
+			fAIO_AdaptSteady(A);
+			break;
+		}
+		// step paid off, keep doubling
+		if (Bps > A->AdaptBps * FAIO_ADAPT_GAIN)
+		{
+			A->AdaptBps = Bps;
+			if (A->QueueDepth < A->QueueDepthMax)
+			{
+				A->AdaptDepthLast	= A->QueueDepth;
+				A->QueueDepth		= (A->QueueDepth * 2 > A->QueueDepthMax) ? A->QueueDepthMax : A->QueueDepth * 2;
+				A->AdaptSettle		= true;
+				A->StatAdapt++;
+				break;
+			}
+		}
+		// no gain, smaller depth saturates as well
+		else if (A->AdaptDepthLast != 0)
+		{
+			A->QueueDepth		= A->AdaptDepthLast;
+			A->StatAdapt++;
+		}
+		fAIO_AdaptBlock(A);
+		break;
+
+	case FAIO_ADAPT_BLOCK:
+		if (Saturated && (Bps > A->AdaptBps * FAIO_ADAPT_GAIN))
+		{
+			A->AdaptBps = Bps;
+			fAIO_AdaptBlock(A);
+			break;
+		}
+		// larger block drained the queue, keep it
+		if (!Saturated)
+		{
+			A->AdaptBps = (Bps > A->AdaptBps) ? Bps : A->AdaptBps;
+		}
+		else
+		{
+			A->BlockSizeNext = A->AdaptBlockLast;
+			A->StatAdapt++;
+		}
+		fAIO_AdaptSteady(A);
+		break;
+
+	case FAIO_ADAPT_STEADY:
+		// device or load may have changed, probe again from half the depth
+		if ((++A->AdaptSteady >= FAIO_ADAPT_REPROBE) && Saturated)
+		{
+			A->AdaptState		= FAIO_ADAPT_DEPTH;
+			A->AdaptDepthLast	= 0;
+			A->AdaptBps			= 0;
+			A->QueueDepth		= (A->QueueDepth > 1) ? A->QueueDepth / 2 : 1;
+			A->AdaptSettle		= true;
+			A->StatAdapt++;
+		}
+		break;
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// register a caller buffer region e.g. the chunk pool for io_uring fixed buffer writes 
+bool fAIO_RegisterBuffer(fAIO_t* A, u8* Base, u64 Length)
+{
+	if (A->Engine != FAIO_ENGINE_URING) return false;
+
+	// single iovec is limited to 1GB
+	if (Length > kGB(1)) return false;
+
+	// re-register the full table with the region on the end
+	if (A->RingFixedBuffer)
+	{
+		io_uring_register(A->RingFD, IORING_UNREGISTER_BUFFERS, NULL, 0);
+		A->RingFixedBuffer = false;
+	}
+
+	struct iovec BufferList[2];
+	BufferList[0].iov_base	= A->Arena;
+	BufferList[0].iov_len	= A->ArenaSize;
+	BufferList[1].iov_base	= Base;
+	BufferList[1].iov_len	= Length;
+
+	if (io_uring_register(A->RingFD, IORING_REGISTER_BUFFERS, BufferList, 2) == 0)
+	{
+		A->RingFixedBuffer	= true;
+		A->RingExtBase		= Base;
+		A->RingExtLength	= Length;
+		return true;
+	}
+	fprintf(stderr, "io_uring register region failed %i (%s)\n", errno, strerror(errno));
+
+	// fall back to just the staging arena
+	A->RingFixedBuffer = (io_uring_register(A->RingFD, IORING_REGISTER_BUFFERS, BufferList, 1) == 0);
+	return false;
+}
+
 //-----------------------------------------------------------------------------------------------
 
 void fAIO_WriteUpdate(fAIO_t* A)
 {
-	// nothing to do 
-	if (A->WriteQueuePut == A->WriteQueueGet) return;
-	fAIOOp_t* Op = (fAIOOp_t*)A->WriteQueue[ A->WriteQueueGet & A->WriteQueueMsk ];
+	u32 Get = A->WriteQueueGet;
+	while (A->WriteQueuePut != A->WriteQueueGet)
+	{
+		u32 QueueIndex	= A->WriteQueueGet & A->WriteQueueMsk;
+		fAIOOp_t* Op	= (fAIOOp_t*)A->WriteQueue[ QueueIndex ];
 
-	// not completed
-	if (Op->State != AIO_OP_STATE_COMPLETE) return;
+		// not completed
+		if (Op->State != AIO_OP_STATE_COMPLETE) break;
+
+		// release
+		fAIO_OpClose(A, Op);
+		A->ArenaGet += A->WriteQueueArena[ QueueIndex ];
+		A->WriteQueueArena[ QueueIndex ] = 0;
+
+		// hand zero copy buffers back to the caller
+		for (int i=0; i < A->WriteQueueVecCnt[ QueueIndex ]; i++)
+		{
+			if (A->WriteQueueRelease[ QueueIndex ][ i ] == NULL) continue;
+
+			A->WriteQueueRelease[ QueueIndex ][ i ](A->WriteQueueUser[ QueueIndex ][ i ]);
+
+			A->WriteQueueRelease[ QueueIndex ][ i ]	= NULL;
+			A->WriteQueueUser	[ QueueIndex ][ i ]	= NULL;
+		}
+		A->WriteQueueVecCnt[ QueueIndex ] = 0;
 
-	// release
-	fAIO_OpClose(A, Op);
+		// update queue
+		A->WriteQueueGet++;
+	}
 
-	// update queue
-	A->WriteQueueGet++;
+	// wake a blocked writer
+	if (A->WriteQueueGet != Get)
+	{
+		__sync_synchronize();
+		if (A->SpaceWait) fAIO_EventSignal(A->SpaceFD);
+	}
 }
 
 //-----------------------------------------------------------------------------------------------
@@ -394,9 +1170,21 @@ void fAIO_WriteUpdate(fAIO_t* A)
 // called from top level thread, not worker thread 
 void fAIO_WriteFlush(fAIO_t* A)
 {
+	fAIO_WriteSubmit(A);
+
+	// partially staged block goes out as is, a partial sector is padded
+	// and the caller truncates the file
+	if (A->WritePos > 0)
+	{
+		u32 BlockNext = A->BlockSizeNext;
+		while (!fAIO_WriteSpace(A, 1, 1, BlockNext)) fAIO_WriteWait(A);
+		fAIO_BlockQueue(A, (A->WritePos + 4095) & ~4095, BlockNext);
+	}
+
 	while (A->WriteQueueGet != A->WriteQueuePut)
 	{
-		sleep(0);
+		A->SpaceGet = A->WriteQueueGet;
+		fAIO_WriteWait(A);
 		/*
 		fprintf(stderr, "AIO G:%08x P:%08x (%08x)\n", 	A->WriteQueueGet, 
 														A->WriteQueuePut, 
@@ -412,110 +1200,257 @@ static void* fAIO_WriteThread(void* User)
 	fAIO_t* A = (fAIO_t*)User;
 
 	fprintf(stderr, "Write Thread start\n");
+	fProfile_ThreadInit("aio write");
+
+	u64 IdleTSC = rdtsc();
 	while (!A->IsExit)
 	{
-		if (A->IOCount > 0)
+		u32 Get			= A->WriteQueueGet;
+		u32 Pending		= A->IOPending;
+		bool Kick		= (A->IOCount > 0);
+		if (Kick)
 		{
+			fProfile_Start(FAIO_PROFILE_KICK, "kick");
 			fAIO_Kick(A);
+			fProfile_Stop(FAIO_PROFILE_KICK);
 		}
 
+		fProfile_Start(FAIO_PROFILE_UPDATE, "reap");
 		fAIO_Update		(A);
+		fProfile_Stop(FAIO_PROFILE_UPDATE);
+
+		fProfile_Start(FAIO_PROFILE_WRITE, "submit");
 		fAIO_WriteUpdate(A);
+		fProfile_Stop(FAIO_PROFILE_WRITE);
+
+		if (A->Adaptive) fAIO_Adapt(A);
+
+		// something was submitted, completed or released
+		if (Kick || (A->IOPending != Pending) || (A->WriteQueueGet != Get))
+		{
+			IdleTSC = rdtsc();
+			continue;
+		}
 
-		sleep(0);
+		// spin for the next event, then block unless busy polling
+		if ((A->SpinUS == FAIO_SPIN_FOREVER) || (tsc2ns(rdtsc() - IdleTSC) < A->SpinUS * 1000ULL))
+		{
+			sleep(0);
+			continue;
+		}
+		fAIO_ThreadSleep(A);
+		IdleTSC = rdtsc();
 	}
 
+	struct timespec CPU;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &CPU);
+	A->StatCPU = CPU.tv_sec * 1000000000ULL + CPU.tv_nsec;
+
 	fprintf(stderr, "Write Thread End\n");
 
 	return NULL;
 }
 
 //-----------------------------------------------------------------------------------------------
+// queue reads into every free block up to the end of the range
 
-u64 fAIO_LatencyMax(fAIO_t*A)
+static void fAIO_ReadFill(fAIORead_t* R)
 {
-	u32 LatencyMax = 0;
-	for (int i=0; i < A->HistoMax; i++)
+	fAIO_t* A = R->AIO;
+
+	u32 Queued = 0;
+	while ((R->Put - R->Free < R->Depth) && (R->Offset < R->End))
 	{
-		if (A->HistoWr[i] != 0)
-		{
-			LatencyMax = i * A->HistoBin;
-		}
-		if (A->HistoRd[i] != 0)
-		{
-			LatencyMax = i * A->HistoBin;
-		}
+		u32 Index	= R->Put % R->Depth;
+		u8* Buffer	= A->Arena + (u64)Index * R->BlockSize;
+
+		// O_DIRECT length is whole sectors, the file end comes back short
+		u64 Remain	= R->End - R->Offset;
+		u32 Length	= (Remain < R->BlockSize) ? (Remain + 4095) & ~4095 : R->BlockSize;
+
+		R->Op[Index] = fAIO_QueueOp(A, R->fd, IOCB_CMD_PREAD, Buffer, R->Offset, Length, 0, 0);
+
+		R->Offset	+= Length;
+		R->Put++;
+		Queued++;
 	}
-	return LatencyMax;
+	if (Queued > 0) fAIO_Wake(A);
 }
 
 //-----------------------------------------------------------------------------------------------
+// block until a read completes, spinning SpinUS first or forever
 
-u64 fAIO_LatencyMid(fAIO_t*A)
+static void fAIO_ReadWait(fAIO_t* A, fAIOOp_t* Op)
 {
-	u64 Total = 0;
-	u32 SampleMax = 0;
-	for (int i=0; i < A->HistoMax; i++)
+	bool Forever	= (A->SpinUS == FAIO_SPIN_FOREVER);
+	u64 SpinTSC		= rdtsc() + ns2tsc(A->SpinUS * 1000ULL);
+	while ((Op->State != AIO_OP_STATE_COMPLETE) && (Forever || (rdtsc() < SpinTSC)))
 	{
-		Total += A->HistoWr[i];
-		SampleMax = (SampleMax < A->HistoWr[i]) ? A->HistoWr[i] : SampleMax;
+		usleep(0);
 	}
-	u64 Sum = 0;
-	for (int i=0; i < A->HistoMax; i++)
-	{
-		if (A->HistoWr[i] == 0) continue;
+	if (Op->State == AIO_OP_STATE_COMPLETE) return;
 
-		double Pct = A->HistoWr[i] / (double)SampleMax;
-		if (Pct >= 0.50) return i * A->HistoBin;
+	A->SpaceWait = true;
+	__sync_synchronize();
+	if (Op->State != AIO_OP_STATE_COMPLETE)
+	{
+		fAIO_EventWait(A->SpaceFD, FAIO_WAIT_MS, true);
+		A->StatSpaceWait++;
 	}
-	return 0;
+	A->SpaceWait = false;
 }
 
 //-----------------------------------------------------------------------------------------------
 
-void fAIO_DumpHisto(fAIO_t*A)
+fAIORead_t* fAIO_ReadOpen(int fd, u64 Offset, u64 Length, fAIOConfig_t* _Config)
 {
-	u64 Total = 0;
-	u32 SampleMax = 0;
-	for (int i=0; i < A->HistoMax; i++)
+	assert((Offset & 4095) == 0);
+
+	// controller tunes writes, not used here
+	fAIOConfig_t Config	= *_Config;
+	Config.Adaptive		= false;
+
+	fAIO_t* A = fAIO_OpenConfig(fd, &Config);
+	if (A == NULL) return NULL;
+
+	fAIORead_t* R = (fAIORead_t*)malloc(sizeof(fAIORead_t));
+	assert(R != NULL);
+	memset(R, 0, sizeof(fAIORead_t));
+
+	R->AIO			= A;
+	R->fd			= fd;
+	R->Offset		= Offset;
+	R->End			= Offset + Length;
+	R->BlockSize	= A->BlockSize;
+
+	// every block has its own part of the staging arena
+	R->Depth		= A->QueueDepthMax;
+	R->Depth		= (R->Depth > A->ArenaSize / R->BlockSize) ? A->ArenaSize / R->BlockSize : R->Depth;
+
+	fAIO_ReadFill(R);
+
+	return R;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+s32 fAIO_ReadNext(fAIORead_t* R, u8** Data)
+{
+	fAIO_ReadFill(R);
+
+	// everything queued has been handed out
+	if (R->Get == R->Put)
 	{
-		Total += A->HistoWr[i];
-		Total += A->HistoRd[i];
-		SampleMax = (SampleMax < A->HistoWr[i]) ? A->HistoWr[i] : SampleMax;
-		SampleMax = (SampleMax < A->HistoRd[i]) ? A->HistoRd[i] : SampleMax;
+		if (R->Offset >= R->End) return 0;
+
+		fprintf(stderr, "fAIO_ReadNext: all %i blocks held by the caller\n", R->Depth);
+		return -1;
 	}
-	u64 Sum = 0;
-	for (int i=0; i < A->HistoMax; i++)
+
+	u32 Index		= R->Get % R->Depth;
+	fAIOOp_t* Op	= R->Op[Index];
+	if (Op->State != AIO_OP_STATE_COMPLETE)
 	{
-		if ((A->HistoWr[i] == 0) && (A->HistoRd[i] == 0)) continue;
+		R->StatWait++;
+		while (Op->State != AIO_OP_STATE_COMPLETE) fAIO_ReadWait(R->AIO, Op);
+	}
+	R->Get++;
+
+	*Data = Op->Buffer;
+	if (Op->Res < 0) return -1;
+
+	// stop at the range or a short file, reads queued past it come back empty
+	u64 Length		= Op->Offset + Op->Res;
+	Length			= (Length > R->End) ? R->End : Length;
+	Length			= (Length > Op->Offset) ? Length - Op->Offset : 0;
+	if (Op->Res < Op->Length) R->End = (R->End < Op->Offset + Op->Res) ? R->End : Op->Offset + Op->Res;
+
+	R->StatByte		+= Length;
+	return Length;
+}
 
-		double PctWr = A->HistoWr[i] / (double)SampleMax;
-		double PctRd = A->HistoRd[i] / (double)SampleMax;
+//-----------------------------------------------------------------------------------------------
 
-		Sum += A->HistoWr[i];
-		Sum += A->HistoRd[i];
+void fAIO_ReadRelease(fAIORead_t* R)
+{
+	assert(R->Free != R->Get);
 
-		char Buffer[1024];
-		sprintf(Buffer, "%12.6fms : %.6f %.6f : Wr:%8i :: ", i*A->HistoBin / 1e6, PctWr, Sum / (double)Total, A->HistoWr[i]);
+	fAIO_OpClose(R->AIO, R->Op[ R->Free % R->Depth ]);
+	R->Free++;
 
-		char Stars[1024];
-		Stars[0] = 0;	
-		for (int s =0; s < 100 * PctWr; s++) strcat(Stars, "w");
-		printf("%s : %s\n", Buffer, Stars);
+	// keep the read ahead full
+	fAIO_ReadFill(R);
+}
 
-		sprintf(Buffer, "%12.6fms : %.6f %.6f : Rd:%8i :: ", i*A->HistoBin / 1e6, PctRd, Sum / (double)Total, A->HistoRd[i]);
+//-----------------------------------------------------------------------------------------------
+
+void fAIO_ReadClose(fAIORead_t* R)
+{
+	// reads still in flight finish before the buffers go away
+	for (; R->Free != R->Put; R->Free++)
+	{
+		fAIOOp_t* Op = R->Op[ R->Free % R->Depth ];
+		while (Op->State != AIO_OP_STATE_COMPLETE) fAIO_ReadWait(R->AIO, Op);
 
-		Stars[0] = 0;	
-		for (int s =0; s < 100 * PctRd; s++) strcat(Stars, "r");
-		printf("%s : %s\n", Buffer, Stars);
-		//printf("\n");
+		fAIO_OpClose(R->AIO, Op);
 	}
+	fAIO_Close(R->AIO);
+	free(R);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+u64 fAIO_LatencyMax(fAIO_t*A)
+{
+	u64 LatencyMax = 0;
+	if (A->HistoWr.Count > 0) LatencyMax = A->HistoWr.Max;
+	if ((A->HistoRd.Count > 0) && (A->HistoRd.Max > LatencyMax)) LatencyMax = A->HistoRd.Max;
+	return LatencyMax;
+}
+
+//-----------------------------------------------------------------------------------------------
+// median write latency in ns
+
+u64 fAIO_LatencyMid(fAIO_t*A)
+{
+	double Pct = 0.5;
+	u64 Latency = 0;
+	fHisto_Percentile(&A->HistoWr, &Pct, &Latency, 1);
+	return Latency;
+}
+
+//-----------------------------------------------------------------------------------------------
+// write latency in ns at each of the PctCnt fractions in Pct[] (ascending),
+// returns the number of writes in the histogram
+
+u64 fAIO_LatencyPercentile(fAIO_t*A, double* Pct, u64* Latency, u32 PctCnt)
+{
+	return fHisto_Percentile(&A->HistoWr, Pct, Latency, PctCnt);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fAIO_DumpHisto(fAIO_t*A)
+{
+	fHisto_Dump(&A->HistoWr, "write");
+	fHisto_Dump(&A->HistoRd, "read");
 }
 
 //-----------------------------------------------------------------------------------------------
 
 void fAIO_HistoReset(fAIO_t*A)
 {
-	memset(A->HistoWr, 0, A->HistoMax * sizeof(u32) );
-	memset(A->HistoRd, 0, A->HistoMax * sizeof(u32) );
+	fHisto_Reset(&A->HistoWr);
+	fHisto_Reset(&A->HistoRd);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+const char* fAIO_EngineName(fAIO_t* A)
+{
+	if (A->Engine == FAIO_ENGINE_URING)
+	{
+		return (A->RingFlags & IORING_SETUP_SQPOLL) ? "io_uring+sqpoll" : "io_uring";
+	}
+	return "libaio";
 }
@@ -9,6 +9,8 @@
 #include <malloc.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
 
 #define IOCB_FLAG_RESFD		(1 << 0)
 
@@ -83,14 +85,88 @@ typedef struct fAIOOp_t
 	u64					Offset;
 	u64					Length;
 	u8*					Buffer;
+	s64					Res;			// bytes transferred or -errno, once complete
 
 } fAIOOp_t;
 
+// io engines
+#define FAIO_ENGINE_LIBAIO			0		// io_setup/io_submit/io_getevents 
+#define FAIO_ENGINE_URING			1		// io_uring with registered buffers + output fd 
+
+// staged write size and writes in flight, 0 in the config = default
+#define FAIO_BLOCK_DEFAULT			kKB(256)
+#define FAIO_BLOCK_MIN				kKB(4)
+#define FAIO_BLOCK_MAX				kMB(4)		// adaptive growth limit
+#define FAIO_DEPTH_DEFAULT			126			// the old fixed 128 slot write queue
+#define FAIO_QUEUE_MAX				1024		// write queue slots
+#define FAIO_STAGE_MIN				kMB(32)		// staging arena floor
+#define FAIO_GATHER_MAX				8			// zero copy writes per vectored write
+
+// idle write thread and refused writers spin then block on an eventfd
+#define FAIO_SPIN_US				20			// spin before blocking
+#define FAIO_SPIN_FOREVER			((u32)-1)	// never block, busy poll, not a duration
+#define FAIO_WAIT_MS				10			// blocking wait timeout, bounds a missed wakeup
+
+// adaptive controller, hill climbs depth then block size on saturated windows
+#define FAIO_ADAPT_WINDOW_NS		100000000ULL
+#define FAIO_ADAPT_GAIN				1.05		// a step must add 5% throughput to be kept
+#define FAIO_ADAPT_REPROBE			50			// steady windows before probing again
+#define FAIO_ADAPT_DEPTH			0
+#define FAIO_ADAPT_BLOCK			1
+#define FAIO_ADAPT_STEADY			2
+
+typedef struct fAIOConfig_t
+{
+	u32					Engine;			// FAIO_ENGINE_* 
+	bool				SQPoll;			// io_uring kernel side submission polling
+
+	u32					BlockSize;		// fAIO_Write block size, 4KB multiple
+	u32					QueueDepth;		// max writes in flight
+	bool				Adaptive;		// tune depth and block size from completions
+	u32					BlockMax;		// adaptive block size limit
+	u32					GatherMax;		// zero copy writes coalesced into one vectored write, 1 = off
+	u32					SpinUS;			// spin this long before blocking, FAIO_SPIN_FOREVER = busy poll
+
+} fAIOConfig_t;
+
 typedef struct fAIO_t 
 {
+	u32					Engine;			// FAIO_ENGINE_* in use
+
 	int					afd;
 	aio_context_t 		ctx;
 
+	// io_uring engine
+	int					RingFD;
+	u32					RingFlags;		// IORING_SETUP_* flags
+	u8*					RingSQ;			// submission ring mapping
+	u64					RingSQSize;
+	u8*					RingCQ;			// completion ring mapping
+	u64					RingCQSize;
+	struct io_uring_sqe*	RingSQE;
+	u32					RingSQECnt;
+
+	volatile u32*		RingSQHead;
+	volatile u32*		RingSQTail;
+	volatile u32*		RingSQFlags;
+	u32*				RingSQArray;
+	u32					RingSQMask;
+	u32					RingSQTailLocal;
+
+	volatile u32*		RingCQHead;
+	volatile u32*		RingCQTail;
+	struct io_uring_cqe*	RingCQE;
+	u32					RingCQMask;
+
+	bool				RingFixedBuffer;	// staging arena registered with the kernel
+	bool				RingFixedFile;		// WriteFD registered with the kernel
+	u8*					RingExtBase;		// caller buffer region registered after the write queue buffers 
+	u64					RingExtLength;
+
+	// syscall stats
+	u64					StatSyscall;		// number of syscalls issued for submit + reap 
+	u64					StatOp;				// number of ops queued
+
 	u32 				IOEventMax;
 	io_event_t*			IOEvent;
 
@@ -102,13 +178,12 @@ typedef struct fAIO_t
 	u32					IOCount;
 	u32 				IOListMax;
 	iocb_t**			IOList;
+	iocb_t**			IOSubmit;				// IOList copy being submitted
 
 	u32					IOPending;
 
-	u64					HistoBin;
-	u32					HistoMax;
-	u32*				HistoRd;
-	u32*				HistoWr;
+	fHisto_t			HistoRd;				// completion latency in ns
+	fHisto_t			HistoWr;
 
 	// serialized write interface 
 	int 				WriteFD;	
@@ -120,20 +195,101 @@ typedef struct fAIO_t
 	volatile u32 		WriteQueueGet;
 	u32 				WriteQueueMsk;
 	u32 				WriteQueueMax;
-	volatile fAIOOp_t* 	WriteQueue[1024];
-	u8*					WriteQueueBuffer[1024];
-
-	// staging buffer
-	u32					WritePos;
-	u32					WriteMax;
-	u8*					WriteUnaligned;
+	volatile fAIOOp_t* 	WriteQueue[FAIO_QUEUE_MAX];
+	u32					WriteQueueArena[FAIO_QUEUE_MAX];	// staging bytes freed on completion
+
+	// zero copy caller buffers of each write, released on completion
+	struct iovec		WriteQueueVec[FAIO_QUEUE_MAX][FAIO_GATHER_MAX];
+	void*				WriteQueueUser[FAIO_QUEUE_MAX][FAIO_GATHER_MAX];
+	void				(*WriteQueueRelease[FAIO_QUEUE_MAX][FAIO_GATHER_MAX])(void* User);
+	u8					WriteQueueVecCnt[FAIO_QUEUE_MAX];
+
+	// zero copy writes gathered into the next queue slot, not yet queued
+	u32					GatherMax;
+	u32					GatherCnt;
+	u64					GatherOffset;
+
+	// staging arena, blocks are carved off in order and freed in order
+	u8*					Arena;
+	u64					ArenaSize;
+	u64					ArenaPut;						// bytes reserved
+	volatile u64		ArenaGet;						// bytes freed
+
+	// block being staged
 	u8*					Write;
+	u32					WritePos;
+	u32					WriteReserve;					// arena bytes held incl wrap padding
+
+	// block size + depth, the controller changes them while writing
+	u32					BlockSize;						// of the block being staged
+	volatile u32		BlockSizeNext;					// for the next block
+	u32					BlockMax;
+	volatile u32		QueueDepth;
+	u32					QueueDepthMax;
+
+	bool				Adaptive;
+	u32					AdaptState;						// FAIO_ADAPT_*
+	u64					AdaptTSC;						// end of the current window
+	u64					AdaptByte;						// counters at the window start
+	u64					AdaptFull;
+	bool				AdaptSettle;					// skip a window after a change
+	double				AdaptBps;						// throughput of the kept setting
+	u32					AdaptDepthLast;					// setting to go back to
+	u32					AdaptBlockLast;
+	u32					AdaptSteady;
+	u64					StatAdapt;						// setting changes
+
+	u64					StatGatherOp;					// vectored writes queued
+	u64					StatGatherSeg;					// zero copy writes in them
+
+	// event driven waits. the write thread blocks on afd, which libaio and
+	// io_uring completions signal and writers ring while ThreadSleep is set.
+	// a refused writer blocks on SpaceFD until WriteQueueGet moves past
+	// SpaceGet, a reader until its read completes. the write thread rings
+	// it while SpaceWait is set
+	u32					SpinUS;
+	int					SpaceFD;
+	volatile bool		ThreadSleep;
+	volatile bool		SpaceWait;
+	u32					SpaceGet;						// WriteQueueGet at the last refused write
+	bool				RingEventFD;					// afd registered for io_uring completions
+
+	u64					StatSleep;						// write thread blocking waits
+	u64					StatSpaceWait;					// writer blocking waits
+	u64					StatCPU;						// write thread cpu ns, set on exit
+
+	u64					StatWriteByte;					// bytes completed
+	volatile u64		StatQueueFull;					// writes refused for queue or arena space
 
 	volatile bool		IsExit;
 	pthread_t			WriteThread;
 
 } fAIO_t;
 
+// sequential reader, keeps Depth O_DIRECT reads in flight ahead of the
+// caller and hands out completed blocks in file order without copying.
+// blocks live in the fAIO staging arena, a block is read again once the
+// caller releases it
+typedef struct fAIORead_t
+{
+	fAIO_t*				AIO;
+	int					fd;
+
+	u64					Offset;							// file offset of the next read to queue
+	u64					End;							// file offset reading stops at
+	u32					BlockSize;
+	u32					Depth;							// reads in flight + blocks held by the caller
+
+	u32					Put;							// reads queued
+	u32					Get;							// blocks handed to the caller
+	u32					Free;							// blocks released by the caller
+	fAIOOp_t*			Op[FAIO_QUEUE_MAX];
+
+	u64					StatByte;						// bytes handed out
+	u64					StatWait;						// blocks still in flight when asked for
+
+} fAIORead_t;
+
 static long io_setup(unsigned nr_reqs, aio_context_t *ctx) {
 	return syscall(__NR_io_setup, nr_reqs, ctx);
 }
@@ -156,6 +312,18 @@ static long io_getevents(aio_context_t ctx, long min_nr, long nr,
 	return syscall(__NR_io_getevents, ctx, min_nr, nr, events, tmo);
 }
 
+static int io_uring_setup(u32 entries, struct io_uring_params* p) {
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, u32 to_submit, u32 min_complete, u32 flags) {
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, u32 opcode, void* arg, u32 nr_args) {
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
 static int eventfd(int count) {
 	return syscall(__NR_eventfd, count);
 }
@@ -237,7 +405,11 @@ static long waitasync(int afd, int timeo)
 
 //-------------------------------------------------------------------------------
 
+extern fAIOConfig_t	g_fAIOConfig;		// default config used by fAIO_Open
+
 fAIO_t* 	fAIO_Open(int fd);
+fAIO_t* 	fAIO_OpenConfig(int fd, fAIOConfig_t* Config);
+void		fAIO_ConfigDefault(fAIOConfig_t* Config);
 void 		fAIO_Close(fAIO_t* A);
 
 fAIOOp_t*	fAIO_Queue(fAIO_t* A, int fd, u32 FileOp, void* Buffer, u64 Offset, u64 SectorSize);
@@ -249,14 +421,31 @@ int 		fAIO_NumPending(fAIO_t*A);
 void 		fAIO_DumpHisto(fAIO_t*A);
 u64 		fAIO_LatencyMax(fAIO_t*A);
 u64 		fAIO_LatencyMid(fAIO_t*A);
+u64 		fAIO_LatencyPercentile(fAIO_t*A, double* Pct, u64* Latency, u32 PctCnt);
 void 		fAIO_HistoReset(fAIO_t*A);
 
 
 s32 		fAIO_Write(fAIO_t* A, u8* Buffer, u32 Length);
+s32 		fAIO_WriteZC(fAIO_t* A, u8* Buffer, u32 Length, void (*Release)(void* User), void* User);
+void 		fAIO_WriteSubmit(fAIO_t* A);
+void 		fAIO_WriteWait(fAIO_t* A);
+bool 		fAIO_RegisterBuffer(fAIO_t* A, u8* Base, u64 Length);
 void 		fAIO_WriteUpdate(fAIO_t* a);
 void 		fAIO_WriteFlush(fAIO_t* A);
 
 void 		fAIO_OpClose(fAIO_t* A, fAIOOp_t* Op);
 bool 		fAIO_IsOpComplete(fAIO_t* A, fAIOOp_t* Op);
 
+const char*	fAIO_EngineName(fAIO_t* A);
+
+// Offset 4KB aligned, fd opened O_DIRECT. uses the Config block size + depth
+fAIORead_t*	fAIO_ReadOpen(int fd, u64 Offset, u64 Length, fAIOConfig_t* Config);
+
+// next block in file order, returns its length, 0 at the end, -1 on error
+s32 		fAIO_ReadNext(fAIORead_t* R, u8** Data);
+
+// hand back the oldest block from fAIO_ReadNext
+void 		fAIO_ReadRelease(fAIORead_t* R);
+void 		fAIO_ReadClose(fAIORead_t* R);
+
 #endif
@@ -0,0 +1,559 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio capture device emulator, serves synthetic captures over loopback
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "fTypes.h"
+#include "fPacket.h"
+#include "fProtocol.h"
+#include "fEmu.h"
+#include "fLZ4.h"
+
+//-----------------------------------------------------------------------------------------------
+
+fEmuConfig_t g_fEmuConfig =
+{
+	.StreamSize			= 4000000000ULL,
+	.Rate				= 0,
+	.Interleave			= FEMU_INTERLEAVE_RR,
+	.Burst				= 8,
+	.DelayUS			= 0,
+	.DelayEvery			= 0,
+};
+
+static const char* s_StreamName[FEMU_STREAM_MAX] = { "emu_64", "emu_imix", "emu_uniform", "emu_1514" };
+
+//-----------------------------------------------------------------------------------------------
+
+static u64 fEmu_ThreadCPU(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+	return (u64)t.tv_sec * k1E9 + t.tv_nsec;
+}
+
+// listening socket on all interfaces
+static int fEmu_Listen(u32 Port)
+{
+	int Sock = socket(AF_INET, SOCK_STREAM, 0);
+	assert(Sock > 0);
+
+	int One = 1;
+	setsockopt(Sock, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+
+	struct sockaddr_in Addr;
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sin_family			= AF_INET;
+	Addr.sin_port			= htons(Port);
+	Addr.sin_addr.s_addr	= htonl(INADDR_ANY);
+
+	if ((bind(Sock, (struct sockaddr*)&Addr, sizeof(Addr)) < 0) || (listen(Sock, 8) < 0))
+	{
+		fprintf(stderr, "emu: failed to listen on port %i : %i %s\n", Port, errno, strerror(errno));
+		close(Sock);
+		return -1;
+	}
+	return Sock;
+}
+
+// wait for the socket to be ready, gives up after TimeoutMS or on exit
+static bool fEmu_Poll(fEmu_t* E, int Sock, u32 TimeoutMS)
+{
+	for (u32 t=0; t < TimeoutMS; t += 100)
+	{
+		if (E->Exit) return false;
+
+		struct pollfd P = { .fd = Sock, .events = POLLIN };
+		if (poll(&P, 1, 100) > 0) return true;
+	}
+	return false;
+}
+
+static bool fEmu_Recv(fEmu_t* E, int Sock, u8* Buffer8, s32 Length)
+{
+	while (Length > 0)
+	{
+		if (!fEmu_Poll(E, Sock, -1)) return false;
+
+		int rlen = recv(Sock, Buffer8, Length, 0);
+		if (rlen <= 0) return false;
+
+		Length	-= rlen;
+		Buffer8	+= rlen;
+	}
+	return true;
+}
+
+static bool fEmu_Send(int Sock, u8* Buffer8, s32 Length, int Flags)
+{
+	while (Length > 0)
+	{
+		int wlen = send(Sock, Buffer8, Length, Flags | MSG_NOSIGNAL);
+		if (wlen <= 0)
+		{
+			if (errno == EINTR) continue;
+			return false;
+		}
+		Length	-= wlen;
+		Buffer8	+= wlen;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+// chunk timestamps, template offsets on top of a fixed per chunk span
+
+static inline u64 fEmu_ChunkTSFirst(fEmuStream_t* S, u64 Chunk)
+{
+	return FEMU_TS_BASE + Chunk * S->ChunkSpan;
+}
+
+static inline u64 fEmu_ChunkTSLast(fEmuStream_t* S, u64 Chunk)
+{
+	return FEMU_TS_BASE + Chunk * S->ChunkSpan + S->TemplateTSLast[Chunk % FEMU_TEMPLATE_MAX];
+}
+
+// template with its timestamps moved to the chunks place in the capture
+static void fEmu_Rebase(u8* Dst, u8* Src, u32 Length, u64 TSBase)
+{
+	memcpy(Dst, Src, Length);
+
+	u8* Data8		= Dst;
+	u8* Data8End	= Dst + Length;
+	while (Data8 < Data8End)
+	{
+		FMADPacket_t* Pkt = (FMADPacket_t*)Data8;
+		Pkt->TS		+= TSBase;
+		Data8		+= sizeof(FMADPacket_t) + Pkt->LengthCapture;
+	}
+}
+
+// connection a SeqNo is sent on
+static inline u32 fEmu_Owner(fEmu_t* E, u64 SeqNo)
+{
+	switch (E->Config.Interleave)
+	{
+	case FEMU_INTERLEAVE_RANDOM:
+	{
+		u64 h = SeqNo * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+		h *= 0xBF58476D1CE4E5B9ULL;
+		h ^= h >> 32;
+		return h % E->ConnCnt;
+	}
+	case FEMU_INTERLEAVE_BURST:	return ((SeqNo - 1) / E->Config.Burst) % E->ConnCnt;
+	}
+	return (SeqNo - 1) % E->ConnCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// one data connection, sends every SeqNo it owns then the EOF marker
+
+static void* fEmu_DataThread(void* User)
+{
+	fEmuConn_t* C		= (fEmuConn_t*)User;
+	fEmu_t* E			= C->E;
+	fEmuStream_t* S		= E->GetStream;
+
+	if (!fEmu_Poll(E, C->ListenSock, 10000))
+	{
+		fprintf(stderr, "emu: [%i] no data connection\n", C->Index);
+		return NULL;
+	}
+	int Sock = accept(C->ListenSock, NULL, NULL);
+	if (Sock < 0)
+	{
+		fprintf(stderr, "emu: [%i] accept failed %i %s\n", C->Index, errno, strerror(errno));
+		return NULL;
+	}
+
+	int Size = kMB(16);
+	setsockopt(Sock, SOL_SOCKET, SO_SNDBUF, &Size, sizeof(Size));
+
+	u64 CPU0		= fEmu_ThreadCPU();
+	u64 SeqCnt		= E->ChunkHi - E->ChunkLo;
+	u64 SeqNo		= E->SeqNoStart;
+	for (; SeqNo <= SeqCnt; SeqNo++)
+	{
+		if (E->Exit) break;
+		if (fEmu_Owner(E, SeqNo) != C->Index) continue;
+
+		// stall the connection, chunks behind it on others pile up in the reorder buffer
+		u64 TSC0 = rdtsc();
+		if (E->Config.DelayEvery && ((SeqNo % E->Config.DelayEvery) == 0)) usleep(E->Config.DelayUS);
+
+		u64 Chunk		= E->ChunkLo + SeqNo - 1;
+		u32 Template	= Chunk % FEMU_TEMPLATE_MAX;
+		u32 Length		= S->TemplateLength[Template];
+
+		u64 TSC1 = rdtsc();
+		fEmu_Rebase(C->Buffer, S->Template[Template], Length, fEmu_ChunkTSFirst(S, Chunk));
+
+		PktHeader_t Header;
+		memset(&Header, 0, sizeof(Header));
+		Header.SeqNo		= SeqNo;
+		Header.XferLength	= Length;
+		Header.DataLength	= Length;
+
+		// compressed when it shrinks, otherwise raw like the device
+		u8* Payload			= C->Buffer;
+		u64 TSCC = rdtsc();
+		if (E->Compress == CMDHEADER_COMPRESS_LZ4)
+		{
+			u32 Xfer = fLZ4_Compress(C->Packed, Length - 1, C->Buffer, Length, C->Hash);
+			if (Xfer != 0)
+			{
+				Header.XferLength	= Xfer;
+				Header.Flag			|= PACKETHEADER_FLAG_LZ4;
+				Payload				= C->Packed;
+			}
+		}
+
+		u64 TSC2 = rdtsc();
+		if (!fEmu_Send(Sock, (u8*)&Header, sizeof(Header), MSG_MORE)) break;
+		if (!fEmu_Send(Sock, Payload, Header.XferLength, 0)) break;
+		u64 TSC3 = rdtsc();
+
+		C->StatByte		+= Length;
+		C->StatXfer		+= Header.XferLength;
+		C->StatChunk	+= 1;
+		C->StatPkt		+= S->TemplatePkt[Template];
+
+		// pace all connections together to the configured rate
+		if (E->Config.Rate > 0)
+		{
+			u64 Total	= __sync_add_and_fetch(&E->RateByte, sizeof(Header) + Header.XferLength);
+			u64 Due		= E->RateStartNS + (u64)(Total * 8.0 / E->Config.Rate);
+			u64 Now		= clock_ns();
+			if (Due > Now) usleep((Due - Now) / 1000);
+		}
+
+		C->StatRebase	+= TSCC - TSC1;
+		C->StatCompress	+= TSC2 - TSCC;
+		C->StatSend		+= TSC3 - TSC2;
+		C->StatWait		+= (TSC1 - TSC0) + (rdtsc() - TSC3);
+	}
+
+	// every connection gets the EOF, SeqNo is one past the last chunk
+	if (SeqNo > SeqCnt)
+	{
+		PktHeader_t Header;
+		memset(&Header, 0, sizeof(Header));
+		Header.SeqNo	= SeqCnt + 1;
+		Header.Flag		= PACKETHEADER_FLAG_EOF;
+		fEmu_Send(Sock, (u8*)&Header, sizeof(Header), 0);
+	}
+	else if (!E->Exit)
+	{
+		fprintf(stderr, "emu: [%i] send failed SeqNo %lli %i %s\n", C->Index, SeqNo, errno, strerror(errno));
+	}
+	close(Sock);
+
+	C->StatCPU = fEmu_ThreadCPU() - CPU0;
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------
+// serve one GET, returns once every data connection sent its EOF
+
+static void fEmu_Get(fEmu_t* E, int Sock, CmdHeader_t* Cmd)
+{
+	CmdHeader_t Reply;
+	memset(&Reply, 0, sizeof(Reply));
+	Reply.Version	= CMDHEADER_VERSION_1_0;
+	Reply.Cmd		= CMDHEADER_CMD_NG;
+	memcpy(Reply.StreamName, Cmd->StreamName, sizeof(Reply.StreamName));
+
+	fEmuStream_t* S = NULL;
+	for (int s=0; s < E->StreamCnt; s++)
+	{
+		if (strncmp(E->Stream[s].Name, Cmd->StreamName, sizeof(Cmd->StreamName)) == 0) S = &E->Stream[s];
+	}
+
+	u32 ConnCnt = Cmd->Arg[CMDHEADER_ARG_STREAMCNT];
+	if (ConnCnt == 0) ConnCnt = 4;
+
+	if ((S == NULL) || (ConnCnt > FEMU_CONN_MAX))
+	{
+		fprintf(stderr, "emu: GET [%s] rejected, streams %i\n", Cmd->StreamName, ConnCnt);
+		fEmu_Send(Sock, (u8*)&Reply, sizeof(Reply), 0);
+		return;
+	}
+
+	// whole chunks outside the time range are never sent. no device side
+	// BPF/RE filtering, the client filter does all of it
+	u64 TSFrom	= Cmd->Arg[CMDHEADER_ARG_TSFROM_LO] | ((u64)Cmd->Arg[CMDHEADER_ARG_TSFROM_HI] << 32);
+	u64 TSTo	= Cmd->Arg[CMDHEADER_ARG_TSTO_LO]   | ((u64)Cmd->Arg[CMDHEADER_ARG_TSTO_HI]   << 32);
+
+	u64 ChunkLo = 0;
+	while ((ChunkLo < S->ChunkCnt) && (fEmu_ChunkTSLast(S, ChunkLo) < TSFrom)) ChunkLo++;
+
+	u64 ChunkHi = ChunkLo;
+	while ((ChunkHi < S->ChunkCnt) && ((TSTo == 0) || (fEmu_ChunkTSFirst(S, ChunkHi) < TSTo))) ChunkHi++;
+
+	u64 SeqNoStart = Cmd->Arg[CMDHEADER_ARG_SEQNO];
+	if (SeqNoStart == 0) SeqNoStart = 1;
+
+	// data ports listen before the OK, the client connects straight after
+	for (int c=0; c < ConnCnt; c++)
+	{
+		fEmuConn_t* C = &E->Conn[c];
+		memset(C, 0, sizeof(fEmuConn_t));
+
+		C->E			= E;
+		C->Index		= c;
+		C->ListenSock	= fEmu_Listen(PROTOCOL_PORT_DATA + c);
+		if (C->ListenSock < 0)
+		{
+			for (int i=0; i < c; i++) close(E->Conn[i].ListenSock);
+			fEmu_Send(Sock, (u8*)&Reply, sizeof(Reply), 0);
+			return;
+		}
+		C->Buffer		= memalign(4096, FPACKET_CHUNK_MAX);
+		C->Packed		= memalign(4096, FPACKET_CHUNK_MAX);
+		C->Hash			= memalign(64, FLZ4_HASH_MAX * sizeof(u32));
+		assert(C->Buffer != NULL);
+		assert(C->Packed != NULL);
+		assert(C->Hash != NULL);
+	}
+
+	fprintf(stderr, "emu: GET [%s] Streams %i Chunks %lli-%lli of %lli SeqNo %lli%s\n", S->Name, ConnCnt, ChunkLo, ChunkHi, S->ChunkCnt, SeqNoStart,
+		(Cmd->Arg[CMDHEADER_ARG_COMPRESS] == CMDHEADER_COMPRESS_LZ4) ? " LZ4" : "");
+
+	E->GetStream	= S;
+	E->ChunkLo		= ChunkLo;
+	E->ChunkHi		= ChunkHi;
+	E->SeqNoStart	= SeqNoStart;
+	E->Compress		= Cmd->Arg[CMDHEADER_ARG_COMPRESS];
+	E->ConnCnt		= ConnCnt;
+	E->RateByte		= 0;
+	E->RateStartNS	= clock_ns();
+
+	for (int c=0; c < ConnCnt; c++)
+	{
+		pthread_create(&E->Conn[c].Thread, NULL, fEmu_DataThread, (void*)&E->Conn[c]);
+	}
+
+	// stream size is the full capture, the client gets the ranged part of it
+	Reply.Cmd			= CMDHEADER_CMD_OK;
+	Reply.StreamSize	= S->StreamSize;
+	fEmu_Send(Sock, (u8*)&Reply, sizeof(Reply), 0);
+
+	for (int c=0; c < ConnCnt; c++)
+	{
+		fEmuConn_t* C = &E->Conn[c];
+		pthread_join(C->Thread, NULL);
+		close(C->ListenSock);
+		free(C->Buffer);
+		free(C->Packed);
+		free(C->Hash);
+
+		E->StatByte		+= C->StatByte;
+		E->StatXfer		+= C->StatXfer;
+		E->StatChunk	+= C->StatChunk;
+		E->StatPkt		+= C->StatPkt;
+		E->StatCPU		+= C->StatCPU;
+		E->StatRebase	+= C->StatRebase;
+		E->StatCompress	+= C->StatCompress;
+		E->StatSend		+= C->StatSend;
+		E->StatWait		+= C->StatWait;
+	}
+	E->StatGet++;
+	E->StatTime			+= clock_ns() - E->RateStartNS;
+}
+
+//-----------------------------------------------------------------------------------------------
+// control connection, one command at a time until the client goes away
+
+static void fEmu_Session(fEmu_t* E, int Sock)
+{
+	CmdHeader_t Cmd;
+	while (fEmu_Recv(E, Sock, (u8*)&Cmd, sizeof(Cmd)))
+	{
+		if ((Cmd.Version != CMDHEADER_VERSION_1_0) || ((Cmd.Cmd != CMDHEADER_CMD_LIST) && (Cmd.Cmd != CMDHEADER_CMD_GET)))
+		{
+			fprintf(stderr, "emu: invalid command Version:%02x Cmd:%i\n", Cmd.Version, Cmd.Cmd);
+
+			memset(&Cmd, 0, sizeof(Cmd));
+			Cmd.Version	= CMDHEADER_VERSION_1_0;
+			Cmd.Cmd		= CMDHEADER_CMD_NG;
+			fEmu_Send(Sock, (u8*)&Cmd, sizeof(Cmd), 0);
+			break;
+		}
+
+		if (Cmd.Cmd == CMDHEADER_CMD_GET)
+		{
+			fEmu_Get(E, Sock, &Cmd);
+			continue;
+		}
+
+		// one header per stream then END
+		for (int s=0; s < E->StreamCnt; s++)
+		{
+			memset(&Cmd, 0, sizeof(Cmd));
+			Cmd.Version		= CMDHEADER_VERSION_1_0;
+			Cmd.Cmd			= CMDHEADER_CMD_OK;
+			Cmd.StreamSize	= E->Stream[s].StreamSize;
+			strncpy(Cmd.StreamName, E->Stream[s].Name, sizeof(Cmd.StreamName) - 1);
+			fEmu_Send(Sock, (u8*)&Cmd, sizeof(Cmd), 0);
+		}
+		memset(&Cmd, 0, sizeof(Cmd));
+		Cmd.Version		= CMDHEADER_VERSION_1_0;
+		Cmd.Cmd			= CMDHEADER_CMD_END;
+		fEmu_Send(Sock, (u8*)&Cmd, sizeof(Cmd), 0);
+	}
+}
+
+static void* fEmu_CtrlThread(void* User)
+{
+	fEmu_t* E = (fEmu_t*)User;
+	while (!E->Exit)
+	{
+		if (!fEmu_Poll(E, E->ListenSock, 1000)) continue;
+
+		int Sock = accept(E->ListenSock, NULL, NULL);
+		if (Sock < 0) continue;
+
+		fEmu_Session(E, Sock);
+		close(Sock);
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------
+// build the stream templates. packet timestamps are relative to the chunk
+// start and spaced at line rate so the capture time follows the bytes
+
+fEmu_t* fEmu_Create(fEmuConfig_t* Config)
+{
+	fEmu_t* E = (fEmu_t*)memalign(64, sizeof(fEmu_t));
+	assert(E != NULL);
+	memset(E, 0, sizeof(fEmu_t));
+
+	E->Config		= *Config;
+	E->ListenSock	= -1;
+	if (E->Config.Burst == 0) E->Config.Burst = 1;
+
+	E->StreamCnt	= FEMU_STREAM_MAX;
+	for (int s=0; s < E->StreamCnt; s++)
+	{
+		fEmuStream_t* S = &E->Stream[s];
+		strncpy(S->Name, s_StreamName[s], sizeof(S->Name) - 1);
+		S->Mix = s;
+
+		u64 CycleByte	= 0;
+		u64 SpanMax		= 0;
+		for (int t=0; t < FEMU_TEMPLATE_MAX; t++)
+		{
+			S->Template[t] = memalign(4096, FPACKET_CHUNK_MAX);
+			assert(S->Template[t] != NULL);
+
+			u64 TSNext = 0;
+			u32 Length = fPacket_SynthChunk(S->Template[t], FPACKET_CHUNK_MAX, S->Mix, &TSNext);
+
+			u64 TS		= 0;
+			u32 PktCnt	= 0;
+			u8* Data8	= S->Template[t];
+			while (Data8 < S->Template[t] + Length)
+			{
+				FMADPacket_t* Pkt = (FMADPacket_t*)Data8;
+				Pkt->TS				= TS;
+				S->TemplateTSLast[t]= TS;
+
+				// wire bytes incl preamble + ifg
+				TS		+= ((Pkt->LengthWire + 24) * 8) / FEMU_LINE_GBPS;
+				Data8	+= sizeof(FMADPacket_t) + Pkt->LengthCapture;
+				PktCnt++;
+			}
+			S->TemplateLength[t]	= Length;
+			S->TemplatePkt[t]		= PktCnt;
+
+			CycleByte	+= Length;
+			SpanMax		= (TS > SpanMax) ? TS : SpanMax;
+		}
+		S->ChunkSpan	= SpanMax;
+
+		// round the capture up to whole chunks
+		u64 ChunkByte	= CycleByte / FEMU_TEMPLATE_MAX;
+		S->ChunkCnt		= (E->Config.StreamSize + ChunkByte - 1) / ChunkByte;
+		if (S->ChunkCnt == 0) S->ChunkCnt = 1;
+
+		S->StreamSize	= (S->ChunkCnt / FEMU_TEMPLATE_MAX) * CycleByte;
+		for (int t=0; t < S->ChunkCnt % FEMU_TEMPLATE_MAX; t++) S->StreamSize += S->TemplateLength[t];
+	}
+	return E;
+}
+
+void fEmu_Destroy(fEmu_t* E)
+{
+	for (int s=0; s < E->StreamCnt; s++)
+	{
+		for (int t=0; t < FEMU_TEMPLATE_MAX; t++) free(E->Stream[s].Template[t]);
+	}
+	free(E);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+bool fEmu_Start(fEmu_t* E)
+{
+	E->ListenSock = fEmu_Listen(PROTOCOL_PORT_CMD);
+	if (E->ListenSock < 0) return false;
+
+	E->Exit = false;
+	pthread_create(&E->CtrlThread, NULL, fEmu_CtrlThread, (void*)E);
+
+	for (int s=0; s < E->StreamCnt; s++)
+	{
+		fEmuStream_t* S = &E->Stream[s];
+		fprintf(stderr, "emu: stream [%-12s] %8.3f GB Chunks %lli\n", S->Name, S->StreamSize / 1e9, S->ChunkCnt);
+	}
+	return true;
+}
+
+void fEmu_Stop(fEmu_t* E)
+{
+	E->Exit = true;
+	pthread_join(E->CtrlThread, NULL);
+
+	close(E->ListenSock);
+	E->ListenSock = -1;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fEmu_Dump(fEmu_t* E)
+{
+	float dT = E->StatTime / 1e9;
+	fprintf(stderr, "Emu Gets %lli Sent %.3f GB Wire %.3f GB Chunks %lli Pkts %lli | %.3f Gbps %.3f Mpps | CPU %.3f Sec Rebase %.3f Compress %.3f Send %.3f Wait %.3f Sec\n",
+		E->StatGet,
+		E->StatByte / 1e9,
+		E->StatXfer / 1e9,
+		E->StatChunk,
+		E->StatPkt,
+		E->StatByte * 8.0 * inverse(dT) / 1e9,
+		E->StatPkt * inverse(dT) / 1e6,
+		E->StatCPU / 1e9,
+		tsc2ns(E->StatRebase) / 1e9,
+		tsc2ns(E->StatCompress) / 1e9,
+		tsc2ns(E->StatSend) / 1e9,
+		tsc2ns(E->StatWait) / 1e9);
+}
@@ -0,0 +1,127 @@
+#ifndef __F_EMU_H__
+#define __F_EMU_H__
+
+#include <pthread.h>
+
+// capture device emulator
+//
+// serves the control protocol and the chunked data protocol over
+// loopback so the full download path can run without a device. there
+// is one stream per packet size mix (emu_64, emu_imix, emu_uniform,
+// emu_1514). chunk payloads come from a small set of synthetic templates
+// and timestamps are rebased per chunk, so the capture is monotonic and
+// a requested time range skips whole chunks like the device does
+
+#define FEMU_STREAM_MAX			4			// one per FPACKET_MIX_*
+#define FEMU_TEMPLATE_MAX		16			// synthetic chunks per stream
+#define FEMU_CONN_MAX			64			// data connections
+#define FEMU_LINE_GBPS			10			// packet timestamps are spaced at this line rate
+#define FEMU_TS_BASE			1540000000000000000ULL
+
+// how chunk SeqNos are spread over the data connections
+#define FEMU_INTERLEAVE_RR		0			// round robin
+#define FEMU_INTERLEAVE_RANDOM	1			// random connection per chunk
+#define FEMU_INTERLEAVE_BURST	2			// Burst consecutive chunks per connection
+
+typedef struct fEmuConfig_t
+{
+	u64					StreamSize;				// capture bytes per stream
+	float				Rate;					// Gbps cap over all connections, 0 = unlimited
+	u32					Interleave;				// FEMU_INTERLEAVE_*
+	u32					Burst;					// chunks per connection in burst mode
+	u32					DelayUS;				// injected stall before a chunk is sent
+	u32					DelayEvery;				// every N chunks by SeqNo, 0 = no delays
+
+} fEmuConfig_t;
+
+typedef struct fEmuStream_t
+{
+	char				Name[64];
+	u32					Mix;					// FPACKET_MIX_*
+
+	u8*					Template[FEMU_TEMPLATE_MAX];
+	u32					TemplateLength[FEMU_TEMPLATE_MAX];
+	u32					TemplatePkt[FEMU_TEMPLATE_MAX];
+	u64					TemplateTSLast[FEMU_TEMPLATE_MAX];	// last packet TS relative to the chunk start
+
+	u64					ChunkCnt;
+	u64					ChunkSpan;				// ns between chunk start timestamps
+	u64					StreamSize;				// exact payload bytes of all chunks
+
+} fEmuStream_t;
+
+// one data connection of the current GET
+typedef struct fEmuConn_t
+{
+	struct fEmu_t*		E;
+	u32					Index;
+	int					ListenSock;
+	pthread_t			Thread;
+	u8*					Buffer;					// rebased chunk
+	u8*					Packed;					// LZ4 compressed chunk
+	u32*				Hash;					// LZ4 match table
+
+	u64					StatByte;
+	u64					StatXfer;				// bytes sent after compression
+	u64					StatChunk;
+	u64					StatPkt;
+	u64					StatCPU;				// thread cpu ns
+	u64					StatRebase;				// cycles copying + rebasing timestamps
+	u64					StatCompress;			// cycles in LZ4 compression
+	u64					StatSend;				// cycles in send()
+	u64					StatWait;				// cycles in rate limit + injected delays
+
+} fEmuConn_t;
+
+typedef struct fEmu_t
+{
+	fEmuConfig_t		Config;
+
+	u32					StreamCnt;
+	fEmuStream_t		Stream[FEMU_STREAM_MAX];
+
+	int					ListenSock;				// control port
+	pthread_t			CtrlThread;
+	volatile bool		Exit;
+
+	// current GET, chunks [ChunkLo, ChunkHi) are SeqNo 1.. and sending
+	// starts at SeqNoStart when the client resumes
+	fEmuStream_t*		GetStream;
+	u64					ChunkLo;
+	u64					ChunkHi;
+	u64					SeqNoStart;
+	u32					Compress;				// CMDHEADER_COMPRESS_* the client asked for
+	u32					ConnCnt;
+	fEmuConn_t			Conn[FEMU_CONN_MAX];
+
+	volatile u64		RateByte;				// bytes sent by all connections for pacing
+	u64					RateStartNS;
+
+	// totals over all GETs
+	u64					StatGet;
+	u64					StatByte;
+	u64					StatXfer;
+	u64					StatChunk;
+	u64					StatPkt;
+	u64					StatCPU;
+	u64					StatRebase;
+	u64					StatCompress;
+	u64					StatSend;
+	u64					StatWait;
+	u64					StatTime;				// ns from GET to last EOF
+
+} fEmu_t;
+
+//-------------------------------------------------------------------------------
+
+extern fEmuConfig_t	g_fEmuConfig;			// config set from the command line
+
+fEmu_t*		fEmu_Create		(fEmuConfig_t* Config);
+void		fEmu_Destroy	(fEmu_t* E);
+
+bool		fEmu_Start		(fEmu_t* E);
+void		fEmu_Stop		(fEmu_t* E);
+
+void		fEmu_Dump		(fEmu_t* E);
+
+#endif
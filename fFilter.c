@@ -0,0 +1,698 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio tcpdump style packet filter, compiled to a branch program
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <ctype.h>
+
+#include "fTypes.h"
+#include "fPacket.h"
+#include "fFilter.h"
+
+//-----------------------------------------------------------------------------------------------
+// parser
+
+#define QUAL_HOST				1
+#define QUAL_NET				2
+#define QUAL_PORT				3
+#define QUAL_PORTRANGE			4
+
+#define DIR_ANY					0
+#define DIR_SRC					1
+#define DIR_DST					2
+
+typedef struct Parse_t
+{
+	fFilter_t*			F;
+	char*				Pos;						// next char to tokenize
+	char				Tok[128];					// current token, empty at end
+	bool				Error;
+
+	// qualifiers of the last primitive, reused for bare values
+	bool				QualValid;
+	u32					QualKind;
+	u32					QualDir;
+	u32					QualProto;
+
+} Parse_t;
+
+static void Parse_Next(Parse_t* P)
+{
+	while (isspace(*P->Pos)) P->Pos++;
+
+	char* s = P->Pos;
+	u32 Len = 0;
+	if (*s == 0)
+	{
+		Len = 0;
+	}
+	else if ((*s == '(') || (*s == ')') || ((*s == '!') && (s[1] != '=')))
+	{
+		Len = 1;
+	}
+	else if (((s[0] == '&') && (s[1] == '&')) || ((s[0] == '|') && (s[1] == '|')))
+	{
+		Len = 2;
+	}
+	else
+	{
+		while (s[Len] && !isspace(s[Len]) && !strchr("()!&|", s[Len])) Len++;
+	}
+	if (Len >= sizeof(P->Tok)) Len = sizeof(P->Tok) - 1;
+
+	memcpy(P->Tok, s, Len);
+	P->Tok[Len] = 0;
+	P->Pos += Len;
+}
+
+static bool Parse_Is(Parse_t* P, char* Word)
+{
+	return strcmp(P->Tok, Word) == 0;
+}
+
+static s32 Parse_Fail(Parse_t* P, char* Msg)
+{
+	if (!P->Error) fprintf(stderr, "filter: %s at [%s] in [%s]\n", Msg, P->Tok, P->F->Expr);
+	P->Error = true;
+	return -1;
+}
+
+static s32 Parse_Node(Parse_t* P, u32 Type, s32 L, s32 R)
+{
+	fFilter_t* F = P->F;
+	if (F->NodeCnt >= FFILTER_NODE_MAX) return Parse_Fail(P, "expression too long");
+
+	s32 Index 			= F->NodeCnt++;
+	fFilterNode_t* N 	= &F->Node[Index];
+	memset(N, 0, sizeof(fFilterNode_t));
+	N->Type				= Type;
+	N->L				= L;
+	N->R				= R;
+	return Index;
+}
+
+static s32 Parse_Test(Parse_t* P, u32 Op, u32 A, u32 B)
+{
+	s32 Index = Parse_Node(P, FFILTER_NODE_TEST, -1, -1);
+	if (Index < 0) return -1;
+
+	fFilterNode_t* N 	= &P->F->Node[Index];
+	N->Test.Op			= Op;
+	N->Test.A			= A;
+	N->Test.B			= B;
+	return Index;
+}
+
+static bool Parse_Number(char* Str, u32* Value)
+{
+	if (!isdigit(*Str)) return false;
+
+	char* End;
+	*Value = strtoul(Str, &End, 10);
+	return *End == 0;
+}
+
+static bool Parse_IP(char* Str, u32* IP, u32* MaskLen)
+{
+	u32 a, b, c, d, m = 32;
+	char Tail = 0;
+
+	int n = sscanf(Str, "%u.%u.%u.%u/%u%c", &a, &b, &c, &d, &m, &Tail);
+	if ((n != 4) && (n != 5)) return false;
+	if ((a > 255) || (b > 255) || (c > 255) || (d > 255) || (m > 32)) return false;
+
+	*IP = (a << 24) | (b << 16) | (c << 8) | d;
+	if (MaskLen) *MaskLen = m;
+	else if (n != 4) return false;
+	return true;
+}
+
+static s32 Parse_Or(Parse_t* P);
+
+// [tcp|udp] [src|dst] host|net|port|portrange value
+static s32 Parse_Qualified(Parse_t* P, u32 Kind, u32 Dir, u32 Proto)
+{
+	s32 Index = -1;
+	switch (Kind)
+	{
+	case QUAL_HOST:
+	{
+		u32 IP;
+		if (!Parse_IP(P->Tok, &IP, NULL)) return Parse_Fail(P, "expected a.b.c.d");
+
+		u32 Op = (Dir == DIR_SRC) ? FFILTER_OP_HOST_SRC : (Dir == DIR_DST) ? FFILTER_OP_HOST_DST : FFILTER_OP_HOST_ANY;
+		Index = Parse_Test(P, Op, IP, 0);
+	}
+	break;
+	case QUAL_NET:
+	{
+		u32 IP, MaskLen;
+		if (!Parse_IP(P->Tok, &IP, &MaskLen)) return Parse_Fail(P, "expected a.b.c.d/len");
+
+		u32 Mask = (MaskLen == 0) ? 0 : 0xffffffff << (32 - MaskLen);
+		u32 Op = (Dir == DIR_SRC) ? FFILTER_OP_NET_SRC : (Dir == DIR_DST) ? FFILTER_OP_NET_DST : FFILTER_OP_NET_ANY;
+		Index = Parse_Test(P, Op, IP & Mask, Mask);
+	}
+	break;
+	case QUAL_PORT:
+	case QUAL_PORTRANGE:
+	{
+		u32 Lo, Hi;
+		if (Kind == QUAL_PORT)
+		{
+			if (!Parse_Number(P->Tok, &Lo)) return Parse_Fail(P, "expected port number");
+			Hi = Lo;
+		}
+		else
+		{
+			char Tail = 0;
+			if (sscanf(P->Tok, "%u-%u%c", &Lo, &Hi, &Tail) != 2) return Parse_Fail(P, "expected port range a-b");
+		}
+		if ((Lo > 65535) || (Hi > 65535) || (Lo > Hi)) return Parse_Fail(P, "invalid port");
+
+		u32 Op = (Dir == DIR_SRC) ? FFILTER_OP_PORT_SRC : (Dir == DIR_DST) ? FFILTER_OP_PORT_DST : FFILTER_OP_PORT_ANY;
+		Index = Parse_Test(P, Op, Lo, Hi);
+	}
+	break;
+	}
+	if (Index < 0) return -1;
+	Parse_Next(P);
+
+	// save for bare values e.g. "port 80 or 443"
+	P->QualValid	= true;
+	P->QualKind		= Kind;
+	P->QualDir		= Dir;
+	P->QualProto	= Proto;
+
+	// tcp port 80 -> tcp and port 80
+	if (Proto != 0)
+	{
+		s32 ProtoIndex = Parse_Test(P, FFILTER_OP_IPPROTO, Proto, 0);
+		Index = Parse_Node(P, FFILTER_NODE_AND, ProtoIndex, Index);
+	}
+	return Index;
+}
+
+static s32 Parse_Primitive(Parse_t* P)
+{
+	u32 Value;
+
+	if (P->Tok[0] == 0) return Parse_Fail(P, "unexpected end");
+
+	// bare value, same qualifiers as the previous primitive
+	if (isdigit(P->Tok[0]))
+	{
+		if (!P->QualValid) return Parse_Fail(P, "value without qualifier");
+		return Parse_Qualified(P, P->QualKind, P->QualDir, P->QualProto);
+	}
+
+	// ethertypes
+	if (Parse_Is(P, "ip"))	{ Parse_Next(P); return Parse_Test(P, FFILTER_OP_ETHERTYPE, 0x0800, 0); }
+	if (Parse_Is(P, "ip6"))	{ Parse_Next(P); return Parse_Test(P, FFILTER_OP_ETHERTYPE, 0x86dd, 0); }
+	if (Parse_Is(P, "arp"))	{ Parse_Next(P); return Parse_Test(P, FFILTER_OP_ETHERTYPE, 0x0806, 0); }
+
+	if (Parse_Is(P, "vlan"))
+	{
+		Parse_Next(P);
+		if (Parse_Number(P->Tok, &Value))
+		{
+			Parse_Next(P);
+			return Parse_Test(P, FFILTER_OP_VLANID, Value, 0);
+		}
+		return Parse_Test(P, FFILTER_OP_VLAN, 0, 0);
+	}
+
+	if (Parse_Is(P, "less") || Parse_Is(P, "greater"))
+	{
+		u32 Op = Parse_Is(P, "less") ? FFILTER_OP_LESS : FFILTER_OP_GREATER;
+		Parse_Next(P);
+		if (!Parse_Number(P->Tok, &Value)) return Parse_Fail(P, "expected length");
+		Parse_Next(P);
+		return Parse_Test(P, Op, Value, 0);
+	}
+
+	// protocol, optionally qualifying a port
+	u32 Proto = 0;
+	if (Parse_Is(P, "tcp"))		Proto = 6;
+	if (Parse_Is(P, "udp"))		Proto = 17;
+	if (Parse_Is(P, "icmp"))	Proto = 1;
+	if (Proto != 0)
+	{
+		Parse_Next(P);
+		if (!Parse_Is(P, "src") && !Parse_Is(P, "dst") && !Parse_Is(P, "port") && !Parse_Is(P, "portrange"))
+		{
+			return Parse_Test(P, FFILTER_OP_IPPROTO, Proto, 0);
+		}
+		if (Proto == 1) return Parse_Fail(P, "icmp has no ports");
+	}
+
+	u32 Dir = DIR_ANY;
+	if (Parse_Is(P, "src")) { Dir = DIR_SRC; Parse_Next(P); }
+	else if (Parse_Is(P, "dst")) { Dir = DIR_DST; Parse_Next(P); }
+
+	u32 Kind = 0;
+	if (Parse_Is(P, "host"))			Kind = QUAL_HOST;
+	else if (Parse_Is(P, "net"))		Kind = QUAL_NET;
+	else if (Parse_Is(P, "port"))		Kind = QUAL_PORT;
+	else if (Parse_Is(P, "portrange"))	Kind = QUAL_PORTRANGE;
+
+	if (Kind != 0)
+	{
+		Parse_Next(P);
+	}
+	// "src 10.0.0.1" is a host
+	else if ((Dir != DIR_ANY) && isdigit(P->Tok[0]))
+	{
+		Kind = QUAL_HOST;
+	}
+	else
+	{
+		return Parse_Fail(P, "unknown primitive");
+	}
+
+	if ((Proto != 0) && (Kind != QUAL_PORT) && (Kind != QUAL_PORTRANGE)) return Parse_Fail(P, "protocol only qualifies ports");
+
+	return Parse_Qualified(P, Kind, Dir, Proto);
+}
+
+static s32 Parse_Unary(Parse_t* P)
+{
+	if (Parse_Is(P, "not") || Parse_Is(P, "!"))
+	{
+		Parse_Next(P);
+		s32 X = Parse_Unary(P);
+		if (X < 0) return -1;
+		return Parse_Node(P, FFILTER_NODE_NOT, X, -1);
+	}
+	if (Parse_Is(P, "("))
+	{
+		Parse_Next(P);
+		s32 X = Parse_Or(P);
+		if (X < 0) return -1;
+		if (!Parse_Is(P, ")")) return Parse_Fail(P, "expected )");
+		Parse_Next(P);
+		return X;
+	}
+	return Parse_Primitive(P);
+}
+
+static s32 Parse_And(Parse_t* P)
+{
+	s32 L = Parse_Unary(P);
+	while ((L >= 0) && (Parse_Is(P, "and") || Parse_Is(P, "&&")))
+	{
+		Parse_Next(P);
+		s32 R = Parse_Unary(P);
+		if (R < 0) return -1;
+		L = Parse_Node(P, FFILTER_NODE_AND, L, R);
+	}
+	return L;
+}
+
+static s32 Parse_Or(Parse_t* P)
+{
+	s32 L = Parse_And(P);
+	while ((L >= 0) && (Parse_Is(P, "or") || Parse_Is(P, "||")))
+	{
+		Parse_Next(P);
+		s32 R = Parse_And(P);
+		if (R < 0) return -1;
+		L = Parse_Node(P, FFILTER_NODE_OR, L, R);
+	}
+	return L;
+}
+
+//-----------------------------------------------------------------------------------------------
+// flatten the tree into the branch program. each node is emitted once,
+// and/or/not only rewire the true/false targets of their children
+
+static s32 Compile_Node(fFilter_t* F, s32 Index, u32 True, u32 False)
+{
+	fFilterNode_t* N = &F->Node[Index];
+	switch (N->Type)
+	{
+	case FFILTER_NODE_AND:
+	{
+		s32 R = Compile_Node(F, N->R, True, False);
+		if (R < 0) return -1;
+		return Compile_Node(F, N->L, R, False);
+	}
+	case FFILTER_NODE_OR:
+	{
+		s32 R = Compile_Node(F, N->R, True, False);
+		if (R < 0) return -1;
+		return Compile_Node(F, N->L, True, R);
+	}
+	case FFILTER_NODE_NOT:
+		return Compile_Node(F, N->L, False, True);
+
+	case FFILTER_NODE_TEST:
+	{
+		if (F->OpCnt >= FFILTER_OP_MAX) return -1;
+
+		s32 OpIndex 	= F->OpCnt++;
+		fFilterOp_t* Op = &F->Op[OpIndex];
+		*Op				= N->Test;
+		Op->JumpTrue	= True;
+		Op->JumpFalse	= False;
+		return OpIndex;
+	}
+	}
+	return -1;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fFilter_t* fFilter_Compile(char* Expr)
+{
+	fFilter_t* F = (fFilter_t*)malloc(sizeof(fFilter_t));
+	memset(F, 0, sizeof(fFilter_t));
+	strncpy(F->Expr, Expr, sizeof(F->Expr) - 1);
+
+	Parse_t P;
+	memset(&P, 0, sizeof(P));
+	P.F		= F;
+	P.Pos	= F->Expr;
+	Parse_Next(&P);
+
+	// empty filter accepts everything
+	if (P.Tok[0] == 0)
+	{
+		F->Root		= -1;
+		F->Entry	= FFILTER_ACCEPT;
+		return F;
+	}
+
+	F->Root = Parse_Or(&P);
+	if ((F->Root >= 0) && (P.Tok[0] != 0)) Parse_Fail(&P, "trailing input");
+	if (P.Error)
+	{
+		free(F);
+		return NULL;
+	}
+
+	s32 Entry = Compile_Node(F, F->Root, FFILTER_ACCEPT, FFILTER_REJECT);
+	if (Entry < 0)
+	{
+		fprintf(stderr, "filter: program too long [%s]\n", F->Expr);
+		free(F);
+		return NULL;
+	}
+	F->Entry = Entry;
+
+	return F;
+}
+
+void fFilter_Free(fFilter_t* F)
+{
+	free(F);
+}
+
+//-----------------------------------------------------------------------------------------------
+// pull the fields the tests look at out of an ethernet frame
+
+static INLINE u16 BE16(u8* p) { return (p[0] << 8) | p[1]; }
+static INLINE u32 BE32(u8* p) { return ((u32)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+static INLINE void fFilter_Decode(fFilterPkt_t* Pkt, u8* Frame, u32 Length, u32 LengthWire)
+{
+	memset(Pkt, 0, sizeof(fFilterPkt_t));
+	Pkt->LengthWire = LengthWire;
+	if (Length < 14) return;
+
+	// skip vlan / qinq tags
+	u32 Pos			= 12;
+	u16 EtherType	= BE16(Frame + Pos);
+	while (((EtherType == 0x8100) || (EtherType == 0x88a8)) && (Pos + 6 <= Length))
+	{
+		if (!Pkt->VLAN)
+		{
+			Pkt->VLAN	= 1;
+			Pkt->VLANID	= BE16(Frame + Pos + 2) & 0xfff;
+		}
+		Pos			+= 4;
+		EtherType	= BE16(Frame + Pos);
+	}
+	Pos += 2;
+	Pkt->EtherType = EtherType;
+
+	u8* IP = Frame + Pos;
+	if ((EtherType == 0x0800) && (Pos + 20 <= Length))
+	{
+		u32 IHL			= (IP[0] & 0xf) * 4;
+		Pkt->IsIP4		= 1;
+		Pkt->Proto		= IP[9];
+		Pkt->SrcIP		= BE32(IP + 12);
+		Pkt->DstIP		= BE32(IP + 16);
+
+		// ports only in the first fragment
+		bool First		= (BE16(IP + 6) & 0x1fff) == 0;
+		if (First && ((Pkt->Proto == 6) || (Pkt->Proto == 17)) && (Pos + IHL + 4 <= Length))
+		{
+			Pkt->HasPort	= 1;
+			Pkt->SrcPort	= BE16(IP + IHL + 0);
+			Pkt->DstPort	= BE16(IP + IHL + 2);
+		}
+	}
+	else if ((EtherType == 0x86dd) && (Pos + 40 <= Length))
+	{
+		Pkt->Proto		= IP[6];
+		if (((Pkt->Proto == 6) || (Pkt->Proto == 17)) && (Pos + 44 <= Length))
+		{
+			Pkt->HasPort	= 1;
+			Pkt->SrcPort	= BE16(IP + 40);
+			Pkt->DstPort	= BE16(IP + 42);
+		}
+	}
+}
+
+static INLINE bool fFilter_Test(fFilterOp_t* Op, fFilterPkt_t* Pkt)
+{
+	switch (Op->Op)
+	{
+	case FFILTER_OP_ETHERTYPE:	return Pkt->EtherType == Op->A;
+	case FFILTER_OP_IPPROTO:	return Pkt->Proto == Op->A;
+	case FFILTER_OP_VLAN:		return Pkt->VLAN;
+	case FFILTER_OP_VLANID:		return Pkt->VLAN && (Pkt->VLANID == Op->A);
+
+	case FFILTER_OP_HOST_SRC:	return Pkt->IsIP4 && (Pkt->SrcIP == Op->A);
+	case FFILTER_OP_HOST_DST:	return Pkt->IsIP4 && (Pkt->DstIP == Op->A);
+	case FFILTER_OP_HOST_ANY:	return Pkt->IsIP4 && ((Pkt->SrcIP == Op->A) || (Pkt->DstIP == Op->A));
+
+	case FFILTER_OP_NET_SRC:	return Pkt->IsIP4 && ((Pkt->SrcIP & Op->B) == Op->A);
+	case FFILTER_OP_NET_DST:	return Pkt->IsIP4 && ((Pkt->DstIP & Op->B) == Op->A);
+	case FFILTER_OP_NET_ANY:	return Pkt->IsIP4 && (((Pkt->SrcIP & Op->B) == Op->A) || ((Pkt->DstIP & Op->B) == Op->A));
+
+	case FFILTER_OP_PORT_SRC:	return Pkt->HasPort && (Pkt->SrcPort >= Op->A) && (Pkt->SrcPort <= Op->B);
+	case FFILTER_OP_PORT_DST:	return Pkt->HasPort && (Pkt->DstPort >= Op->A) && (Pkt->DstPort <= Op->B);
+	case FFILTER_OP_PORT_ANY:	return Pkt->HasPort && (((Pkt->SrcPort >= Op->A) && (Pkt->SrcPort <= Op->B)) ||
+														((Pkt->DstPort >= Op->A) && (Pkt->DstPort <= Op->B)));
+
+	case FFILTER_OP_LESS:		return Pkt->LengthWire <= Op->A;
+	case FFILTER_OP_GREATER:	return Pkt->LengthWire >= Op->A;
+	}
+	return false;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+bool fFilter_Match(fFilter_t* F, u8* Frame, u32 Length, u32 LengthWire)
+{
+	u32 PC = F->Entry;
+	if (PC >= FFILTER_REJECT) return PC == FFILTER_ACCEPT;
+
+	fFilterPkt_t Pkt;
+	fFilter_Decode(&Pkt, Frame, Length, LengthWire);
+
+	while (PC < FFILTER_REJECT)
+	{
+		fFilterOp_t* Op = &F->Op[PC];
+		PC = fFilter_Test(Op, &Pkt) ? Op->JumpTrue : Op->JumpFalse;
+	}
+	return PC == FFILTER_ACCEPT;
+}
+
+// reference evaluator, walks the parse tree
+static bool MatchTree_Node(fFilter_t* F, s32 Index, fFilterPkt_t* Pkt)
+{
+	fFilterNode_t* N = &F->Node[Index];
+	switch (N->Type)
+	{
+	case FFILTER_NODE_AND:	return MatchTree_Node(F, N->L, Pkt) && MatchTree_Node(F, N->R, Pkt);
+	case FFILTER_NODE_OR:	return MatchTree_Node(F, N->L, Pkt) || MatchTree_Node(F, N->R, Pkt);
+	case FFILTER_NODE_NOT:	return !MatchTree_Node(F, N->L, Pkt);
+	case FFILTER_NODE_TEST:	return fFilter_Test(&N->Test, Pkt);
+	}
+	return false;
+}
+
+bool fFilter_MatchTree(fFilter_t* F, u8* Frame, u32 Length, u32 LengthWire)
+{
+	if (F->Root < 0) return true;
+
+	fFilterPkt_t Pkt;
+	fFilter_Decode(&Pkt, Frame, Length, LengthWire);
+	return MatchTree_Node(F, F->Root, &Pkt);
+}
+
+//-----------------------------------------------------------------------------------------------
+// runs the filter over a pcap format chunk. the offset table is reduced
+// to the matching packets, returns the match count and their total bytes
+
+u32 fFilter_Chunk(fFilter_t* F, u8* Data, u32* Offset, u32 PktCnt, u32* KeepByte)
+{
+	u32 KeepCnt		= 0;
+	u32 Bytes		= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Data + Offset[i]);
+		if (!fFilter_Match(F, (u8*)(PPkt + 1), PPkt->LengthCapture, PPkt->LengthWire)) continue;
+
+		Offset[KeepCnt++]	= Offset[i];
+		Bytes				+= sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+	}
+	*KeepByte = Bytes;
+	return KeepCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// checks the branch program against the tree walk and measures
+// packets per second on synthetic traffic
+
+void fFilter_Bench(fFilter_t* UserFilter, u32 ChunkCnt)
+{
+	CycleCalibration();
+
+	char* ExprList[] =
+	{
+		"tcp",
+		"udp port 53",
+		"host 10.0.1.7",
+		"tcp and dst port 443 and src net 10.0.2.0/24",
+		"not arp and (port 80 or 443 or 22)",
+		"vlan and icmp",
+		"greater 1000 or (udp and not port 123)",
+		"ip6 or arp or vlan 3",
+	};
+	u32 ExprCnt			= sizeof(ExprList) / sizeof(ExprList[0]);
+	if (UserFilter) ExprCnt = 1;
+
+	const char* MixStr[] = { "64B", "imix", "uniform", "1514B" };
+	u32 MixList[]		= { FPACKET_MIX_64, FPACKET_MIX_IMIX };
+
+	u8* Chunk			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u8* Work			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u32* OffsetAll		= memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+	u32* Offset			= memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+
+	bool Pass			= true;
+	for (int m=0; m < 2; m++)
+	{
+		srand(m + 1);
+
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(Chunk, FPACKET_CHUNK_MAX, MixList[m], &TSNext);
+		u32 PktCnt		= fPacket_FMAD2PCAPBatch(Chunk, Length, OffsetAll);
+
+		for (int e=0; e < ExprCnt; e++)
+		{
+			fFilter_t* F = UserFilter ? UserFilter : fFilter_Compile(ExprList[e]);
+			assert(F != NULL);
+
+			// branch program vs tree walk
+			u32 Mismatch = 0;
+			for (int i=0; i < PktCnt; i++)
+			{
+				PCAPPacket_t* PPkt = (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+				bool A = fFilter_Match	 (F, (u8*)(PPkt + 1), PPkt->LengthCapture, PPkt->LengthWire);
+				bool B = fFilter_MatchTree(F, (u8*)(PPkt + 1), PPkt->LengthCapture, PPkt->LengthWire);
+				if (A != B) Mismatch++;
+			}
+
+			// compacted output holds exactly the matching packets
+			u32 KeepByte;
+			memcpy(Work, Chunk, Length);
+			memcpy(Offset, OffsetAll, PktCnt * sizeof(u32));
+			u32 KeepCnt		= fFilter_Chunk(F, Work, Offset, PktCnt, &KeepByte);
+			u32 CompactLen	= fPacket_Compact(Work, Work, Offset, KeepCnt);
+			u32 CompactCnt	= 0;
+			for (u32 Pos=0; Pos < CompactLen; CompactCnt++)
+			{
+				PCAPPacket_t* PPkt = (PCAPPacket_t*)(Work + Pos);
+				if (!fFilter_Match(F, (u8*)(PPkt + 1), PPkt->LengthCapture, PPkt->LengthWire)) Mismatch++;
+				Pos += sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+			}
+			if ((CompactLen != KeepByte) || (CompactCnt != KeepCnt)) Mismatch++;
+
+			// branch program throughput
+			u64 CyclesMatch	= 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				memcpy(Offset, OffsetAll, PktCnt * sizeof(u32));
+
+				u64 TSC0 = rdtsc();
+				fFilter_Chunk(F, Chunk, Offset, PktCnt, &KeepByte);
+				CyclesMatch += rdtsc() - TSC0;
+			}
+
+			// tree walk throughput
+			u64 CyclesTree	= 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				u64 TSC0 = rdtsc();
+				u32 Cnt = 0;
+				for (int i=0; i < PktCnt; i++)
+				{
+					PCAPPacket_t* PPkt = (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+					Cnt += fFilter_MatchTree(F, (u8*)(PPkt + 1), PPkt->LengthCapture, PPkt->LengthWire);
+				}
+				CyclesTree += rdtsc() - TSC0;
+				assert(Cnt == KeepCnt);
+			}
+
+			// filter + compaction
+			u64 CyclesCompact = 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				memcpy(Work, Chunk, Length);
+				memcpy(Offset, OffsetAll, PktCnt * sizeof(u32));
+
+				u64 TSC0 = rdtsc();
+				u32 Cnt = fFilter_Chunk(F, Work, Offset, PktCnt, &KeepByte);
+				fPacket_Compact(Work, Work, Offset, Cnt);
+				CyclesCompact += rdtsc() - TSC0;
+			}
+
+			double Pkts = (double)PktCnt * ChunkCnt;
+			fprintf(stderr, "Filter %-5s Ops:%3i Match:%5.1f%% Compiled %7.2f Mpps Tree %7.2f Mpps Compact %7.2f Mpps Mismatch:%i %s : %s\n",
+					MixStr[MixList[m]],
+					F->OpCnt,
+					KeepCnt * 100.0 / PktCnt,
+					Pkts / tsc2ns(CyclesMatch) * 1e3,
+					Pkts / tsc2ns(CyclesTree) * 1e3,
+					Pkts / tsc2ns(CyclesCompact) * 1e3,
+					Mismatch,
+					(Mismatch == 0) ? "OK" : "FAIL",
+					F->Expr);
+
+			if (Mismatch != 0) Pass = false;
+			if (F != UserFilter) fFilter_Free(F);
+		}
+	}
+	fprintf(stderr, "Filter %s\n", Pass ? "PASS" : "FAIL");
+
+	free(Chunk);
+	free(Work);
+	free(OffsetAll);
+	free(Offset);
+}
@@ -0,0 +1,113 @@
+#ifndef __F_FILTER_H__
+#define __F_FILTER_H__
+
+// tcpdump style packet filter
+//
+// the expression is parsed once into a tree, then flattened into a
+// branch program: every node is a single test with a true and a false
+// target, and/or/not become jump targets so evaluation is one pass with
+// short circuit and no stack. supported subset
+//
+//   ip ip6 arp tcp udp icmp vlan [id]
+//   [src|dst] host a.b.c.d
+//   [src|dst] net a.b.c.d/len
+//   [tcp|udp] [src|dst] port n
+//   [tcp|udp] [src|dst] portrange a-b
+//   less n, greater n
+//   and && or || not ! ( )
+//
+// a bare value reuses the previous qualifiers, e.g. "port 80 or 443".
+// vlan tags are skipped when decoding so "tcp" also matches tagged frames
+
+#define FFILTER_NODE_MAX		256
+#define FFILTER_OP_MAX			256
+
+#define FFILTER_ACCEPT			0xffff		// branch targets that end evaluation
+#define FFILTER_REJECT			0xfffe
+
+// branch program ops
+#define FFILTER_OP_ETHERTYPE	1			// A = ethertype after vlan tags
+#define FFILTER_OP_IPPROTO		2			// A = ip protocol / ip6 next header
+#define FFILTER_OP_VLAN			3			// frame has a vlan tag
+#define FFILTER_OP_VLANID		4			// A = outer vlan id
+#define FFILTER_OP_HOST_SRC		5			// A = ipv4 address
+#define FFILTER_OP_HOST_DST		6
+#define FFILTER_OP_HOST_ANY		7
+#define FFILTER_OP_NET_SRC		8			// A = network B = mask
+#define FFILTER_OP_NET_DST		9
+#define FFILTER_OP_NET_ANY		10
+#define FFILTER_OP_PORT_SRC		11			// A <= port <= B
+#define FFILTER_OP_PORT_DST		12
+#define FFILTER_OP_PORT_ANY		13
+#define FFILTER_OP_LESS			14			// wire length <= A
+#define FFILTER_OP_GREATER		15			// wire length >= A
+
+// parse tree
+#define FFILTER_NODE_AND		1
+#define FFILTER_NODE_OR			2
+#define FFILTER_NODE_NOT		3
+#define FFILTER_NODE_TEST		4
+
+typedef struct fFilterOp_t
+{
+	u16					Op;
+	u16					JumpTrue;					// next op index or ACCEPT/REJECT
+	u16					JumpFalse;
+	u16					pad0;
+	u32					A;
+	u32					B;
+
+} fFilterOp_t;
+
+typedef struct fFilterNode_t
+{
+	u32					Type;
+	s32					L;							// child node index
+	s32					R;
+	fFilterOp_t			Test;						// leaf test
+
+} fFilterNode_t;
+
+// fields pulled out of a frame before evaluation
+typedef struct fFilterPkt_t
+{
+	u32					LengthWire;
+	u16					EtherType;
+	u16					VLANID;
+	u8					VLAN;
+	u8					Proto;
+	u8					IsIP4;
+	u8					HasPort;
+	u32					SrcIP;						// host byte order
+	u32					DstIP;
+	u16					SrcPort;
+	u16					DstPort;
+
+} fFilterPkt_t;
+
+typedef struct fFilter_t
+{
+	char				Expr[1024];
+
+	u32					NodeCnt;
+	s32					Root;
+	fFilterNode_t		Node[FFILTER_NODE_MAX];
+
+	u32					OpCnt;
+	u32					Entry;						// first op or ACCEPT/REJECT
+	fFilterOp_t			Op[FFILTER_OP_MAX];
+
+} fFilter_t;
+
+//-------------------------------------------------------------------------------
+
+fFilter_t*	fFilter_Compile	(char* Expr);
+void		fFilter_Free	(fFilter_t* F);
+
+bool		fFilter_Match	(fFilter_t* F, u8* Frame, u32 Length, u32 LengthWire);
+bool		fFilter_MatchTree(fFilter_t* F, u8* Frame, u32 Length, u32 LengthWire);
+u32			fFilter_Chunk	(fFilter_t* F, u8* Data, u32* Offset, u32 PktCnt, u32* KeepByte);
+
+void		fFilter_Bench	(fFilter_t* F, u32 ChunkCnt);
+
+#endif
@@ -0,0 +1,242 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio log bucketed latency histogram
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#include "fTypes.h"
+#include "fHisto.h"
+
+//-----------------------------------------------------------------------------------------------
+
+void fHisto_Reset(fHisto_t* H)
+{
+	memset(H, 0, sizeof(fHisto_t));
+	H->Min = (u64)-1;
+}
+
+//-----------------------------------------------------------------------------------------------
+// value range of a bucket
+
+u64 fHisto_BucketLow(u32 Index)
+{
+	if (Index < FHISTO_SUB_CNT) return Index;
+
+	u32 Exp = Index / FHISTO_SUB_CNT + FHISTO_SUB_BITS - 1;
+	u64 Sub = Index & (FHISTO_SUB_CNT - 1);
+	return (FHISTO_SUB_CNT + Sub) << (Exp - FHISTO_SUB_BITS);
+}
+
+u64 fHisto_BucketHigh(u32 Index)
+{
+	if (Index < FHISTO_SUB_CNT) return Index;
+
+	u32 Exp = Index / FHISTO_SUB_CNT + FHISTO_SUB_BITS - 1;
+	return fHisto_BucketLow(Index) + (1ULL << (Exp - FHISTO_SUB_BITS)) - 1;
+}
+
+//-----------------------------------------------------------------------------------------------
+// percentiles are the highest value of the bucket they land in, clamped to
+// the recorded min/max. the total comes from the buckets so a concurrent
+// Record only shifts the result by that one sample
+
+u64 fHisto_Percentile(fHisto_t* H, double* Pct, u64* Value, u32 Cnt)
+{
+	u64 Total = 0;
+	for (int i=0; i < FHISTO_BUCKET_MAX; i++) Total += H->Bucket[i];
+
+	u64 Min = H->Min;
+	u64 Max = H->Max;
+
+	u64 Sum = 0;
+	u32 p	= 0;
+	for (int i=0; (i < FHISTO_BUCKET_MAX) && (p < Cnt) && (Total > 0); i++)
+	{
+		if (H->Bucket[i] == 0) continue;
+
+		Sum += H->Bucket[i];
+		while ((p < Cnt) && (Sum >= Pct[p] * Total))
+		{
+			u64 V	= fHisto_BucketHigh(i);
+			V		= (V > Max) ? Max : V;
+			V		= (V < Min) ? Min : V;
+			Value[p++] = V;
+		}
+	}
+	for (; p < Cnt; p++) Value[p] = (Total > 0) ? Max : 0;
+
+	return Total;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fHisto_Merge(fHisto_t* Dst, fHisto_t* Src)
+{
+	for (int i=0; i < FHISTO_BUCKET_MAX; i++) Dst->Bucket[i] += Src->Bucket[i];
+
+	Dst->Count	+= Src->Count;
+	Dst->Sum	+= Src->Sum;
+	Dst->Min	= (Src->Min < Dst->Min) ? Src->Min : Dst->Min;
+	Dst->Max	= (Src->Max > Dst->Max) ? Src->Max : Dst->Max;
+}
+
+//-----------------------------------------------------------------------------------------------
+// what was recorded since the last call. min/max of the interval are the
+// edges of its lowest and highest buckets
+
+void fHisto_Interval(fHisto_t* H, fHisto_t* Last, fHisto_t* Interval)
+{
+	// histogram was reset or replaced, everything in it is new
+	if (H->Count < Last->Count) fHisto_Reset(Last);
+
+	Interval->Count	= 0;
+	Interval->Sum	= H->Sum - Last->Sum;
+	Interval->Min	= (u64)-1;
+	Interval->Max	= 0;
+	Last->Sum		= H->Sum;
+	for (int i=0; i < FHISTO_BUCKET_MAX; i++)
+	{
+		u64 B				= H->Bucket[i];
+		u64 dB				= (B > Last->Bucket[i]) ? B - Last->Bucket[i] : 0;
+
+		Interval->Bucket[i]	= dB;
+		Last->Bucket[i]		= B;
+		if (dB == 0) continue;
+
+		Interval->Count		+= dB;
+		Interval->Min		= (Interval->Min == (u64)-1) ? fHisto_BucketLow(i) : Interval->Min;
+		Interval->Max		= fHisto_BucketHigh(i);
+	}
+	Last->Count = H->Count;
+	Last->Min	= H->Min;
+	Last->Max	= H->Max;
+
+	// the overall extremes are exact when they fall in the interval
+	if ((H->Max >= Interval->Min) && (H->Max <= Interval->Max)) Interval->Max = H->Max;
+	if ((H->Min >= Interval->Min) && (H->Min <= Interval->Max)) Interval->Min = H->Min;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fHisto_Dump(fHisto_t* H, char* Desc)
+{
+	double Pct[] = { 0.5, 0.9, 0.99, 0.999 };
+	u64 Value[4];
+	u64 Total = fHisto_Percentile(H, Pct, Value, 4);
+
+	fprintf(stderr, "Latency %-8s Count %10lli Mean %10.3f us p50 %10.3f p90 %10.3f p99 %10.3f p99.9 %10.3f Max %10.3f us\n",
+			Desc,
+			Total,
+			H->Sum * inverse(H->Count) / 1e3,
+			Value[0] / 1e3,
+			Value[1] / 1e3,
+			Value[2] / 1e3,
+			Value[3] / 1e3,
+			(Total > 0) ? H->Max / 1e3 : 0);
+}
+
+//-----------------------------------------------------------------------------------------------
+// percentiles against a sorted copy of the samples, merge and interval
+// against the same samples recorded in one histogram
+
+static int Bench_Cmp(const void* A, const void* B)
+{
+	u64 a = *(u64*)A;
+	u64 b = *(u64*)B;
+	return (a < b) ? -1 : (a > b);
+}
+
+void fHisto_Bench(u32 SampleCnt)
+{
+	bool Pass = true;
+
+	// log normal around 100us with a long tail, like nvme write latency
+	u64* Sample = malloc(SampleCnt * sizeof(u64));
+	srand(1);
+	for (int i=0; i < SampleCnt; i++)
+	{
+		double u0 = (rand() + 1.0) / (RAND_MAX + 2.0);
+		double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+		double g  = sqrt(-2 * log(u0)) * cos(2 * M_PI * u1);
+		Sample[i] = exp(log(100e3) + 1.0 * g);
+	}
+
+	fHisto_t* H = malloc(sizeof(fHisto_t));
+	fHisto_t* A = malloc(sizeof(fHisto_t));
+	fHisto_t* B = malloc(sizeof(fHisto_t));
+	fHisto_t* L = malloc(sizeof(fHisto_t));
+	fHisto_t* I = malloc(sizeof(fHisto_t));
+	fHisto_Reset(H);
+	fHisto_Reset(A);
+	fHisto_Reset(B);
+	fHisto_Reset(L);
+
+	u64 TS0 = clock_ns();
+	for (int i=0; i < SampleCnt; i++) fHisto_Record(H, Sample[i]);
+	u64 TS1 = clock_ns();
+
+	for (int i=0; i < SampleCnt; i++) fHisto_Record((i < SampleCnt / 2) ? A : B, Sample[i]);
+
+	// percentile error vs exact
+	double Pct[]	= { 0.5, 0.9, 0.99, 0.999, 1.0 };
+	u64 Value[5];
+	fHisto_Percentile(H, Pct, Value, 5);
+
+	u64* Sorted = malloc(SampleCnt * sizeof(u64));
+	memcpy(Sorted, Sample, SampleCnt * sizeof(u64));
+	qsort(Sorted, SampleCnt, sizeof(u64), Bench_Cmp);
+
+	for (int p=0; p < 5; p++)
+	{
+		u64 Rank	= ceil(Pct[p] * SampleCnt);
+		u64 Exact	= Sorted[(Rank > 0 ? Rank : 1) - 1];
+		double Err	= fabs((double)Value[p] - Exact) / Exact;
+		bool Ok		= Err <= 1.0 / FHISTO_SUB_CNT;
+		Pass		&= Ok;
+
+		fprintf(stderr, "Histo p%-6g Exact %12lli Histo %12lli Error %8.4f%% %s\n", Pct[p] * 100, Exact, Value[p], Err * 100, Ok ? "ok" : "FAIL");
+	}
+
+	// merged halves match the whole
+	fHisto_Merge(A, B);
+	bool MergeOk = (memcmp(A->Bucket, H->Bucket, sizeof(H->Bucket)) == 0) && (A->Count == H->Count) && (A->Sum == H->Sum) && (A->Min == H->Min) && (A->Max == H->Max);
+	Pass &= MergeOk;
+	fprintf(stderr, "Histo Merge %s\n", MergeOk ? "ok" : "FAIL");
+
+	// interval over the second half matches a histogram of the second half
+	fHisto_Reset(A);
+	fHisto_Reset(B);
+	for (int i=0; i < SampleCnt / 2; i++) fHisto_Record(A, Sample[i]);
+	fHisto_Interval(A, L, I);
+	for (int i=SampleCnt / 2; i < SampleCnt; i++)
+	{
+		fHisto_Record(A, Sample[i]);
+		fHisto_Record(B, Sample[i]);
+	}
+	fHisto_Interval(A, L, I);
+	bool IntervalOk = (memcmp(I->Bucket, B->Bucket, sizeof(B->Bucket)) == 0) && (I->Count == B->Count) && (I->Sum == B->Sum);
+	Pass &= IntervalOk;
+	fprintf(stderr, "Histo Interval %s\n", IntervalOk ? "ok" : "FAIL");
+
+	fHisto_Dump(H, "bench");
+	fprintf(stderr, "Histo Record %.2f ns/sample, %i bytes per histogram\n", (TS1 - TS0) / (double)SampleCnt, (u32)sizeof(fHisto_t));
+	fprintf(stderr, "Histo %s\n", Pass ? "PASS" : "FAIL");
+
+	free(Sorted);
+	free(I);
+	free(L);
+	free(B);
+	free(A);
+	free(H);
+	free(Sample);
+}
@@ -0,0 +1,62 @@
+#ifndef __F_HISTO_H__
+#define __F_HISTO_H__
+
+// log bucketed latency histogram
+//
+// HDR style, values below FHISTO_SUB_CNT are exact and every power of two
+// above is split into FHISTO_SUB_CNT linear buckets, so any u64 is recorded
+// within 1/FHISTO_SUB_CNT relative error in a fixed 15KB. one thread
+// records with plain stores, readers work off the buckets and tolerate a
+// concurrent Record
+
+#define FHISTO_SUB_BITS			5
+#define FHISTO_SUB_CNT			(1 << FHISTO_SUB_BITS)
+#define FHISTO_BUCKET_MAX		((64 - FHISTO_SUB_BITS + 1) * FHISTO_SUB_CNT)
+
+typedef struct fHisto_t
+{
+	u64				Count;
+	u64				Sum;
+	u64				Min;
+	u64				Max;
+	u64				Bucket[FHISTO_BUCKET_MAX];
+
+} fHisto_t;
+
+//-------------------------------------------------------------------------------
+
+static inline u32 fHisto_Index(u64 Value)
+{
+	if (Value < FHISTO_SUB_CNT) return Value;
+
+	u32 Exp = 63 - __builtin_clzll(Value);
+	u32 Sub = (Value >> (Exp - FHISTO_SUB_BITS)) & (FHISTO_SUB_CNT - 1);
+	return (Exp - FHISTO_SUB_BITS + 1) * FHISTO_SUB_CNT + Sub;
+}
+
+static inline void fHisto_Record(fHisto_t* H, u64 Value)
+{
+	H->Bucket[ fHisto_Index(Value) ]++;
+	H->Count	+= 1;
+	H->Sum		+= Value;
+	H->Min		= (Value < H->Min) ? Value : H->Min;
+	H->Max		= (Value > H->Max) ? Value : H->Max;
+}
+
+void		fHisto_Reset		(fHisto_t* H);
+u64			fHisto_BucketLow	(u32 Index);
+u64			fHisto_BucketHigh	(u32 Index);
+
+// value at each of the Cnt fractions in Pct[] (ascending), returns the count
+u64			fHisto_Percentile	(fHisto_t* H, double* Pct, u64* Value, u32 Cnt);
+
+// Dst += Src, e.g. the stripe targets of one output
+void		fHisto_Merge		(fHisto_t* Dst, fHisto_t* Src);
+
+// Interval = H - Last, then Last = H. a reset H restarts the interval
+void		fHisto_Interval		(fHisto_t* H, fHisto_t* Last, fHisto_t* Interval);
+
+void		fHisto_Dump			(fHisto_t* H, char* Desc);
+void		fHisto_Bench		(u32 SampleCnt);
+
+#endif
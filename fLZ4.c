@@ -0,0 +1,484 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio LZ4 block codec for compressed chunk transfer
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <assert.h>
+
+#include "fTypes.h"
+#include "fPacket.h"
+#include "fLZ4.h"
+
+//-----------------------------------------------------------------------------------------------
+
+static inline u32 Read32(u8* p)
+{
+	u32 v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline u64 Read64(u8* p)
+{
+	u64 v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline void Copy8(u8* Dst, u8* Src)
+{
+	memcpy(Dst, Src, 8);
+}
+
+static inline void Copy16(u8* Dst, u8* Src)
+{
+	memcpy(Dst, Src, 16);
+}
+
+static inline u32 Hash32(u32 v)
+{
+	return (v * 2654435761U) >> (32 - FLZ4_HASH_LOG);
+}
+
+// length extension bytes after a saturated token nibble
+static inline u8* WriteLength(u8* op, u32 Length)
+{
+	while (Length >= 255)
+	{
+		*op++	= 255;
+		Length	-= 255;
+	}
+	*op++ = Length;
+	return op;
+}
+
+//-----------------------------------------------------------------------------------------------
+// greedy compressor, one hash probe per position. misses skip ahead faster
+// the longer they run so incompressible data costs little
+
+u32 fLZ4_Compress(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Hash)
+{
+	u8* ip			= Src;
+	u8* iend		= Src + Length;
+	u8* anchor		= Src;
+	u8* mflimit		= iend - FLZ4_MFLIMIT;
+	u8* matchlimit	= iend - FLZ4_LASTLITERALS;
+
+	u8* op			= Dst;
+	u8* oend		= Dst + DstMax;
+
+	memset(Hash, 0, FLZ4_HASH_MAX * sizeof(u32));
+
+	if (Length > FLZ4_MFLIMIT)
+	{
+		ip++;
+		while (ip <= mflimit)
+		{
+			u32 Seq		= Read32(ip);
+			u32 h		= Hash32(Seq);
+			u8* ref		= Src + Hash[h];
+			Hash[h]		= ip - Src;
+
+			if ((ref >= ip) || (ip - ref > FLZ4_DISTANCE_MAX) || (Read32(ref) != Seq))
+			{
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			// extend backwards into the pending literals
+			while ((ip > anchor) && (ref > Src) && (ip[-1] == ref[-1]))
+			{
+				ip--;
+				ref--;
+			}
+
+			// extend forwards, 8 bytes at a time
+			u8* mp = ip  + FLZ4_MINMATCH;
+			u8* rp = ref + FLZ4_MINMATCH;
+			while (mp + 8 <= matchlimit)
+			{
+				u64 Diff = Read64(mp) ^ Read64(rp);
+				if (Diff != 0)
+				{
+					mp += __builtin_ctzll(Diff) >> 3;
+					goto match_end;
+				}
+				mp += 8;
+				rp += 8;
+			}
+			while ((mp < matchlimit) && (*mp == *rp))
+			{
+				mp++;
+				rp++;
+			}
+		match_end:;
+
+			u32 LitLength	= ip - anchor;
+			u32 MatchLength	= mp - ip - FLZ4_MINMATCH;
+
+			// token + lengths + literals + offset, keep room for the end literals
+			if (op + 1 + LitLength / 255 + 1 + LitLength + 2 + MatchLength / 255 + 1 + FLZ4_LASTLITERALS + 1 > oend) return 0;
+
+			u8* Token = op++;
+			*Token = ((LitLength < 15) ? LitLength : 15) << 4;
+			if (LitLength >= 15) op = WriteLength(op, LitLength - 15);
+
+			memcpy(op, anchor, LitLength);
+			op += LitLength;
+
+			u32 Offset = ip - ref;
+			*op++ = Offset & 0xff;
+			*op++ = Offset >> 8;
+
+			*Token |= (MatchLength < 15) ? MatchLength : 15;
+			if (MatchLength >= 15) op = WriteLength(op, MatchLength - 15);
+
+			ip		= mp;
+			anchor	= ip;
+
+			// seed the table inside the match for the next search
+			if (ip - 2 > Src) Hash[Hash32(Read32(ip - 2))] = ip - 2 - Src;
+		}
+	}
+
+	// remaining bytes are literals
+	u32 LitLength = iend - anchor;
+	if (op + 1 + LitLength / 255 + 1 + LitLength > oend) return 0;
+
+	u8* Token = op++;
+	*Token = ((LitLength < 15) ? LitLength : 15) << 4;
+	if (LitLength >= 15) op = WriteLength(op, LitLength - 15);
+
+	memcpy(op, anchor, LitLength);
+	op += LitLength;
+
+	return op - Dst;
+}
+
+//-----------------------------------------------------------------------------------------------
+// decoder. short literal runs and non overlapping matches use over wide
+// copies while there is room before the end of the output
+
+s32 fLZ4_Decompress(u8* Dst, u32 DstMax, u8* Src, u32 Length)
+{
+	u8* ip			= Src;
+	u8* iend		= Src + Length;
+	u8* op			= Dst;
+	u8* oend		= Dst + DstMax;
+
+	while (ip < iend)
+	{
+		u32 Token		= *ip++;
+
+		// literals
+		u32 LitLength	= Token >> 4;
+		if (LitLength == 15)
+		{
+			u32 s;
+			do
+			{
+				if (ip >= iend) return -1;
+				s			= *ip++;
+				LitLength	+= s;
+			} while (s == 255);
+		}
+		if ((LitLength > iend - ip) || (LitLength > oend - op)) return -1;
+
+		if ((LitLength <= 16) && (ip + 16 <= iend) && (op + 16 <= oend))
+		{
+			Copy16(op, ip);
+		}
+		else
+		{
+			memcpy(op, ip, LitLength);
+		}
+		ip += LitLength;
+		op += LitLength;
+
+		// last sequence has no match
+		if (ip == iend) break;
+
+		// match
+		if (ip + 2 > iend) return -1;
+		u32 Offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if ((Offset == 0) || (Offset > op - Dst)) return -1;
+
+		u32 MatchLength	= Token & 15;
+		if (MatchLength == 15)
+		{
+			u32 s;
+			do
+			{
+				if (ip >= iend) return -1;
+				s			= *ip++;
+				MatchLength	+= s;
+			} while (s == 255);
+		}
+		MatchLength += FLZ4_MINMATCH;
+		if (MatchLength > oend - op) return -1;
+
+		u8* Match = op - Offset;
+		if ((Offset >= 16) && (op + MatchLength + 16 <= oend))
+		{
+			for (u32 i=0; i < MatchLength; i += 16) Copy16(op + i, Match + i);
+		}
+		else if ((Offset >= 8) && (op + MatchLength + 8 <= oend))
+		{
+			for (u32 i=0; i < MatchLength; i += 8) Copy8(op + i, Match + i);
+		}
+		else
+		{
+			// overlapping copy repeats the pattern
+			for (u32 i=0; i < MatchLength; i++) op[i] = Match[i];
+		}
+		op += MatchLength;
+	}
+	return op - Dst;
+}
+
+//-----------------------------------------------------------------------------------------------
+// frames. FLG version 01 + independent blocks, no checksums or content 
+// size. the header checksum is the second byte of xxh32(FLG, BD)
+
+#define XXH_PRIME32_1			2654435761U
+#define XXH_PRIME32_2			2246822519U
+#define XXH_PRIME32_3			3266489917U
+#define XXH_PRIME32_4			668265263U
+#define XXH_PRIME32_5			374761393U
+
+#define FRAME_FLG				0x60
+#define FRAME_BD				0x50		// 256KB blocks
+#define FRAME_BLOCK_RAW			0x80000000	// block size bit for stored blocks
+
+static inline u32 rotl32(u32 v, u32 r)
+{
+	return (v << r) | (v >> (32 - r));
+}
+
+// xxh32 for inputs under 16 bytes
+static u32 XXH32_Short(u8* p, u32 Length)
+{
+	u32 h = XXH_PRIME32_5 + Length;
+	u8* End = p + Length;
+	for (; p + 4 <= End; p += 4)
+	{
+		h += Read32(p) * XXH_PRIME32_3;
+		h  = rotl32(h, 17) * XXH_PRIME32_4;
+	}
+	for (; p < End; p++)
+	{
+		h += (*p) * XXH_PRIME32_5;
+		h  = rotl32(h, 11) * XXH_PRIME32_1;
+	}
+	h ^= h >> 15;
+	h *= XXH_PRIME32_2;
+	h ^= h >> 13;
+	h *= XXH_PRIME32_3;
+	h ^= h >> 16;
+	return h;
+}
+
+static inline void Write32(u8* p, u32 v)
+{
+	memcpy(p, &v, 4);
+}
+
+u32 fLZ4_FrameCompress(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Hash)
+{
+	assert(Length <= FLZ4_FRAME_BLOCK_MAX);
+	assert(DstMax >= FLZ4_FRAME_BOUND(Length));
+
+	u8* op = Dst;
+	Write32(op, FLZ4_FRAME_MAGIC);
+	op[4] = FRAME_FLG;
+	op[5] = FRAME_BD;
+	op[6] = (XXH32_Short(op + 4, 2) >> 8) & 0xff;
+	op += FLZ4_FRAME_HEADER;
+
+	// block, stored when compression does not shrink it
+	if (Length > 0)
+	{
+		u32 Block = fLZ4_Compress(op + 4, Length - 1, Src, Length, Hash);
+		if (Block != 0)
+		{
+			Write32(op, Block);
+		}
+		else
+		{
+			Write32(op, Length | FRAME_BLOCK_RAW);
+			memcpy(op + 4, Src, Length);
+			Block = Length;
+		}
+		op += 4 + Block;
+	}
+
+	// end mark
+	Write32(op, 0);
+	op += 4;
+
+	return op - Dst;
+}
+
+s32 fLZ4_FrameDecompress(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Used)
+{
+	u8* ip		= Src;
+	u8* iend	= Src + Length;
+
+	if (Length < FLZ4_FRAME_HEADER + 4) return -1;
+	if (Read32(ip) != FLZ4_FRAME_MAGIC) return -1;
+
+	// only what fLZ4_FrameCompress writes, plus any block size
+	u32 FLG = ip[4];
+	u32 BD	= ip[5];
+	if ((FLG & 0xfc) != FRAME_FLG) return -1;
+	if (ip[6] != ((XXH32_Short(ip + 4, 2) >> 8) & 0xff)) return -1;
+	if ((BD & 0x8f) != 0) return -1;
+	ip += FLZ4_FRAME_HEADER;
+
+	u32 Total = 0;
+	while (true)
+	{
+		if (ip + 4 > iend) return -1;
+		u32 Block = Read32(ip);
+		ip += 4;
+		if (Block == 0) break;
+
+		u32 BlockLength = Block & ~FRAME_BLOCK_RAW;
+		if (BlockLength > iend - ip) return -1;
+
+		s32 Out;
+		if (Block & FRAME_BLOCK_RAW)
+		{
+			if (BlockLength > DstMax - Total) return -1;
+			memcpy(Dst + Total, ip, BlockLength);
+			Out = BlockLength;
+		}
+		else
+		{
+			Out = fLZ4_Decompress(Dst + Total, DstMax - Total, ip, BlockLength);
+			if (Out < 0) return -1;
+		}
+		ip		+= BlockLength;
+		Total	+= Out;
+
+		// block checksum
+		if (FLG & 0x10) ip += 4;
+	}
+
+	// content checksum
+	if (FLG & 0x04) ip += 4;
+	if (ip > iend) return -1;
+
+	*Used = ip - Src;
+	return Total;
+}
+
+//-----------------------------------------------------------------------------------------------
+// round trip + ratio + GB/s per packet size mix, then incompressible and
+// corrupted input
+
+void fLZ4_Bench(u32 ChunkCnt)
+{
+	CycleCalibration();
+
+	const char* MixStr[]	= { "64B", "imix", "uniform", "1514B", "random" };
+
+	u8* Raw			= memalign(4096, FPACKET_CHUNK_MAX);
+	u8* Packed		= memalign(4096, FLZ4_BOUND(FPACKET_CHUNK_MAX));
+	u8* Out			= memalign(4096, FPACKET_CHUNK_MAX);
+	u32* Hash		= memalign(64, FLZ4_HASH_MAX * sizeof(u32));
+
+	bool Pass		= true;
+	for (int Mix=0; Mix < 5; Mix++)
+	{
+		srand(Mix + 1);
+
+		u32 Length = FPACKET_CHUNK_MAX;
+		if (Mix < 4)
+		{
+			u64 TSNext	= 1500000000123456789ULL;
+			Length		= fPacket_SynthChunk(Raw, FPACKET_CHUNK_MAX, Mix, &TSNext);
+		}
+		else
+		{
+			for (int i=0; i < Length; i++) Raw[i] = rand();
+		}
+
+		u64 CompCycles	= 0;
+		u64 DecCycles	= 0;
+		u32 PackedLength	= 0;
+		bool Match		= true;
+		for (int c=0; c < ChunkCnt; c++)
+		{
+			u64 TSC0 = rdtsc();
+			PackedLength = fLZ4_Compress(Packed, FLZ4_BOUND(Length), Raw, Length, Hash);
+			u64 TSC1 = rdtsc();
+			s32 Decoded = fLZ4_Decompress(Out, Length, Packed, PackedLength);
+			u64 TSC2 = rdtsc();
+
+			CompCycles	+= TSC1 - TSC0;
+			DecCycles	+= TSC2 - TSC1;
+
+			if ((Decoded != Length) || (memcmp(Out, Raw, Length) != 0)) Match = false;
+		}
+
+		// a chunk that does not shrink is sent raw
+		u32 Small = fLZ4_Compress(Packed, Length - 1, Raw, Length, Hash);
+
+		double GB = (double)Length * ChunkCnt / 1e9;
+		fprintf(stderr, "LZ4 %-8s Length:%6i Packed:%6i Ratio:%6.2f Compress %6.2f GB/s Decompress %6.2f GB/s RoundTrip:%s Raw:%s\n",
+			MixStr[Mix],
+			Length,
+			PackedLength,
+			Length / (double)PackedLength,
+			GB / (tsc2ns(CompCycles) / 1e9),
+			GB / (tsc2ns(DecCycles) / 1e9),
+			Match ? "OK" : "FAIL",
+			(Small == 0) ? "yes" : "no");
+
+		if (!Match) Pass = false;
+		if ((Mix == 4) && (Small != 0)) Pass = false;
+	}
+
+	// corrupt blocks must fail or decode inside the output, never overrun
+	{
+		srand(1);
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(Raw, FPACKET_CHUNK_MAX, FPACKET_MIX_IMIX, &TSNext);
+		u32 PackedLen	= fLZ4_Compress(Packed, FLZ4_BOUND(Length), Raw, Length, Hash);
+
+		u32 Reject		= 0;
+		u32 Bad			= 0;
+		for (int i=0; i < 10000; i++)
+		{
+			u8* Work = memalign(64, PackedLen);
+			memcpy(Work, Packed, PackedLen);
+			for (int k=0; k < 4; k++) Work[rand() % PackedLen] = rand();
+
+			u32 Cut = PackedLen - (rand() % 16);
+			s32 Decoded = fLZ4_Decompress(Out, Length, Work, Cut);
+			if (Decoded < 0) Reject++;
+			if (Decoded > (s32)Length) Bad++;
+			free(Work);
+		}
+		fprintf(stderr, "LZ4 corrupt  10000 blocks Rejected:%i OutOfBounds:%i %s\n", Reject, Bad, (Bad == 0) ? "OK" : "FAIL");
+		if (Bad != 0) Pass = false;
+	}
+	fprintf(stderr, "LZ4 %s\n", Pass ? "PASS" : "FAIL");
+
+	free(Raw);
+	free(Packed);
+	free(Out);
+	free(Hash);
+}
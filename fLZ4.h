@@ -0,0 +1,72 @@
+#ifndef __F_LZ4_H__
+#define __F_LZ4_H__
+
+// LZ4 block format codec for compressed chunk transfer
+//
+// standard LZ4 block layout (no frame header) so a device side liblz4
+// LZ4_compress_default() payload decodes here. greedy single probe
+// compressor, the decoder checks every length and offset against the
+// input and output so a corrupt chunk fails instead of overrunning
+
+#define FLZ4_HASH_LOG			12
+#define FLZ4_HASH_MAX			(1 << FLZ4_HASH_LOG)
+
+#define FLZ4_MINMATCH			4
+#define FLZ4_LASTLITERALS		5			// block always ends in literals
+#define FLZ4_MFLIMIT			12			// last match starts this far from the end
+#define FLZ4_DISTANCE_MAX		65535
+
+// worst case compressed size
+#define FLZ4_BOUND(Length)		((Length) + (Length) / 255 + 16)
+
+// LZ4 frame format, one block per frame so every frame decodes on its
+// own and the file still works with the lz4 command line tool
+#define FLZ4_FRAME_MAGIC		0x184D2204
+#define FLZ4_FRAME_HEADER		7			// magic, FLG, BD, header checksum
+#define FLZ4_FRAME_BLOCK_MAX	(256*1024)	// BD block max size
+#define FLZ4_FRAME_BOUND(Length)	(FLZ4_FRAME_HEADER + 4 + FLZ4_BOUND(Length) + 4)
+
+// skippable frame, lz4 -d ignores it
+#define FLZ4_SKIP_MAGIC			0x184D2A5E
+
+// seek table, a skippable frame at the end of the file. the footer is the
+// last 12 bytes so a reader finds the table from the file size
+#define FLZ4_SEEK_MAGIC			0x314b5346	// "FSK1"
+typedef struct fLZ4Seek_t
+{
+	u64					FileOffset;				// frame start in the file
+	u64					RawOffset;				// decompressed offset of the frame
+	u64					TSFirst;				// first packet timestamp in the frame
+	u32					FrameLength;
+	u32					RawLength;
+
+} __attribute__((packed)) fLZ4Seek_t;
+
+typedef struct fLZ4SeekFooter_t
+{
+	u32					EntryCnt;
+	u32					Flags;
+	u32					Magic;					// FLZ4_SEEK_MAGIC
+
+} __attribute__((packed)) fLZ4SeekFooter_t;
+
+//-------------------------------------------------------------------------------
+
+// compress Src into at most DstMax bytes, returns the compressed length
+// or 0 when it does not fit. Hash is FLZ4_HASH_MAX entries of scratch
+u32			fLZ4_Compress		(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Hash);
+
+// returns the decoded length, -1 on a malformed block
+s32			fLZ4_Decompress		(u8* Dst, u32 DstMax, u8* Src, u32 Length);
+
+// one frame holding Length <= FLZ4_FRAME_BLOCK_MAX bytes, stored raw if
+// it does not compress. returns the frame length
+u32			fLZ4_FrameCompress	(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Hash);
+
+// decode the frame at Src, Used gets its length. -1 on a malformed or
+// unsupported frame
+s32			fLZ4_FrameDecompress(u8* Dst, u32 DstMax, u8* Src, u32 Length, u32* Used);
+
+void		fLZ4_Bench			(u32 ChunkCnt);
+
+#endif
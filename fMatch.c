@@ -0,0 +1,729 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio multi pattern payload matching, aho-corasick prefilter + regex confirm
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <ctype.h>
+#include <regex.h>
+#include <immintrin.h>
+
+#include "fTypes.h"
+#include "fPacket.h"
+#include "fMatch.h"
+
+//-----------------------------------------------------------------------------------------------
+// required literal extraction from a POSIX extended regex. conservative:
+// anything that is not a plain char ends the current literal run
+
+#define RUN_MAX					255
+
+// skip a bracket expression, s points at '['
+static char* Regex_SkipClass(char* s, char* End)
+{
+	s++;
+	if ((s < End) && (*s == '^')) s++;
+	if ((s < End) && (*s == ']')) s++;
+	while ((s < End) && (*s != ']'))
+	{
+		// [:alpha:] [.x.] [=x=]
+		if ((s[0] == '[') && (s + 1 < End) && strchr(":.=", s[1]))
+		{
+			char Close = s[1];
+			s += 2;
+			while ((s + 1 < End) && !((s[0] == Close) && (s[1] == ']'))) s++;
+			s += 2;
+			continue;
+		}
+		s++;
+	}
+	return (s < End) ? s + 1 : End;
+}
+
+// skip a group, s points at '('
+static char* Regex_SkipGroup(char* s, char* End)
+{
+	u32 Depth = 0;
+	while (s < End)
+	{
+		if (*s == '\\')				{ s += 2; continue; }
+		if (*s == '[')				{ s = Regex_SkipClass(s, End); continue; }
+		if (*s == '(')				Depth++;
+		if ((*s == ')') && (--Depth == 0)) return s + 1;
+		s++;
+	}
+	return End;
+}
+
+// longest literal every match of the branch [s, End) has to contain
+static u32 Regex_BranchLiteral(char* s, char* End, u8* Best)
+{
+	u8 Run[RUN_MAX];
+	u32 RunLength 	= 0;
+	u32 BestLength	= 0;
+
+	while (s < End)
+	{
+		// next atom
+		bool IsLiteral	= false;
+		u8 Literal		= 0;
+		char* Next		= s + 1;
+		switch (*s)
+		{
+		case '\\':
+			if (s + 1 >= End) break;
+			// escaped punctuation is a literal, \w \b etc are not
+			IsLiteral	= !isalnum(s[1]);
+			Literal		= s[1];
+			Next		= s + 2;
+			break;
+		case '[':	Next = Regex_SkipClass(s, End); break;
+		case '(':	Next = Regex_SkipGroup(s, End); break;
+		case '.':
+		case '^':
+		case '$':
+			break;
+		default:
+			IsLiteral	= true;
+			Literal		= *s;
+			break;
+		}
+
+		// quantifier decides if the atom is required
+		bool Optional	= false;
+		bool Repeat		= false;
+		if (Next < End)
+		{
+			if ((*Next == '*') || (*Next == '?'))
+			{
+				Optional	= true;
+				Next++;
+			}
+			else if (*Next == '+')
+			{
+				Repeat		= true;
+				Next++;
+			}
+			else if (*Next == '{')
+			{
+				Optional	= (Next + 1 >= End) || (Next[1] == '0') || (Next[1] == ',');
+				Repeat		= !Optional;
+				while ((Next < End) && (*Next != '}')) Next++;
+				if (Next < End) Next++;
+			}
+		}
+
+		// required literal extends the run
+		if (IsLiteral && !Optional && (RunLength < RUN_MAX)) Run[RunLength++] = Literal;
+
+		// run ends at anything that is not exactly one literal char
+		if (!IsLiteral || Optional || Repeat || (RunLength == RUN_MAX))
+		{
+			if (RunLength > BestLength)
+			{
+				memcpy(Best, Run, RunLength);
+				BestLength = RunLength;
+			}
+			RunLength = 0;
+		}
+		s = Next;
+	}
+	if (RunLength > BestLength)
+	{
+		memcpy(Best, Run, RunLength);
+		BestLength = RunLength;
+	}
+	return BestLength;
+}
+
+//-----------------------------------------------------------------------------------------------
+// aho-corasick automaton over all literals, dense transitions over byte classes
+
+static void fMatch_Build(fMatch_t* M)
+{
+	free(M->Next);
+	free(M->Out);
+	M->Next			= NULL;
+	M->Out			= NULL;
+	M->StateCnt		= 0;
+	if (M->LiteralCnt == 0) return;
+
+	// leading byte pairs, little endian u16 load order
+	memset(M->Bigram, 0, sizeof(M->Bigram));
+	for (int l=0; l < M->LiteralCnt; l++)
+	{
+		u32 w = M->Literal[l][0] | (M->Literal[l][1] << 8);
+		M->Bigram[w >> 3] |= 1 << (w & 7);
+	}
+	memset(M->NibbleLo, 0, sizeof(M->NibbleLo));
+	memset(M->NibbleHi, 0, sizeof(M->NibbleHi));
+	for (int l=0; l < M->LiteralCnt; l++)
+	{
+		for (int k=0; k < 2; k++)
+		{
+			u8 b = M->Literal[l][k];
+			M->NibbleLo[k][b & 0xf] |= 1 << (l & 7);
+			M->NibbleHi[k][b >> 4]	|= 1 << (l & 7);
+		}
+	}
+
+	// bytes that appear in a literal get their own class, everything else is 0
+	memset(M->Class, 0, sizeof(M->Class));
+	M->ClassCnt = 1;
+
+	u32 StateMax = 1;
+	for (int l=0; l < M->LiteralCnt; l++)
+	{
+		for (int i=0; i < M->LiteralLength[l]; i++)
+		{
+			u8 b = M->Literal[l][i];
+			if (M->Class[b] == 0) M->Class[b] = M->ClassCnt++;
+		}
+		StateMax += M->LiteralLength[l];
+	}
+	u32 K = M->ClassCnt;
+
+	// trie
+	s32* Goto 		= (s32*)malloc(StateMax * K * sizeof(s32));
+	u32* Fail		= (u32*)malloc(StateMax * sizeof(u32));
+	u32* Queue		= (u32*)malloc(StateMax * sizeof(u32));
+	M->Out			= (u64*)calloc(StateMax, sizeof(u64));
+	M->Next			= (u32*)malloc(StateMax * K * sizeof(u32));
+
+	memset(Goto, 0xff, StateMax * K * sizeof(s32));
+	M->StateCnt 	= 1;
+	for (int l=0; l < M->LiteralCnt; l++)
+	{
+		u32 s = 0;
+		for (int i=0; i < M->LiteralLength[l]; i++)
+		{
+			u32 c = M->Class[M->Literal[l][i]];
+			if (Goto[s * K + c] < 0) Goto[s * K + c] = M->StateCnt++;
+			s = Goto[s * K + c];
+		}
+		M->Out[s] |= 1ULL << M->LiteralPattern[l];
+	}
+
+	// breadth first fail links, missing transitions follow the fail state
+	u32 QueueGet = 0;
+	u32 QueuePut = 0;
+	for (int c=0; c < K; c++)
+	{
+		s32 t = Goto[c];
+		if (t > 0)
+		{
+			Fail[t] 			= 0;
+			Queue[QueuePut++]	= t;
+		}
+		M->Next[c] = (t > 0) ? t : 0;
+	}
+	while (QueueGet < QueuePut)
+	{
+		u32 s = Queue[QueueGet++];
+		for (int c=0; c < K; c++)
+		{
+			s32 t = Goto[s * K + c];
+			if (t > 0)
+			{
+				Fail[t]				= M->Next[Fail[s] * K + c];
+				M->Out[t]			|= M->Out[Fail[t]];
+				M->Next[s * K + c]	= t;
+				Queue[QueuePut++]	= t;
+			}
+			else
+			{
+				M->Next[s * K + c] = M->Next[Fail[s] * K + c];
+			}
+		}
+	}
+
+	// state numbers to row offsets, flag states with outputs
+	for (int i=0; i < M->StateCnt * K; i++)
+	{
+		u32 t = M->Next[i];
+		M->Next[i] = (t * K) | ((M->Out[t] != 0) ? 0x80000000 : 0);
+	}
+
+	free(Goto);
+	free(Fail);
+	free(Queue);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fMatch_t* fMatch_Create(void)
+{
+	fMatch_t* M = (fMatch_t*)malloc(sizeof(fMatch_t));
+	memset(M, 0, sizeof(fMatch_t));
+	return M;
+}
+
+void fMatch_Destroy(fMatch_t* M)
+{
+	for (int l=0; l < M->LiteralCnt; l++) free(M->Literal[l]);
+	free(M->Next);
+	free(M->Out);
+	free(M);
+}
+
+bool fMatch_Add(fMatch_t* M, char* Regex)
+{
+	if (M->PatternCnt >= FMATCH_PATTERN_MAX)
+	{
+		fprintf(stderr, "match: too many patterns (max %i)\n", FMATCH_PATTERN_MAX);
+		return false;
+	}
+
+	// syntax check
+	regex_t R;
+	int ret = regcomp(&R, Regex, REG_EXTENDED | REG_NOSUB);
+	if (ret != 0)
+	{
+		char Error[256];
+		regerror(ret, &R, Error, sizeof(Error));
+		fprintf(stderr, "match: invalid regex [%s] : %s\n", Regex, Error);
+		return false;
+	}
+	regfree(&R);
+
+	u32 Index 			= M->PatternCnt++;
+	fMatchPattern_t* P	= &M->Pattern[Index];
+	memset(P, 0, sizeof(fMatchPattern_t));
+	strncpy(P->Regex, Regex, sizeof(P->Regex) - 1);
+
+	// one literal per top level alternative
+	u8 Literal[FMATCH_PATTERN_MAX][RUN_MAX];
+	u32 LiteralLength[FMATCH_PATTERN_MAX];
+	u32 LiteralCnt	= 0;
+	bool Always		= false;
+
+	char* s			= Regex;
+	char* End		= Regex + strlen(Regex);
+	char* Start		= s;
+	while (true)
+	{
+		if ((s == End) || (*s == '|'))
+		{
+			if (LiteralCnt >= FMATCH_PATTERN_MAX) Always = true;
+			else
+			{
+				LiteralLength[LiteralCnt] = Regex_BranchLiteral(Start, s, Literal[LiteralCnt]);
+				if (LiteralLength[LiteralCnt] < FMATCH_LITERAL_MIN) Always = true;
+				LiteralCnt++;
+			}
+			if (s == End) break;
+			Start = ++s;
+			continue;
+		}
+		if (*s == '\\')		{ s = (s + 2 < End) ? s + 2 : End; continue; }
+		if (*s == '[')		{ s = Regex_SkipClass(s, End); continue; }
+		if (*s == '(')		{ s = Regex_SkipGroup(s, End); continue; }
+		s++;
+	}
+	if (M->LiteralCnt + LiteralCnt > FMATCH_LITERAL_MAX) Always = true;
+
+	if (Always)
+	{
+		M->AlwaysMask |= 1ULL << Index;
+		return true;
+	}
+
+	for (int l=0; l < LiteralCnt; l++)
+	{
+		M->Literal			[M->LiteralCnt] = memcpy(malloc(LiteralLength[l]), Literal[l], LiteralLength[l]);
+		M->LiteralLength	[M->LiteralCnt] = LiteralLength[l];
+		M->LiteralPattern	[M->LiteralCnt] = Index;
+		M->LiteralCnt++;
+	}
+	fMatch_Build(M);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fMatchCtx_t* fMatch_CtxOpen(fMatch_t* M)
+{
+	fMatchCtx_t* X = (fMatchCtx_t*)malloc(sizeof(fMatchCtx_t));
+	memset(X, 0, sizeof(fMatchCtx_t));
+	X->M = M;
+
+	for (int p=0; p < M->PatternCnt; p++)
+	{
+		int ret = regcomp(&X->Regex[p], M->Pattern[p].Regex, REG_EXTENDED | REG_NOSUB);
+		assert(ret == 0);
+	}
+	return X;
+}
+
+// fold the worker counters into the shared totals
+void fMatch_CtxClose(fMatchCtx_t* X)
+{
+	fMatch_t* M = X->M;
+
+	__sync_fetch_and_add(&M->StatPkt, X->StatPkt);
+	__sync_fetch_and_add(&M->StatByte, X->StatByte);
+	for (int p=0; p < M->PatternCnt; p++)
+	{
+		__sync_fetch_and_add(&M->Pattern[p].StatCandidate, X->StatCandidate[p]);
+		__sync_fetch_and_add(&M->Pattern[p].StatHit, X->StatHit[p]);
+
+		regfree(&X->Regex[p]);
+	}
+	free(X);
+}
+
+//-----------------------------------------------------------------------------------------------
+// candidate patterns whose literal occurs in the data
+
+// first position that may start a literal, Length if none. nibble
+// lookups per byte position, and-ed so a byte pair only passes when both
+// bytes belong to a literal in the same bucket. can false positive
+__attribute__((target("avx2")))
+static u32 fMatch_Prefilter_AVX2(fMatch_t* M, u8* Data, u32 Length)
+{
+	const __m256i LoMask	= _mm256_set1_epi8(0xf);
+	const __m256i Lo0		= _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)M->NibbleLo[0]));
+	const __m256i Hi0		= _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)M->NibbleHi[0]));
+	const __m256i Lo1		= _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)M->NibbleLo[1]));
+	const __m256i Hi1		= _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)M->NibbleHi[1]));
+	const __m256i Zero		= _mm256_setzero_si256();
+
+	u32 i = 0;
+	for (; i + 33 <= Length; i += 32)
+	{
+		__m256i v0	= _mm256_loadu_si256((__m256i*)(Data + i));
+		__m256i v1	= _mm256_loadu_si256((__m256i*)(Data + i + 1));
+
+		__m256i m0	= _mm256_and_si256(	_mm256_shuffle_epi8(Lo0, _mm256_and_si256(v0, LoMask)),
+										_mm256_shuffle_epi8(Hi0, _mm256_and_si256(_mm256_srli_epi16(v0, 4), LoMask)));
+		__m256i m1	= _mm256_and_si256(	_mm256_shuffle_epi8(Lo1, _mm256_and_si256(v1, LoMask)),
+										_mm256_shuffle_epi8(Hi1, _mm256_and_si256(_mm256_srli_epi16(v1, 4), LoMask)));
+
+		u32 Hit		= ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(m0, m1), Zero));
+		if (Hit) return i + __builtin_ctz(Hit);
+	}
+
+	// tail
+	for (; i + 1 < Length; i++)
+	{
+		u32 w = *(u16*)(Data + i);
+		if ((M->Bigram[w >> 3] >> (w & 7)) & 1) return i;
+	}
+	return Length;
+}
+
+static u32 fMatch_Prefilter_Scalar(fMatch_t* M, u8* Data, u32 Length)
+{
+	for (u32 i=0; i + 1 < Length; i++)
+	{
+		u32 w = *(u16*)(Data + i);
+		if ((M->Bigram[w >> 3] >> (w & 7)) & 1) return i;
+	}
+	return Length;
+}
+
+static u32 (*s_Prefilter)(fMatch_t* M, u8* Data, u32 Length) = NULL;
+
+u64 fMatch_Scan(fMatch_t* M, u8* Data, u32 Length)
+{
+	if ((M->Next == NULL) || (Length < 2)) return 0;
+
+	// pick prefilter on first use
+	if (s_Prefilter == NULL)
+	{
+		__builtin_cpu_init();
+		s_Prefilter = __builtin_cpu_supports("avx2") ? fMatch_Prefilter_AVX2 : fMatch_Prefilter_Scalar;
+	}
+
+	// no literal can start before the first prefilter hit
+	u32 Start = s_Prefilter(M, Data, Length);
+	if (Start >= Length) return 0;
+
+	u32* Next	= M->Next;
+	u8* Class	= M->Class;
+	u64 Mask	= 0;
+	u32 Row		= 0;
+	for (u32 i=Start; i < Length; i++)
+	{
+		Row = Next[(Row & 0x7fffffff) + Class[Data[i]]];
+		if (Row & 0x80000000) Mask |= M->Out[(Row & 0x7fffffff) / M->ClassCnt];
+	}
+	return Mask;
+}
+
+// true if any pattern matches the L4 payload, every candidate is
+// confirmed so the per pattern hit counts are exact
+bool fMatch_Packet(fMatchCtx_t* X, u8* Frame, u32 Length)
+{
+	fMatch_t* M		= X->M;
+
+	u32 Pos			= fPacket_PayloadOffset(Frame, Length);
+	u8* Payload		= Frame + Pos;
+	u32 PayloadLength = Length - Pos;
+
+	X->StatPkt		+= 1;
+	X->StatByte		+= PayloadLength;
+
+	u64 Mask		= fMatch_Scan(M, Payload, PayloadLength) | M->AlwaysMask;
+	bool Hit		= false;
+	while (Mask)
+	{
+		u32 p		= __builtin_ctzll(Mask);
+		Mask		&= Mask - 1;
+
+		X->StatCandidate[p]++;
+
+		// payload is binary, bound it explicitly
+		regmatch_t R;
+		R.rm_so		= 0;
+		R.rm_eo		= PayloadLength;
+		if (regexec(&X->Regex[p], (char*)Payload, 1, &R, REG_STARTEND) == 0)
+		{
+			X->StatHit[p]++;
+			Hit = true;
+		}
+	}
+	return Hit;
+}
+
+// same contract as fFilter_Chunk, offset table is reduced to the matches
+u32 fMatch_Chunk(fMatchCtx_t* X, u8* Data, u32* Offset, u32 PktCnt, u32* KeepByte)
+{
+	u32 KeepCnt		= 0;
+	u32 Bytes		= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Data + Offset[i]);
+		if (!fMatch_Packet(X, (u8*)(PPkt + 1), PPkt->LengthCapture)) continue;
+
+		Offset[KeepCnt++]	= Offset[i];
+		Bytes				+= sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+	}
+	*KeepByte = Bytes;
+	return KeepCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fMatch_Dump(fMatch_t* M)
+{
+	fprintf(stderr, "Match Pkts %lli Payload %.3f GB States:%i Classes:%i\n", M->StatPkt, M->StatByte / 1e9, M->StateCnt, M->ClassCnt);
+	for (int p=0; p < M->PatternCnt; p++)
+	{
+		fMatchPattern_t* P = &M->Pattern[p];
+		fprintf(stderr, "  [%2i] Candidate %12lli Hit %12lli %s: %s\n",
+				p,
+				P->StatCandidate,
+				P->StatHit,
+				(M->AlwaysMask & (1ULL << p)) ? "(no literal) " : "",
+				P->Regex);
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// prefilter + confirm against running every regex on every packet, on
+// synthetic traffic with matching and near miss strings planted in 1/16
+// of the payloads
+
+void fMatch_Bench(fMatch_t* UserMatch, u32 ChunkCnt)
+{
+	CycleCalibration();
+
+	char* RegexList[] =
+	{
+		"GET /[a-z]+\\.php",
+		"HTTP/1\\.[01] 404",
+		"User-Agent: .*curl",
+		"password=[^&]+",
+		"(SELECT|UNION) .* FROM",
+		"ssn [0-9]{3}-[0-9]{2}-[0-9]{4}",
+		"evil\\.example\\.(com|net)",
+	};
+	char* PlantList[] =
+	{
+		"GET /login.php HTTP/1.1",
+		"HTTP/1.1 404 Not Found",
+		"User-Agent: curl/7.58.0",
+		"user=bob&password=hunter2",
+		"SELECT name FROM users",
+		"ssn 123-45-6789",
+		"Host: evil.example.net",
+
+		// near misses
+		"GET /index.html HTTP/1.1",
+		"HTTP/1.1 200 OK",
+		"User-Agent: Mozilla/5.0",
+		"SELECTED",
+		"example.com",
+	};
+	u32 PlantCnt		= sizeof(PlantList) / sizeof(PlantList[0]);
+
+	fMatch_t* M			= UserMatch;
+	if (M == NULL)
+	{
+		M = fMatch_Create();
+		for (int r=0; r < sizeof(RegexList) / sizeof(RegexList[0]); r++) fMatch_Add(M, RegexList[r]);
+	}
+
+	const char* MixStr[] = { "64B", "imix", "uniform", "1514B" };
+	u32 MixList[]		= { FPACKET_MIX_IMIX, FPACKET_MIX_1514 };
+
+	u8* Chunk			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u32* OffsetAll		= memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+	u32* Offset			= memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+
+	bool Pass			= true;
+	for (int m=0; m < 2; m++)
+	{
+		srand(m + 1);
+
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(Chunk, FPACKET_CHUNK_MAX, MixList[m], &TSNext);
+		u32 PktCnt		= fPacket_FMAD2PCAPBatch(Chunk, Length, OffsetAll);
+
+		// plant strings
+		u64 PayloadByte = 0;
+		for (int i=0; i < PktCnt; i++)
+		{
+			PCAPPacket_t* PPkt 	= (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+			u8* Frame			= (u8*)(PPkt + 1);
+			u32 Pos				= fPacket_PayloadOffset(Frame, PPkt->LengthCapture);
+			PayloadByte			+= PPkt->LengthCapture - Pos;
+
+			if ((rand() & 15) != 0) continue;
+
+			char* Plant			= PlantList[rand() % PlantCnt];
+			u32 PlantLength		= strlen(Plant);
+			if (Pos + PlantLength > PPkt->LengthCapture) continue;
+
+			u32 At = Pos + rand() % (PPkt->LengthCapture - Pos - PlantLength + 1);
+			memcpy(Frame + At, Plant, PlantLength);
+		}
+
+		// reference: every regex on every payload
+		fMatchCtx_t* X	= fMatch_CtxOpen(M);
+		fMatchCtx_t* Y	= fMatch_CtxOpen(M);
+
+		u32 Mismatch	= 0;
+		u32 MatchCnt	= 0;
+		for (int i=0; i < PktCnt; i++)
+		{
+			PCAPPacket_t* PPkt 	= (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+			u8* Frame			= (u8*)(PPkt + 1);
+			u32 Pos				= fPacket_PayloadOffset(Frame, PPkt->LengthCapture);
+
+			bool Ref = false;
+			for (int p=0; p < M->PatternCnt; p++)
+			{
+				regmatch_t R;
+				R.rm_so		= 0;
+				R.rm_eo		= PPkt->LengthCapture - Pos;
+				if (regexec(&Y->Regex[p], (char*)Frame + Pos, 1, &R, REG_STARTEND) == 0)
+				{
+					Y->StatHit[p]++;
+					Ref = true;
+				}
+			}
+			if (fMatch_Packet(X, Frame, PPkt->LengthCapture) != Ref) Mismatch++;
+			MatchCnt += Ref;
+		}
+		for (int p=0; p < M->PatternCnt; p++)
+		{
+			if (X->StatHit[p] != Y->StatHit[p]) Mismatch++;
+		}
+
+		// prefilter + confirm
+		u64 CyclesMatch = 0;
+		for (int c=0; c < ChunkCnt; c++)
+		{
+			memcpy(Offset, OffsetAll, PktCnt * sizeof(u32));
+
+			u32 KeepByte;
+			u64 TSC0 = rdtsc();
+			fMatch_Chunk(X, Chunk, Offset, PktCnt, &KeepByte);
+			CyclesMatch += rdtsc() - TSC0;
+		}
+
+		// automaton scan only
+		u64 CyclesScan	= 0;
+		u64 ScanMask	= 0;
+		for (int c=0; c < ChunkCnt; c++)
+		{
+			u64 TSC0 = rdtsc();
+			for (int i=0; i < PktCnt; i++)
+			{
+				PCAPPacket_t* PPkt 	= (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+				u8* Frame			= (u8*)(PPkt + 1);
+				u32 Pos				= fPacket_PayloadOffset(Frame, PPkt->LengthCapture);
+				ScanMask			|= fMatch_Scan(M, Frame + Pos, PPkt->LengthCapture - Pos);
+			}
+			CyclesScan += rdtsc() - TSC0;
+		}
+		assert(ScanMask != 0);
+
+		// regex only
+		u64 CyclesRegex	= 0;
+		for (int c=0; c < ChunkCnt; c++)
+		{
+			u64 TSC0 = rdtsc();
+			for (int i=0; i < PktCnt; i++)
+			{
+				PCAPPacket_t* PPkt 	= (PCAPPacket_t*)(Chunk + OffsetAll[i]);
+				u8* Frame			= (u8*)(PPkt + 1);
+				u32 Pos				= fPacket_PayloadOffset(Frame, PPkt->LengthCapture);
+				for (int p=0; p < M->PatternCnt; p++)
+				{
+					regmatch_t R;
+					R.rm_so		= 0;
+					R.rm_eo		= PPkt->LengthCapture - Pos;
+					if (regexec(&Y->Regex[p], (char*)Frame + Pos, 1, &R, REG_STARTEND) == 0) break;
+				}
+			}
+			CyclesRegex += rdtsc() - TSC0;
+		}
+
+		double Pkts		= (double)PktCnt * ChunkCnt;
+		double Bits		= (double)PayloadByte * 8 * ChunkCnt;
+		fprintf(stderr, "Match %-5s Patterns:%i States:%i Match:%5.2f%% | Prefilter+Confirm %7.2f Mpps %6.2f Gbps | Scan %6.2f Gbps | Regex Only %7.2f Mpps %6.2f Gbps | Mismatch:%i %s\n",
+				MixStr[MixList[m]],
+				M->PatternCnt,
+				M->StateCnt,
+				MatchCnt * 100.0 / PktCnt,
+				Pkts / tsc2ns(CyclesMatch) * 1e3,
+				Bits / tsc2ns(CyclesMatch),
+				Bits / tsc2ns(CyclesScan),
+				Pkts / tsc2ns(CyclesRegex) * 1e3,
+				Bits / tsc2ns(CyclesRegex),
+				Mismatch,
+				(Mismatch == 0) ? "OK" : "FAIL");
+
+		if (Mismatch != 0) Pass = false;
+
+		// reference counters are not part of the pattern totals
+		fMatch_CtxClose(X);
+
+		memset(Y->StatCandidate, 0, sizeof(Y->StatCandidate));
+		memset(Y->StatHit, 0, sizeof(Y->StatHit));
+		Y->StatPkt	= 0;
+		Y->StatByte = 0;
+		fMatch_CtxClose(Y);
+	}
+	fMatch_Dump(M);
+	fprintf(stderr, "Match %s\n", Pass ? "PASS" : "FAIL");
+
+	if (M != UserMatch) fMatch_Destroy(M);
+
+	free(Chunk);
+	free(OffsetAll);
+	free(Offset);
+}
@@ -0,0 +1,86 @@
+#ifndef __F_MATCH_H__
+#define __F_MATCH_H__
+
+#include <regex.h>
+
+// multi pattern payload matching
+//
+// each regex contributes the literal(s) it can not match without. all
+// literals go into one aho-corasick automaton, one scan of the payload
+// gives the set of candidate patterns and only those run the full POSIX
+// regex. patterns with no usable literal are confirmed on every packet
+
+#define FMATCH_PATTERN_MAX		64			// one bit per pattern in the candidate mask
+#define FMATCH_LITERAL_MAX		256
+#define FMATCH_LITERAL_MIN		2			// shorter literals make a useless prefilter
+
+typedef struct fMatchPattern_t
+{
+	char				Regex[1024];
+
+	u64					StatCandidate;				// prefilter hits
+	u64					StatHit;					// confirmed by the regex
+
+} fMatchPattern_t;
+
+typedef struct fMatch_t
+{
+	u32					PatternCnt;
+	fMatchPattern_t		Pattern[FMATCH_PATTERN_MAX];
+	u64					AlwaysMask;					// patterns without a literal
+
+	u32					LiteralCnt;
+	u8*					Literal[FMATCH_LITERAL_MAX];
+	u32					LiteralLength[FMATCH_LITERAL_MAX];
+	u32					LiteralPattern[FMATCH_LITERAL_MAX];
+
+	// first 2 bytes of every literal, a payload with none of them can be
+	// skipped and the automaton starts at the first hit. the SIMD version
+	// puts literals in 8 buckets with a nibble table per byte position
+	u8					Bigram[65536 / 8];
+	u8					NibbleLo[2][16];			// [byte position][low nibble] bucket mask
+	u8					NibbleHi[2][16];
+
+	// automaton, bytes map to classes. transitions hold the row offset
+	// of the next state, bit 31 set when the state has outputs
+	u8					Class[256];
+	u32					ClassCnt;
+	u32					StateCnt;
+	u32*				Next;						// [StateCnt * ClassCnt]
+	u64*				Out;						// [StateCnt] pattern mask
+
+	u64					StatPkt;
+	u64					StatByte;					// payload bytes scanned
+
+} fMatch_t;
+
+// per worker state, regex_t is not shared between threads
+typedef struct fMatchCtx_t
+{
+	fMatch_t*			M;
+	regex_t				Regex[FMATCH_PATTERN_MAX];
+
+	u64					StatPkt;
+	u64					StatByte;
+	u64					StatCandidate[FMATCH_PATTERN_MAX];
+	u64					StatHit[FMATCH_PATTERN_MAX];
+
+} fMatchCtx_t;
+
+//-------------------------------------------------------------------------------
+
+fMatch_t*		fMatch_Create		(void);
+void			fMatch_Destroy		(fMatch_t* M);
+bool			fMatch_Add			(fMatch_t* M, char* Regex);
+
+fMatchCtx_t*	fMatch_CtxOpen		(fMatch_t* M);
+void			fMatch_CtxClose		(fMatchCtx_t* X);
+
+u64				fMatch_Scan			(fMatch_t* M, u8* Data, u32 Length);
+bool			fMatch_Packet		(fMatchCtx_t* X, u8* Frame, u32 Length);
+u32				fMatch_Chunk		(fMatchCtx_t* X, u8* Data, u32* Offset, u32 PktCnt, u32* KeepByte);
+
+void			fMatch_Dump			(fMatch_t* M);
+void			fMatch_Bench		(fMatch_t* M, u32 ChunkCnt);
+
+#endif
@@ -0,0 +1,193 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio live metrics, prometheus text over loopback http
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "fTypes.h"
+#include "fMetrics.h"
+
+//-----------------------------------------------------------------------------------------------
+// one request per connection, anything but GET /metrics or / is a 404
+
+static void fMetrics_Request(fMetrics_t* M, int Sock)
+{
+	// request line and headers, only the path is looked at
+	char Request[4096];
+	u32 Length = 0;
+	while (Length < sizeof(Request) - 1)
+	{
+		struct pollfd P = { .fd = Sock, .events = POLLIN };
+		if (poll(&P, 1, 1000) <= 0) return;
+
+		int rlen = recv(Sock, Request + Length, sizeof(Request) - 1 - Length, 0);
+		if (rlen <= 0) return;
+		Length += rlen;
+		Request[Length] = 0;
+
+		if (strstr(Request, "\r\n\r\n") || strstr(Request, "\n\n")) break;
+	}
+
+	bool Found = (strncmp(Request, "GET /metrics ", 13) == 0) || (strncmp(Request, "GET / ", 6) == 0);
+
+	u32 PageLength = 0;
+	if (Found)
+	{
+		pthread_mutex_lock(&M->Lock);
+		PageLength = M->PageLength;
+		memcpy(M->Send, M->Page, PageLength);
+		pthread_mutex_unlock(&M->Lock);
+	}
+
+	char Header[256];
+	u32 HeaderLength = sprintf(Header,
+		"HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %i\r\n"
+		"Connection: close\r\n"
+		"\r\n",
+		Found ? "200 OK" : "404 Not Found",
+		PageLength);
+
+	send(Sock, Header, HeaderLength, MSG_NOSIGNAL);
+
+	u32 Pos = 0;
+	while (Pos < PageLength)
+	{
+		int wlen = send(Sock, M->Send + Pos, PageLength - Pos, MSG_NOSIGNAL);
+		if (wlen <= 0) break;
+		Pos += wlen;
+	}
+	M->StatScrape++;
+}
+
+static void* fMetrics_Thread(void* User)
+{
+	fMetrics_t* M = (fMetrics_t*)User;
+	while (!M->Exit)
+	{
+		struct pollfd P = { .fd = M->ListenSock, .events = POLLIN };
+		if (poll(&P, 1, 100) <= 0) continue;
+
+		int Sock = accept(M->ListenSock, NULL, NULL);
+		if (Sock < 0) continue;
+
+		fMetrics_Request(M, Sock);
+		close(Sock);
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------------------------
+// listens on 127.0.0.1 only
+
+fMetrics_t* fMetrics_Open(u32 Port)
+{
+	int Sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (Sock < 0) return NULL;
+
+	int One = 1;
+	setsockopt(Sock, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+
+	struct sockaddr_in Addr;
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sin_family			= AF_INET;
+	Addr.sin_port			= htons(Port);
+	Addr.sin_addr.s_addr	= htonl(INADDR_LOOPBACK);
+
+	if ((bind(Sock, (struct sockaddr*)&Addr, sizeof(Addr)) < 0) || (listen(Sock, 8) < 0))
+	{
+		fprintf(stderr, "metrics: failed to listen on port %i : %i %s\n", Port, errno, strerror(errno));
+		close(Sock);
+		return NULL;
+	}
+
+	fMetrics_t* M = (fMetrics_t*)memalign(64, sizeof(fMetrics_t));
+	memset(M, 0, sizeof(fMetrics_t));
+
+	M->Port			= Port;
+	M->ListenSock	= Sock;
+	M->Page			= malloc(FMETRICS_PAGE_MAX);
+	M->Send			= malloc(FMETRICS_PAGE_MAX);
+	pthread_mutex_init(&M->Lock, NULL);
+
+	pthread_create(&M->Thread, NULL, fMetrics_Thread, M);
+	return M;
+}
+
+void fMetrics_Close(fMetrics_t* M)
+{
+	if (M == NULL) return;
+
+	M->Exit = true;
+	pthread_join(M->Thread, NULL);
+	close(M->ListenSock);
+
+	pthread_mutex_destroy(&M->Lock);
+	free(M->Page);
+	free(M->Send);
+	free(M);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fMetrics_Publish(fMetrics_t* M, u8* Page, u32 Length)
+{
+	if (Length > FMETRICS_PAGE_MAX) Length = FMETRICS_PAGE_MAX;
+
+	pthread_mutex_lock(&M->Lock);
+	memcpy(M->Page, Page, Length);
+	M->PageLength = Length;
+	pthread_mutex_unlock(&M->Lock);
+
+	M->StatPublish++;
+}
+
+u32 fMetrics_Add(u8* Page, u32 Pos, char* Name, char* Type, char* Label, double Value)
+{
+	// keep room for the line, drop samples past the end
+	if (Pos + 512 > FMETRICS_PAGE_MAX) return Pos;
+
+	if (Type) Pos += sprintf(Page + Pos, "# TYPE fmadio_rsync_%s %s\n", Name, Type);
+	Pos += sprintf(Page + Pos, "fmadio_rsync_%s%s %.17g\n", Name, Label, Value);
+	return Pos;
+}
+
+u32 fMetrics_Label(char* Out, u32 Max, char* Name, char* Value)
+{
+	u32 Pos = snprintf(Out, Max, "{%s=\"", Name);
+	if (Pos + 3 > Max)
+	{
+		if (Max > 0) Out[0] = 0;
+		return 0;
+	}
+
+	// room for an escape pair plus the closing "}
+	for (u32 i=0; (Value[i] != 0) && (Pos + 5 <= Max); i++)
+	{
+		char c = Value[i];
+		if ((c == '\\') || (c == '"'))	{ Out[Pos++] = '\\'; Out[Pos++] = c;		}
+		else if (c == '\n')				{ Out[Pos++] = '\\'; Out[Pos++] = 'n';		}
+		else							{ Out[Pos++] = c;							}
+	}
+	Out[Pos++] = '"';
+	Out[Pos++] = '}';
+	Out[Pos] = 0;
+	return Pos;
+}
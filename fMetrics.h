@@ -0,0 +1,46 @@
+#ifndef __F_METRICS_H__
+#define __F_METRICS_H__
+
+#include <pthread.h>
+
+// live metrics over loopback http in prometheus text format
+//
+// the transfer renders the page at its own pace and publishes it, a 
+// scrape only copies the last published page so it never waits on or 
+// reads from the transfer threads
+
+#define FMETRICS_PAGE_MAX		(256*1024)
+
+typedef struct fMetrics_t
+{
+	u32					Port;
+	int					ListenSock;
+	pthread_t			Thread;
+	volatile bool		Exit;
+
+	pthread_mutex_t		Lock;					// guards Page
+	u8*					Page;
+	u32					PageLength;
+	u8*					Send;					// scrape copy of the page
+
+	u64					StatScrape;
+	u64					StatPublish;
+
+} fMetrics_t;
+
+//-------------------------------------------------------------------------------
+
+fMetrics_t*	fMetrics_Open		(u32 Port);
+void		fMetrics_Close		(fMetrics_t* M);
+
+void		fMetrics_Publish	(fMetrics_t* M, u8* Page, u32 Length);
+
+// append one sample, Label is "" or {name="value",..}. Type is written
+// as a # TYPE line when not NULL, once per metric name
+u32			fMetrics_Add		(u8* Page, u32 Pos, char* Name, char* Type, char* Label, double Value);
+
+// single label {Name="Value"} into Out, Value escaped for the text format
+// and truncated to fit Max bytes
+u32			fMetrics_Label		(char* Out, u32 Max, char* Name, char* Value);
+
+#endif
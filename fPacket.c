@@ -0,0 +1,939 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio packet header conversion, fmad chunk format -> pcap
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "fTypes.h"
+#include "fPacket.h"
+
+//-----------------------------------------------------------------------------------------------
+// single pass scalar conversion, returns number of packets
+
+u32 fPacket_FMAD2PCAP(u8* Data, u32 Length)
+{
+	u32 PktCnt 		= 0;
+	u8* Data8 		= Data;
+	u8* Data8End 	= Data + Length;
+	while (Data8 < Data8End)
+	{
+		FMADPacket_t* FPkt 	= (FMADPacket_t*)Data8;
+		PCAPPacket_t* PPkt 	= (PCAPPacket_t*)FPkt;
+
+		u64 TS				= FPkt->TS;
+		u32 LengthCapture 	= FPkt->LengthCapture;
+		u32 LengthWire 		= FPkt->LengthWire;
+
+		u64 Sec				= fPacket_TSSec(TS);
+
+		// overwrite
+		PPkt->Sec			= Sec;
+		PPkt->NSec			= TS - Sec * 1000000000ULL;
+		PPkt->LengthCapture	= LengthCapture;
+		PPkt->LengthWire	= LengthWire;
+
+		Data8 += sizeof(PCAPPacket_t) + LengthCapture;
+		PktCnt += 1;
+	}
+	return PktCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// pass 1: length walk only, builds the offset of every packet in the chunk
+
+u32 fPacket_OffsetTable(u8* Data, u32 Length, u32* Offset)
+{
+	u32 PktCnt 	= 0;
+	u32 Pos 	= 0;
+	while (Pos < Length)
+	{
+		Offset[PktCnt++] = Pos;
+		Pos += sizeof(FMADPacket_t) + ((FMADPacket_t*)(Data + Pos))->LengthCapture;
+	}
+	assert(PktCnt < FPACKET_OFFSET_MAX - 16);
+
+	return PktCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// pass 2: convert headers listed in the offset table
+
+static void fPacket_FMAD2PCAPTable_Scalar(u8* Data, u32* Offset, u32 PktCnt)
+{
+	for (int i=0; i < PktCnt; i++)
+	{
+		FMADPacket_t* FPkt 	= (FMADPacket_t*)(Data + Offset[i]);
+		PCAPPacket_t* PPkt 	= (PCAPPacket_t*)FPkt;
+
+		u64 TS				= FPkt->TS;
+		u32 LengthCapture 	= FPkt->LengthCapture;
+		u32 LengthWire 		= FPkt->LengthWire;
+
+		u64 Sec				= fPacket_TSSec(TS);
+
+		PPkt->Sec			= Sec;
+		PPkt->NSec			= TS - Sec * 1000000000ULL;
+		PPkt->LengthCapture	= LengthCapture;
+		PPkt->LengthWire	= LengthWire;
+	}
+}
+
+// 8 packets per iteration. headers are still cache hot from pass 1 so
+// there is no explicit prefetch. the 64x64 high multiply is built from 32x32
+// partial products, TS >> 9 is < 2^55 and the reciprocal < 2^55 so the
+// middle sum can not overflow
+__attribute__((target("avx512f")))
+static void fPacket_FMAD2PCAPTable_AVX512(u8* Data, u32* Offset, u32 PktCnt)
+{
+	const __m512i RecipLo	= _mm512_set1_epi64(FPACKET_NS_RECIP & 0xffffffff);
+	const __m512i RecipHi	= _mm512_set1_epi64(FPACKET_NS_RECIP >> 32);
+	const __m512i NSPerSec	= _mm512_set1_epi64(1000000000ULL);
+	const __m512i Mask32	= _mm512_set1_epi64(0xffffffff);
+	const __m512i Mask16	= _mm512_set1_epi64(0xffff);
+	const __m512i Zero		= _mm512_setzero_si512();
+
+	for (int i=0; i < PktCnt; i += 8)
+	{
+		__mmask8 Mask = (PktCnt - i >= 8) ? 0xff : (1 << (PktCnt - i)) - 1;
+
+		// table is padded so a full load is always safe
+		__m256i Index	= _mm256_loadu_si256((__m256i*)(Offset + i));
+
+		__m512i TS		= _mm512_mask_i32gather_epi64(Zero, Mask, Index, Data,     1);
+		__m512i Len		= _mm512_mask_i32gather_epi64(Zero, Mask, Index, Data + 8, 1);
+
+		// Sec = mulhi(TS >> 9, recip) >> 11
+		__m512i A		= _mm512_srli_epi64(TS, 9);
+		__m512i AHi		= _mm512_srli_epi64(A, 32);
+
+		__m512i LoLo	= _mm512_mul_epu32(A,   RecipLo);
+		__m512i HiLo	= _mm512_mul_epu32(AHi, RecipLo);
+		__m512i LoHi	= _mm512_mul_epu32(A,   RecipHi);
+		__m512i HiHi	= _mm512_mul_epu32(AHi, RecipHi);
+
+		__m512i Mid		= _mm512_add_epi64(_mm512_add_epi64(HiLo, LoHi), _mm512_srli_epi64(LoLo, 32));
+		__m512i Sec		= _mm512_srli_epi64(_mm512_add_epi64(HiHi, _mm512_srli_epi64(Mid, 32)), FPACKET_NS_SHIFT);
+
+		// Sec fits in 32b so a 32x32 multiply is exact
+		__m512i NSec	= _mm512_sub_epi64(TS, _mm512_mul_epu32(Sec, NSPerSec));
+
+		// pcap header as 2 x 64b words
+		__m512i W0		= _mm512_or_si512(_mm512_and_si512(Sec, Mask32), _mm512_slli_epi64(NSec, 32));
+		__m512i W1		= _mm512_or_si512(_mm512_and_si512(Len, Mask16), _mm512_slli_epi64(_mm512_and_si512(_mm512_srli_epi64(Len, 16), Mask16), 32));
+
+		_mm512_mask_i32scatter_epi64(Data,     Mask, Index, W0, 1);
+		_mm512_mask_i32scatter_epi64(Data + 8, Mask, Index, W1, 1);
+	}
+}
+
+static void (*s_FMAD2PCAPTable)(u8* Data, u32* Offset, u32 PktCnt) = NULL;
+
+void fPacket_FMAD2PCAPTable(u8* Data, u32* Offset, u32 PktCnt)
+{
+	// pick kernel on first use
+	if (s_FMAD2PCAPTable == NULL)
+	{
+		__builtin_cpu_init();
+		s_FMAD2PCAPTable = __builtin_cpu_supports("avx512f") ? fPacket_FMAD2PCAPTable_AVX512 : fPacket_FMAD2PCAPTable_Scalar;
+	}
+	s_FMAD2PCAPTable(Data, Offset, PktCnt);
+}
+
+//-----------------------------------------------------------------------------------------------
+// two pass conversion, Offset needs FPACKET_OFFSET_MAX entries and holds
+// the packet offsets on return
+
+u32 fPacket_FMAD2PCAPBatch(u8* Data, u32 Length, u32* Offset)
+{
+	u32 PktCnt = fPacket_OffsetTable(Data, Length, Offset);
+	fPacket_FMAD2PCAPTable(Data, Offset, PktCnt);
+	return PktCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// keeps pcap packets with TSFrom <= TS < TSTo, same contract as fFilter_Chunk
+
+u32 fPacket_TrimTime(u8* Data, u32* Offset, u32 PktCnt, u64 TSFrom, u64 TSTo, u32* KeepByte)
+{
+	u32 KeepCnt		= 0;
+	u32 Bytes		= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Data + Offset[i]);
+
+		u64 TS = PPkt->Sec * 1000000000ULL + PPkt->NSec;
+		if ((TS < TSFrom) || (TS >= TSTo)) continue;
+
+		Offset[KeepCnt++]	= Offset[i];
+		Bytes				+= sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+	}
+	*KeepByte = Bytes;
+	return KeepCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// output rotation points, where the capture time moves to another period.
+// split offsets are in the compacted layout of the packets in Offset[].
+// only divides when a packet leaves the current period
+
+u32 fPacket_SplitTime(u8* Data, u32* Offset, u32 PktCnt, u64 PeriodNS, u64* PeriodFirst, u64* PeriodLast, u32* Split, u32 SplitMax)
+{
+	u32 SplitCnt	= 0;
+	u32 Pos			= 0;
+	u64 Period		= 0;
+	u64 PeriodLo	= 1;			// empty range, first packet sets it
+	u64 PeriodHi	= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Data + Offset[i]);
+
+		u64 TS = PPkt->Sec * 1000000000ULL + PPkt->NSec;
+		if ((TS < PeriodLo) || (TS >= PeriodHi))
+		{
+			Period		= TS / PeriodNS;
+			PeriodLo	= Period * PeriodNS;
+			PeriodHi	= PeriodLo + PeriodNS;
+
+			if (i == 0)						*PeriodFirst 		= Period;
+			else if (SplitCnt < SplitMax)	Split[SplitCnt++]	= Pos;
+		}
+		Pos += sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+	}
+	if (PktCnt > 0) *PeriodLast = Period;
+	return SplitCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// offset of the L4 payload in an ethernet frame. frames that are not
+// tcp/udp over ip return the offset after the ethernet header
+
+u32 fPacket_PayloadOffset(u8* Frame, u32 Length)
+{
+	if (Length < 14) return Length;
+
+	// skip vlan / qinq tags
+	u32 Pos			= 12;
+	u16 EtherType	= (Frame[Pos] << 8) | Frame[Pos + 1];
+	while (((EtherType == 0x8100) || (EtherType == 0x88a8)) && (Pos + 6 <= Length))
+	{
+		Pos			+= 4;
+		EtherType	= (Frame[Pos] << 8) | Frame[Pos + 1];
+	}
+	Pos += 2;
+
+	u8* IP		= Frame + Pos;
+	u32 Proto	= 0;
+	if ((EtherType == 0x0800) && (Pos + 20 <= Length))
+	{
+		Proto	= IP[9];
+		Pos		+= (IP[0] & 0xf) * 4;
+	}
+	else if ((EtherType == 0x86dd) && (Pos + 40 <= Length))
+	{
+		Proto	= IP[6];
+		Pos		+= 40;
+	}
+
+	if ((Proto == 6) && (Pos + 20 <= Length))
+	{
+		Pos		+= (Frame[Pos + 12] >> 4) * 4;
+	}
+	else if ((Proto == 17) && (Pos + 8 <= Length))
+	{
+		Pos		+= 8;
+	}
+	return (Pos > Length) ? Length : Pos;
+}
+
+//-----------------------------------------------------------------------------------------------
+// truncates the pcap packets in the offset table to SnapLen bytes, or to
+// the end of the L2-L4 headers with Headers (SnapLen 0 = no limit).
+// LengthWire keeps the original size. returns the bytes left, the packets
+// are no longer back to back so fPacket_Compact must follow
+
+u32 fPacket_Slice(u8* Data, u32* Offset, u32 PktCnt, u32 SnapLen, bool Headers)
+{
+	u32 Bytes = 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Data + Offset[i]);
+
+		u32 Length = PPkt->LengthCapture;
+		if (Headers)						Length = fPacket_PayloadOffset((u8*)(PPkt + 1), Length);
+		if ((SnapLen != 0) && (Length > SnapLen))	Length = SnapLen;
+
+		PPkt->LengthCapture	= Length;
+		Bytes				+= sizeof(PCAPPacket_t) + Length;
+	}
+	return Bytes;
+}
+
+//-----------------------------------------------------------------------------------------------
+// moves the packets listed in the offset table down to Dst, adjacent
+// packets are moved as one run. Dst <= Src, returns the new length
+
+u32 fPacket_Compact(u8* Dst, u8* Src, u32* Offset, u32 PktCnt)
+{
+	u32 Pos = 0;
+	for (int i=0; i < PktCnt; )
+	{
+		u32 Start	= Offset[i];
+		u32 End		= Start + sizeof(PCAPPacket_t) + ((PCAPPacket_t*)(Src + Start))->LengthCapture;
+
+		// extend the run while packets are back to back
+		for (i++; (i < PktCnt) && (Offset[i] == End); i++)
+		{
+			End += sizeof(PCAPPacket_t) + ((PCAPPacket_t*)(Src + End))->LengthCapture;
+		}
+
+		u8* D		= Dst + Pos;
+		u8* S		= Src + Start;
+		u32 Length	= End - Start;
+
+		// sliced packets are short, one fixed size copy instead of memmove.
+		// the source stays inside the chunk as the next packet is 64B on, the
+		// spill past Length is below S so only hits bytes already moved
+		if ((Length <= 64) && (S - D >= 64) && (i < PktCnt) && (Offset[i] >= Start + 64))
+		{
+			__builtin_memcpy(D, S, 64);
+		}
+		else if (D != S)
+		{
+			memmove(D, S, Length);
+		}
+		Pos += Length;
+	}
+	return Pos;
+}
+
+//-----------------------------------------------------------------------------------------------
+// port of every fmad packet in the offset table, run before conversion
+// overwrites the header. PortMap is indexed by Offset / 16, packets are
+// at least a header apart so every packet has its own entry
+
+void fPacket_PortMap(u8* Data, u32* Offset, u32 PktCnt, u8* PortMap)
+{
+	for (int i=0; i < PktCnt; i++)
+	{
+		FMADPacket_t* FPkt = (FMADPacket_t*)(Data + Offset[i]);
+		PortMap[Offset[i] / sizeof(FMADPacket_t)] = FPkt->PortNo;
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// fPacket_Compact into a separate Dst with the packets grouped by port,
+// ascending port order and capture order within a port. PortList and
+// PortLength get the runs, returns the number of ports
+
+u32 fPacket_CompactPort(u8* Dst, u8* Src, u32* Offset, u32 PktCnt, u8* PortMap, u8* PortList, u32* PortLength)
+{
+	u32 PortByte[FPACKET_PORT_MAX];
+	u32 PortPos[FPACKET_PORT_MAX];
+	memset(PortByte, 0, sizeof(PortByte));
+
+	for (int i=0; i < PktCnt; i++)
+	{
+		PCAPPacket_t* PPkt = (PCAPPacket_t*)(Src + Offset[i]);
+		PortByte[PortMap[Offset[i] / sizeof(FMADPacket_t)]] += sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+	}
+
+	u32 PortCnt	= 0;
+	u32 Pos		= 0;
+	for (int p=0; p < FPACKET_PORT_MAX; p++)
+	{
+		if (PortByte[p] == 0) continue;
+
+		PortList[PortCnt]	= p;
+		PortLength[PortCnt]	= PortByte[p];
+		PortPos[p]			= Pos;
+		Pos					+= PortByte[p];
+		PortCnt++;
+	}
+
+	for (int i=0; i < PktCnt; )
+	{
+		u32 Start	= Offset[i];
+		u32 Port	= PortMap[Start / sizeof(FMADPacket_t)];
+		u32 End		= Start + sizeof(PCAPPacket_t) + ((PCAPPacket_t*)(Src + Start))->LengthCapture;
+
+		// extend the run while packets are back to back on the same port
+		for (i++; (i < PktCnt) && (Offset[i] == End) && (PortMap[End / sizeof(FMADPacket_t)] == Port); i++)
+		{
+			End += sizeof(PCAPPacket_t) + ((PCAPPacket_t*)(Src + End))->LengthCapture;
+		}
+
+		memcpy(Dst + PortPos[Port], Src + Start, End - Start);
+		PortPos[Port] += End - Start;
+	}
+	return PortCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// pcapng option, value padded to 32 bits. returns the bytes written
+
+static u32 PCAPNG_Option(u8* Dst, u16 Code, void* Value, u16 Length)
+{
+	u32 Pad = (Length + 3) & ~3;
+	((u16*)Dst)[0] = Code;
+	((u16*)Dst)[1] = Length;
+	memcpy(Dst + 4, Value, Length);
+	memset(Dst + 4 + Length, 0, Pad - Length);
+	return 4 + Pad;
+}
+
+// enhanced packet block size for a packet of LengthCapture bytes
+static inline u32 PCAPNG_EPBLength(u32 LengthCapture, u32 Options)
+{
+	u32 Length = sizeof(PCAPNGEPB_t) + ((LengthCapture + 3) & ~3) + 4;
+	if (Options & FPACKET_PCAPNG_FLAGS) Length += 4 + 4 + 4;
+	return Length;
+}
+
+//-----------------------------------------------------------------------------------------------
+// section header then one nanosecond interface per capture port. Comment 
+// is an optional section comment. returns the bytes written
+
+u32 fPacket_PCAPNGHeader(u8* Dst, u32 PortCnt, u32 SnapLen, char* Comment)
+{
+	u32 Pos = 0;
+
+	u32* SHB	= (u32*)Dst;
+	SHB[0]		= PCAPNG_BLOCK_SHB;
+	SHB[2]		= PCAPNG_BYTE_ORDER;
+	SHB[3]		= PCAPNG_MAJOR | (PCAPNG_MINOR << 16);
+	SHB[4]		= 0xffffffff;						// section length unknown
+	SHB[5]		= 0xffffffff;
+	Pos			= 24;
+
+	Pos			+= PCAPNG_Option(Dst + Pos, PCAPNG_OPT_SHB_USERAPPL, "fmadio_rsync", 12);
+	if (Comment) Pos += PCAPNG_Option(Dst + Pos, PCAPNG_OPT_COMMENT, Comment, strlen(Comment));
+	Pos			+= PCAPNG_Option(Dst + Pos, PCAPNG_OPT_END, NULL, 0);
+	Pos			+= 4;
+	SHB[1]		= Pos;
+	((u32*)(Dst + Pos))[-1] = Pos;
+
+	for (int p=0; p < PortCnt; p++)
+	{
+		u32 Start	= Pos;
+		u32* IDB	= (u32*)(Dst + Pos);
+		IDB[0]		= PCAPNG_BLOCK_IDB;
+		IDB[2]		= PCAPHEADER_LINK_ETHERNET;		// reserved 16b is 0
+		IDB[3]		= SnapLen;
+		Pos			+= 16;
+
+		char Name[16];
+		u8 TSResol	= 9;							// 10^-9
+		sprintf(Name, "port%i", p);
+		Pos			+= PCAPNG_Option(Dst + Pos, PCAPNG_OPT_IF_NAME, Name, strlen(Name));
+		Pos			+= PCAPNG_Option(Dst + Pos, PCAPNG_OPT_IF_TSRESOL, &TSResol, 1);
+		Pos			+= PCAPNG_Option(Dst + Pos, PCAPNG_OPT_END, NULL, 0);
+		Pos			+= 4;
+		IDB[1]		= Pos - Start;
+		((u32*)(Dst + Pos))[-1] = Pos - Start;
+	}
+	return Pos;
+}
+
+//-----------------------------------------------------------------------------------------------
+// pcapng size of the pcap packets in the offset table, before compaction.
+// Split offsets in the compacted pcap layout are moved to the pcapng layout
+
+u32 fPacket_PCAPNGLayout(u8* Data, u32* Offset, u32 PktCnt, u32 Options, u32* Split, u32 SplitCnt)
+{
+	u32 Pos		= 0;
+	u32 PosNG	= 0;
+	u32 s		= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		if ((s < SplitCnt) && (Split[s] == Pos)) Split[s++] = PosNG;
+
+		u32 LengthCapture = ((PCAPPacket_t*)(Data + Offset[i]))->LengthCapture;
+		Pos		+= sizeof(PCAPPacket_t) + LengthCapture;
+		PosNG	+= PCAPNG_EPBLength(LengthCapture, Options);
+	}
+	return PosNG;
+}
+
+//-----------------------------------------------------------------------------------------------
+// compacted pcap packets to enhanced packet blocks in place. blocks are
+// larger so it runs back to front, every block lands at or after its
+// packet and never on a packet not yet moved. Data must have room for
+// the fPacket_PCAPNGLayout size, Offset is scratch. returns the new length
+
+u32 fPacket_PCAPNG(u8* Data, u32* Offset, u32 PktCnt, u8* Port, u32 PortCnt, u32 Options)
+{
+	u32 Pos		= 0;
+	u32 PosNG	= 0;
+	for (int i=0; i < PktCnt; i++)
+	{
+		u32 LengthCapture = ((PCAPPacket_t*)(Data + Pos))->LengthCapture;
+		Offset[i]	= Pos;
+		Pos			+= sizeof(PCAPPacket_t) + LengthCapture;
+		PosNG		+= PCAPNG_EPBLength(LengthCapture, Options);
+	}
+
+	u32 Length = PosNG;
+	for (int i=PktCnt-1; i >= 0; i--)
+	{
+		PCAPPacket_t* PPkt	= (PCAPPacket_t*)(Data + Offset[i]);
+		u64 TS				= PPkt->Sec * 1000000000ULL + PPkt->NSec;
+		u32 LengthCapture	= PPkt->LengthCapture;
+		u32 LengthWire		= PPkt->LengthWire;
+		u32 EPBLength		= PCAPNG_EPBLength(LengthCapture, Options);
+
+		PosNG				-= EPBLength;
+		u8* Block			= Data + PosNG;
+
+		// payload first, the new header may cover the old payload
+		memmove(Block + sizeof(PCAPNGEPB_t), PPkt + 1, LengthCapture);
+
+		PCAPNGEPB_t* EPB	= (PCAPNGEPB_t*)Block;
+		EPB->Type			= PCAPNG_BLOCK_EPB;
+		EPB->Length			= EPBLength;
+		EPB->Interface		= (Port[i] < PortCnt) ? Port[i] : PortCnt - 1;
+		EPB->TSHigh			= TS >> 32;
+		EPB->TSLow			= TS;
+		EPB->LengthCapture	= LengthCapture;
+		EPB->LengthWire		= LengthWire;
+
+		u32 Pad				= ((LengthCapture + 3) & ~3) - LengthCapture;
+		u8* Tail			= Block + sizeof(PCAPNGEPB_t) + LengthCapture;
+		memset(Tail, 0, Pad);
+		Tail				+= Pad;
+
+		if (Options & FPACKET_PCAPNG_FLAGS)
+		{
+			((u32*)Tail)[0]	= PCAPNG_OPT_EPB_FLAGS | (4 << 16);
+			((u32*)Tail)[1]	= 1;						// inbound
+			((u32*)Tail)[2]	= PCAPNG_OPT_END;
+			Tail			+= 12;
+		}
+		*(u32*)Tail			= EPBLength;
+	}
+	return Length;
+}
+
+//-----------------------------------------------------------------------------------------------
+// original RxThread conversion, goes through a double so timestamps
+// close to a second boundary round into the next second
+
+static u32 fPacket_FMAD2PCAP_Legacy(u8* Data, u32 Length)
+{
+	u32 PktCnt 		= 0;
+	u8* Data8 		= Data;
+	u8* Data8End 	= Data + Length;
+	while (Data8 < Data8End)
+	{
+		FMADPacket_t* FPkt 	= (FMADPacket_t*)Data8;
+		PCAPPacket_t* PPkt 	= (PCAPPacket_t*)FPkt;
+
+		u64 TS				= FPkt->TS;
+		u32 LengthCapture 	= FPkt->LengthCapture;
+		u32 LengthWire 		= FPkt->LengthWire;
+
+		PPkt->Sec			= TS / 1e9;
+		PPkt->NSec			= TS - (u64)PPkt->Sec * 1000000000ULL;
+		PPkt->LengthCapture	= LengthCapture;
+		PPkt->LengthWire	= LengthWire;
+
+		Data8 += sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+		PktCnt += 1;
+	}
+	return PktCnt;
+}
+
+static u32 Bench_Legacy(u8* Data, u32 Length, u32* Offset)		{ return fPacket_FMAD2PCAP_Legacy(Data, Length); }
+static u32 Bench_Scalar(u8* Data, u32 Length, u32* Offset)		{ return fPacket_FMAD2PCAP(Data, Length); }
+static u32 Bench_Table(u8* Data, u32 Length, u32* Offset)
+{
+	u32 PktCnt = fPacket_OffsetTable(Data, Length, Offset);
+	fPacket_FMAD2PCAPTable_Scalar(Data, Offset, PktCnt);
+	return PktCnt;
+}
+static u32 Bench_AVX512(u8* Data, u32 Length, u32* Offset)
+{
+	u32 PktCnt = fPacket_OffsetTable(Data, Length, Offset);
+	fPacket_FMAD2PCAPTable_AVX512(Data, Offset, PktCnt);
+	return PktCnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+// synthetic traffic for the benchmarks. frames are ethernet with a mix of
+// ipv4 tcp/udp/icmp, ipv6, arp and the odd vlan tag, payload is filler
+
+u32 fPacket_SynthSize(u32 Mix)
+{
+	switch (Mix)
+	{
+	case FPACKET_MIX_64: 		return 64;
+	case FPACKET_MIX_IMIX:
+	{
+		// simple imix 7:4:1
+		u32 r = rand() % 12;
+		return (r < 7) ? 64 : (r < 11) ? 576 : 1500;
+	}
+	case FPACKET_MIX_UNIFORM:	return 60 + rand() % (1514 - 60 + 1);
+	case FPACKET_MIX_1514:		return 1514;
+	}
+	return 64;
+}
+
+void fPacket_SynthFrame(u8* Frame, u32 Length)
+{
+	static const u16 PortList[] = { 80, 443, 22, 53, 8080, 123 };
+
+	u32 r		= rand();
+	u32 Pos		= 0;
+
+	// mac addresses
+	for (int i=0; i < 12; i++) Frame[i] = 0x02 + i + (r & 0x3);
+	Pos			= 12;
+
+	// 1 in 16 have a vlan tag
+	if ((r & 0xf0) == 0)
+	{
+		Frame[Pos + 0] = 0x81;
+		Frame[Pos + 1] = 0x00;
+		Frame[Pos + 2] = 0x00;
+		Frame[Pos + 3] = 1 + (r >> 8) % 16;
+		Pos += 4;
+	}
+
+	u32 Type	= (r >> 12) % 20;
+	u16 EtherType = (Type < 17) ? 0x0800 : (Type < 18) ? 0x86dd : 0x0806;
+	Frame[Pos + 0] = EtherType >> 8;
+	Frame[Pos + 1] = EtherType & 0xff;
+	Pos += 2;
+
+	// filler payload
+	for (int i=Pos; i < Length; i++) Frame[i] = i;
+
+	if (EtherType == 0x0800)
+	{
+		u8* IP		= Frame + Pos;
+		u32 Proto	= (r >> 20) % 10;
+		Proto		= (Proto < 6) ? 6 : (Proto < 9) ? 17 : 1;
+
+		u16 IPLength = Length - Pos;
+		memset(IP, 0, 20);
+		IP[0]		= 0x45;
+		IP[2]		= IPLength >> 8;
+		IP[3]		= IPLength & 0xff;
+		IP[8]		= 64;
+		IP[9]		= Proto;
+
+		// 10.0.x.y -> 192.168.x.y
+		u32 s		= rand();
+		IP[12] = 10;  IP[13] = 0;   IP[14] = s & 3;		IP[15] = 1 + (s >> 2) % 250;
+		IP[16] = 192; IP[17] = 168; IP[18] = (s >> 10) & 3;	IP[19] = 1 + (s >> 12) % 250;
+
+		if ((Proto == 6) || (Proto == 17))
+		{
+			u8* L4		= IP + 20;
+			u16 SrcPort	= 1024 + (s >> 20) % 60000;
+			u16 DstPort	= PortList[(s >> 8) % 6];
+			L4[0] = SrcPort >> 8; L4[1] = SrcPort & 0xff;
+			L4[2] = DstPort >> 8; L4[3] = DstPort & 0xff;
+
+			// tcp data offset, no options
+			if (Proto == 6) L4[12] = 0x50;
+		}
+	}
+	else if (EtherType == 0x86dd)
+	{
+		u8* IP		= Frame + Pos;
+		memset(IP, 0, 40);
+		IP[0]		= 0x60;
+		IP[6]		= 6;
+		IP[7]		= 64;
+	}
+}
+
+// fills a chunk with fmad packets. about 1 in 8 timestamps lands within
+// a few hundred ns of a second boundary
+u32 fPacket_SynthChunk(u8* Data, u32 Max, u32 Mix, u64* TSNext)
+{
+	u32 Pos = 0;
+	while (true)
+	{
+		u32 Length = fPacket_SynthSize(Mix);
+		if (Pos + sizeof(FMADPacket_t) + Length > Max) break;
+
+		u64 TS = *TSNext;
+		if ((rand() & 7) == 0) TS = (TS / 1000000000ULL + 1) * 1000000000ULL - (rand() % 512);
+		*TSNext = TS + 1 + rand() % 1000;
+
+		FMADPacket_t* FPkt 	= (FMADPacket_t*)(Data + Pos);
+		FPkt->TS			= TS;
+		FPkt->LengthCapture	= Length;
+		FPkt->LengthWire	= Length;
+		FPkt->PortNo		= rand() & 3;
+		FPkt->pad1			= 0;
+		FPkt->pad0			= 0;
+
+		fPacket_SynthFrame((u8*)(FPkt + 1), Length);
+
+		Pos += sizeof(FMADPacket_t) + Length;
+	}
+	return Pos;
+}
+
+// pcap reference of a fmad chunk using plain u64 division
+static void Bench_Reference(u8* PCAP, u8* FMAD, u32 Length, u32* Offset)
+{
+	memcpy(PCAP, FMAD, Length);
+
+	u32 PktCnt = fPacket_OffsetTable(FMAD, Length, Offset);
+	for (int i=0; i < PktCnt; i++)
+	{
+		FMADPacket_t* FPkt 	= (FMADPacket_t*)(FMAD + Offset[i]);
+		PCAPPacket_t* PPkt 	= (PCAPPacket_t*)(PCAP + Offset[i]);
+
+		PPkt->Sec			= FPkt->TS / 1000000000ULL;
+		PPkt->NSec			= FPkt->TS % 1000000000ULL;
+		PPkt->LengthCapture	= FPkt->LengthCapture;
+		PPkt->LengthWire	= FPkt->LengthWire;
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// checks every kernel against exact integer division and measures
+// packets per second for each packet size mix
+
+void fPacket_Bench(u32 ChunkCnt)
+{
+	CycleCalibration();
+
+	const char* MixStr[]	= { "64B", "imix", "uniform", "1514B" };
+	const char* KernelStr[]	= { "legacy", "scalar", "2pass", "2pass-avx512" };
+
+	u32 (*KernelList[])(u8* Data, u32 Length, u32* Offset) = { Bench_Legacy, Bench_Scalar, Bench_Table, Bench_AVX512 };
+
+	__builtin_cpu_init();
+	bool HasAVX512		= __builtin_cpu_supports("avx512f");
+
+	u8* FMAD			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u8* PCAP			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u8* Work			= memalign2(4096, FPACKET_CHUNK_MAX);
+	u32* Offset			= memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+
+	bool Pass			= true;
+	for (int Mix=0; Mix < 4; Mix++)
+	{
+		srand(Mix + 1);
+
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(FMAD, FPACKET_CHUNK_MAX, Mix, &TSNext);
+		Bench_Reference(PCAP, FMAD, Length, Offset);
+
+		for (int k=0; k < 4; k++)
+		{
+			if ((k == 3) && !HasAVX512) continue;
+
+			// correctness, count packets that differ from the reference
+			memcpy(Work, FMAD, Length);
+			u32 PktCnt = KernelList[k](Work, Length, Offset);
+
+			u32 ErrorCnt = 0;
+			fPacket_OffsetTable(FMAD, Length, Offset);
+			for (int i=0; i < PktCnt; i++)
+			{
+				u32 Pos = Offset[i];
+				u32 PktLength = sizeof(PCAPPacket_t) + ((PCAPPacket_t*)(PCAP + Pos))->LengthCapture;
+				if (memcmp(Work + Pos, PCAP + Pos, PktLength) != 0) ErrorCnt++;
+			}
+
+			// throughput, chunk is restored outside the timed region
+			u64 Cycles = 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				memcpy(Work, FMAD, Length);
+
+				u64 TSC0 = rdtsc();
+				KernelList[k](Work, Length, Offset);
+				Cycles += rdtsc() - TSC0;
+			}
+			double Pkts = (double)PktCnt * ChunkCnt;
+			double ns	= tsc2ns(Cycles);
+
+			fprintf(stderr, "Convert %-8s %-14s Pkts/Chunk:%6i %8.2f Mpps %6.2f ns/pkt Mismatch:%6i %s\n",
+					MixStr[Mix],
+					KernelStr[k],
+					PktCnt,
+					Pkts / ns * 1e3,
+					ns / Pkts,
+					ErrorCnt,
+					(k == 0) ? "" : (ErrorCnt == 0) ? "OK" : "FAIL");
+
+			if ((k != 0) && (ErrorCnt != 0)) Pass = false;
+		}
+	}
+
+	// slice + compact against a packet by packet reference
+	const u32 SnapList[]	= { 64, 128, 0 };
+	const char* SnapStr[]	= { "snap64", "snap128", "headers" };
+	u8* Ref					= memalign2(4096, FPACKET_CHUNK_MAX);
+	for (int Mix=0; Mix < 4; Mix++)
+	{
+		srand(Mix + 1);
+
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(FMAD, FPACKET_CHUNK_MAX, Mix, &TSNext);
+		Bench_Reference(PCAP, FMAD, Length, Offset);
+
+		for (int k=0; k < 3; k++)
+		{
+			u32 SnapLen		= SnapList[k];
+			bool Headers	= (SnapLen == 0);
+
+			u32 PktCnt		= fPacket_OffsetTable(PCAP, Length, Offset);
+			u32 RefLength	= 0;
+			for (int i=0; i < PktCnt; i++)
+			{
+				PCAPPacket_t* PPkt	= (PCAPPacket_t*)(PCAP + Offset[i]);
+				u32 Keep			= Headers ? fPacket_PayloadOffset((u8*)(PPkt + 1), PPkt->LengthCapture) : PPkt->LengthCapture;
+				if ((SnapLen != 0) && (Keep > SnapLen)) Keep = SnapLen;
+
+				memcpy(Ref + RefLength, PPkt, sizeof(PCAPPacket_t) + Keep);
+				((PCAPPacket_t*)(Ref + RefLength))->LengthCapture = Keep;
+				RefLength			+= sizeof(PCAPPacket_t) + Keep;
+			}
+
+			u64 Cycles		= 0;
+			u32 WorkLength	= 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				memcpy(Work, PCAP, Length);
+				fPacket_OffsetTable(Work, Length, Offset);
+
+				u64 TSC0 = rdtsc();
+				u32 Bytes		= fPacket_Slice(Work, Offset, PktCnt, SnapLen, Headers);
+				WorkLength		= fPacket_Compact(Work, Work, Offset, PktCnt);
+				Cycles 			+= rdtsc() - TSC0;
+
+				assert(Bytes == WorkLength);
+			}
+			bool Match		= (WorkLength == RefLength) && (memcmp(Work, Ref, RefLength) == 0);
+			double Pkts		= (double)PktCnt * ChunkCnt;
+			double ns		= tsc2ns(Cycles);
+
+			fprintf(stderr, "Slice   %-8s %-14s Pkts/Chunk:%6i %8.2f Mpps %6.2f ns/pkt Bytes %6i -> %6i %s\n",
+					MixStr[Mix],
+					SnapStr[k],
+					PktCnt,
+					Pkts / ns * 1e3,
+					ns / Pkts,
+					Length,
+					WorkLength,
+					Match ? "OK" : "FAIL");
+
+			if (!Match) Pass = false;
+		}
+	}
+	free(Ref);
+
+	// pcapng in place against the pcap reference, timed with the pcap convert 
+	u8* NG					= memalign2(4096, 2 * FPACKET_CHUNK_MAX);
+	u8* PortMap				= memalign2(64, FPACKET_PORTMAP_MAX);
+	u8* Port				= memalign2(64, FPACKET_OFFSET_MAX);
+	for (int Mix=0; Mix < 4; Mix++)
+	{
+		srand(Mix + 1);
+
+		u64 TSNext		= 1500000000123456789ULL;
+		u32 Length		= fPacket_SynthChunk(FMAD, FPACKET_CHUNK_MAX, Mix, &TSNext);
+		Bench_Reference(PCAP, FMAD, Length, Offset);
+
+		for (int k=0; k < 2; k++)
+		{
+			u32 Options		= (k == 1) ? FPACKET_PCAPNG_FLAGS : 0;
+			u64 Cycles		= 0;
+			u64 CyclesPCAP	= 0;
+			u32 PktCnt		= 0;
+			u32 NGLength	= 0;
+			for (int c=0; c < ChunkCnt; c++)
+			{
+				memcpy(NG, FMAD, Length);
+
+				u64 TSC0 = rdtsc();
+				PktCnt			= fPacket_OffsetTable(NG, Length, Offset);
+				fPacket_PortMap(NG, Offset, PktCnt, PortMap);
+				fPacket_FMAD2PCAPTable(NG, Offset, PktCnt);
+				for (int i=0; i < PktCnt; i++) Port[i] = PortMap[Offset[i] / sizeof(FMADPacket_t)];
+				fPacket_PCAPNGLayout(NG, Offset, PktCnt, Options, NULL, 0);
+				NGLength		= fPacket_PCAPNG(NG, Offset, PktCnt, Port, 4, Options);
+				Cycles			+= rdtsc() - TSC0;
+
+				memcpy(Work, FMAD, Length);
+
+				u64 TSC1 = rdtsc();
+				fPacket_FMAD2PCAP(Work, Length);
+				CyclesPCAP		+= rdtsc() - TSC1;
+			}
+
+			// walk the blocks against the reference packets and ports
+			u32 ErrorCnt	= 0;
+			u32 Pos			= 0;
+			u32 PosRef		= 0;
+			fPacket_OffsetTable(FMAD, Length, Offset);
+			for (int i=0; i < PktCnt; i++)
+			{
+				PCAPNGEPB_t* EPB	= (PCAPNGEPB_t*)(NG + Pos);
+				PCAPPacket_t* PPkt	= (PCAPPacket_t*)(PCAP + PosRef);
+				u64 TS				= PPkt->Sec * 1000000000ULL + PPkt->NSec;
+
+				bool OK = (EPB->Type == PCAPNG_BLOCK_EPB) &&
+						  (EPB->Interface == ((FMADPacket_t*)(FMAD + Offset[i]))->PortNo) &&
+						  ((((u64)EPB->TSHigh << 32) | EPB->TSLow) == TS) &&
+						  (EPB->LengthCapture == PPkt->LengthCapture) &&
+						  (EPB->LengthWire == PPkt->LengthWire) &&
+						  (memcmp(EPB + 1, PPkt + 1, PPkt->LengthCapture) == 0) &&
+						  (*(u32*)(NG + Pos + EPB->Length - 4) == EPB->Length);
+				if (!OK) ErrorCnt++;
+
+				Pos		+= EPB->Length;
+				PosRef	+= sizeof(PCAPPacket_t) + PPkt->LengthCapture;
+			}
+			if (Pos != NGLength) ErrorCnt++;
+
+			double Pkts		= (double)PktCnt * ChunkCnt;
+			double ns		= tsc2ns(Cycles);
+			double nsPCAP	= tsc2ns(CyclesPCAP);
+
+			fprintf(stderr, "PCAPNG  %-8s %-14s Pkts/Chunk:%6i %8.2f Mpps (pcap %8.2f Mpps) Bytes %6i -> %6i Mismatch:%6i %s\n",
+					MixStr[Mix],
+					(k == 1) ? "epb+flags" : "epb",
+					PktCnt,
+					Pkts / ns * 1e3,
+					Pkts / nsPCAP * 1e3,
+					Length,
+					NGLength,
+					ErrorCnt,
+					(ErrorCnt == 0) ? "OK" : "FAIL");
+
+			if (ErrorCnt != 0) Pass = false;
+		}
+	}
+	free(NG);
+	free(PortMap);
+	free(Port);
+
+	fprintf(stderr, "Convert %s\n", Pass ? "PASS" : "FAIL");
+
+	free(FMAD);
+	free(PCAP);
+	free(Work);
+	free(Offset);
+}
@@ -0,0 +1,132 @@
+#ifndef __F_PACKET_H__
+#define __F_PACKET_H__
+
+// packet formats and the fmad -> pcap header conversion kernels
+
+// standard PCAP header
+#define PCAPHEADER_MAGIC_NANO       0xa1b23c4d
+#define PCAPHEADER_MAGIC_USEC       0xa1b2c3d4
+#define PCAPHEADER_MAJOR            2
+#define PCAPHEADER_MINOR            4
+#define PCAPHEADER_LINK_ETHERNET    1
+
+typedef struct
+{
+
+	u32             Magic;
+	u16             Major;
+	u16             Minor;
+	u32             TimeZone;
+	u32             SigFlag;
+	u32             SnapLen;
+	u32             Link;
+
+} __attribute__((packed)) PCAPHeader_t;
+
+typedef struct PCAPPacket_t
+{
+	u32             Sec;                    // time stamp sec since epoch
+	u32             NSec;                   // nsec fraction since epoch
+
+	u32             LengthCapture;			// captured length
+	u32             LengthWire;				// Length on the wire
+
+} __attribute__((packed)) PCAPPacket_t;
+
+
+// pcapng, little endian section with a nanosecond interface per port
+#define PCAPNG_BLOCK_SHB			0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB			0x00000001
+#define PCAPNG_BLOCK_EPB			0x00000006
+#define PCAPNG_BYTE_ORDER			0x1A2B3C4D
+#define PCAPNG_MAJOR				1
+#define PCAPNG_MINOR				0
+
+#define PCAPNG_OPT_END				0
+#define PCAPNG_OPT_COMMENT			1
+#define PCAPNG_OPT_SHB_USERAPPL		4
+#define PCAPNG_OPT_IF_NAME			2
+#define PCAPNG_OPT_IF_TSRESOL		9
+#define PCAPNG_OPT_EPB_FLAGS		2
+
+typedef struct PCAPNGEPB_t
+{
+	u32				Type;					// PCAPNG_BLOCK_EPB
+	u32				Length;					// total block length, repeated at the end
+	u32				Interface;				// IDB index = capture port
+	u32				TSHigh;					// ns since epoch
+	u32				TSLow;
+	u32				LengthCapture;
+	u32				LengthWire;
+
+} __attribute__((packed)) PCAPNGEPB_t;
+
+// internal format thats on the tcp connection
+// contains some extra metadata
+typedef struct FMADPacket_t
+{
+	u64             TS;                     // 64bit nanosecond epoch
+
+	u32             LengthCapture	: 16;	// length captured
+	u32             LengthWire		: 16;   // Length on the wire
+
+	u32             PortNo			:  8;   // Port number
+	u32             pad1			:  8;   // flags
+	u32             pad0			: 16;
+
+} __attribute__((packed)) FMADPacket_t;
+
+//-------------------------------------------------------------------------------
+
+#define FPACKET_CHUNK_MAX		(256*1024)		// max payload bytes in a chunk
+
+// packet offset table entries for a full chunk of header-only packets,
+// plus padding so the batch kernel can always load a full vector of offsets
+#define FPACKET_OFFSET_MAX		(FPACKET_CHUNK_MAX / sizeof(FMADPacket_t) + 16)
+
+// per port split, PortNo is 8 bits and PortMap has an entry per 16B
+#define FPACKET_PORT_MAX		256
+#define FPACKET_PORTMAP_MAX		(FPACKET_CHUNK_MAX / sizeof(FMADPacket_t))
+
+// pcapng enhanced packet blocks
+#define FPACKET_PCAPNG_FLAGS	(1 << 0)		// epb_flags inbound on every packet
+#define FPACKET_PCAPNG_HEADER_MAX	(64*1024)	// SHB + IDBs
+
+// exact TS / 1e9 with a reciprocal multiply. same sequence gcc emits for a
+// u64 divide by 1e9, written out so the SIMD kernel matches it bit for bit
+#define FPACKET_NS_RECIP		0x0044B82FA09B5A53ULL
+#define FPACKET_NS_SHIFT		11
+
+static inline u64 fPacket_TSSec(u64 TS)
+{
+	return (u64)(((u128)(TS >> 9) * FPACKET_NS_RECIP) >> 64) >> FPACKET_NS_SHIFT;
+}
+
+u32			fPacket_FMAD2PCAP		(u8* Data, u32 Length);
+u32			fPacket_OffsetTable		(u8* Data, u32 Length, u32* Offset);
+void		fPacket_FMAD2PCAPTable	(u8* Data, u32* Offset, u32 PktCnt);
+u32			fPacket_FMAD2PCAPBatch	(u8* Data, u32 Length, u32* Offset);
+u32			fPacket_Slice			(u8* Data, u32* Offset, u32 PktCnt, u32 SnapLen, bool Headers);
+u32			fPacket_Compact			(u8* Dst, u8* Src, u32* Offset, u32 PktCnt);
+void		fPacket_PortMap			(u8* Data, u32* Offset, u32 PktCnt, u8* PortMap);
+u32			fPacket_CompactPort		(u8* Dst, u8* Src, u32* Offset, u32 PktCnt, u8* PortMap, u8* PortList, u32* PortLength);
+u32			fPacket_PCAPNGHeader	(u8* Dst, u32 PortCnt, u32 SnapLen, char* Comment);
+u32			fPacket_PCAPNGLayout	(u8* Data, u32* Offset, u32 PktCnt, u32 Options, u32* Split, u32 SplitCnt);
+u32			fPacket_PCAPNG			(u8* Data, u32* Offset, u32 PktCnt, u8* Port, u32 PortCnt, u32 Options);
+u32			fPacket_PayloadOffset	(u8* Frame, u32 Length);
+u32			fPacket_TrimTime		(u8* Data, u32* Offset, u32 PktCnt, u64 TSFrom, u64 TSTo, u32* KeepByte);
+u32			fPacket_SplitTime		(u8* Data, u32* Offset, u32 PktCnt, u64 PeriodNS, u64* PeriodFirst, u64* PeriodLast, u32* Split, u32 SplitMax);
+
+// synthetic traffic
+#define FPACKET_MIX_64			0			// 64B frames
+#define FPACKET_MIX_IMIX		1			// 64/576/1500 at 7:4:1
+#define FPACKET_MIX_UNIFORM		2			// uniform 60-1514
+#define FPACKET_MIX_1514		3			// 1514B frames
+
+u32			fPacket_SynthSize		(u32 Mix);
+void		fPacket_SynthFrame		(u8* Frame, u32 Length);
+u32			fPacket_SynthChunk		(u8* Data, u32 Max, u32 Mix, u64* TSNext);
+
+void		fPacket_Bench			(u32 ChunkCnt);
+
+#endif
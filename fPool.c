@@ -0,0 +1,486 @@
+//-----------------------------------------------------------------------------------------------
+//
+// fmadio fixed size object pool with per thread magazines
+//
+// Copyright fmad enginering inc 2018 all rights reserved
+//
+// BSD License
+//
+//-------------------------------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "fTypes.h"
+#include "fPool.h"
+
+//-----------------------------------------------------------------------------------------------
+// thread ids index the magazines. ids are recycled on thread exit, the
+// next thread with the same id inherits whatever is left in the magazine
+
+static pthread_once_t		s_ThreadKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t		s_ThreadKey;
+static volatile u64			s_ThreadIDUsed	= 0;		// bitmap of ids in use
+static __thread s32			s_ThreadID		= -1;
+
+static void fPool_ThreadExit(void* User)
+{
+	u32 ID = (u32)(u64)User - 1;
+	__sync_fetch_and_and(&s_ThreadIDUsed, ~(1ULL << ID));
+}
+
+static void fPool_ThreadKeyInit(void)
+{
+	pthread_key_create(&s_ThreadKey, fPool_ThreadExit);
+}
+
+static inline fPoolMag_t* fPool_Mag(fPool_t* P)
+{
+	if (s_ThreadID >= 0) return &P->Mag[s_ThreadID];
+
+	// first pool op on this thread, claim the lowest free id
+	pthread_once(&s_ThreadKeyOnce, fPool_ThreadKeyInit);
+	while (true)
+	{
+		u64 Used = s_ThreadIDUsed;
+		if (Used == ~0ULL) return NULL;
+
+		u32 ID = __builtin_ctzll(~Used);
+		if (__sync_bool_compare_and_swap(&s_ThreadIDUsed, Used, Used | (1ULL << ID)))
+		{
+			s_ThreadID = ID;
+			pthread_setspecific(s_ThreadKey, (void*)(u64)(ID + 1));
+			return &P->Mag[s_ThreadID];
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+
+static inline u32 fPool_Index(fPool_t* P, void* Obj)
+{
+	return ((u8*)Obj - P->Base) / P->Stride;
+}
+
+static inline void* fPool_Obj(fPool_t* P, u32 Index)
+{
+	return P->Base + Index * P->Stride;
+}
+
+//-----------------------------------------------------------------------------------------------
+// pop up to Max objects off the shared stack in a single CAS
+static u32 fPool_StackPop(fPool_t* P, void** List, u32 Max)
+{
+	while (true)
+	{
+		u64 Head	= P->Head;
+		u32 Top		= (u32)Head;
+		if (Top == 0) return 0;
+
+		// walk the links, objects are never unmapped so reading a link thats
+		// concurrently being popped is safe. the tag fails the CAS if it changed
+		u32 Cnt		= 0;
+		u32 Last	= Top;
+		List[Cnt++]	= fPool_Obj(P, Last - 1);
+		while (Cnt < Max)
+		{
+			u32 Next = P->Next[Last - 1];
+			if (Next == 0) break;
+
+			Last		= Next;
+			List[Cnt++]	= fPool_Obj(P, Last - 1);
+		}
+
+		u64 HeadNew	= ((Head + (1ULL << 32)) & 0xffffffff00000000ULL) | P->Next[Last - 1];
+		if (__sync_bool_compare_and_swap(&P->Head, Head, HeadNew))
+		{
+			__sync_fetch_and_sub(&P->StackCnt, Cnt);
+			return Cnt;
+		}
+		__sync_fetch_and_add(&P->StatCASRetry, 1);
+		__asm__ volatile("pause");
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+// push a batch of objects onto the shared stack in a single CAS
+static void fPool_StackPush(fPool_t* P, void** List, u32 Cnt)
+{
+	// link the batch together
+	for (int i=0; i < Cnt - 1; i++)
+	{
+		P->Next[ fPool_Index(P, List[i]) ] = fPool_Index(P, List[i + 1]) + 1;
+	}
+	u32 First	= fPool_Index(P, List[0]) + 1;
+	u32 Last	= fPool_Index(P, List[Cnt - 1]);
+
+	__sync_fetch_and_add(&P->StackCnt, Cnt);
+	while (true)
+	{
+		u64 Head		= P->Head;
+		P->Next[Last]	= (u32)Head;
+
+		u64 HeadNew		= ((Head + (1ULL << 32)) & 0xffffffff00000000ULL) | First;
+		if (__sync_bool_compare_and_swap(&P->Head, Head, HeadNew)) break;
+
+		__sync_fetch_and_add(&P->StatCASRetry, 1);
+		__asm__ volatile("pause");
+	}
+}
+
+//-----------------------------------------------------------------------------------------------
+
+fPool_t* fPool_Create(u32 ObjMax, u64 ObjSize, u32 Align, u32 MagSize)
+{
+	fPool_t* P = memalign2(128, sizeof(fPool_t));
+	assert(P != NULL);
+	memset(P, 0, sizeof(fPool_t));
+
+	P->ObjMax	= ObjMax;
+	P->Stride	= (ObjSize + Align - 1) & ~((u64)Align - 1);
+	P->MagSize	= (MagSize > FPOOL_MAG_MAX) ? FPOOL_MAG_MAX : MagSize;
+	P->MagSize	= (P->MagSize < 2) ? 2 : P->MagSize;
+
+	P->Base		= memalign2(Align, P->Stride * ObjMax);
+	assert(P->Base != NULL);
+
+	P->Next		= malloc(ObjMax * sizeof(u32));
+	assert(P->Next != NULL);
+
+	// everything starts on the shared stack
+	for (int i=0; i < ObjMax; i++)
+	{
+		P->Next[i] = (i + 1 < ObjMax) ? i + 2 : 0;
+	}
+	P->Head		= (ObjMax > 0) ? 1 : 0;
+	P->StackCnt	= ObjMax;
+
+	return P;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fPool_Destroy(fPool_t* P)
+{
+	free((void*)P->Next);
+	free(P->Base);
+	free(P);
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void* fPool_Alloc(fPool_t* P)
+{
+	fPoolMag_t* M = fPool_Mag(P);
+	if (M == NULL)
+	{
+		void* Obj = NULL;
+		fPool_StackPop(P, &Obj, 1);
+
+		__sync_fetch_and_add(&P->StatDirect, 1);
+		return Obj;
+	}
+
+	// refill half a magazine
+	if (M->Cnt == 0)
+	{
+		M->Cnt = fPool_StackPop(P, M->List, P->MagSize / 2);
+		M->StatRefill++;
+		if (M->Cnt == 0)
+		{
+			M->StatEmpty++;
+			return NULL;
+		}
+	}
+
+	M->StatAlloc++;
+	return M->List[--M->Cnt];
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fPool_Free(fPool_t* P, void* Obj)
+{
+	fPoolMag_t* M = fPool_Mag(P);
+	if (M == NULL)
+	{
+		fPool_StackPush(P, &Obj, 1);
+
+		__sync_fetch_and_add(&P->StatDirect, 1);
+		return;
+	}
+
+	// spill half the magazine
+	if (M->Cnt == P->MagSize)
+	{
+		u32 Spill = P->MagSize / 2;
+		fPool_StackPush(P, M->List + M->Cnt - Spill, Spill);
+
+		M->Cnt -= Spill;
+		M->StatSpill++;
+	}
+
+	M->StatFree++;
+	M->List[M->Cnt++] = Obj;
+}
+
+//-----------------------------------------------------------------------------------------------
+// return the calling threads magazine to the shared stack e.g. before it exits
+void fPool_ThreadFlush(fPool_t* P)
+{
+	fPoolMag_t* M = fPool_Mag(P);
+	if ((M == NULL) || (M->Cnt == 0)) return;
+
+	fPool_StackPush(P, M->List, M->Cnt);
+	M->Cnt = 0;
+}
+
+//-----------------------------------------------------------------------------------------------
+// number of free objects, approximate while the pool is in use
+u32 fPool_FreeCnt(fPool_t* P)
+{
+	s64 Cnt = P->StackCnt;
+	for (int i=0; i < FPOOL_THREAD_MAX; i++)
+	{
+		Cnt += P->Mag[i].Cnt;
+	}
+	return (Cnt < 0) ? 0 : Cnt;
+}
+
+//-----------------------------------------------------------------------------------------------
+
+void fPool_Dump(fPool_t* P, char* Desc)
+{
+	u64 Alloc	= 0;
+	u64 Free	= 0;
+	u64 Refill	= 0;
+	u64 Spill	= 0;
+	u64 Empty	= 0;
+	for (int i=0; i < FPOOL_THREAD_MAX; i++)
+	{
+		Alloc	+= P->Mag[i].StatAlloc;
+		Free	+= P->Mag[i].StatFree;
+		Refill	+= P->Mag[i].StatRefill;
+		Spill	+= P->Mag[i].StatSpill;
+		Empty	+= P->Mag[i].StatEmpty;
+	}
+
+	fprintf(stderr, "Pool %-8s Obj:%i Free:%i Stack:%lli | Alloc:%lli Free:%lli Refill:%lli Spill:%lli Empty:%lli Direct:%lli CASRetry:%lli\n",
+			Desc,
+			P->ObjMax,
+			fPool_FreeCnt(P),
+			P->StackCnt,
+			Alloc,
+			Free,
+			Refill,
+			Spill,
+			Empty,
+			P->StatDirect,
+			P->StatCASRetry);
+}
+
+//-----------------------------------------------------------------------------------------------
+//
+// micro benchmark vs a single spinlock free list
+//
+//-----------------------------------------------------------------------------------------------
+
+#define BENCH_OBJ_MAX			4096
+#define BENCH_RING_MAX			256
+
+typedef struct BenchObj_t
+{
+	struct BenchObj_t*	NextFree;
+	u8					pad[128 - 8];
+
+} BenchObj_t;
+
+typedef struct BenchRing_t
+{
+	volatile u64		Put;
+	u8					pad0[128 - 8];
+	volatile u64		Get;
+	u8					pad1[128 - 8];
+	void*				Entry[BENCH_RING_MAX];
+
+} BenchRing_t;
+
+typedef struct BenchThread_t
+{
+	pthread_t			Thread;
+	u32					Mode;						// 0 = spinlock, 1 = fPool
+	u32					Pattern;					// 0 = local alloc/free, 1 = handoff to consumer
+	u64					OpCnt;						// alloc + free pairs to run
+	u64					OpDone;						// pairs actually run, rounded up to the batch
+	u32					RingCnt;					// consumer, rings to drain
+	BenchRing_t*		Ring;						// handoff ring to the consumer
+
+} BenchThread_t;
+
+static volatile u32			s_BenchLock[128/4];
+static BenchObj_t*			s_BenchFree		= NULL;
+static fPool_t*				s_BenchPool		= NULL;
+static volatile u32			s_BenchProducerCnt = 0;
+
+static void* Bench_Alloc(u32 Mode)
+{
+	if (Mode == 1) return fPool_Alloc(s_BenchPool);
+
+	sync_lock((u32*)&s_BenchLock[0], 100);
+	BenchObj_t* O = s_BenchFree;
+	if (O != NULL) s_BenchFree = O->NextFree;
+	sync_unlock((u32*)&s_BenchLock[0]);
+
+	return O;
+}
+
+static void Bench_Free(u32 Mode, void* Obj)
+{
+	if (Mode == 1) { fPool_Free(s_BenchPool, Obj); return; }
+
+	BenchObj_t* O = (BenchObj_t*)Obj;
+	sync_lock((u32*)&s_BenchLock[0], 100);
+	O->NextFree = s_BenchFree;
+	s_BenchFree = O;
+	sync_unlock((u32*)&s_BenchLock[0]);
+}
+
+static void* Bench_Producer(void* User)
+{
+	BenchThread_t* T = (BenchThread_t*)User;
+
+	void* List[8];
+	u64 OpDone = 0;
+	for (u64 i=0; i < T->OpCnt; i += 8)
+	{
+		OpDone += 8;
+		for (int j=0; j < 8; j++)
+		{
+			while ((List[j] = Bench_Alloc(T->Mode)) == NULL) usleep(0);
+		}
+
+		// local churn, free straight back
+		if (T->Pattern == 0)
+		{
+			for (int j=0; j < 8; j++) Bench_Free(T->Mode, List[j]);
+			continue;
+		}
+
+		// handoff to the consumer like RxThread -> reorder thread
+		for (int j=0; j < 8; j++)
+		{
+			while (T->Ring->Put - T->Ring->Get >= BENCH_RING_MAX) usleep(0);
+			T->Ring->Entry[T->Ring->Put % BENCH_RING_MAX] = List[j];
+			sfence();
+			T->Ring->Put++;
+		}
+	}
+	if (T->Mode == 1) fPool_ThreadFlush(s_BenchPool);
+	T->OpDone = OpDone;
+	__sync_fetch_and_sub(&s_BenchProducerCnt, 1);
+
+	return NULL;
+}
+
+static void* Bench_Consumer(void* User)
+{
+	BenchThread_t* T = (BenchThread_t*)User;
+
+	while (true)
+	{
+		bool Idle = true;
+		for (int i=0; i < T->RingCnt; i++)
+		{
+			BenchRing_t* R = &T->Ring[i];
+			while (R->Get != R->Put)
+			{
+				Bench_Free(T->Mode, R->Entry[R->Get % BENCH_RING_MAX]);
+				R->Get++;
+				Idle = false;
+			}
+		}
+		if (Idle && (s_BenchProducerCnt == 0)) break;
+		if (Idle) usleep(0);
+	}
+	if (T->Mode == 1) fPool_ThreadFlush(s_BenchPool);
+
+	return NULL;
+}
+
+void fPool_Bench(u32 ThreadCnt, u64 OpCnt)
+{
+	CycleCalibration();
+
+	const char* ModeStr[]		= { "spinlock", "fPool" };
+	const char* PatternStr[]	= { "local", "handoff" };
+
+	BenchObj_t* ObjList			= memalign2(128, BENCH_OBJ_MAX * sizeof(BenchObj_t));
+	BenchRing_t* RingList		= memalign2(128, ThreadCnt * sizeof(BenchRing_t));
+	BenchThread_t* ThreadList	= malloc((ThreadCnt + 1) * sizeof(BenchThread_t));
+
+	for (int Pattern=0; Pattern < 2; Pattern++)
+	{
+		for (int Mode=0; Mode < 2; Mode++)
+		{
+			// reset allocators
+			s_BenchFree = NULL;
+			for (int i=0; i < BENCH_OBJ_MAX; i++)
+			{
+				ObjList[i].NextFree = s_BenchFree;
+				s_BenchFree = &ObjList[i];
+			}
+			s_BenchPool = fPool_Create(BENCH_OBJ_MAX, sizeof(BenchObj_t), 128, 64);
+			memset(RingList, 0, ThreadCnt * sizeof(BenchRing_t));
+
+			s_BenchProducerCnt = ThreadCnt;
+
+			u64 TS0 = clock_ns();
+			for (int t=0; t < ThreadCnt; t++)
+			{
+				BenchThread_t* T = &ThreadList[t];
+				T->Mode		= Mode;
+				T->Pattern	= Pattern;
+				T->OpCnt	= OpCnt;
+				T->Ring		= &RingList[t];
+				pthread_create(&T->Thread, NULL, Bench_Producer, T);
+			}
+
+			BenchThread_t* C = &ThreadList[ThreadCnt];
+			if (Pattern == 1)
+			{
+				C->Mode		= Mode;
+				C->RingCnt	= ThreadCnt;
+				C->Ring		= RingList;
+				pthread_create(&C->Thread, NULL, Bench_Consumer, C);
+			}
+
+			for (int t=0; t < ThreadCnt; t++) pthread_join(ThreadList[t].Thread, NULL);
+			if (Pattern == 1) pthread_join(C->Thread, NULL);
+			u64 TS1 = clock_ns();
+
+			// alloc + free pairs per second
+			double Ops = 0;
+			for (int t=0; t < ThreadCnt; t++) Ops += ThreadList[t].OpDone;
+
+			fprintf(stderr, "Bench %-8s %-8s Threads:%2i %8.3f Mops/sec %8.2f ns/op\n",
+					PatternStr[Pattern],
+					ModeStr[Mode],
+					ThreadCnt,
+					Ops / (TS1 - TS0) * 1e3,
+					(TS1 - TS0) / Ops);
+
+			if (Mode == 1) fPool_Dump(s_BenchPool, "bench");
+			fPool_Destroy(s_BenchPool);
+			s_BenchPool = NULL;
+		}
+	}
+
+	free(ThreadList);
+	free(RingList);
+	free(ObjList);
+}
@@ -0,0 +1,61 @@
+#ifndef __F_POOL_H__
+#define __F_POOL_H__
+
+// fixed size object pool
+//
+// each thread allocates/frees from its own magazine of free objects, the
+// magazines refill/spill in batches from a shared lock-free stack. stack
+// links are object indices with a 32bit tag in the head word to stop ABA
+
+#define FPOOL_THREAD_MAX		64			// max threads with a magazine, others go direct to the stack
+#define FPOOL_MAG_MAX			256			// max magazine size
+
+typedef struct fPoolMag_t
+{
+	u32					Cnt;						// objects in the magazine
+	u32					pad0;
+	void*				List[FPOOL_MAG_MAX];
+
+	u64					StatAlloc;					// allocs serviced by this magazine
+	u64					StatFree;					// frees serviced by this magazine
+	u64					StatRefill;					// batch pops from the shared stack
+	u64					StatSpill;					// batch pushes to the shared stack
+	u64					StatEmpty;					// allocs that found the pool empty
+
+} __attribute__((aligned(128))) fPoolMag_t;
+
+typedef struct fPool_t
+{
+	u8*					Base;						// object memory
+	u64					Stride;						// bytes per object
+	u32					ObjMax;						// total number of objects
+	u32					MagSize;					// per thread magazine capacity
+	volatile u32*		Next;						// free stack link per object (index + 1, 0 = end)
+
+	volatile u64		Head __attribute__((aligned(128)));	// tag:32 | top index + 1:32
+	u8					pad0[128 - 8];
+
+	volatile s64		StackCnt;					// objects on the shared stack
+	volatile u64		StatCASRetry;				// failed CAS on the stack head
+	volatile u64		StatDirect;					// ops from threads without a magazine
+	u8					pad1[128 - 24];
+
+	fPoolMag_t			Mag[FPOOL_THREAD_MAX];		// indexed by fPool thread id
+
+} fPool_t;
+
+//-------------------------------------------------------------------------------
+
+fPool_t*	fPool_Create(u32 ObjMax, u64 ObjSize, u32 Align, u32 MagSize);
+void		fPool_Destroy(fPool_t* P);
+
+void*		fPool_Alloc(fPool_t* P);
+void		fPool_Free(fPool_t* P, void* Obj);
+void		fPool_ThreadFlush(fPool_t* P);
+
+u32			fPool_FreeCnt(fPool_t* P);
+void		fPool_Dump(fPool_t* P, char* Desc);
+
+void		fPool_Bench(u32 ThreadCnt, u64 OpCnt);
+
+#endif
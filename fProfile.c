@@ -1,8 +1,8 @@
 //---------------------------------------------------------------------------------------------
 //
-// Copyright (c) 2015, fmad engineering llc 
+// Copyright (c) 2015, fmad engineering llc
 //
-// quick and dirty profiling 
+// quick and dirty profiling, per thread slots merged by thread name
 //
 //---------------------------------------------------------------------------------------------
 
@@ -12,6 +12,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/shm.h>
@@ -19,33 +20,256 @@
 #include "fTypes.h"
 #include "fProfile.h"
 
+bool						g_ProfileEnable		= false;
+__thread fProfileThread_t*	g_ProfileThread		= NULL;
 
-u64 g_ProfileStart[32];
-u64 g_ProfileStop[32];
-u64 g_ProfileTotal[32];
-char* g_ProfileDesc[32];
+static fProfileThread_t		s_ProfileThread[FPROFILE_THREAD_MAX];
+static u32					s_ProfileThreadCnt	= 0;
+static pthread_mutex_t		s_ProfileLock		= PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t		s_ThreadKeyOnce		= PTHREAD_ONCE_INIT;
+static pthread_key_t		s_ThreadKey;
+
+//---------------------------------------------------------------------------------------------
+
+static void fProfile_SlotReset(fProfileThread_t* T)
+{
+	for (int i=0; i < FPROFILE_SLOT_MAX; i++)
+	{
+		fProfileSlot_t* S = &T->Slot[i];
+		S->Total	= 0;
+		S->Child	= 0;
+		S->Count	= 0;
+		S->Min		= (u64)-1;
+		S->Max		= 0;
+	}
+}
+
+// block is kept for the dump, the next thread with the same name picks it up
+static void fProfile_ThreadExit(void* User)
+{
+	fProfileThread_t* T = (fProfileThread_t*)User;
+	T->InUse = false;
+}
+
+static void fProfile_ThreadKeyInit(void)
+{
+	pthread_key_create(&s_ThreadKey, fProfile_ThreadExit);
+}
+
+//---------------------------------------------------------------------------------------------
+// start profiling the calling thread, no-op unless profiling is enabled
+
+void fProfile_ThreadInit(char* Name)
+{
+	if (!g_ProfileEnable) return;
+	if (g_ProfileThread != NULL) return;
+
+	pthread_once(&s_ThreadKeyOnce, fProfile_ThreadKeyInit);
+
+	pthread_mutex_lock(&s_ProfileLock);
+
+	// reuse a released block of the same name
+	fProfileThread_t* T = NULL;
+	for (int i=0; i < s_ProfileThreadCnt; i++)
+	{
+		fProfileThread_t* B = &s_ProfileThread[i];
+		if (B->InUse) continue;
+		if (strcmp(B->Name, Name) != 0) continue;
+
+		T = B;
+		break;
+	}
+	if ((T == NULL) && (s_ProfileThreadCnt < FPROFILE_THREAD_MAX))
+	{
+		T = &s_ProfileThread[s_ProfileThreadCnt++];
+		strncpy(T->Name, Name, sizeof(T->Name) - 1);
+		fProfile_SlotReset(T);
+	}
+	if (T != NULL)
+	{
+		T->InUse	= true;
+		T->Depth	= 0;
+	}
+
+	pthread_mutex_unlock(&s_ProfileLock);
+
+	if (T == NULL)
+	{
+		fprintf(stderr, "fProfile: no free thread block for [%s]\n", Name);
+		return;
+	}
+
+	g_ProfileThread = T;
+	pthread_setspecific(s_ThreadKey, T);
+}
+
+//---------------------------------------------------------------------------------------------
+// clear all counts. only exact when the profiled threads are idle
 
 void fProfile_Reset(void)
 {
-	for (int i=0; i < 16; i++)
+	pthread_mutex_lock(&s_ProfileLock);
+	for (int i=0; i < s_ProfileThreadCnt; i++)
+	{
+		fProfile_SlotReset(&s_ProfileThread[i]);
+	}
+	pthread_mutex_unlock(&s_ProfileLock);
+}
+
+//---------------------------------------------------------------------------------------------
+// merged dump, blocks with the same thread name are summed and printed as
+// a tree of slots
+
+typedef struct
+{
+	u64				Total;
+	u64				Child;
+	u64				Count;
+	u64				Min;
+	u64				Max;
+	char*			Desc;
+	u8				Parent;
+
+} ProfileMerge_t;
+
+static void fProfile_DumpSlot(ProfileMerge_t* M, u32 Index, u32 Depth, u64 ParentTotal)
+{
+	ProfileMerge_t* S = &M[Index];
+
+	char Name[64];
+	sprintf(Name, "%*s%s", Depth * 2, "", S->Desc ? S->Desc : "");
+
+	fprintf(stderr, "    [%2i] %-32s %12lli calls %10.3f ms %10.3f self %10.1f avg %10.1f min %12.1f max ns : (%.4f)\n",
+			Index,
+			Name,
+			S->Count,
+			tsc2ns(S->Total) / 1e6,
+			tsc2ns(S->Total - S->Child) / 1e6,
+			tsc2ns(S->Total) / (double)S->Count,
+			(double)tsc2ns(S->Min),
+			(double)tsc2ns(S->Max),
+			S->Total * inverse(ParentTotal));
+
+	if (Depth + 1 >= FPROFILE_DEPTH_MAX) return;
+	for (int i=0; i < FPROFILE_SLOT_MAX; i++)
 	{
-		g_ProfileStart	[i] = 0;
-		g_ProfileStop	[i] = 0;
-		g_ProfileTotal	[i] = 0;
+		if (M[i].Count == 0) continue;
+		if (M[i].Parent != Index) continue;
+		if (i == Index) continue;
+
+		fProfile_DumpSlot(M, i, Depth + 1, S->Total);
 	}
 }
 
-void fProfile_Dump(u32 Index)
+void fProfile_Dump(void)
 {
-	double oot = 1.0 / g_ProfileTotal[Index];
-	for (int i=0; i < 16; i++)
+	pthread_mutex_lock(&s_ProfileLock);
+
+	bool Done[FPROFILE_THREAD_MAX];
+	memset(Done, 0, sizeof(Done));
+
+	for (int t=0; t < s_ProfileThreadCnt; t++)
 	{
-		printf("    [%2i] %016llx %20lli : (%.4f) : %s\n", 
-				i,
-				g_ProfileTotal[i],
-				g_ProfileTotal[i],
-				g_ProfileTotal[i] * oot,
-				g_ProfileDesc[i]);
+		if (Done[t]) continue;
+		fProfileThread_t* T = &s_ProfileThread[t];
+
+		// sum every block of this name
+		ProfileMerge_t M[FPROFILE_SLOT_MAX];
+		memset(M, 0, sizeof(M));
+		for (int i=0; i < FPROFILE_SLOT_MAX; i++) M[i].Min = (u64)-1;
+
+		u32 BlockCnt = 0;
+		for (int b=t; b < s_ProfileThreadCnt; b++)
+		{
+			fProfileThread_t* B = &s_ProfileThread[b];
+			if (strcmp(B->Name, T->Name) != 0) continue;
+
+			Done[b] = true;
+			BlockCnt++;
+			for (int i=0; i < FPROFILE_SLOT_MAX; i++)
+			{
+				fProfileSlot_t* S = &B->Slot[i];
+				if (S->Count == 0) continue;
+
+				if (M[i].Count == 0)
+				{
+					M[i].Desc	= S->Desc;
+					M[i].Parent	= S->Parent;
+				}
+				M[i].Total		+= S->Total;
+				M[i].Child		+= S->Child;
+				M[i].Count		+= S->Count;
+				M[i].Min		= (S->Min < M[i].Min) ? S->Min : M[i].Min;
+				M[i].Max		= (S->Max > M[i].Max) ? S->Max : M[i].Max;
+			}
+		}
+
+		// a slot whose parent never completed is shown at the top level
+		u64 RootTotal = 0;
+		for (int i=0; i < FPROFILE_SLOT_MAX; i++)
+		{
+			if (M[i].Count == 0) continue;
+			if ((M[i].Parent != FPROFILE_ROOT) && (M[ M[i].Parent ].Count == 0)) M[i].Parent = FPROFILE_ROOT;
+			if (M[i].Parent == FPROFILE_ROOT) RootTotal += M[i].Total;
+		}
+		if (RootTotal == 0) continue;
+
+		fprintf(stderr, "  Profile Thread [%s] x%i\n", T->Name, BlockCnt);
+		for (int i=0; i < FPROFILE_SLOT_MAX; i++)
+		{
+			if (M[i].Count == 0) continue;
+			if (M[i].Parent != FPROFILE_ROOT) continue;
+
+			fProfile_DumpSlot(M, i, 0, RootTotal);
+		}
+	}
+
+	pthread_mutex_unlock(&s_ProfileLock);
+}
+
+//---------------------------------------------------------------------------------------------
+// cost of a Start/Stop pair, profiled and unregistered
+
+void fProfile_Bench(u32 LoopCnt)
+{
+	CycleCalibration();
+
+	bool Enable		= g_ProfileEnable;
+	g_ProfileEnable	= true;
+
+	for (int Mode=0; Mode < 2; Mode++)
+	{
+		fProfileThread_t* T = g_ProfileThread;
+		if (Mode == 0)	g_ProfileThread = NULL;
+		else			fProfile_ThreadInit("bench");
+
+		// clobber forces g_ProfileThread to be reloaded per call like real
+		// code between Start/Stop would, and the sink keeps the loop alive
+		volatile u64 Sink = 0;
+
+		u64 TS0 = clock_ns();
+		for (int i=0; i < LoopCnt; i++)
+		{
+			fProfile_Start(0, "outer");
+			for (int j=0; j < 4; j++)
+			{
+				fProfile_Start(1, "inner");
+				__asm__ volatile("" ::: "memory");
+				fProfile_Stop(1);
+			}
+			fProfile_Stop(0);
+			Sink += fProfile_Cycles(0);
+		}
+		u64 TS1 = clock_ns();
+
+		if (Mode == 0) g_ProfileThread = T;
+
+		fprintf(stderr, "Bench Profile %-8s %8.2f ns per Start/Stop pair\n",
+				(Mode == 0) ? "off" : "on",
+				(TS1 - TS0) / (LoopCnt * 5.0));
 	}
-	fProfile_Reset();
+	fProfile_Dump();
+
+	g_ProfileEnable = Enable;
 }
@@ -1,30 +1,96 @@
 #ifndef __FMAD_COMMON_PROFILE_H__
 #define __FMAD_COMMON_PROFILE_H__
 
-extern u64 g_ProfileStart[32];
-extern u64 g_ProfileStop[32];
-extern u64 g_ProfileTotal[32];
-extern char* g_ProfileDesc[32];
+// per thread hierarchical profiler
+//
+// each thread that calls fProfile_ThreadInit() gets its own cache line
+// padded block of slots, so Start/Stop never share a line with another
+// thread. slots nest, a slot remembers the slot it was first entered from
+// and its time is also charged to that parent as child time. a thread that
+// never registered (or profiling off) costs one branch per Start/Stop.
+// blocks are released on thread exit and reused by the next thread with
+// the same name, so short lived threads accumulate into one block
+
+#define FPROFILE_SLOT_MAX		32				// slots per thread
+#define FPROFILE_THREAD_MAX		128				// registered thread blocks
+#define FPROFILE_DEPTH_MAX		16				// nesting depth
+#define FPROFILE_ROOT			0xff			// parent of a top level slot
+
+typedef struct fProfileSlot_t
+{
+	u64				Start;						// TSC at the last Start
+	u64				Total;						// cycles inside, including children
+	u64				Child;						// cycles inside nested slots
+	u64				Count;						// completed Start/Stop pairs
+	u64				Min;
+	u64				Max;
+	char*			Desc;
+	u8				Parent;						// slot it was first entered from
+
+} __attribute__((aligned(64))) fProfileSlot_t;
+
+typedef struct fProfileThread_t
+{
+	char			Name[32];
+	volatile bool	InUse;						// owning thread is alive
+	u32				Depth;
+	u8				Stack[FPROFILE_DEPTH_MAX];
+
+	fProfileSlot_t	Slot[FPROFILE_SLOT_MAX];
+
+} __attribute__((aligned(64))) fProfileThread_t;
+
+extern bool						g_ProfileEnable;
+extern __thread fProfileThread_t*	g_ProfileThread;
 
 //---------------------------------------------------------------------------------------------
 
+void fProfile_ThreadInit(char* Name);
 void fProfile_Reset(void);
-void fProfile_Dump(u32 Index);
+void fProfile_Dump(void);
+void fProfile_Bench(u32 LoopCnt);
 
+// Start/Stop pairs must nest on a thread
 static inline void fProfile_Start(u32 Index, char* Desc)
 {
-	g_ProfileStart[Index] = rdtsc();
-	g_ProfileDesc[Index] = Desc; 
+	fProfileThread_t* T = g_ProfileThread;
+	if (T == NULL) return;
+
+	fProfileSlot_t* S = &T->Slot[Index];
+	if (S->Count == 0)
+	{
+		S->Desc		= Desc;
+		S->Parent	= (T->Depth > 0) ? T->Stack[T->Depth - 1] : FPROFILE_ROOT;
+	}
+	assert(T->Depth < FPROFILE_DEPTH_MAX);
+	T->Stack[T->Depth++] = Index;
+
+	S->Start = rdtsc();
 }
 
 static inline void fProfile_Stop(u32 Index)
 {
-	g_ProfileTotal[Index] += rdtsc() - g_ProfileStart[Index];
+	fProfileThread_t* T = g_ProfileThread;
+	if (T == NULL) return;
+
+	fProfileSlot_t* S = &T->Slot[Index];
+	u64 Cycles	= rdtsc() - S->Start;
+
+	S->Total	+= Cycles;
+	S->Count	+= 1;
+	S->Min		= (Cycles < S->Min) ? Cycles : S->Min;
+	S->Max		= (Cycles > S->Max) ? Cycles : S->Max;
+
+	T->Depth--;
+	if (T->Depth > 0) T->Slot[ T->Stack[T->Depth - 1] ].Child += Cycles;
 }
 
 static inline u64 fProfile_Cycles(u32 Index)
 {
-	return g_ProfileTotal[Index];
+	fProfileThread_t* T = g_ProfileThread;
+	if (T == NULL) return 0;
+
+	return T->Slot[Index].Total;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+#ifndef __F_PROTOCOL_H__
+#define __F_PROTOCOL_H__
+
+// capture device protocol. one control connection for commands, the
+// capture is then streamed as sequence numbered chunks spread over
+// PROTOCOL_PORT_DATA + N parallel data connections
+
+#define PROTOCOL_PORT_CMD				10000	// control connection
+#define PROTOCOL_PORT_DATA				10010	// first data connection
+
+// packet header from the capture system
+#define PACKETHEADER_FLAG_EOF			(1<<0)	// end of capture
+#define PACKETHEADER_FLAG_LZ4			(1<<1)	// payload is an LZ4 block of XferLength bytes, DataLength decoded
+typedef struct
+{
+	u32                 SeqNo;              // chunk seq no
+	u32                 XferLength;         // byte length of transfer size
+	u32                 DataLength;         // raw unpacked data length
+	u8                 	Flag;           	// flags for the chunk 
+	u8					pad[3];
+
+} __attribute__((packed)) PktHeader_t;
+
+// commands to/from the capture system
+#define CMDHEADER_CMD_LIST          1       // list all the captures
+#define CMDHEADER_CMD_GET           2       // get a capture
+#define CMDHEADER_CMD_END          100 		// end of communications 
+#define CMDHEADER_CMD_OK           101 		// sucess 
+#define CMDHEADER_CMD_NG           102 		// failed 
+
+#define CMDHEADER_VERSION_1_0		0x10	// first release
+
+// Arg[] index assignments
+#define CMDHEADER_ARG_STREAMCNT		0		// number of parallel data connections, 0 = device default (4)
+#define CMDHEADER_ARG_TSFROM_LO		1		// time range start, 64bit ns epoch as 2 x 32b, 0 = start of capture
+#define CMDHEADER_ARG_TSFROM_HI		2
+#define CMDHEADER_ARG_TSTO_LO		3		// time range end (exclusive), 0 = end of capture
+#define CMDHEADER_ARG_TSTO_HI		4
+#define CMDHEADER_ARG_SEQNO			5		// first chunk SeqNo to send when resuming, 0 = start of capture
+#define CMDHEADER_ARG_COMPRESS		6		// chunk compression the client accepts, CMDHEADER_COMPRESS_*
+
+// chunk compression, the device may still send any chunk raw
+#define CMDHEADER_COMPRESS_NONE		0
+#define CMDHEADER_COMPRESS_LZ4		1
+
+typedef struct
+{
+	u8					Version;			// cmd header version
+	u32                 Cmd;                // command to issue
+	u8                  StreamName[1024];	// stream info 
+	u64					StreamSize;
+
+	u32					Arg[1024];			// various arguments
+
+	u8                  FilterBPF[1024];    // run BPF filter
+	u8                  FilterRE[1024];     // run RegEx filter
+
+} __attribute__((packed)) CmdHeader_t;
+
+#endif
@@ -21,99 +21,31 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 
+#include "fHisto.h"
 #include "fAIO.h"
+#include "fPool.h"
+#include "fPacket.h"
+#include "fFilter.h"
+#include "fMatch.h"
 #include "fProfile.h"
+#include "fProtocol.h"
+#include "fEmu.h"
+#include "fLZ4.h"
+#include "fMetrics.h"
 
 //-------------------------------------------------------------------------------------------
 
-// packet header from the capture system
-#define PACKETHEADER_FLAG_EOF			(1<<0)	// end of capture
-typedef struct
-{
-	u32                 SeqNo;              // chunk seq no
-	u32                 XferLength;         // byte length of transfer size
-	u32                 DataLength;         // raw unpacked data length
-	u8                 	Flag;           	// flags for the chunk 
-	u8					pad[3];
-
-} __attribute__((packed)) PktHeader_t;
-
-// commands to/from the capture system
-#define CMDHEADER_CMD_LIST          1       // list all the captures
-#define CMDHEADER_CMD_GET           2       // get a capture
-#define CMDHEADER_CMD_END          100 		// end of communications 
-#define CMDHEADER_CMD_OK           101 		// sucess 
-#define CMDHEADER_CMD_NG           102 		// failed 
-
-#define CMDHEADER_VERSION_1_0		0x10	// first release
-
-typedef struct
-{
-	u8					Version;			// cmd header version
-	u32                 Cmd;                // command to issue
-	u8                  StreamName[1024];	// stream info 
-	u64					StreamSize;
-
-	u32					Arg[1024];			// various arguments
-
-	u8                  FilterBPF[1024];    // run BPF filter
-	u8                  FilterRE[1024];     // run RegEx filter
-
-} __attribute__((packed)) CmdHeader_t;
-
-
-// standard PCAP header 
-#define PCAPHEADER_MAGIC_NANO       0xa1b23c4d
-#define PCAPHEADER_MAGIC_USEC       0xa1b2c3d4
-#define PCAPHEADER_MAJOR            2
-#define PCAPHEADER_MINOR            4
-#define PCAPHEADER_LINK_ETHERNET    1
-
-typedef struct
-{
-
-	u32             Magic;
-	u16             Major;
-	u16             Minor;
-	u32             TimeZone;
-	u32             SigFlag;
-	u32             SnapLen;
-	u32             Link;
-
-} __attribute__((packed)) PCAPHeader_t;
-
-typedef struct PCAPPacket_t
-{
-	u32             Sec;                    // time stamp sec since epoch
-	u32             NSec;                   // nsec fraction since epoch
-
-	u32             LengthCapture;			// captured length
-	u32             LengthWire;				// Length on the wire 
-
-} __attribute__((packed)) PCAPPacket_t;
-
-
-// internal format thats on the tcp connection
-// contains some extra metadata
-typedef struct FMADPacket_t
-{
-	u64             TS;                     // 64bit nanosecond epoch 
-
-	u32             LengthCapture	: 16;	// length captured 
-	u32             LengthWire		: 16;   // Length on the wire 
-
-	u32             PortNo			:  8;   // Port number 
-	u32             pad1			:  8;   // flags 
-	u32             pad0			: 16; 
-
-} __attribute__((packed)) FMADPacket_t;
-
+#define CHUNK_SPLIT_MAX				16			// rotation points per chunk, later periods share the last file
+#define ROTATE_PERIOD_NONE			((u64)-1)	// chunk has no packets
 
 typedef struct Chunk_t
 {
 
 	u32					SeqNo;
+	u32					StreamID;					// connection the chunk arrived on
 	u32					Bytes;						// number of bytes in this chunk
 	u64					PktCnt;						// number of packets in this chunk	
 
@@ -122,25 +54,143 @@ typedef struct Chunk_t
 	u8					SliceList[64];				// list of recv slice ids 
 
 	PktHeader_t			Header;						// header info from sender
-	u8					Data[256*1024];				// up to 256KB for full chunk
+	u8*					Data;						// payload start within Buffer
+
+	// capture time rotation, period of the first/last packet and the
+	// payload offsets where a new period starts
+	u64					PeriodFirst;
+	u64					PeriodLast;
+	u32					SplitCnt;
+	u32					Split[CHUNK_SPLIT_MAX];
+
+	// per port output, payload is grouped into one run per port
+	u32					PortCnt;
+	u8					PortList[FPACKET_PORT_MAX];
+	u32					PortLength[FPACKET_PORT_MAX];
 
-	struct Chunk_t*		NextFree;					// next free chunk 
 	struct Chunk_t*		NextAck;					// chunk has been complete send ack 
 
+	volatile u32		WriteRef;					// zero copy disk writes still reading Buffer
+
+	// zero copy output places the payload at Buffer + (file offset & 4095) 
+	// so the previous chunks unaligned tail copied in front of it makes 
+	// a 4KB aligned O_DIRECT write. s_ChunkBufferSize bytes, pcapng 
+	// blocks need more than the payload
+	u8					Buffer[] __attribute__((aligned(4096)));
+
 } Chunk_t;
 
-typedef struct Queue_t
+// zero copy file placement of each chunk, from the header lengths 
+#define PLACE_MAX					(64*1024)
+typedef struct ChunkPlace_t
 {
-	volatile u64		Put;
-	u8					pad0[4096 - 8];
+	volatile u32		SeqNo;						// chunk seqno the entry is for 
+	volatile u32		Length;						// chunk data length
+	volatile u32		Skew;						// chunk file offset & 4095
+	u32					SplitLast;					// last rotation point in the chunk, 0 = none
+	u64					PeriodFirst;
+	u64					PeriodLast;
+
+} ChunkPlace_t;
+
+// output file position in SeqNo order. the writer and the zero copy 
+// placement both run it so they switch files at the same chunk
+typedef struct Rotate_t
+{
+	u64					Offset;						// file offset of the next chunk
+	u64					Period;						// capture time period of the file
 
-	volatile u64		Get;
-	u8					pad1[4096 - 8];
+} Rotate_t;
 
-	u32					Mask;
-	Chunk_t*			Entry[4*1024];
+// one output file, rotation opens the next one ahead of time. a striped 
+// file is spread round robin over its targets in s_StripeSize blocks, each 
+// target with its own AIO write thread
+#define OUTPUT_STRIPE_MAX			16
+#define OUTPUT_STALL_NS				60e9		// a write refused this long means the disk is gone
+typedef struct Output_t
+{
+	u32					Index;						// rotation sequence number
+	u8					FileName[OUTPUT_STRIPE_MAX][256 + 16];
+	int					FD[OUTPUT_STRIPE_MAX];
+	fAIO_t*				AIO[OUTPUT_STRIPE_MAX];
+	u64					WriteOffset;				// file offset of the next disk write
+
+	u8*					Buffer;						// output buffer, zero copy keeps the sector tail here
+	u8*					BufferSpare;				// swapped in while Buffer has a write in flight
+	volatile u32		SparePending;				// writes still reading the spare
+	u32					SparePut[OUTPUT_STRIPE_MAX];// per target write queue position after the spare
+	u32					BufferPos;
+	u32					BufferMax;
+
+} Output_t;
+
+// compressed output. reordered chunks are handed to a pool of compressor
+// threads in SeqNo order and their LZ4 frames written back in that order
+#define COMPRESS_JOB_MAX			128
+#define COMPRESS_THREAD_MAX			64
+typedef struct CompressJob_t
+{
+	Chunk_t*			C;
+	volatile u32		Done;
+	u32					FrameLength;
+	u8*					Frame;
+
+} CompressJob_t;
+
+// fProfile slots, numbered per thread
+#define PROFILE_RX_STALL			0
+#define PROFILE_RX_RECV				1
+#define PROFILE_RX_DECODE			2
+#define PROFILE_RX_PARSE			3
+#define PROFILE_RX_CONVERT			4
+#define PROFILE_RX_FILTER			5
+#define PROFILE_RX_COMPACT			6
+#define PROFILE_RX_PCAPNG			7
+#define PROFILE_RX_REORDER			8
+
+#define PROFILE_CORE_TOP			0
+#define PROFILE_CORE_WRITE			1
+#define PROFILE_CORE_CHECKPOINT		2
+
+#define PROFILE_COMPRESS_FRAME		0
+
+// resume checkpoint, kept next to the output as <output file>.ckpt. the 
+// file holds everything up to the last sector boundary, the checkpoint
+// carries the partial sector after it
+#define CHECKPOINT_MAGIC			0x54504b43	// "CKPT"
+#define CHECKPOINT_VERSION			5
+typedef struct
+{
+	u32					Magic;
+	u32					Version;
 
-} Queue_t;
+	// request the checkpoint belongs to, a resume must match it
+	u8					StreamName[1024];
+	u64					StreamSize;
+	u32					Arg[8];						// CmdHeader_t time range etc
+	u8					FilterBPF[1024];
+	u8					FilterRE[1024];
+	u64					RotateSize;
+	u64					RotateNS;
+	u32					StripeCnt;
+	u32					StripeSize;
+	u32					SnapLen;
+	u32					SnapHeaders;
+	u32					Pcapng;
+	u32					PcapngPortCnt;
+	u32					PcapngOptions;
+
+	u32					SeqNo;						// last chunk durably written
+	u32					FileIndex;					// rotated output file SeqNo is in
+	u64					FilePeriod;					// its capture time period
+	u64					FileOffset;					// output bytes up to the end of SeqNo
+	u64					TotalByte;					// chunk payload bytes up to SeqNo
+	u64					TotalPkt;
+
+	u32					TailLength;					// FileOffset & 4095
+	u8					Tail[4096];
+
+} __attribute__((packed)) Checkpoint_t;
 
 typedef struct
 {
@@ -149,15 +199,34 @@ typedef struct
 	int					Sock;					// socket for acks
 	struct sockaddr_in	BindAddr;					// bind address for acks
 
-	u8*					Buffer;						// receive buffer	
+	u8*					Buffer;						// receive buffer for compressed payloads
 	u32					BufferMax;					// max size of buffer
 
-	u64					TotalByte;					// total number of bytes recveid
+	u64					TotalByte;					// total number of bytes recveid, decompressed
+	u64					XferByte;					// bytes on the wire
+	u64					LZ4Chunk;					// chunks that arrived compressed
 	u64					TotalChunk;					// total number of chunks
 
 	u32					LastSeqNo;					// last recevied seqno 
 
-	Queue_t				Queue;						// per worker queue 
+	u64					FilterPkt;					// packets seen by the filter
+	u64					FilterPktKeep;				// packets that matched
+	u64					FilterByteKeep;				// bytes after compaction
+
+	u64					TrimPkt;					// packets outside the time range
+	u64					TrimByte;
+
+	u64					SliceByte;					// bytes before slicing
+	u64					SliceByteKeep;				// bytes after
+
+	u64					PcapngByte;					// pcapng blocks for FilterByteKeep pcap bytes
+
+	// Put/Get are 64b and reset for each download
+	volatile u64		ChunkPut;					// chunks placed in the reorder buffer
+	u8					pad0[128 - 8];
+
+	volatile u64		ChunkGet;					// chunks written out by the reorder thread
+	u8					pad1[128 - 8];
 
 } Network_t;
 
@@ -166,8 +235,8 @@ typedef struct
 double TSC2Nano;
 volatile u32 g_Exit = false;
 
-static volatile u32			s_ChunkFreeLock[128/4];		// use a full 128B cache line to avoid contention
-static volatile Chunk_t*	s_ChunkFree	= NULL;			// free chunk list
+static fPool_t*				s_ChunkPool		= NULL;		// free chunk pool
+static u32					s_ChunkBufferSize	= 4096 + 256*1024;	// Chunk_t Buffer bytes
 
 static volatile u32			s_EOFSeqNo 		= 0;		// indicates SeqNo for EOF
 
@@ -175,306 +244,1333 @@ u32							g_Quiet 		= false;	// quiet mode
 
 static bool					s_OutputAIO		= false;	// output via AIO
 static bool					s_OutputStdout 	= true;		// output on stdout
-static u8					s_OutputFileName[256];		// where to write the file
-static int					s_OutputFD;					// output file descriptor
-static fAIO_t*				s_OutputAIOFD	= NULL;		// output AIO instance	
-
-static u8					s_OutputFileName[256];		// output file name 
-static u32					s_OutputBufferMax = 0;		// max bytes in output buffer 
-static u32					s_OutputBufferPos = 0;		// current bytes in output buffer 
-static u8*					s_OutputBuffer 		= NULL;	// 1MB output buffer
-static u64					s_OutputWriteByte	= 0;	// total bytes written
+static u8					s_OutputFileName[256];		// where to write the file, base name when rotating
+static u32					s_StripeCnt			= 1;	// output targets, first one is s_OutputFileName
+static u8					s_StripeFileName[OUTPUT_STRIPE_MAX][256];
+static u32					s_StripeSize		= 256*1024;	// bytes per target before moving to the next
+static Output_t*			s_Output		= NULL;		// current output file
 
-static u64					s_WorkerCPUTop[16];			// total cycles in worker threads
-static u64					s_WorkerCPUIO[16];			// total cycles in recv() tcp  
-static u64					s_WorkerCPUParse[16];		// total cycles in parsing the data 
-static u64					s_WorkerCPUStall[16];		// total cycles worker is stalled 
+static u64					s_OutputWriteByte	= 0;	// total bytes written
+static bool					s_OutputZeroCopy	= false;// write chunk buffers directly 
+static u64					s_OutputCopyByte	= 0;	// total bytes memcpy`d in zero copy mode
+
+static bool					s_Pcapng			= false;// pcapng output, an interface per port
+static u32					s_PcapngPortCnt		= 8;	// interfaces, higher ports use the last one
+static u32					s_PcapngOptions		= 0;	// FPACKET_PCAPNG_*
+static char*				s_PcapngComment		= NULL;	// section comment
+static u8					s_FileHeader[FPACKET_PCAPNG_HEADER_MAX];	// pcap header or pcapng SHB + IDBs
+static u32					s_FileHeaderLength	= 0;
+
+static bool					s_SplitPort			= false;// one output file per capture port
+static Output_t*			s_PortOutput[FPACKET_PORT_MAX];	// opened on the ports first packet
+static u64					s_PortOutputSize	= 0;	// size to preallocate port files to
+
+static u64					s_RotateSize		= 0;	// start a new file before it gets bigger than this, 0 = off
+static u64					s_RotateNS			= 0;	// one file per capture time period, 0 = off
+static Rotate_t				s_WriteRotate;				// writer file position
+static volatile Output_t*	s_OutputNext		= NULL;	// pre-opened next file
+static u32					s_OutputNextIndex	= 0;	// index the rotate thread opens next
+static u64					s_OutputNextSize	= 0;	// size to preallocate the next file to
+static volatile bool		s_RotateExit		= false;
+static Output_t*			s_RotateRetire[16];			// files waiting to be closed by the rotate thread
+static volatile u32			s_RotateRetirePut	= 0;
+static volatile u32			s_RotateRetireGet	= 0;
+static u32					s_RotateCnt			= 0;	// files switched
+static u64					s_RotateStall		= 0;	// cycles the writer waited on a file switch
+
+static fFilter_t*			s_Filter			= NULL;	// client side packet filter
+static fMatch_t*			s_Match				= NULL;	// client side payload regex filter
+
+static bool					s_Resume			= false;// continue from the output checkpoint
+static bool					s_Resumed			= false;// checkpoint was loaded for this download
+static u32					s_CheckpointSec		= 10;	// seconds between checkpoints, 0 = off
+static u8					s_CheckpointFileName[256 + 8];
+static Checkpoint_t			s_Checkpoint;				// last written or loaded checkpoint
+static bool					s_CheckpointSaved	= false;// s_Checkpoint is in the checkpoint file
+
+static u32					s_Compress			= CMDHEADER_COMPRESS_NONE;	// chunk compression to ask the device for
+
+static bool					s_OutputLZ4			= false;// write LZ4 frames + seek table
+static u32					s_CompressThreadCnt	= 0;	// compressor threads, 0 = one per cpu
+static pthread_t			s_CompressThread[COMPRESS_THREAD_MAX];
+static u64					s_CompressCPU[COMPRESS_THREAD_MAX];	// cycles compressing per thread
+static CompressJob_t		s_CompressJob[COMPRESS_JOB_MAX];
+static volatile u32			s_CompressPut		= 0;	// next job the writer queues
+static volatile u32			s_CompressGet		= 0;	// next job a compressor takes
+static u32					s_CompressEmit		= 0;	// next job written to the file
+static volatile bool		s_CompressExit		= false;
+static volatile u32			s_CompressIdle		= 0;	// compressors blocked on s_CompressWake
+static pthread_mutex_t		s_CompressLock		= PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		s_CompressWake		= PTHREAD_COND_INITIALIZER;
+static u64					s_CompressStall		= 0;	// cycles the writer waited for a free job
+static u64					s_CompressRawByte	= 0;	// pcap bytes before compression
+static fLZ4Seek_t*			s_Seek				= NULL;	// one entry per frame
+static u32					s_SeekCnt			= 0;
+static u32					s_SeekMax			= 0;
+
+static u64					s_TSFrom			= 0;	// time range to download [From, To) 
+static u64					s_TSTo				= 0;	// 0 = end of capture
+
+static u32					s_MetricsPort		= 0;	// loopback http metrics port, 0 = off
+static fMetrics_t*			s_Metrics			= NULL;
+static u8					s_MetricsStream[256];		// stream being downloaded
+static u32					s_MetricsLinger		= 5;	// seconds the final page is served after the download
+
+static u32					s_SnapLen			= 0;	// truncate packets to this, 0 = off
+static bool					s_SnapHeaders		= false;// truncate packets after the L2-L4 headers
+
+// reorder buffer indexed by SeqNo & (s_ReorderMax - 1). RxThreads drop 
+// completed chunks straight into their slot, the writer drains consecutive slots
+static Chunk_t* volatile*	s_ReorderSlot	= NULL;
+static u32					s_ReorderMax	= 0;		// number of slots, pow2 
+static volatile u32			s_ReorderSeqNo	= 1;		// next SeqNo the writer expects
+static volatile u32			s_ReorderSeqMax	= 0;		// highest SeqNo placed
+
+static ChunkPlace_t			s_Place[PLACE_MAX];			// zero copy per chunk placement
+static volatile u32			s_PlaceLock		= 0;
+static volatile u32			s_PlaceSeqNo	= 1;		// first seqno with an unknown file offset 
+static Rotate_t				s_PlaceRotate;				// file position of s_PlaceSeqNo
+
+#define STREAM_MAX			64							// max number of parallel data connections 
+
+static u32					s_StreamCnt			= 4;	// number of parallel data connections
+static u32					s_StreamCPUCnt		= 0;	// number of entries in the cpu list, 0 = default pinning
+static u32					s_StreamCPU[STREAM_MAX];	// cpu list the worker threads get pinned to 
+
+static u64					s_WorkerCPUTop[STREAM_MAX];	// total cycles in worker threads
+static u64					s_WorkerCPUIO[STREAM_MAX];	// total cycles in recv() tcp  
+static u64					s_WorkerCPUParse[STREAM_MAX];// total cycles in parsing the data 
+static u64					s_WorkerCPUStall[STREAM_MAX];// total cycles worker is stalled 
+static u64					s_WorkerCPUDecode[STREAM_MAX];// total cycles decompressing chunks
+
+void ChunkFree(Chunk_t* C);
 
 //-------------------------------------------------------------------------------------------
-// open file for output 
-static void File_Open(u64 MaxSize) 
+// output file name, rotated files get _<index> in front of the extension
+// and per port files _port<index>
+static void Output_FileName(u8* FileName, u8* Path, u32 Index)
 {
-	if (s_OutputAIO)
+	if (!s_SplitPort && !s_RotateSize && !s_RotateNS)
 	{
-		s_OutputFD = open(s_OutputFileName, O_WRONLY| O_DIRECT | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR); 
-		//s_OutputFD = open(s_OutputFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR); 
-		if (s_OutputFD < 0)
-		{
-			fprintf(stderr, "failed to create file [%s] %i %s\n", s_OutputFileName, errno, strerror(errno));
-			exit(-1);	
-		}
-
-		s_OutputAIOFD = fAIO_Open(s_OutputFD);
-		assert(s_OutputAIOFD != NULL);
+		strcpy(FileName, Path);
+		return;
+	}
 
-		// truncate to 1TB 
-		ftruncate64(s_OutputFD, MaxSize); 
+	u32 Length	= strlen(Path);
+	u32 Ext		= 0;
+	if ((Length > 5) && (strcmp(Path + Length - 5, ".pcap") == 0)) 	Ext = 5;
+	if ((Length > 7) && (strcmp(Path + Length - 7, ".pcapng") == 0))	Ext = 7;
 
-		// allocate output buffer
-		s_OutputBufferPos	= 0;
-		s_OutputBufferMax	= kMB(1);
-		s_OutputBuffer		= memalign(4096, s_OutputBufferMax);
-		assert(s_OutputBuffer != NULL);
-	}
+	if (s_SplitPort)	sprintf(FileName, "%.*s_port%02i%s", Length - Ext, Path, Index, Path + Length - Ext);
+	else				sprintf(FileName, "%.*s_%05i%s", Length - Ext, Path, Index, Path + Length - Ext);
 }
 
 //-------------------------------------------------------------------------------------------
-// write data out
-static void File_Write(u8* Data, u32 Length)
+// striping, file offset -> target, offset in the target, bytes of [0, Length) on a target
+static inline u32 Stripe_Target(u64 Offset)
 {
-	if (s_OutputStdout)
+	return (s_StripeCnt == 1) ? 0 : (Offset / s_StripeSize) % s_StripeCnt;
+}
+
+static inline u64 Stripe_Offset(u64 Offset)
+{
+	if (s_StripeCnt == 1) return Offset;
+	return (Offset / (s_StripeSize * s_StripeCnt)) * s_StripeSize + (Offset % s_StripeSize);
+}
+
+static u64 Stripe_Size(u32 Target, u64 Length)
+{
+	if (s_StripeCnt == 1) return Length;
+
+	u64 Row = (u64)s_StripeSize * s_StripeCnt;
+	s64 Rem = (Length % Row) - (u64)Target * s_StripeSize;
+	if (Rem < 0) Rem = 0;
+	if (Rem > s_StripeSize) Rem = s_StripeSize;
+
+	return (Length / Row) * s_StripeSize + Rem;
+}
+
+// bytes from Offset until the write has to move to the next target
+static inline u32 Stripe_Piece(u64 Offset, u32 Length)
+{
+	if (s_StripeCnt == 1) return Length;
+
+	u32 Remain = s_StripeSize - (Offset % s_StripeSize);
+	return (Length < Remain) ? Length : Remain;
+}
+
+// number of target writes Output_Submit splits Length into 
+static u32 Stripe_PieceCnt(u64 Offset, u32 Length)
+{
+	u32 Cnt = 0;
+	while (Length > 0)
 	{
-		int wlen = fwrite(Data, 1, Length, stdout);
-		if (wlen != Length)
-		{
-			fprintf(stderr, "ERROR: write to output failed wlen:%i errno:%i (%s)\n", wlen, errno, strerror(errno) );
-			g_Exit = true;
-		}
+		u32 Piece	= Stripe_Piece(Offset, Length);
+		Offset		+= Piece;
+		Length		-= Piece;
+		Cnt++;
 	}
+	return Cnt;
+}
+
+//-------------------------------------------------------------------------------------------
+// open an output file truncated to Size. resume keeps whats on disk and
+// continues at the checkpoint sector, its tail goes in front of the next data
+static Output_t* Output_Open(u32 Index, u64 Size, bool Resume)
+{
+	Output_t* O = (Output_t*)memalign(64, sizeof(Output_t));
+	assert(O != NULL);
+	memset(O, 0, sizeof(Output_t));
 
-	if (s_OutputAIO)
+	O->Index		= Index;
+	O->WriteOffset	= Resume ? s_Checkpoint.FileOffset - s_Checkpoint.TailLength : 0;
+
+	u32 Flags = Resume ? 0 : O_CREAT | O_TRUNC;
+	for (int t=0; t < s_StripeCnt; t++)
 	{
-		// buffer full
-		if (s_OutputBufferPos + Length > s_OutputBufferMax)
+		Output_FileName(O->FileName[t], s_StripeFileName[t], Index);
+
+		O->FD[t] = open(O->FileName[t], O_WRONLY| O_DIRECT | Flags, S_IWUSR | S_IRUSR); 
+		if (O->FD[t] < 0)
 		{
-			u32 BLength 	= s_OutputBufferMax- s_OutputBufferPos;
-			memcpy(s_OutputBuffer + s_OutputBufferPos, Data, BLength);
+			fprintf(stderr, "failed to create file [%s] %i %s\n", O->FileName[t], errno, strerror(errno));
+			exit(-1);	
+		}
 
-			// write block
-			for (int i=0; i < 4; i++)
-			{
-				u32 Timeout = 0;
-				while (fAIO_Write(s_OutputAIOFD, s_OutputBuffer + i * kKB(256), kKB(256)) < 0)
-				{
-					usleep(0);
-					assert(Timeout++ < 10e6);
-				}
-				s_OutputWriteByte	+= kKB(256);
-			}
+		O->AIO[t] = fAIO_Open(O->FD[t]);
+		assert(O->AIO[t] != NULL);
 
-			s_OutputBufferPos 	= 0;
+		ftruncate64(O->FD[t], Stripe_Size(t, Size)); 
 
-			// write remaining into next block
-			memcpy(s_OutputBuffer + s_OutputBufferPos, Data + BLength, Length - BLength);
+		// each target continues from its share of the checkpoint offset
+		O->AIO[t]->WriteOffset = Stripe_Size(t, O->WriteOffset);
 
-			s_OutputBufferPos += Length - BLength;
-		}
-		// append to current buffer
-		else
+		// io_uring can write straight from the registered chunk pool 
+		if (s_OutputZeroCopy)
 		{
-			memcpy(s_OutputBuffer + s_OutputBufferPos, Data, Length);
-			s_OutputBufferPos += Length;
+			fAIO_RegisterBuffer(O->AIO[t], s_ChunkPool->Base, s_ChunkPool->Stride * s_ChunkPool->ObjMax);
 		}
+	}
 
-		/*
-		// write block fd only
-		int rlen = write(s_OutputFD, Data, Length);
-		if (rlen != Length)
-		{
-			fprintf(stderr, "failed to write data: %i %s : length %i\n", errno, strerror(errno), Length);
-		}
-		*/
+	// allocate output buffer, striped gets a full row so a flush hits every target
+	O->BufferPos	= 0;
+	O->BufferMax	= kMB(1);
+	if ((s_StripeCnt > 1) && (s_StripeSize * s_StripeCnt > O->BufferMax)) O->BufferMax = s_StripeSize * s_StripeCnt;
+
+	O->Buffer		= memalign(4096, O->BufferMax);
+	O->BufferSpare	= memalign(4096, O->BufferMax);
+	assert(O->Buffer != NULL);
+	assert(O->BufferSpare != NULL);
+
+	if (Resume)
+	{
+		O->BufferPos		= s_Checkpoint.TailLength;
+		memcpy(O->Buffer, s_Checkpoint.Tail, s_Checkpoint.TailLength);
 	}
+	return O;
 }
 
 //-------------------------------------------------------------------------------------------
-// flush any remaining data 
-static void File_Close(void)
+// striped files get a text manifest next to the first target for --unstripe
+static void Output_Manifest(Output_t* O, u64 Size)
 {
-	if (s_OutputStdout)
+	u8 FileName[256 + 16 + 8];
+	sprintf(FileName, "%s.stripe", O->FileName[0]);
+
+	FILE* F = fopen(FileName, "w");
+	if (F == NULL)
 	{
-		fflush(stdout);
+		fprintf(stderr, "failed to create manifest [%s] %i %s\n", FileName, errno, strerror(errno));
+		return;
 	}
-	if (s_OutputAIO)
+	fprintf(F, "fmadio-stripe 1\n");
+	fprintf(F, "StripeSize %i\n", s_StripeSize);
+	fprintf(F, "Size %lli\n", Size);
+	for (int t=0; t < s_StripeCnt; t++)
 	{
-		// lseek dosent work on aio objects
-		// get the write pos
-		u64 WritePos = s_OutputAIOFD->WriteOffset;
+		fprintf(F, "Target %s\n", O->FileName[t]);
+	}
+	fclose(F);
+}
 
+//-------------------------------------------------------------------------------------------
+// flush, write the unaligned tail and truncate to the final size. returns the size
+static u64 Output_Close(Output_t* O)
+{
+	for (int t=0; t < s_StripeCnt; t++)
+	{
 		// shutdown AIO
-		fAIO_Close(s_OutputAIOFD);
+		fAIO_Close(O->AIO[t]);
 
 		// shutdown AIO and file handle
-		close(s_OutputFD);
+		close(O->FD[t]);
 
 		// need re-open for non POW2 aligned writes
-		s_OutputFD = open(s_OutputFileName, O_WRONLY, S_IWUSR | S_IRUSR); 
+		O->FD[t] = open(O->FileName[t], O_WRONLY, S_IWUSR | S_IRUSR); 
+	}
 
-		// move the last write poisiton
-		lseek(s_OutputFD, WritePos, SEEK_SET); 
+	// write remainder using normal IO, a full buffer can span targets 
+	u32 Pos = 0;
+	while (Pos < O->BufferPos)
+	{
+		u64 Offset	= O->WriteOffset + Pos;
+		u32 Piece	= Stripe_Piece(Offset, O->BufferPos - Pos);
 
-		// write remainder using normal IO
-		int wlen = write(s_OutputFD, s_OutputBuffer, s_OutputBufferPos);
-		if (wlen <= 0)
+		int wlen = pwrite(O->FD[Stripe_Target(Offset)], O->Buffer + Pos, Piece, Stripe_Offset(Offset));
+		if (wlen != Piece)
 		{
 			fprintf(stderr, "trailing write error %i %s\n", errno, strerror(errno));
+			break;
 		}
-		
-		// truncate file to final total byte size
-		ftruncate64(s_OutputFD, WritePos + s_OutputBufferPos);
+		Pos += Piece;
+	}
+	
+	// truncate file to final total byte size
+	u64 Size = O->WriteOffset + O->BufferPos;
+	for (int t=0; t < s_StripeCnt; t++)
+	{
+		ftruncate64(O->FD[t], Stripe_Size(t, Size));
 
 		// close
-		close(s_OutputFD);
+		close(O->FD[t]);
 	}
+	if (s_StripeCnt > 1) Output_Manifest(O, Size);
+
+	free(O->Buffer);
+	free(O->BufferSpare);
+	free(O);
+
+	return Size;
 }
 
 //-------------------------------------------------------------------------------------------
-// light weight mutexs
-static inline void Lock(volatile u32* Lock)
+// write a sector aligned buffer without copying, split over the stripe 
+// targets. Release(User) runs once per piece, see Stripe_PieceCnt
+static void Output_Submit(Output_t* O, u8* Buffer, u32 Length, void (*Release)(void* User), void* User)
 {
-	while (__sync_bool_compare_and_swap(Lock, 0, 1) == false)
+	while (Length > 0)
 	{
-		// put cpu into low prioity for 100nsec
-		ndelay(100);
+		u32 Piece	= Stripe_Piece(O->WriteOffset, Length);
+		fAIO_t* AIO	= O->AIO[ Stripe_Target(O->WriteOffset) ];
+
+		u64 StallTSC = rdtsc();
+		while (fAIO_WriteZC(AIO, Buffer, Piece, Release, User) < 0)
+		{
+			fAIO_WriteWait(AIO);
+			assert(tsc2ns(rdtsc() - StallTSC) < OUTPUT_STALL_NS);
+		}
+		s_OutputWriteByte	+= Piece;
+
+		O->WriteOffset		+= Piece;
+		Buffer				+= Piece;
+		Length				-= Piece;
 	}
 }
-static inline void Unlock(volatile u32* Lock)
+
+//-------------------------------------------------------------------------------------------
+// queue the zero copy writes each target has gathered
+static void Output_Kick(Output_t* O)
+{
+	for (int t=0; t < s_StripeCnt; t++) fAIO_WriteSubmit(O->AIO[t]);
+}
+
+static void Output_SpareRelease(void* User)
 {
-	// required to ensure correct memory ordering 
-	// of lock/unlock. a normal write should be sufficent 
-	// however the ordering of that write seems very relaxed..
-	if (__sync_bool_compare_and_swap(Lock, 1, 0) == false)
-	{
-		fprintf(stderr, "Unlock failed\n");
-	}
+	Output_t* O = (Output_t*)User;
+	__sync_fetch_and_sub(&O->SparePending, 1);
 }
 
-Chunk_t* ChunkAlloc(void)
+//-------------------------------------------------------------------------------------------
+// write the sector aligned part of the buffer without waiting, leaving 
+// less than a sector buffered. the tail moves to the spare buffer while
+// the write reads from the old one
+static void Output_Align(Output_t* O)
 {
-	// get lock
-	Lock(&s_ChunkFreeLock[0]);
+	u32 Aligned = O->BufferPos & ~4095;
+	if (Aligned == 0) return;
 
-	volatile Chunk_t* C = (volatile Chunk_t*)s_ChunkFree;
-	if (C != NULL)
+	// spare may still be in flight from the last align, block on each target
+	// until its queue passes the spare. releases run before the queue moves
+	while (O->SparePending != 0)
 	{
-		s_ChunkFree = C->NextFree;
-
-		// reset
-		C->SeqNo = 0;	
+		for (int t=0; t < s_StripeCnt; t++)
+		{
+			fAIO_t* AIO = O->AIO[t];
+			AIO->SpaceGet = AIO->WriteQueueGet;
+			if ((s32)(AIO->SpaceGet - O->SparePut[t]) < 0) fAIO_WriteWait(AIO);
+		}
 	}
 
-	// release lock
-	Unlock(&s_ChunkFreeLock[0]);
-
-	return (Chunk_t*)C;
-}
-
-void ChunkFree(Chunk_t* C)
-{
-	// get lock
-	Lock(&s_ChunkFreeLock[0]);
+	// queued now so every target has its piece of the row in flight while
+	// the next row fills, not left in the gather list until the next kick
+	O->SparePending		= Stripe_PieceCnt(O->WriteOffset, Aligned);
+	Output_Submit(O, O->Buffer, Aligned, Output_SpareRelease, O);
+	Output_Kick(O);
+	for (int t=0; t < s_StripeCnt; t++) O->SparePut[t] = O->AIO[t]->WriteQueuePut;
 
-	C->NextFree = (Chunk_t*)s_ChunkFree;
-	s_ChunkFree = C;
+	u8* Buffer			= O->BufferSpare;
+	memcpy(Buffer, O->Buffer + Aligned, O->BufferPos - Aligned);
 
-	// release lock
-	Unlock(&s_ChunkFreeLock[0]);
+	O->BufferSpare		= O->Buffer;
+	O->Buffer			= Buffer;
+	O->BufferPos		-= Aligned;
 }
 
 //-------------------------------------------------------------------------------------------
-
-static Network_t* NetworkOpen(u32 CPUID, u32 PortBase, u8* IPAddress)
+// append to the output buffer, full buffers go out as 4 x 256KB writes or
+// a full stripe row 
+static void Output_Write(Output_t* O, u8* Data, u32 Length)
 {
-	Network_t* N = memalign2(4*1024,  sizeof(Network_t)); 
-	memset(N, 0, sizeof(Network_t));
+	if (s_OutputZeroCopy) s_OutputCopyByte += Length;
 
-	N->CPUID		= CPUID;
+	// buffer full
+	if (O->BufferPos + Length > O->BufferMax)
+	{
+		u32 BLength 	= O->BufferMax - O->BufferPos;
+		memcpy(O->Buffer + O->BufferPos, Data, BLength);
 
-	N->Sock = socket(AF_INET, SOCK_STREAM, 0);
-	assert(N->Sock > 0);
-	
-	// listen address 
-	memset((char *) &N->BindAddr, 0, sizeof(N->BindAddr));
+		// write block
+		if (s_StripeCnt > 1)
+		{
+			O->BufferPos = O->BufferMax;
+			Output_Align(O);
+		}
+		else
+		{
+			for (int i=0; i < 4; i++)
+			{
+				u64 StallTSC = rdtsc();
+				while (fAIO_Write(O->AIO[0], O->Buffer + i * kKB(256), kKB(256)) < 0)
+				{
+					fAIO_WriteWait(O->AIO[0]);
+					assert(tsc2ns(rdtsc() - StallTSC) < OUTPUT_STALL_NS);
+				}
+				s_OutputWriteByte	+= kKB(256);
+				O->WriteOffset		+= kKB(256);
+			}
+		}
 
-	N->BindAddr.sin_family 		= AF_INET;
-	N->BindAddr.sin_port 		= htons(PortBase + CPUID);
-	N->BindAddr.sin_addr.s_addr = inet_addr(IPAddress);
+		O->BufferPos 	= 0;
 
-	// retry connection a few times 
-	int ret = -1;
-	for (int r=0; r < 10; r++)
-	{
-		//bind socket to port
-		ret = connect(N->Sock, (struct sockaddr*)&N->BindAddr, sizeof(N->BindAddr));
-		if (ret >= 0) break;
+		// write remaining into next block
+		memcpy(O->Buffer + O->BufferPos, Data + BLength, Length - BLength);
 
-		// connection timed out
-		usleep(100e3);
+		O->BufferPos += Length - BLength;
 	}
-	if (ret < 0)
+	// append to current buffer
+	else
 	{
-		fprintf(stderr, "connect failed: %i %i : %s : %s:%i\n", ret, errno, strerror(errno), IPAddress, PortBase + CPUID); 
-		return NULL;
+		memcpy(O->Buffer + O->BufferPos, Data, Length);
+		O->BufferPos += Length;
 	}
+}
 
-	// set massive recvie buffer to minimize packet drops
-	int size = kMB(256);
-	ret = setsockopt(N->Sock, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));  
-	if (ret < 0)
+//-------------------------------------------------------------------------------------------
+// compressor pool, threads take queued jobs in order and finish in any order
+static void* CompressThread(void* User)
+{
+	u32 Index	= (u64)User;
+	u32* Hash	= memalign(64, FLZ4_HASH_MAX * sizeof(u32));
+
+	fProfile_ThreadInit("compress");
+
+	while (!s_CompressExit)
 	{
-		fprintf(stderr, "failed to set recv buffer size: %i %s\n", ret, strerror(errno));
-	}
+		u32 Get = s_CompressGet;
+		if (Get == s_CompressPut)
+		{
+			// count as idle then recheck under the lock so a queued job cant be missed
+			pthread_mutex_lock(&s_CompressLock);
+			s_CompressIdle++;
+			__sync_synchronize();
+			while ((s_CompressGet == s_CompressPut) && !s_CompressExit)
+			{
+				pthread_cond_wait(&s_CompressWake, &s_CompressLock);
+			}
+			s_CompressIdle--;
+			pthread_mutex_unlock(&s_CompressLock);
+			continue;
+		}
+		if (!__sync_bool_compare_and_swap(&s_CompressGet, Get, Get + 1)) continue;
 
-	// packet recv buffer
-	N->Buffer 		= memalign2(128, 256*1024);
-	N->BufferMax 	= 256*1024;
+		u64 TSC0 = rdtsc();
 
-	// reset queue
-	N->Queue.Put	= 0;
-	N->Queue.Get	= 0;
-	N->Queue.Mask	= 1024 - 1;
+		fProfile_Start(PROFILE_COMPRESS_FRAME, "lz4 frame");
 
-	return N;
+		CompressJob_t* J	= &s_CompressJob[Get & (COMPRESS_JOB_MAX - 1)];
+		J->FrameLength		= fLZ4_FrameCompress(J->Frame, FLZ4_FRAME_BOUND(FPACKET_CHUNK_MAX), J->C->Data, J->C->Header.DataLength, Hash);
+
+		fProfile_Stop(PROFILE_COMPRESS_FRAME);
+		sfence();
+		J->Done				= true;
+
+		s_CompressCPU[Index] += rdtsc() - TSC0;
+	}
+	free(Hash);
+	return NULL;
 }
 
-//-------------------------------------------------------------------------------------------
+// frame goes to the output with its seek entry
+static void Compress_Frame(u8* Frame, u32 FrameLength, u32 RawLength, u64 TSFirst)
+{
+	if (s_SeekCnt == s_SeekMax)
+	{
+		s_SeekMax	= (s_SeekMax == 0) ? 1024 : s_SeekMax * 2;
+		s_Seek		= realloc(s_Seek, s_SeekMax * sizeof(fLZ4Seek_t));
+		assert(s_Seek != NULL);
+	}
+	fLZ4Seek_t* S	= &s_Seek[s_SeekCnt++];
+	S->FileOffset	= s_Output->WriteOffset + s_Output->BufferPos;
+	S->RawOffset	= s_CompressRawByte;
+	S->TSFirst		= TSFirst;
+	S->FrameLength	= FrameLength;
+	S->RawLength	= RawLength;
+
+	Output_Write(s_Output, Frame, FrameLength);
+	s_CompressRawByte += RawLength;
+}
 
-static bool RecvSock(int Sock, u8* Buffer8, s32 BufferLength)
+// write finished jobs in SeqNo order, all of them when Wait
+static void Compress_Emit(bool Wait)
 {
-	while (BufferLength > 0)
+	while (s_CompressEmit != s_CompressPut)
 	{
-		int rlen = recv(Sock, Buffer8, BufferLength, 0);
-		if (rlen <= 0)
-		{
-			if (errno != EAGAIN)
-			{
-				fprintf(stderr, "RecvSock Error %i %i %s\n", rlen, errno, strerror(errno));
-				return false;	
-			}
-		}
-		else
+		CompressJob_t* J = &s_CompressJob[s_CompressEmit & (COMPRESS_JOB_MAX - 1)];
+		if (!J->Done)
 		{
-			// iterate thought the raw buffer 
-			BufferLength	-= rlen;
-			Buffer8			+= rlen;	
+			if (!Wait) break;
+			usleep(0);
+			continue;
 		}
+
+		PCAPPacket_t* Pkt = (PCAPPacket_t*)J->C->Data;
+		Compress_Frame(J->Frame, J->FrameLength, J->C->Header.DataLength, Pkt->Sec * k1E9 + Pkt->NSec);
+
+		ChunkFree(J->C);
+		J->C		= NULL;
+		J->Done		= false;
+		s_CompressEmit++;
 	}
-	return true;
 }
 
-//-------------------------------------------------------------------------------------------
-// process a single TCP condition and push the result on the output queu
-void* RxThread(void* _User)
+// queue a chunk, only waits when every job is in use
+static void Compress_Chunk(Chunk_t* C)
 {
-	Network_t* N = (Network_t*)_User;
-	if (!g_Quiet) fprintf(stderr, "[%i] RxThread starting\n", N->CPUID);
-
-	// receive at maximum rate per thread 
-	bool Exit = false;
-	while (!Exit)
+	if (C->Header.DataLength == 0)
 	{
-		// global exit
-		if (g_Exit) break;
+		ChunkFree(C);
+		return;
+	}
 
+	Compress_Emit(false);
+	if (s_CompressPut - s_CompressEmit >= COMPRESS_JOB_MAX)
+	{
 		u64 TSC0 = rdtsc();
-
-		// dont have too many outstanding entries
-		// Put/Get are 64b and reset for each download
-		// its impossible to for this to wrap around 
-		if (N->Queue.Put  - N->Queue.Get >= 192) 
+		while (s_CompressPut - s_CompressEmit >= COMPRESS_JOB_MAX)
 		{
 			usleep(0);
-
+			Compress_Emit(false);
+		}
+		s_CompressStall += rdtsc() - TSC0;
+	}
+
+	CompressJob_t* J = &s_CompressJob[s_CompressPut & (COMPRESS_JOB_MAX - 1)];
+	J->C	= C;
+	J->Done	= false;
+	sfence();
+	s_CompressPut++;
+
+	// doorbell, only when a compressor is asleep
+	__sync_synchronize();
+	if (s_CompressIdle)
+	{
+		pthread_mutex_lock(&s_CompressLock);
+		pthread_cond_signal(&s_CompressWake);
+		pthread_mutex_unlock(&s_CompressLock);
+	}
+}
+
+// data outside the chunk stream e.g. the pcap header, compressed inline
+static void Compress_Write(u8* Data, u32 Length)
+{
+	Compress_Emit(true);
+
+	u32* Hash = memalign(64, FLZ4_HASH_MAX * sizeof(u32));
+	u8* Frame = memalign(64, FLZ4_FRAME_BOUND(Length));
+
+	u32 FrameLength = fLZ4_FrameCompress(Frame, FLZ4_FRAME_BOUND(Length), Data, Length, Hash);
+	Compress_Frame(Frame, FrameLength, Length, 0);
+
+	free(Frame);
+	free(Hash);
+}
+
+static void Compress_Open(void)
+{
+	if (s_CompressThreadCnt == 0) s_CompressThreadCnt = sysconf(_SC_NPROCESSORS_ONLN);
+	if (s_CompressThreadCnt > COMPRESS_THREAD_MAX) s_CompressThreadCnt = COMPRESS_THREAD_MAX;
+
+	for (int j=0; j < COMPRESS_JOB_MAX; j++)
+	{
+		s_CompressJob[j].Frame	= memalign(4096, FLZ4_FRAME_BOUND(FPACKET_CHUNK_MAX));
+		s_CompressJob[j].Done	= false;
+		assert(s_CompressJob[j].Frame != NULL);
+	}
+	s_CompressPut		= 0;
+	s_CompressGet		= 0;
+	s_CompressEmit		= 0;
+	s_CompressExit		= false;
+	s_CompressIdle		= 0;
+	s_CompressRawByte	= 0;
+	s_SeekCnt			= 0;
+
+	for (int t=0; t < s_CompressThreadCnt; t++)
+	{
+		pthread_create(&s_CompressThread[t], NULL, CompressThread, (void*)(u64)t);
+	}
+}
+
+// drain the pool and finish the file with the seek table 
+static void Compress_Close(void)
+{
+	Compress_Emit(true);
+
+	pthread_mutex_lock(&s_CompressLock);
+	s_CompressExit = true;
+	pthread_cond_broadcast(&s_CompressWake);
+	pthread_mutex_unlock(&s_CompressLock);
+
+	for (int t=0; t < s_CompressThreadCnt; t++)
+	{
+		pthread_join(s_CompressThread[t], NULL);
+	}
+	for (int j=0; j < COMPRESS_JOB_MAX; j++) free(s_CompressJob[j].Frame);
+
+	fLZ4SeekFooter_t Footer;
+	Footer.EntryCnt		= s_SeekCnt;
+	Footer.Flags		= 0;
+	Footer.Magic		= FLZ4_SEEK_MAGIC;
+
+	u32 Header[2];
+	Header[0]			= FLZ4_SKIP_MAGIC;
+	Header[1]			= s_SeekCnt * sizeof(fLZ4Seek_t) + sizeof(Footer);
+
+	u64 PackedByte		= s_Output->WriteOffset + s_Output->BufferPos;
+	Output_Write(s_Output, (u8*)Header, sizeof(Header));
+	Output_Write(s_Output, (u8*)s_Seek, s_SeekCnt * sizeof(fLZ4Seek_t));
+	Output_Write(s_Output, (u8*)&Footer, sizeof(Footer));
+
+	if (!g_Quiet)
+	{
+		u64 CPU = 0;
+		for (int t=0; t < s_CompressThreadCnt; t++) CPU += s_CompressCPU[t];
+
+		fprintf(stderr, "LZ4 Output Frames %i Raw %.3f GB Packed %.3f GB Ratio %.2f | Threads %i CPU %.3f Sec Writer Stall %.3f Sec\n",
+			s_SeekCnt,
+			s_CompressRawByte / 1e9,
+			PackedByte / 1e9,
+			s_CompressRawByte * inverse(PackedByte),
+			s_CompressThreadCnt,
+			tsc2ns(CPU) / 1e9,
+			tsc2ns(s_CompressStall) / 1e9);
+	}
+
+	free(s_Seek);
+	s_Seek		= NULL;
+	s_SeekMax	= 0;
+}
+
+//-------------------------------------------------------------------------------------------
+// rotation keeps the next file open ahead of time and closes the old
+// ones, so the writer only swaps a pointer 
+static void* RotateThread(void* User)
+{
+	while (true)
+	{
+		if ((s_OutputNext == NULL) && !s_RotateExit)
+		{
+			Output_t* O = Output_Open(s_OutputNextIndex++, s_OutputNextSize, false);
+			sfence();
+			s_OutputNext = O;
+		}
+
+		bool Idle = true;
+		while (s_RotateRetireGet != s_RotateRetirePut)
+		{
+			Output_t* O = s_RotateRetire[s_RotateRetireGet & 15];
+			u32 Index	= O->Index;
+			u64 Size	= Output_Close(O);
+			s_RotateRetireGet++;
+
+			// time rotation, preallocate for what the last file needed 
+			if (!s_RotateSize) s_OutputNextSize = Size;
+
+			if (!g_Quiet) fprintf(stderr, "Rotated file %i %.3f GB\n", Index, Size / 1e9);
+			Idle = false;
+		}
+		if (s_RotateExit && Idle) break;
+
+		usleep(1000);
+	}
+
+	// next file was never used
+	if (s_OutputNext != NULL)
+	{
+		Output_t* O = (Output_t*)s_OutputNext;
+		u8 FileName[OUTPUT_STRIPE_MAX][sizeof(O->FileName[0]) + 8];
+		for (int t=0; t < s_StripeCnt; t++) strcpy(FileName[t], O->FileName[t]);
+
+		Output_Close(O);
+		for (int t=0; t < s_StripeCnt; t++) unlink(FileName[t]);
+
+		// and its manifest
+		strcat(FileName[0], ".stripe");
+		unlink(FileName[0]);
+		s_OutputNext = NULL;
+	}
+	return NULL;
+}
+
+//-------------------------------------------------------------------------------------------
+// process cpu seconds, user + system
+static double CPUTime(void)
+{
+	struct rusage Usage;
+	getrusage(RUSAGE_SELF, &Usage);
+	return Usage.ru_utime.tv_sec + Usage.ru_utime.tv_usec / 1e6 + Usage.ru_stime.tv_sec + Usage.ru_stime.tv_usec / 1e6;
+}
+
+//-------------------------------------------------------------------------------------------
+// header every output file starts with 
+static void File_Header(void)
+{
+	if (s_Pcapng)
+	{
+		s_FileHeaderLength = fPacket_PCAPNGHeader(s_FileHeader, s_PcapngPortCnt, s_SnapLen ? s_SnapLen : 65535, s_PcapngComment);
+		return;
+	}
+
+	PCAPHeader_t*	PCAPHeader = (PCAPHeader_t*)s_FileHeader;
+	PCAPHeader->Magic		= PCAPHEADER_MAGIC_NANO;
+	PCAPHeader->Major		= PCAPHEADER_MAJOR;
+	PCAPHeader->Minor		= PCAPHEADER_MINOR;
+	PCAPHeader->TimeZone	= 0; 
+	PCAPHeader->SigFlag		= 0; 
+	PCAPHeader->SnapLen		= s_SnapLen ? s_SnapLen : 65535; 
+	PCAPHeader->Link		= PCAPHEADER_LINK_ETHERNET;
+	s_FileHeaderLength		= sizeof(PCAPHeader_t);
+}
+
+//-------------------------------------------------------------------------------------------
+// open file for output 
+static pthread_t s_RotateThread;
+
+static void File_Open(u64 MaxSize) 
+{
+	// port files are opened as ports show up
+	if (s_OutputAIO && s_SplitPort)
+	{
+		memset(s_PortOutput, 0, sizeof(s_PortOutput));
+		s_PortOutputSize = MaxSize;
+	}
+	else if (s_OutputAIO)
+	{
+		bool Rotate = (s_RotateSize != 0) || (s_RotateNS != 0);
+
+		// rotated files start with the size limit or 1GB, sparse either way
+		s_OutputNextSize	= s_RotateSize ? s_RotateSize : kGB(1);
+		s_OutputNextIndex	= s_Resumed ? s_Checkpoint.FileIndex + 1 : 1;
+		s_Output			= Output_Open(s_Resumed ? s_Checkpoint.FileIndex : 0, Rotate ? s_OutputNextSize : MaxSize, s_Resumed);
+
+		s_RotateExit		= false;
+		s_RotateCnt			= 0;
+		s_RotateStall		= 0;
+		if (Rotate) pthread_create(&s_RotateThread, NULL, RotateThread, NULL);
+
+		if (s_OutputLZ4) Compress_Open();
+	}
+}
+
+//-------------------------------------------------------------------------------------------
+// write data out
+static void File_Write(u8* Data, u32 Length)
+{
+	if (s_OutputStdout)
+	{
+		int wlen = fwrite(Data, 1, Length, stdout);
+		if (wlen != Length)
+		{
+			fprintf(stderr, "ERROR: write to output failed wlen:%i errno:%i (%s)\n", wlen, errno, strerror(errno) );
+			g_Exit = true;
+		}
+	}
+
+	// zero copy only uses this for the pcap header and chunks that span files
+	if (s_OutputAIO && s_SplitPort)
+	{
+		// port files write their own header
+	}
+	else if (s_OutputAIO && s_OutputLZ4)
+	{
+		Compress_Write(Data, Length);
+	}
+	else if (s_OutputAIO)
+	{
+		Output_Write(s_Output, Data, Length);
+	}
+}
+
+//-------------------------------------------------------------------------------------------
+// switch to the pre-opened next file, the old one is closed on the rotate thread
+static void File_Rotate(void)
+{
+	u64 TSC0 = rdtsc();
+	while (s_OutputNext == NULL)
+	{
+		usleep(0);
+	}
+	Output_t* O = (Output_t*)s_OutputNext;
+	s_OutputNext = NULL;
+
+	// gathered writes are queued on this thread before the rotate thread closes it
+	Output_Kick(s_Output);
+
+	while (s_RotateRetirePut - s_RotateRetireGet >= 16)
+	{
+		usleep(0);
+	}
+	s_RotateRetire[s_RotateRetirePut & 15] = s_Output;
+	sfence();
+	s_RotateRetirePut++;
+
+	s_Output = O;
+	s_RotateCnt++;
+	s_RotateStall += rdtsc() - TSC0;
+
+	Output_Write(s_Output, s_FileHeader, s_FileHeaderLength);
+}
+
+//-------------------------------------------------------------------------------------------
+// advance the file position over a chunk, true when it starts a new file.
+// Start gets the chunks offset in its file
+static bool Rotate_Chunk(Rotate_t* R, u32 Length, u64 PeriodFirst, u64 PeriodLast, u32 SplitLast, u64* Start)
+{
+	bool New = false;
+
+	// size limit, at chunk boundaries
+	if (s_RotateSize && (R->Offset > s_FileHeaderLength) && (R->Offset + Length > s_RotateSize)) New = true;
+
+	// capture time period changed since the previous packet
+	if ((PeriodFirst != ROTATE_PERIOD_NONE) && (R->Period != ROTATE_PERIOD_NONE) && (PeriodFirst != R->Period)) New = true;
+
+	if (New) R->Offset = s_FileHeaderLength;
+	*Start = R->Offset;
+
+	// rotation inside the chunk, the next file holds whats after the last split
+	R->Offset = (SplitLast != 0) ? s_FileHeaderLength + Length - SplitLast : R->Offset + Length;
+	if (PeriodLast != ROTATE_PERIOD_NONE) R->Period = PeriodLast;
+
+	return New;
+}
+
+//-------------------------------------------------------------------------------------------
+// zero copy chunk released once its disk write completes, runs on the AIO thread 
+static void File_ChunkRelease(void* User)
+{
+	Chunk_t* C = (Chunk_t*)User;
+	if (__sync_sub_and_fetch(&C->WriteRef, 1) == 0) ChunkFree(C);
+}
+
+//-------------------------------------------------------------------------------------------
+// append each port run of the chunk to its ports file
+static void File_WritePort(Chunk_t* C)
+{
+	u32 Pos = 0;
+	for (int i=0; i < C->PortCnt; i++)
+	{
+		u32 Port	= C->PortList[i];
+		Output_t* O	= s_PortOutput[Port];
+		if (O == NULL)
+		{
+			O = Output_Open(Port, s_PortOutputSize, false);
+			s_PortOutput[Port] = O;
+			Output_Write(O, s_FileHeader, s_FileHeaderLength);
+		}
+		Output_Write(O, C->Data + Pos, C->PortLength[i]);
+		Pos += C->PortLength[i];
+	}
+	ChunkFree(C);
+}
+
+//-------------------------------------------------------------------------------------------
+// write a reordered chunk and recycle it 
+static void File_WriteChunk(Chunk_t* C)
+{
+	if (s_OutputLZ4)
+	{
+		Compress_Chunk(C);
+		return;
+	}
+	if (s_SplitPort)
+	{
+		File_WritePort(C);
+		return;
+	}
+
+	u64 Start;
+	u32 SplitLast = (C->SplitCnt > 0) ? C->Split[C->SplitCnt - 1] : 0;
+	if (Rotate_Chunk(&s_WriteRotate, C->Header.DataLength, C->PeriodFirst, C->PeriodLast, SplitLast, &Start))
+	{
+		File_Rotate();
+	}
+
+	// chunk spans files, pieces are copied 
+	if (C->SplitCnt > 0)
+	{
+		u32 Pos = 0;
+		for (int i=0; i < C->SplitCnt; i++)
+		{
+			File_Write(C->Data + Pos, C->Split[i] - Pos);
+			File_Rotate();
+			Pos = C->Split[i];
+		}
+		File_Write(C->Data + Pos, C->Header.DataLength - Pos);
+
+		// back to a sector tail for the next zero copy chunk
+		if (s_OutputZeroCopy) Output_Align(s_Output);
+
+		ChunkFree(C);
+		return;
+	}
+
+	if (!(s_OutputAIO && s_OutputZeroCopy))
+	{
+		File_Write(C->Data, C->Header.DataLength);
+		ChunkFree(C);
+		return;
+	}
+
+	// prepend the previous unaligned tail, payload was placed so 
+	// the tail fills the buffer up to the first byte 
+	Output_t* O	= s_Output;
+	u32 Residue	= O->BufferPos;
+	assert(C->Data == C->Buffer + Residue);
+	memcpy(C->Buffer, O->Buffer, Residue);
+
+	u32 Total	= Residue + C->Header.DataLength;
+	u32 Aligned	= Total & ~4095;
+
+	// new unaligned tail carried into the next chunk
+	O->BufferPos = Total - Aligned;
+	memcpy(O->Buffer, C->Buffer + Aligned, O->BufferPos);
+
+	s_OutputCopyByte	+= Residue + O->BufferPos;
+
+	// smaller than a sector, its all in the tail
+	if (Aligned == 0)
+	{
+		ChunkFree(C);
+		return;
+	}
+
+	// chunk goes back to the pool when all its writes complete
+	C->WriteRef = Stripe_PieceCnt(O->WriteOffset, Aligned);
+	Output_Submit(O, C->Buffer, Aligned, File_ChunkRelease, C);
+}
+
+//-------------------------------------------------------------------------------------------
+// zero copy chunks drained together go out as one vectored write per target 
+static void File_Submit(void)
+{
+	if (!(s_OutputAIO && s_OutputZeroCopy)) return;
+	if (s_SplitPort || s_OutputLZ4) return;
+
+	Output_Kick(s_Output);
+}
+
+//-------------------------------------------------------------------------------------------
+// everything but the last partial sector is on disk when this returns
+static void File_Sync(void)
+{
+	Output_Align(s_Output);
+	for (int t=0; t < s_StripeCnt; t++) fAIO_WriteFlush(s_Output->AIO[t]);
+
+	for (int t=0; t < s_StripeCnt; t++) fdatasync(s_Output->FD[t]);
+}
+
+//-------------------------------------------------------------------------------------------
+// record SeqNo as durably written. written to a temp file and renamed
+// so a crash leaves either the old or the new checkpoint. true once its on disk,
+// s_Checkpoint only changes then so it always matches the file
+static bool Checkpoint_Write(u32 SeqNo, u64 TotalByte, u64 TotalPkt)
+{
+	File_Sync();
+
+	Checkpoint_t C	= s_Checkpoint;
+	C.SeqNo			= SeqNo;
+	C.FileIndex		= s_Output->Index;
+	C.FilePeriod	= s_WriteRotate.Period;
+	C.FileOffset	= s_Output->WriteOffset + s_Output->BufferPos;
+	C.TotalByte		= TotalByte;
+	C.TotalPkt		= TotalPkt;
+	C.TailLength	= s_Output->BufferPos;
+	memcpy(C.Tail, s_Output->Buffer, s_Output->BufferPos);
+
+	u8 TempFileName[sizeof(s_CheckpointFileName) + 4];
+	sprintf(TempFileName, "%s.tmp", s_CheckpointFileName);
+
+	int fd = open(TempFileName, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+	if (fd < 0)
+	{
+		fprintf(stderr, "failed to create checkpoint [%s] %i %s\n", TempFileName, errno, strerror(errno));
+		return false;
+	}
+	int wlen = write(fd, &C, sizeof(C));
+	fdatasync(fd);
+	close(fd);
+
+	if ((wlen != sizeof(C)) || (rename(TempFileName, s_CheckpointFileName) < 0))
+	{
+		fprintf(stderr, "failed to write checkpoint [%s] %i %s\n", s_CheckpointFileName, errno, strerror(errno));
+		return false;
+	}
+	s_Checkpoint		= C;
+	s_CheckpointSaved	= true;
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// new checkpoint for the request, or load the previous one on --resume
+static bool Checkpoint_Open(CmdHeader_t* Cmd)
+{
+	Checkpoint_t C;
+	memset(&C, 0, sizeof(C));
+	C.Magic		= CHECKPOINT_MAGIC;
+	C.Version	= CHECKPOINT_VERSION;
+	memcpy(C.StreamName, Cmd->StreamName, sizeof(C.StreamName));
+	memcpy(C.Arg, Cmd->Arg, sizeof(C.Arg));
+	memcpy(C.FilterBPF, Cmd->FilterBPF, sizeof(C.FilterBPF));
+	memcpy(C.FilterRE, Cmd->FilterRE, sizeof(C.FilterRE));
+	C.Arg[CMDHEADER_ARG_SEQNO]		= 0;
+	C.Arg[CMDHEADER_ARG_COMPRESS]	= 0;
+	C.RotateSize	= s_RotateSize;
+	C.RotateNS		= s_RotateNS;
+	C.StripeCnt		= s_StripeCnt;
+	C.StripeSize	= s_StripeSize;
+	C.SnapLen		= s_SnapLen;
+	C.SnapHeaders	= s_SnapHeaders;
+	C.Pcapng		= s_Pcapng;
+	C.PcapngPortCnt	= s_PcapngPortCnt;
+	C.PcapngOptions	= s_PcapngOptions;
+
+	sprintf(s_CheckpointFileName, "%s.ckpt", s_OutputFileName);
+
+	s_Checkpoint		= C;
+	s_Resumed			= false;
+	s_CheckpointSaved	= false;
+	if (!s_Resume) return true;
+
+	int fd = open(s_CheckpointFileName, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "no checkpoint [%s], starting from the beginning\n", s_CheckpointFileName);
+		return true;
+	}
+	int rlen = read(fd, &s_Checkpoint, sizeof(s_Checkpoint));
+	close(fd);
+
+	if ((rlen != sizeof(s_Checkpoint)) || (s_Checkpoint.Magic != CHECKPOINT_MAGIC) || (s_Checkpoint.Version != CHECKPOINT_VERSION))
+	{
+		fprintf(stderr, "invalid checkpoint [%s]\n", s_CheckpointFileName);
+		return false;
+	}
+
+	// only the output position may differ
+	if ((memcmp(s_Checkpoint.StreamName, C.StreamName, sizeof(C.StreamName)) != 0) ||
+		(memcmp(s_Checkpoint.Arg, C.Arg, sizeof(C.Arg)) != 0) ||
+		(memcmp(s_Checkpoint.FilterBPF, C.FilterBPF, sizeof(C.FilterBPF)) != 0) ||
+		(memcmp(s_Checkpoint.FilterRE, C.FilterRE, sizeof(C.FilterRE)) != 0) ||
+		(s_Checkpoint.RotateSize != C.RotateSize) || (s_Checkpoint.RotateNS != C.RotateNS) ||
+		(s_Checkpoint.StripeCnt != C.StripeCnt) || (s_Checkpoint.StripeSize != C.StripeSize) ||
+		(s_Checkpoint.SnapLen != C.SnapLen) || (s_Checkpoint.SnapHeaders != C.SnapHeaders) ||
+		(s_Checkpoint.Pcapng != C.Pcapng) || (s_Checkpoint.PcapngPortCnt != C.PcapngPortCnt) || (s_Checkpoint.PcapngOptions != C.PcapngOptions))
+	{
+		fprintf(stderr, "checkpoint [%s] is for a different stream, time range, filter, rotation, striping, snaplen or format\n", s_CheckpointFileName);
+		return false;
+	}
+
+	// file must still hold everything up to the checkpoint sector
+	for (int t=0; t < s_StripeCnt; t++)
+	{
+		u8 FileName[256 + 16];
+		Output_FileName(FileName, s_StripeFileName[t], s_Checkpoint.FileIndex);
+
+		struct stat Stat;
+		if ((stat(FileName, &Stat) < 0) || (Stat.st_size < Stripe_Size(t, s_Checkpoint.FileOffset - s_Checkpoint.TailLength)))
+		{
+			fprintf(stderr, "output [%s] is shorter than checkpoint offset %lli\n", FileName, s_Checkpoint.FileOffset);
+			return false;
+		}
+	}
+
+	fprintf(stderr, "Resume [%s] SeqNo %i Offset %lli Pkts %lli Bytes %.3f GB\n", 
+		s_CheckpointFileName, 
+		s_Checkpoint.SeqNo + 1, 
+		s_Checkpoint.FileOffset, 
+		s_Checkpoint.TotalPkt, 
+		s_Checkpoint.TotalByte / 1e9);
+
+	s_Resumed			= true;
+	s_CheckpointSaved	= true;
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// flush any remaining data 
+static void File_Close(void)
+{
+	if (s_OutputStdout)
+	{
+		fflush(stdout);
+	}
+	if (s_OutputAIO && s_SplitPort)
+	{
+		for (int p=0; p < FPACKET_PORT_MAX; p++)
+		{
+			if (s_PortOutput[p] == NULL) continue;
+
+			u64 Size = Output_Close(s_PortOutput[p]);
+			if (!g_Quiet) fprintf(stderr, "Port %2i %.3f GB\n", p, Size / 1e9);
+			s_PortOutput[p] = NULL;
+		}
+	}
+	else if (s_OutputAIO)
+	{
+		if (s_OutputLZ4) Compress_Close();
+
+		Output_Close(s_Output);
+		s_Output = NULL;
+
+		// close retired files, drop the pre-opened one
+		if (s_RotateSize || s_RotateNS)
+		{
+			s_RotateExit = true;
+			pthread_join(s_RotateThread, NULL);
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------
+// chunks come from a pool with per thread magazines, RxThreads allocate
+// and the reorder thread frees without sharing a lock 
+Chunk_t* ChunkAlloc(void)
+{
+	Chunk_t* C = (Chunk_t*)fPool_Alloc(s_ChunkPool);
+	if (C != NULL)
+	{
+		// reset
+		C->SeqNo = 0;	
+		C->Data	 = C->Buffer;
+
+		C->PeriodFirst	= ROTATE_PERIOD_NONE;
+		C->PeriodLast	= ROTATE_PERIOD_NONE;
+		C->SplitCnt		= 0;
+		C->PortCnt		= 0;
+	}
+	return C;
+}
+
+void ChunkFree(Chunk_t* C)
+{
+	fPool_Free(s_ChunkPool, C);
+}
+
+//-------------------------------------------------------------------------------------------
+// zero copy placement. each RxThread publishes its chunk length, then 
+// waits for the running file offset of all prior chunks to get where 
+// in the buffer the payload must land. headers arrive well ahead of 
+// the payloads so the wait is short 
+static void ChunkPlacePublish(Chunk_t* C, u32 Length)
+{
+	ChunkPlace_t* P = &s_Place[C->SeqNo & (PLACE_MAX - 1)];
+	P->Length		= Length;
+	P->SplitLast	= (C->SplitCnt > 0) ? C->Split[C->SplitCnt - 1] : 0;
+	P->PeriodFirst	= C->PeriodFirst;
+	P->PeriodLast	= C->PeriodLast;
+	sfence();
+	P->SeqNo		= C->SeqNo;
+}
+
+static u32 ChunkPlaceSkew(u32 SeqNo)
+{
+	while (true)
+	{
+		// advance the running offset over every published chunk 
+		if (__sync_bool_compare_and_swap(&s_PlaceLock, 0, 1))
+		{
+			while (true)
+			{
+				ChunkPlace_t* P = &s_Place[s_PlaceSeqNo & (PLACE_MAX - 1)];
+				if (P->SeqNo != s_PlaceSeqNo) break;
+
+				// same file switches as the writer
+				u64 Start;
+				Rotate_Chunk(&s_PlaceRotate, P->Length, P->PeriodFirst, P->PeriodLast, P->SplitLast, &Start);
+				P->Skew			= Start & 4095;
+
+				sfence();
+				s_PlaceSeqNo++;
+			}
+			sync_unlock((u32*)&s_PlaceLock);
+		}
+
+		if ((s32)(s_PlaceSeqNo - SeqNo) > 0) break;
+		if (g_Exit) return 0;
+		usleep(0);
+	}
+	return s_Place[SeqNo & (PLACE_MAX - 1)].Skew;
+}
+
+//-------------------------------------------------------------------------------------------
+
+static Network_t* NetworkOpen(u32 CPUID, u32 PortBase, u8* IPAddress)
+{
+	Network_t* N = memalign2(4*1024,  sizeof(Network_t)); 
+	memset(N, 0, sizeof(Network_t));
+
+	N->CPUID		= CPUID;
+
+	N->Sock = socket(AF_INET, SOCK_STREAM, 0);
+	assert(N->Sock > 0);
+	
+	// listen address 
+	memset((char *) &N->BindAddr, 0, sizeof(N->BindAddr));
+
+	N->BindAddr.sin_family 		= AF_INET;
+	N->BindAddr.sin_port 		= htons(PortBase + CPUID);
+	N->BindAddr.sin_addr.s_addr = inet_addr(IPAddress);
+
+	// retry connection a few times 
+	int ret = -1;
+	for (int r=0; r < 10; r++)
+	{
+		//bind socket to port
+		ret = connect(N->Sock, (struct sockaddr*)&N->BindAddr, sizeof(N->BindAddr));
+		if (ret >= 0) break;
+
+		// connection timed out
+		usleep(100e3);
+	}
+	if (ret < 0)
+	{
+		fprintf(stderr, "connect failed: %i %i : %s : %s:%i\n", ret, errno, strerror(errno), IPAddress, PortBase + CPUID); 
+		close(N->Sock);
+		free(N);
+		return NULL;
+	}
+
+	// set massive recvie buffer to minimize packet drops
+	int size = kMB(256);
+	ret = setsockopt(N->Sock, SOL_SOCKET, SO_RCVBUF, (char *)&size, sizeof(size));  
+	if (ret < 0)
+	{
+		fprintf(stderr, "failed to set recv buffer size: %i %s\n", ret, strerror(errno));
+	}
+
+	// packet recv buffer
+	N->Buffer 		= memalign2(128, 256*1024);
+	N->BufferMax 	= 256*1024;
+
+	// reset queue
+	N->ChunkPut		= 0;
+	N->ChunkGet		= 0;
+
+	return N;
+}
+
+static void NetworkClose(Network_t* N)
+{
+	close(N->Sock);
+	free(N->Buffer);
+	free(N);
+}
+
+//-------------------------------------------------------------------------------------------
+
+static bool RecvSock(int Sock, u8* Buffer8, s32 BufferLength)
+{
+	while (BufferLength > 0)
+	{
+		int rlen = recv(Sock, Buffer8, BufferLength, 0);
+		if (rlen <= 0)
+		{
+			if (errno != EAGAIN)
+			{
+				fprintf(stderr, "RecvSock Error %i %i %s\n", rlen, errno, strerror(errno));
+				return false;	
+			}
+		}
+		else
+		{
+			// iterate thought the raw buffer 
+			BufferLength	-= rlen;
+			Buffer8			+= rlen;	
+		}
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------------------
+// process a single TCP condition and push the result on the output queu
+void* RxThread(void* _User)
+{
+	Network_t* N = (Network_t*)_User;
+	if (!g_Quiet) fprintf(stderr, "[%i] RxThread starting\n", N->CPUID);
+
+	fProfile_ThreadInit("rx");
+
+	// time range edges are trimmed per packet
+	bool Window	= (s_TSFrom != 0) || (s_TSTo != 0);
+	u64 TSTo	= (s_TSTo != 0) ? s_TSTo : (u64)-1;
+
+	// packets are truncated after filtering, which still sees the full payload
+	bool Slice	= (s_SnapLen != 0) || s_SnapHeaders;
+
+	// offset of each packet in the current chunk
+	bool Filter = (s_Filter != NULL) || (s_Match != NULL) || Window || (s_RotateNS != 0) || Slice || s_SplitPort || s_Pcapng;
+	u32* PktOffset = NULL;
+	if (Filter) PktOffset = (u32*)memalign2(64, FPACKET_OFFSET_MAX * sizeof(u32));
+
+	// port of each packet, the fmad header is gone after conversion
+	u8* PortMap = NULL;
+	if (s_SplitPort || s_Pcapng) PortMap = (u8*)memalign2(64, FPACKET_PORTMAP_MAX);
+
+	// pcapng interface of each packet that is kept
+	u8* PktPort = NULL;
+	if (s_Pcapng) PktPort = (u8*)memalign2(64, FPACKET_OFFSET_MAX);
+
+	// per thread regex state + hit counters
+	fMatchCtx_t* MatchCtx = NULL;
+	if (s_Match) MatchCtx = fMatch_CtxOpen(s_Match);
+
+	// receive at maximum rate per thread 
+	bool Exit = false;
+	while (!Exit)
+	{
+		// global exit
+		if (g_Exit) break;
+
+		u64 TSC0 = rdtsc();
+
+		// dont have too many outstanding entries
+		// Put/Get are 64b and reset for each download
+		// its impossible to for this to wrap around 
+		if (N->ChunkPut  - N->ChunkGet >= 192) 
+		{
+			fProfile_Start(PROFILE_RX_STALL, "stall");
+			usleep(0);
+			fProfile_Stop(PROFILE_RX_STALL);
+
 			s_WorkerCPUStall[N->CPUID] 	+= rdtsc() - TSC0;
 			s_WorkerCPUTop[N->CPUID] 	+= rdtsc() - TSC0;
 			continue;
@@ -484,19 +1580,23 @@ void* RxThread(void* _User)
 		if (C == NULL)
 		{
 			// no chunks free
+			fProfile_Start(PROFILE_RX_STALL, "stall");
 			usleep(0);
+			fProfile_Stop(PROFILE_RX_STALL);
 			s_WorkerCPUStall[N->CPUID] 	+= rdtsc() - TSC0;
 			s_WorkerCPUTop[N->CPUID] 	+= rdtsc() - TSC0;
 			continue;
 		}
 
 		// get the packet header first
+		fProfile_Start(PROFILE_RX_RECV, "recv");
 		s32 HeaderLength 	= sizeof(PktHeader_t);
 		u8* Header8			= (u8*)&C->Header;
 		if(!RecvSock(N->Sock, Header8, HeaderLength))
 		{
 			Exit = true;
 			fprintf(stderr, "recv failed %s\n", strerror(errno));
+			ChunkFree(C);
 			break;
 		}
 
@@ -508,6 +1608,7 @@ void* RxThread(void* _User)
 			{
 				s_EOFSeqNo		= C->Header.SeqNo;
 			}
+			ChunkFree(C);
 			break;
 		}
 
@@ -515,51 +1616,169 @@ void* RxThread(void* _User)
 		assert(C->Header.SeqNo != 0);
 		C->SeqNo = C->Header.SeqNo;
 
-		// get the data payload
+		// zero copy payload lands at its file offset alignment. with a filter
+		// the length is only known after filtering, so receive above the 
+		// alignment headroom and compact down once the skew is known
+		bool Place = s_OutputAIO && s_OutputZeroCopy;
+		if (Place && !Filter)
+		{
+			ChunkPlacePublish(C, C->Header.DataLength);
+			C->Data = C->Buffer + ChunkPlaceSkew(C->SeqNo);
+		}
+		else if (Place)
+		{
+			C->Data = C->Buffer + 4096;
+		}
+
+		// get the data payload. compressed chunks land in the connection 
+		// buffer and decode into place
+		bool LZ4		= (C->Header.Flag & PACKETHEADER_FLAG_LZ4) != 0;
 		s32 BufferLength= C->Header.XferLength;
-		u8* Buffer8		= (u8*)C->Data;
+		u8* Buffer8		= LZ4 ? N->Buffer : (u8*)C->Data;
+		if (LZ4 && ((BufferLength > N->BufferMax) || (C->Header.DataLength > FPACKET_CHUNK_MAX)))
+		{
+			Exit = true;
+			fprintf(stderr, "[%i] SeqNo %i invalid compressed chunk Xfer %i Data %i\n", N->CPUID, C->SeqNo, BufferLength, C->Header.DataLength);
+			ChunkFree(C);
+			break;
+		}
 		if(!RecvSock(N->Sock, Buffer8, BufferLength))
 		{
 			Exit = true;
 			fprintf(stderr, "recv data failed %s\n", strerror(errno));
+			ChunkFree(C);
 			break;
 		}
+		fProfile_Stop(PROFILE_RX_RECV);
 		u64 TSC1 = rdtsc();
 		s_WorkerCPUIO[N->CPUID] += TSC1 - TSC0;
 
-		// stats 
-		N->TotalByte 	+= BufferLength;
+		if (LZ4)
+		{
+			fProfile_Start(PROFILE_RX_DECODE, "lz4 decode");
+			s32 Length = fLZ4_Decompress((u8*)C->Data, C->Header.DataLength, N->Buffer, BufferLength);
+			fProfile_Stop(PROFILE_RX_DECODE);
+			if (Length != C->Header.DataLength)
+			{
+				fprintf(stderr, "[%i] SeqNo %i LZ4 decode failed %i of %i bytes\n", N->CPUID, C->SeqNo, Length, C->Header.DataLength);
+				Exit	= true;
+				g_Exit	= true;
+				ChunkFree(C);
+				break;
+			}
+			N->LZ4Chunk++;
 
-		// packet count
-		u64 PktCnt 		= 0; 
+			u64 TSC = rdtsc();
+			s_WorkerCPUDecode[N->CPUID] += TSC - TSC1;
+			TSC1 = TSC;
+		}
 
-		// filter out and translate to PCAP format 
-		u8* Data8 = (u8*)C->Data;	
-		u8* Data8End = Data8 + C->Header.DataLength; 
-		while (Data8 < Data8End)
+		// stats 
+		N->TotalByte 	+= C->Header.DataLength;
+		N->XferByte 	+= BufferLength;
+
+		// translate to PCAP format. single pass scalar measures faster than
+		// the two pass kernel for a plain convert, see --bench-convert
+		fProfile_Start(PROFILE_RX_PARSE, "parse");
+		u64 PktCnt		= 0;
+		if (!Filter)
 		{
-			FMADPacket_t* FPkt 	= (FMADPacket_t*)Data8;
-			PCAPPacket_t* PPkt 	= (PCAPPacket_t*)FPkt;
+			fProfile_Start(PROFILE_RX_CONVERT, "convert");
+			PktCnt		= fPacket_FMAD2PCAP((u8*)C->Data, C->Header.DataLength);
+			fProfile_Stop(PROFILE_RX_CONVERT);
+		}
+		// filter needs the packet offsets, matching packets are compacted
+		else
+		{
+			u8* Data8		= (u8*)C->Data;
+			u32 PktTotal	= 0;
+			fProfile_Start(PROFILE_RX_CONVERT, "convert");
+			if (PortMap)
+			{
+				PktTotal	= fPacket_OffsetTable(Data8, C->Header.DataLength, PktOffset);
+				fPacket_PortMap(Data8, PktOffset, PktTotal, PortMap);
+				fPacket_FMAD2PCAPTable(Data8, PktOffset, PktTotal);
+			}
+			else
+			{
+				PktTotal	= fPacket_FMAD2PCAPBatch(Data8, C->Header.DataLength, PktOffset);
+			}
+			fProfile_Stop(PROFILE_RX_CONVERT);
+
+			// time range, header filter, then payload regex on what is left
+			fProfile_Start(PROFILE_RX_FILTER, "filter");
+			u32 KeepByte	= C->Header.DataLength;
+			PktCnt			= PktTotal;
+			if (Window)
+			{
+				PktCnt		= fPacket_TrimTime(Data8, PktOffset, PktCnt, s_TSFrom, TSTo, &KeepByte);
+
+				N->TrimPkt	+= PktTotal - PktCnt;
+				N->TrimByte	+= C->Header.DataLength - KeepByte;
+			}
+			if (s_Filter)	PktCnt = fFilter_Chunk(s_Filter, Data8, PktOffset, PktCnt, &KeepByte);
+			if (MatchCtx)	PktCnt = fMatch_Chunk(MatchCtx, Data8, PktOffset, PktCnt, &KeepByte);
+			if (Slice)
+			{
+				N->SliceByte		+= KeepByte;
+				KeepByte			= fPacket_Slice(Data8, PktOffset, PktCnt, s_SnapLen, s_SnapHeaders);
+				N->SliceByteKeep	+= KeepByte;
+			}
+			fProfile_Stop(PROFILE_RX_FILTER);
+
+			// where the capture time crosses a rotation period
+			if (s_RotateNS) C->SplitCnt = fPacket_SplitTime(Data8, PktOffset, PktCnt, s_RotateNS, &C->PeriodFirst, &C->PeriodLast, C->Split, CHUNK_SPLIT_MAX);
 
-			// convert from fmad packet to pcap packet
-			u64 TS				= FPkt->TS;
-			u32 LengthCapture 	= FPkt->LengthCapture;
-			u32 LengthWire 		= FPkt->LengthWire;
+			// pcapng size is needed up front for zero copy placement
+			u32 OutputByte	= KeepByte;
+			if (s_Pcapng)
+			{
+				for (int i=0; i < PktCnt; i++) PktPort[i] = PortMap[PktOffset[i] / sizeof(FMADPacket_t)];
+				OutputByte	= fPacket_PCAPNGLayout(Data8, PktOffset, PktCnt, s_PcapngOptions, C->Split, C->SplitCnt);
+				if (OutputByte > s_ChunkBufferSize - 4096)
+				{
+					fprintf(stderr, "[%i] SeqNo %i pcapng blocks %i bytes do not fit the chunk\n", N->CPUID, C->SeqNo, OutputByte);
+					Exit	= true;
+					g_Exit	= true;
+					ChunkFree(C);
+					break;
+				}
+			}
 
-			u32 PortNo			= FPkt->PortNo;
+			fProfile_Start(PROFILE_RX_COMPACT, "compact");
+			u8* Dst			= Data8;
+			if (Place)
+			{
+				ChunkPlacePublish(C, OutputByte);
+				Dst			= C->Buffer + ChunkPlaceSkew(C->SeqNo);
+			}
+			// port runs are built in the idle compressed receive buffer
+			if (s_SplitPort)
+			{
+				C->PortCnt	= fPacket_CompactPort(N->Buffer, Data8, PktOffset, PktCnt, PortMap, C->PortList, C->PortLength);
+				memcpy(Dst, N->Buffer, KeepByte);
+			}
+			else
+			{
+				fPacket_Compact(Dst, Data8, PktOffset, PktCnt);
+			}
+			fProfile_Stop(PROFILE_RX_COMPACT);
 
-			//
-			// *** here is where any custom filter logic goes ***
-			//
+			// expands in place, PktOffset is free after compaction
+			if (s_Pcapng)
+			{
+				fProfile_Start(PROFILE_RX_PCAPNG, "pcapng");
+				fPacket_PCAPNG(Dst, PktOffset, PktCnt, PktPort, s_PcapngPortCnt, s_PcapngOptions);
+				fProfile_Stop(PROFILE_RX_PCAPNG);
+				N->PcapngByte		+= OutputByte;
+			}
 
-			// overwrite
-			PPkt->Sec			= TS / 1e9;
-			PPkt->NSec			= TS - (u64)PPkt->Sec * 1000000000ULL;		// carefull keep full 64bit precision..
-			PPkt->LengthCapture	= LengthCapture;
-			PPkt->LengthWire	= LengthWire;
+			C->Data					= Dst;
+			C->Header.DataLength	= OutputByte;
 
-			Data8 += sizeof(PCAPPacket_t) + PPkt->LengthCapture;
-			PktCnt += 1;
+			N->FilterPkt		+= PktTotal;
+			N->FilterPktKeep	+= PktCnt;
+			N->FilterByteKeep	+= KeepByte;
 		}
 
 		N->TotalChunk++;
@@ -568,109 +1787,265 @@ void* RxThread(void* _User)
 		// update packet count
 		C->PktCnt = PktCnt;
 
-		// push onto serialization queue
-		u32 Index = (N->Queue.Put & N->Queue.Mask); 
+		C->StreamID		= N->CPUID;
+
+		fProfile_Stop(PROFILE_RX_PARSE);
+
+		u64 TSC2 = rdtsc();
+		s_WorkerCPUParse[N->CPUID] += TSC2 - TSC1;
 
-		N->Queue.Entry[Index] = C;
+		// wait for the slot to be inside the reorder window 
+		fProfile_Start(PROFILE_RX_REORDER, "reorder");
+		while ((u32)(C->SeqNo - s_ReorderSeqNo) >= s_ReorderMax)
+		{
+			if (g_Exit) break;
+			usleep(0);
+		}
 
-		// kick it
+		// place in the reorder buffer 
 		sfence();
-		N->Queue.Put++;
+		s_ReorderSlot[C->SeqNo & (s_ReorderMax - 1)] = C;
+		N->ChunkPut++;
+
+		// highest placed for reorder depth 
+		u32 SeqMax;
+		while ((s32)(C->SeqNo - (SeqMax = s_ReorderSeqMax)) > 0)
+		{
+			if (__sync_bool_compare_and_swap(&s_ReorderSeqMax, SeqMax, C->SeqNo)) break;
+		}
+		fProfile_Stop(PROFILE_RX_REORDER);
 
-		s_WorkerCPUParse[N->CPUID] += rdtsc() - TSC1;
+		s_WorkerCPUStall[N->CPUID] += rdtsc() - TSC2;
 		s_WorkerCPUTop	[N->CPUID] += rdtsc() - TSC0;
 	}
 
+	// return cached chunks to the shared pool 
+	fPool_ThreadFlush(s_ChunkPool);
+	free(PktOffset);
+	free(PortMap);
+	free(PktPort);
+	if (MatchCtx) fMatch_CtxClose(MatchCtx);
+
 	if (!g_Quiet) fprintf(stderr, "[%i] RxThread exit\n", N->CPUID);
 
 	return NULL;
 }
 
+//-------------------------------------------------------------------------------------------
+// render the metrics page from the reorder thread, once a second with the stats line
+static void Metrics_Publish(Network_t** N, bool Done, u64 TotalByte, u64 TotalPkt, double bps, u32 SeqNo, s32 ReorderDepth, u32 ReorderDepthMax, float CPUIO, float CPUGap)
+{
+	static u8 Page[FMETRICS_PAGE_MAX];
+	static fHisto_t WrLast;						// merged write histogram at the last publish
+	static fAIO_t* WrLastAIO = NULL;
+	char Label[384];
+	u32 Pos = 0;
+
+	fMetrics_Label(Label, sizeof(Label), "stream", (char*)s_MetricsStream);
+	Pos = fMetrics_Add(Page, Pos, "info",				"gauge",	Label, 1);
+	Pos = fMetrics_Add(Page, Pos, "done",				"gauge",	"", Done);
+	Pos = fMetrics_Add(Page, Pos, "bytes_total",		"counter",	"", TotalByte);
+	Pos = fMetrics_Add(Page, Pos, "packets_total",		"counter",	"", TotalPkt);
+	Pos = fMetrics_Add(Page, Pos, "throughput_gbps",	"gauge",	"", bps / 1e9);
+	Pos = fMetrics_Add(Page, Pos, "seqno",				"gauge",	"", SeqNo);
+	Pos = fMetrics_Add(Page, Pos, "eof_seqno",			"gauge",	"", s_EOFSeqNo);
+	Pos = fMetrics_Add(Page, Pos, "pool_free_chunks",	"gauge",	"", fPool_FreeCnt(s_ChunkPool));
+	Pos = fMetrics_Add(Page, Pos, "reorder_depth",		"gauge",	"", ReorderDepth);
+	Pos = fMetrics_Add(Page, Pos, "reorder_depth_max",	"gauge",	"", ReorderDepthMax);
+
+	// per connection
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		sprintf(Label, "{conn=\"%i\"}", c);
+		Pos = fMetrics_Add(Page, Pos, "conn_queue_depth",		(c == 0) ? "gauge" : NULL,		Label, (u32)(N[c]->ChunkPut - N[c]->ChunkGet));
+	}
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		sprintf(Label, "{conn=\"%i\"}", c);
+		Pos = fMetrics_Add(Page, Pos, "conn_bytes_total",		(c == 0) ? "counter" : NULL,	Label, N[c]->TotalByte);
+	}
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		sprintf(Label, "{conn=\"%i\"}", c);
+		Pos = fMetrics_Add(Page, Pos, "conn_wire_bytes_total",	(c == 0) ? "counter" : NULL,	Label, N[c]->XferByte);
+	}
+
+	// disk writes on the current output, per stripe target
+	if (s_Output != NULL)
+	{
+		double Pct[]		= { 0.5, 0.9, 0.99, 0.999 };
+		const char* PctStr[]= { "0.5", "0.9", "0.99", "0.999" };
+		for (int t=0; t < s_StripeCnt; t++)
+		{
+			sprintf(Label, "{target=\"%i\"}", t);
+			Pos = fMetrics_Add(Page, Pos, "aio_pending_ops",	(t == 0) ? "gauge" : NULL, Label, fAIO_NumPending(s_Output->AIO[t]));
+		}
+		for (int t=0; t < s_StripeCnt; t++)
+		{
+			sprintf(Label, "{target=\"%i\"}", t);
+			Pos = fMetrics_Add(Page, Pos, "aio_queue_depth_limit",	(t == 0) ? "gauge" : NULL, Label, s_Output->AIO[t]->QueueDepth);
+		}
+		for (int t=0; t < s_StripeCnt; t++)
+		{
+			sprintf(Label, "{target=\"%i\"}", t);
+			Pos = fMetrics_Add(Page, Pos, "aio_block_bytes",		(t == 0) ? "gauge" : NULL, Label, s_Output->AIO[t]->BlockSizeNext);
+		}
+		for (int t=0; t < s_StripeCnt; t++)
+		{
+			u64 Latency[4];
+			u64 Count = fAIO_LatencyPercentile(s_Output->AIO[t], Pct, Latency, 4);
+			for (int p=0; p < 4; p++)
+			{
+				sprintf(Label, "{target=\"%i\",quantile=\"%s\"}", t, PctStr[p]);
+				Pos = fMetrics_Add(Page, Pos, "write_latency_seconds", ((t == 0) && (p == 0)) ? "summary" : NULL, Label, Latency[p] / 1e9);
+			}
+			sprintf(Label, "{target=\"%i\"}", t);
+			Pos = fMetrics_Add(Page, Pos, "write_latency_seconds_sum",	NULL, Label, s_Output->AIO[t]->HistoWr.Sum / 1e9);
+			Pos = fMetrics_Add(Page, Pos, "write_latency_seconds_count",	NULL, Label, Count);
+		}
+
+		// tail over all targets since the last publish. a new output
+		// (rotation) starts a new interval
+		fHisto_t Merged, Interval;
+		fHisto_Reset(&Merged);
+		for (int t=0; t < s_StripeCnt; t++) fHisto_Merge(&Merged, &s_Output->AIO[t]->HistoWr);
+		if (WrLastAIO != s_Output->AIO[0]) fHisto_Reset(&WrLast);
+		WrLastAIO = s_Output->AIO[0];
+		fHisto_Interval(&Merged, &WrLast, &Interval);
+
+		u64 Latency[4];
+		fHisto_Percentile(&Interval, Pct, Latency, 4);
+		for (int p=0; p < 4; p++)
+		{
+			sprintf(Label, "{quantile=\"%s\"}", PctStr[p]);
+			Pos = fMetrics_Add(Page, Pos, "write_latency_interval_seconds", (p == 0) ? "gauge" : NULL, Label, Latency[p] / 1e9);
+		}
+		Pos = fMetrics_Add(Page, Pos, "write_latency_interval_max_seconds",	"gauge", "", Interval.Max / 1e9);
+		Pos = fMetrics_Add(Page, Pos, "write_interval_ops",					"gauge", "", Interval.Count);
+	}
+
+	// cpu ratios, same as the stats line
+	u64 WorkerCPUTop = 0, WorkerCPUIO = 0, WorkerCPUParse = 0, WorkerCPUStall = 0, WorkerCPUDecode = 0;
+	for (int i=0; i < s_StreamCnt; i++)
+	{
+		WorkerCPUTop 	+= s_WorkerCPUTop[i]; 
+		WorkerCPUIO 	+= s_WorkerCPUIO[i]; 
+		WorkerCPUParse 	+= s_WorkerCPUParse[i]; 
+		WorkerCPUStall 	+= s_WorkerCPUStall[i]; 
+		WorkerCPUDecode	+= s_WorkerCPUDecode[i]; 
+	}
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", "gauge",	"{thread=\"core\",state=\"io\"}",		CPUIO);
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", NULL,	"{thread=\"core\",state=\"gap\"}",		CPUGap);
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", NULL,	"{thread=\"worker\",state=\"io\"}",		WorkerCPUIO * inverse(WorkerCPUTop));
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", NULL,	"{thread=\"worker\",state=\"decode\"}",	WorkerCPUDecode * inverse(WorkerCPUTop));
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", NULL,	"{thread=\"worker\",state=\"parse\"}",	WorkerCPUParse * inverse(WorkerCPUTop));
+	Pos = fMetrics_Add(Page, Pos, "cpu_ratio", NULL,	"{thread=\"worker\",state=\"stall\"}",	WorkerCPUStall * inverse(WorkerCPUTop));
+
+	fMetrics_Publish(s_Metrics, Page, Pos);
+}
+
 //-------------------------------------------------------------------------------------------
 // master control thread that takes blocks recevied by each thread and
 // re-assemables them in order 
 static void GetStreamData(u64 MaxSize, u8* IPAddress)
 {
 	u64 TSStart = clock_ns();
+	double CPUStart = CPUTime();
+
+	fProfile_ThreadInit("core");
 
 	// init network connections	
-	Network_t* N[4];
-	N[0] = NetworkOpen(0, 10010, IPAddress);
-	N[1] = NetworkOpen(1, 10010, IPAddress);
-	N[2] = NetworkOpen(2, 10010, IPAddress);
-	N[3] = NetworkOpen(3, 10010, IPAddress);
+	Network_t* N[STREAM_MAX];
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		N[c] = NetworkOpen(c, PROTOCOL_PORT_DATA, IPAddress);
+		if (N[c] == NULL)
+		{
+			fprintf(stderr, "failed to open data connection %i\n", c);
+
+			// connections already up for the lower ports
+			for (int i=0; i < c; i++) NetworkClose(N[i]);
+			return;
+		}
+	}
 
-	// init the locks
-	s_ChunkFreeLock[0] = 1;
-	Unlock(&s_ChunkFreeLock[0]);
+	// allocate chunks, 256 per connection + the zero copy writes in flight
+	s_ChunkBufferSize = 4096 + (s_Pcapng ? 2 : 1) * FPACKET_CHUNK_MAX;
+	s_ChunkPool = fPool_Create(256 * s_StreamCnt + 128, sizeof(Chunk_t) + s_ChunkBufferSize, 4096, 32);
 
 	// open data output 
 	File_Open(MaxSize);
 
 	// write pcap header
-	PCAPHeader_t	PCAPHeader;
-	PCAPHeader.Magic	= PCAPHEADER_MAGIC_NANO;
-	PCAPHeader.Major	= PCAPHEADER_MAJOR;
-	PCAPHeader.Minor	= PCAPHEADER_MINOR;
-	PCAPHeader.TimeZone	= 0; 
-	PCAPHeader.SigFlag	= 0; 
-	PCAPHeader.SnapLen	= 65535; 
-	PCAPHeader.Link		= PCAPHEADER_LINK_ETHERNET;
-	File_Write((u8*)&PCAPHeader, sizeof(PCAPHeader));
+	File_Header();
+	if (!s_Resumed) File_Write(s_FileHeader, s_FileHeaderLength);
+
+	// resume carries on after the checkpoint chunk
+	u32 SeqNoStart	= s_Resumed ? s_Checkpoint.SeqNo + 1 : 1;
+
+	// first chunk follows the pcap header
+	s_WriteRotate.Offset	= s_Resumed ? s_Checkpoint.FileOffset : s_FileHeaderLength;
+	s_WriteRotate.Period	= s_Resumed ? s_Checkpoint.FilePeriod : ROTATE_PERIOD_NONE;
+
+	s_PlaceSeqNo	= SeqNoStart;
+	s_PlaceRotate	= s_WriteRotate;
+
+	// reorder buffer covers every chunk that can be in flight 
+	s_ReorderMax	= 1;
+	while (s_ReorderMax < s_ChunkPool->ObjMax) s_ReorderMax *= 2;
+
+	s_ReorderSlot	= (Chunk_t* volatile*)calloc(s_ReorderMax, sizeof(Chunk_t*));
+	assert(s_ReorderSlot != NULL);
+
+	s_ReorderSeqNo	= SeqNoStart;
+	s_ReorderSeqMax	= SeqNoStart - 1;
 
-	// allocate chunks
-	for (int i=0; i < 1024; i++)
-	{
-		Chunk_t* C = (Chunk_t*)memalign2(128, sizeof(Chunk_t));
-		ChunkFree(C);
-	}
 
 	// spin up the worker threads 
-	pthread_t   RxThread0;
-	pthread_t   RxThread1;
-	pthread_t   RxThread2;
-	pthread_t   RxThread3;
-	pthread_t   RxThread4;
-	pthread_t   RxThread5;
-
-	pthread_create(&RxThread0, NULL, RxThread, (void*)N[0]);
-	pthread_create(&RxThread1, NULL, RxThread, (void*)N[1]);
-	pthread_create(&RxThread2, NULL, RxThread, (void*)N[2]);
-	pthread_create(&RxThread3, NULL, RxThread, (void*)N[3]);
-
-	cpu_set_t RxThread0CPU;
-	CPU_ZERO(&RxThread0CPU);
-	CPU_SET (20, &RxThread0CPU);
-	pthread_setaffinity_np(RxThread0, sizeof(cpu_set_t), &RxThread0CPU);
-
-	cpu_set_t RxThread1CPU;
-	CPU_ZERO(&RxThread1CPU);
-	CPU_SET (21, &RxThread1CPU);
-	pthread_setaffinity_np(RxThread1, sizeof(cpu_set_t), &RxThread1CPU);
-
-	cpu_set_t RxThread2CPU;
-	CPU_ZERO(&RxThread2CPU);
-	CPU_SET (22, &RxThread2CPU);
-	pthread_setaffinity_np(RxThread2, sizeof(cpu_set_t), &RxThread2CPU);
-
-	cpu_set_t RxThread3CPU;
-	CPU_ZERO(&RxThread3CPU);
-	CPU_SET (23, &RxThread3CPU);
-	pthread_setaffinity_np(RxThread3, sizeof(cpu_set_t), &RxThread3CPU);
+	u32 CPUCnt = sysconf(_SC_NPROCESSORS_CONF);
+
+	pthread_t   RxThreadList[STREAM_MAX];
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		pthread_create(&RxThreadList[c], NULL, RxThread, (void*)N[c]);
+
+		// pin to the cpu list, or the default cpu 20+ if it exists 
+		s32 CPU = -1;
+		if (s_StreamCPUCnt > 0)		CPU = s_StreamCPU[c % s_StreamCPUCnt];
+		else if (20 + c < CPUCnt)	CPU = 20 + c;
+		if (CPU < 0) continue;
+
+		cpu_set_t RxThreadCPU;
+		CPU_ZERO(&RxThreadCPU);
+		CPU_SET (CPU, &RxThreadCPU);
+		if (pthread_setaffinity_np(RxThreadList[c], sizeof(cpu_set_t), &RxThreadCPU) != 0)
+		{
+			fprintf(stderr, "[%i] failed to pin RxThread to cpu %i\n", c, CPU);
+		}
+	}
 
 	u64 NextPrintTSC = 0;
 
-	u32 SeqNo 		= 1;			// SeqNo 0 is reserved
-	u64 TotalByte 	= 0;
-	u64 TotalPkt	= 0;
+	u32 SeqNo 		= SeqNoStart;	// SeqNo 0 is reserved
+	u64 TotalByte 	= s_Resumed ? s_Checkpoint.TotalByte : 0;
+	u64 TotalPkt	= s_Resumed ? s_Checkpoint.TotalPkt : 0;
 
-	u64 LastByte 	= 0;
+	u64 StartByte	= TotalByte;		// already on disk before a resume
+	u64 StartPkt	= TotalPkt;
+
+	u64 LastByte 	= TotalByte;
 	u64 LastTSC  	= 0;
 
 	u64 LastDataTSC = rdtsc();			// last time data was processed
 
+	// checkpoints need a file to resume into
+	bool Checkpoint			= s_OutputAIO && (s_CheckpointSec != 0) && !s_OutputLZ4 && !s_SplitPort;
+	u64 NextCheckpointTSC	= rdtsc() + ns2tsc(s_CheckpointSec * 1e9);
+
 	u64 CycleTotalTop 	= 0;
 	u64 CycleTotalIO  	= 0;
+	u64 CycleTotalGap  	= 0;			// waiting on a missing chunk with later chunks ready
+	u32 ReorderDepthMax	= 0;
 
 	while (!g_Exit)
 	{
@@ -686,48 +2061,65 @@ static void GetStreamData(u64 MaxSize, u8* IPAddress)
 
 			// core cpu io write stalls
 			float CPUIO = CycleTotalIO * inverse(CycleTotalTop);
+			float CPUGap = CycleTotalGap * inverse(CycleTotalTop);
+
+			// chunks placed behind the next expected one
+			s32 ReorderDepth = s_ReorderSeqMax - SeqNo + 1;
+			ReorderDepth = (ReorderDepth < 0) ? 0 : ReorderDepth;
 
 			// worker cpu occupancy stats
 			u64 WorkerCPUTop = 0;
 			u64 WorkerCPUIO = 0;
 			u64 WorkerCPUParse = 0;
 			u64 WorkerCPUStall = 0;
-			for (int i=0; i < 4; i++)
+			u64 WorkerCPUDecode = 0;
+			for (int i=0; i < s_StreamCnt; i++)
 			{
 				WorkerCPUTop 	+= s_WorkerCPUTop[i]; 
 				WorkerCPUIO 	+= s_WorkerCPUIO[i]; 
 				WorkerCPUParse 	+= s_WorkerCPUParse[i]; 
 				WorkerCPUStall 	+= s_WorkerCPUStall[i]; 
+				WorkerCPUDecode	+= s_WorkerCPUDecode[i]; 
 			}
 
 			float CPUWorkerIO	 = WorkerCPUIO * inverse(WorkerCPUTop);
 			float CPUWorkerParse = WorkerCPUParse * inverse(WorkerCPUTop);
 			float CPUWorkerStall = WorkerCPUStall * inverse(WorkerCPUTop);
+			float CPUWorkerDecode= WorkerCPUDecode * inverse(WorkerCPUTop);
 
 			if (!g_Quiet) 
 			{
-				fprintf(stderr, "Recved %8.3f GB %8.3f Gbps Queue (%3i) (%3i) (%3i) (%3i)  | SeqNo: %i %i | CPU Core IO %.3f | CPU Worker IO:%.3f Parse:%.3f Stall:%.3f\n", 
+				// per connection queue depth
+				char QueueStr[STREAM_MAX * 8 + 1];
+				u32 QueueStrPos = 0;
+				for (int c=0; c < s_StreamCnt; c++)
+				{
+					QueueStrPos += sprintf(QueueStr + QueueStrPos, "(%3i) ", (u32)(N[c]->ChunkPut - N[c]->ChunkGet));
+				}
+
+				fprintf(stderr, "Recved %8.3f GB %8.3f Gbps Queue %s Pool %4i Reorder %4i Max %4i | SeqNo: %i %i | CPU Core IO %.3f Gap %.3f | CPU Worker IO:%.3f Decode:%.3f Parse:%.3f Stall:%.3f\n", 
 					TotalByte / 1e9, 
 					bps / 1e9,
 
-					(u32)(N[0]->Queue.Put - N[0]->Queue.Get),
-					(u32)(N[1]->Queue.Put - N[1]->Queue.Get),
-					(u32)(N[2]->Queue.Put - N[2]->Queue.Get),
-					(u32)(N[3]->Queue.Put - N[3]->Queue.Get),
+					QueueStr,
+					fPool_FreeCnt(s_ChunkPool),
+					ReorderDepth,
+					ReorderDepthMax,
 
 					SeqNo, s_EOFSeqNo,
 
-					CPUIO, CPUWorkerIO, CPUWorkerParse, CPUWorkerStall
+					CPUIO, CPUGap, CPUWorkerIO, CPUWorkerDecode, CPUWorkerParse, CPUWorkerStall
 				); 
 			}
+			if (s_Metrics) Metrics_Publish(N, false, TotalByte, TotalPkt, bps, SeqNo, ReorderDepth, ReorderDepthMax, CPUIO, CPUGap);
 
 			LastByte 	= TotalByte;
 			LastTSC		= TSC0;
 
-			//fProfile_Dump(15);
+			//fProfile_Dump();
 		}
 
-		fProfile_Start(15, "Top Level");
+		fProfile_Start(PROFILE_CORE_TOP, "Top Level");
 
 		// EOF ? 
 		// NOTE: SeqNo is the NEXT expected SeqNo not
@@ -736,47 +2128,66 @@ static void GetStreamData(u64 MaxSize, u8* IPAddress)
 		{
 			if (!g_Quiet) fprintf(stderr, "Last Chunk Written\n");
 			g_Exit = true;
+			fProfile_Stop(PROFILE_CORE_TOP);
 			break;
 		}
 
-		// find next seq no 
-		for (int c=0; c < 4; c++)
+		// next seq no not arrived yet 
+		Chunk_t* C = s_ReorderSlot[SeqNo & (s_ReorderMax - 1)];
+		if (C == NULL)
 		{
-			Queue_t* Q = &N[c]->Queue;
+			u64 TSC2 = rdtsc();
+			ndelay(1000);
 
-			// nothing to process 
-			if (Q->Put == Q->Get)
+			// later chunks are stuck behind the missing one
+			s32 ReorderDepth = s_ReorderSeqMax - SeqNo + 1;
+			if (ReorderDepth > 0)
 			{
-				ndelay(1000);
-				continue;
+				CycleTotalGap	+= rdtsc() - TSC2;
+				ReorderDepthMax	= (ReorderDepth > ReorderDepthMax) ? ReorderDepth : ReorderDepthMax;
 			}
+		}
 
-			// check each queue for the next seq no
-			u32 Index 	= Q->Get & Q->Mask;
-			Chunk_t* C 	= Q->Entry[Index];
-			if (C->SeqNo == SeqNo)
-			{
-				u64 TSC2 = rdtsc();
+		// drain consecutive slots 
+		while (C != NULL)
+		{
+			u64 TSC2 = rdtsc();
+			assert(C->SeqNo == SeqNo);
 
-				TotalByte += C->Header.DataLength;
-				TotalPkt += C->PktCnt;
-				//fprintf(stderr, "%lli %i\n", TotalByte, C->Header.DataLength);
+			TotalByte += C->Header.DataLength;
+			TotalPkt += C->PktCnt;
+			//fprintf(stderr, "%lli %i\n", TotalByte, C->Header.DataLength);
 
-				// next seq no to expect
-				SeqNo 		= C->SeqNo + 1;
+			// release the slot before the chunk can be recycled
+			Network_t* CN 	= N[C->StreamID];
+			s_ReorderSlot[SeqNo & (s_ReorderMax - 1)] = NULL;
 
-				// write sequential block to output 
-				File_Write(C->Data, C->Header.DataLength);
+			// next seq no to expect
+			SeqNo 			= C->SeqNo + 1;
+			s_ReorderSeqNo	= SeqNo;
 
-				// recycle the chunk
-				ChunkFree(C);
-				Q->Get++;
+			// write sequential block to output and recycle the chunk
+			fProfile_Start(PROFILE_CORE_WRITE, "write chunk");
+			File_WriteChunk(C);
+			fProfile_Stop(PROFILE_CORE_WRITE);
+			CN->ChunkGet++;
 
-				// save last time somthing was processed
-				u64 TSC3 		= rdtsc();
-				LastDataTSC  	= TSC3;
-				CycleTotalIO 	+= TSC3 - TSC2;	
-			}
+			// save last time somthing was processed
+			u64 TSC3 		= rdtsc();
+			LastDataTSC  	= TSC3;
+			CycleTotalIO 	+= TSC3 - TSC2;	
+
+			C = s_ReorderSlot[SeqNo & (s_ReorderMax - 1)];
+		}
+		File_Submit();
+
+		// make whats been written so far durable
+		if (Checkpoint && (rdtsc() > NextCheckpointTSC) && (SeqNo - 1 != s_Checkpoint.SeqNo))
+		{
+			fProfile_Start(PROFILE_CORE_CHECKPOINT, "checkpoint");
+			Checkpoint_Write(SeqNo - 1, TotalByte, TotalPkt);
+			fProfile_Stop(PROFILE_CORE_CHECKPOINT);
+			NextCheckpointTSC = rdtsc() + ns2tsc(s_CheckpointSec * 1e9);
 		}
 
 		// check for timeout on no data recevied
@@ -784,32 +2195,209 @@ static void GetStreamData(u64 MaxSize, u8* IPAddress)
 		{
 			fprintf(stderr, "ERROR: no data receveid in 10sec, exiting\n");
 			g_Exit = true;
+			fProfile_Stop(PROFILE_CORE_TOP);
 			break;
 		}
 
-		u64 TSC1 = rdtsc();
-		CycleTotalTop += TSC1 - TSC0;
+		u64 TSC1 = rdtsc();
+		CycleTotalTop += TSC1 - TSC0;
+
+		fProfile_Stop(PROFILE_CORE_TOP);
+	}
+
+	// complete download needs no checkpoint, otherwise save where it got to 
+	bool Complete = (s_EOFSeqNo != 0) && (SeqNo == s_EOFSeqNo);
+	if (Checkpoint && Complete)
+	{
+		unlink(s_CheckpointFileName);
+	}
+	else if (Checkpoint && (SeqNo - 1 != s_Checkpoint.SeqNo))
+	{
+		Checkpoint_Write(SeqNo - 1, TotalByte, TotalPkt);
+	}
+	if (Checkpoint && !Complete)
+	{
+		if (s_CheckpointSaved)	fprintf(stderr, "Incomplete download, checkpoint SeqNo %i saved to [%s], use --resume\n", s_Checkpoint.SeqNo, s_CheckpointFileName);
+		else					fprintf(stderr, "Incomplete download, nothing written so no checkpoint saved\n");
+	}
+
+	// final totals before the output and pool go away
+	if (s_Metrics) Metrics_Publish(N, Complete, TotalByte, TotalPkt, 0, SeqNo, 0, ReorderDepthMax, CycleTotalIO * inverse(CycleTotalTop), CycleTotalGap * inverse(CycleTotalTop));
+
+	File_Close();
+
+	for (int c=0; c < s_StreamCnt; c++)
+	{
+		pthread_join(RxThreadList[c], NULL);
+	}
+
+	if (!g_Quiet) fPool_Dump(s_ChunkPool, "chunk");
+	if (!g_Quiet) fprintf(stderr, "Reorder Slots:%i DepthMax:%i GapWait:%.3f Sec\n", s_ReorderMax, ReorderDepthMax, tsc2ns(CycleTotalGap) / 1e9);
+
+	fPool_Destroy(s_ChunkPool);
+	s_ChunkPool = NULL;
+
+	free((void*)s_ReorderSlot);
+	s_ReorderSlot = NULL;
+
+	u64 TSStop = clock_ns();
+
+	// print transfer stats
+	float dTS = (TSStop - TSStart) / 1e9;
+	float Bps = ((TotalByte - StartByte) * 8.0) / dTS;
+	double CPU = CPUTime() - CPUStart;
+	fprintf(stderr, "Took %.2f Sec  %.3f Gbps %.3f Mpps | CPU %.3f Sec %.3f Sec/GB\n", dTS, Bps / 1e9, (TotalPkt - StartPkt) / (dTS * 1e6), CPU, CPU * inverse((TotalByte - StartByte) / 1e9)); 
+
+	// where the cycles went, per stage
+	if (!g_Quiet)
+	{
+		u64 WorkerCPUTop = 0, WorkerCPUIO = 0, WorkerCPUParse = 0, WorkerCPUStall = 0, WorkerCPUDecode = 0;
+		for (int i=0; i < s_StreamCnt; i++)
+		{
+			WorkerCPUTop 	+= s_WorkerCPUTop[i]; 
+			WorkerCPUIO 	+= s_WorkerCPUIO[i]; 
+			WorkerCPUParse 	+= s_WorkerCPUParse[i]; 
+			WorkerCPUStall 	+= s_WorkerCPUStall[i]; 
+			WorkerCPUDecode	+= s_WorkerCPUDecode[i]; 
+		}
+		fprintf(stderr, "CPU Worker Top %.3f IO %.3f Decode %.3f Parse %.3f Stall %.3f Sec | Core Top %.3f IO %.3f Gap %.3f Sec\n",
+			tsc2ns(WorkerCPUTop) / 1e9,
+			tsc2ns(WorkerCPUIO) / 1e9,
+			tsc2ns(WorkerCPUDecode) / 1e9,
+			tsc2ns(WorkerCPUParse) / 1e9,
+			tsc2ns(WorkerCPUStall) / 1e9,
+			tsc2ns(CycleTotalTop) / 1e9,
+			tsc2ns(CycleTotalIO) / 1e9,
+			tsc2ns(CycleTotalGap) / 1e9);
+	}
+
+	// every thread of the download has exited, blocks are complete
+	if (g_ProfileEnable) fProfile_Dump();
+
+	if (s_Compress && !g_Quiet)
+	{
+		u64 DataByte = 0, XferByte = 0, LZ4Chunk = 0, Chunk = 0, Decode = 0;
+		for (int c=0; c < s_StreamCnt; c++)
+		{
+			DataByte		+= N[c]->TotalByte;
+			XferByte		+= N[c]->XferByte;
+			LZ4Chunk		+= N[c]->LZ4Chunk;
+			Chunk			+= N[c]->TotalChunk;
+			Decode			+= s_WorkerCPUDecode[c];
+		}
+		fprintf(stderr, "Compress LZ4 Chunks %lli of %lli | Wire %.3f GB Data %.3f GB Ratio %.2f | Wire %.3f Gbps | Decode %.3f Sec\n",
+			LZ4Chunk,
+			Chunk,
+			XferByte / 1e9,
+			DataByte / 1e9,
+			DataByte * inverse(XferByte),
+			XferByte * 8.0 / dTS / 1e9,
+			tsc2ns(Decode) / 1e9);
+	}
+
+	if ((s_TSFrom || s_TSTo) && !g_Quiet)
+	{
+		u64 RecvByte = 0, TrimPkt = 0, TrimByte = 0;
+		for (int c=0; c < s_StreamCnt; c++)
+		{
+			RecvByte		+= N[c]->TotalByte;
+			TrimPkt			+= N[c]->TrimPkt;
+			TrimByte		+= N[c]->TrimByte;
+		}
+
+		// capture size is whats on the device, anything not sent was skipped there
+		u64 AvoidByte = (MaxSize > RecvByte) ? MaxSize - RecvByte : 0;
+		fprintf(stderr, "TimeRange [%lli, %lli) Capture %.3f GB Received %.3f GB Avoided %.3f GB (%.2f%%) | Edge Trim Pkts %lli Bytes %.3f MB\n",
+			s_TSFrom,
+			s_TSTo,
+			MaxSize / 1e9,
+			RecvByte / 1e9,
+			AvoidByte / 1e9,
+			100.0 * AvoidByte * inverse(MaxSize),
+			TrimPkt,
+			TrimByte / 1e6);
+	}
+
+	if ((s_Filter || s_Match) && !g_Quiet)
+	{
+		u64 FilterPkt = 0, FilterPktKeep = 0, FilterByte = 0, FilterByteKeep = 0;
+		for (int c=0; c < s_StreamCnt; c++)
+		{
+			FilterPkt		+= N[c]->FilterPkt;
+			FilterPktKeep	+= N[c]->FilterPktKeep;
+			FilterByte		+= N[c]->TotalByte;
+			FilterByteKeep	+= N[c]->FilterByteKeep;
+		}
+		fprintf(stderr, "Filter [%s] Pkts %lli Kept %lli (%.2f%%) Bytes %.3f GB Kept %.3f GB\n", 
+			s_Filter ? s_Filter->Expr : "none",
+			FilterPkt,
+			FilterPktKeep,
+			100.0 * FilterPktKeep * inverse(FilterPkt),
+			FilterByte / 1e9,
+			FilterByteKeep / 1e9);
+
+		if (s_Match) fMatch_Dump(s_Match);
+	}
+
+	if ((s_SnapLen || s_SnapHeaders) && !g_Quiet)
+	{
+		u64 SliceByte = 0, SliceByteKeep = 0;
+		for (int c=0; c < s_StreamCnt; c++)
+		{
+			SliceByte		+= N[c]->SliceByte;
+			SliceByteKeep	+= N[c]->SliceByteKeep;
+		}
+		fprintf(stderr, "Slice SnapLen %i%s Bytes %.3f GB Kept %.3f GB (%.2f%%)\n", 
+			s_SnapLen,
+			s_SnapHeaders ? " Headers" : "",
+			SliceByte / 1e9,
+			SliceByteKeep / 1e9,
+			100.0 * SliceByteKeep * inverse(SliceByte));
+	}
 
-		fProfile_Stop(15);
+	if (s_Pcapng && !g_Quiet)
+	{
+		u64 PCAPByte = 0, PcapngByte = 0;
+		for (int c=0; c < s_StreamCnt; c++)
+		{
+			PCAPByte		+= N[c]->FilterByteKeep;
+			PcapngByte		+= N[c]->PcapngByte;
+		}
+		fprintf(stderr, "Pcapng Interfaces %i Bytes %.3f GB vs pcap %.3f GB (%+.2f%%)\n", 
+			s_PcapngPortCnt,
+			PcapngByte / 1e9,
+			PCAPByte / 1e9,
+			100.0 * ((double)PcapngByte - PCAPByte) * inverse(PCAPByte));
 	}
-	File_Close();
 
-	pthread_join(RxThread0, NULL);
-	pthread_join(RxThread1, NULL);
-	pthread_join(RxThread2, NULL);
-	pthread_join(RxThread3, NULL);
+	if ((s_RotateSize || s_RotateNS) && !g_Quiet)
+	{
+		fprintf(stderr, "Rotate Files %i Stall %.3f ms\n", s_RotateCnt + 1, tsc2ns(s_RotateStall) / 1e6);
+	}
 
-	u64 TSStop = clock_ns();
+	if (s_OutputZeroCopy && !g_Quiet)
+	{
+		fprintf(stderr, "ZeroCopy Written %.3f GB Copied %.3f MB (%.4f%%)\n", s_OutputWriteByte / 1e9, s_OutputCopyByte / 1e6, 100.0 * s_OutputCopyByte * inverse(TotalByte));
+	}
+}
 
-	// print transfer stats
-	float dTS = (TSStop - TSStart) / 1e9;
-	float Bps = (TotalByte * 8.0) / dTS;
-	fprintf(stderr, "Took %.2f Sec  %.3f Gbps\n", dTS, Bps / 1e9); 
+//-------------------------------------------------------------------------------------------
+// 256KB of random data the disk tests write and verify, so write
+// compression is negated
+static void TestPattern(u8* Data)
+{
+	u32 rnd = 0x12345678;
+	for (int i=0; i < kKB(256); i++)
+	{
+		Data[i] = (rnd >> 16)&0xFF;
+		rnd = rnd * 214013 + 2531011; 
+	}
 }
 
 //-------------------------------------------------------------------------------------------
-// test the local disk sequential write performance 
-static void TestStream(u64 FileLength, u8* FilePath)
+// test the local disk sequential write performance, returns bps and the
+// write latency histogram if Latency is set
+static double TestStream(u64 FileLength, u8* FilePath, fAIOConfig_t* Config, fHisto_t* Latency)
 {
 	CycleCalibration();
 
@@ -818,7 +2406,7 @@ static void TestStream(u64 FileLength, u8* FilePath)
 	int fd  = open(FilePath, O_WRONLY| O_DIRECT | O_CREAT, S_IWUSR | S_IRUSR); 
 	assert(fd > 0);
 
-	fAIO_t* AIO = fAIO_Open(fd);
+	fAIO_t* AIO = fAIO_OpenConfig(fd, Config);
 	assert(AIO != NULL);
 
 	// truncate 
@@ -854,14 +2442,10 @@ static void TestStream(u64 FileLength, u8* FilePath)
 	// write compression is negated
 	u8* WriteDataUnalign	= malloc(kKB(256)*2);
 	u8* WriteData			= (u8*)( ((u64) WriteDataUnalign + 4095) & (~4095ULL) );	
-	u32 rnd = 0x12345678;
-	for (int i=0; i < kKB(256); i++)
-	{
-		WriteData[i] = (rnd >> 16)&0xFF;
-		rnd = rnd * 214013 + 2531011; 
-	}
+	TestPattern(WriteData);
 
 	u64 StartTSC = rdtsc();
+	double CPUStart = CPUTime();
 	while (!g_Exit)
 	{
 		// print some stats
@@ -885,9 +2469,8 @@ static void TestStream(u64 FileLength, u8* FilePath)
 			LastByte 	= TotalByte;
 			LastTSC		= TSC0;
 		}
-		fAIO_Update(AIO);
-		fAIO_WriteUpdate(AIO);
 
+		// submit and completion is handled by the AIO write thread
 		/*
 		int wlen = write(fd, WriteData, kKB(256));
 		assert(wlen == kKB(256));
@@ -898,7 +2481,11 @@ static void TestStream(u64 FileLength, u8* FilePath)
 			TotalByte 	+= kKB(256); 
 			TotalPkt 	+= 1; 
 		}
-		fAIO_Kick(AIO);
+		else
+		{
+			// write queue full
+			fAIO_WriteWait(AIO);
+		}
 
 		// exit condition
 		if (TotalByte >= FileLength) break;
@@ -909,19 +2496,188 @@ static void TestStream(u64 FileLength, u8* FilePath)
 	fAIO_WriteFlush(AIO);
 
 	// total average write speed
+	double dByte = TotalByte;
+	double dT = tsc2ns(rdtsc() - StartTSC) / 1e9;
+	double bps = dByte * 8.0 / dT;
+	double CPU = CPUTime() - CPUStart;
 	if (!g_Quiet) 
 	{
-		double dByte = TotalByte;
-		double dT = tsc2ns(rdtsc() - StartTSC) / 1e9;
-		double bps = dByte * 8.0 / dT;
-
-		fprintf(stderr, "Total  %8.3f GB %8.3f Gbps\n", TotalByte / 1e9, bps / 1e9); 
+		fprintf(stderr, "Total  %8.3f GB %8.3f Gbps CPU %.3f Sec/GB | Engine %-16s Depth %4i Block %5iKB Syscalls/Write %.3f\n", 
+				TotalByte / 1e9, 
+				bps / 1e9,
+				CPU * inverse(dByte / 1e9),
+				fAIO_EngineName(AIO),
+				AIO->QueueDepth,
+				AIO->BlockSizeNext / 1024,
+				AIO->StatSyscall * inverse(AIO->StatOp)); 
 	}
 	//munmap(Map, MapLength);
-	//fAIO_DumpHisto(AIO);
+	if (!g_Quiet) fAIO_DumpHisto(AIO);
+	if (Latency) *Latency = AIO->HistoWr;
+
+	fAIO_Close(AIO);
+	free(WriteDataUnalign);
 
 	//fclose(Output);
 	close(fd);
+
+	return bps;
+}
+
+//-------------------------------------------------------------------------------------------
+// read a TestStream file back through the prefetching reader, returns bps
+// and the read latency histogram if Latency is set. every 4KB is checked
+// against the pattern
+static double TestStreamRead(u8* FilePath, fAIOConfig_t* Config, fHisto_t* Latency)
+{
+	CycleCalibration();
+
+	int fd = open(FilePath, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+	{
+		fprintf(stderr, "failed to open [%s] %i (%s)\n", FilePath, errno, strerror(errno));
+		return 0;
+	}
+	struct stat Stat;
+	fstat(fd, &Stat);
+
+	u8* PatternUnalign	= malloc(kKB(256)*2);
+	u8* Pattern			= (u8*)( ((u64) PatternUnalign + 4095) & (~4095ULL) );	
+	TestPattern(Pattern);
+
+	fAIORead_t* R = fAIO_ReadOpen(fd, 0, Stat.st_size, Config);
+	assert(R != NULL);
+
+	u64 NextPrintTSC	= 0;
+	u64 TotalByte		= 0;
+	u64 LastByte		= 0;
+	u64 LastTSC			= 0;
+	u64 BadPage			= 0;
+
+	u64 StartTSC		= rdtsc();
+	double CPUStart		= CPUTime();
+	while (!g_Exit)
+	{
+		// print some stats
+		u64 TSC0 = rdtsc();
+		if (TSC0 > NextPrintTSC)
+		{
+			NextPrintTSC = TSC0 + ns2tsc(1e9);	
+
+			double dByte = TotalByte - LastByte;
+			double dT = tsc2ns(TSC0 - LastTSC) / 1e9;
+			if (!g_Quiet) fprintf(stderr, "Read   %8.3f GB %8.3f Gbps\n", TotalByte / 1e9, dByte * 8.0 / dT / 1e9); 
+
+			LastByte 	= TotalByte;
+			LastTSC		= TSC0;
+		}
+
+		u8* Data		= NULL;
+		s32 Length		= fAIO_ReadNext(R, &Data);
+		if (Length < 0) fprintf(stderr, "read error at %lli\n", TotalByte);
+		if (Length <= 0) break;
+
+		// blocks are 4KB aligned in the file, so is the pattern
+		for (u32 p=0; p < Length; p += 4096)
+		{
+			u32 Page	= (Length - p < 4096) ? Length - p : 4096;
+			u64 Offset	= TotalByte + p;
+			if (memcmp(Data + p, Pattern + Offset % kKB(256), Page) != 0) BadPage++;
+		}
+		TotalByte += Length;
+
+		fAIO_ReadRelease(R);
+	}
+
+	double dT	= tsc2ns(rdtsc() - StartTSC) / 1e9;
+	double bps	= TotalByte * 8.0 / dT;
+	double CPU	= CPUTime() - CPUStart;
+	if (!g_Quiet) 
+	{
+		fprintf(stderr, "Total  %8.3f GB %8.3f Gbps CPU %.3f Sec/GB | Engine %-16s Depth %4i Block %5iKB Waits %lli | Verify %s (%lli bad 4KB pages)\n", 
+				TotalByte / 1e9, 
+				bps / 1e9,
+				CPU * inverse(TotalByte / 1e9),
+				fAIO_EngineName(R->AIO),
+				R->Depth,
+				R->BlockSize / 1024,
+				R->StatWait,
+				(BadPage == 0) && (TotalByte == Stat.st_size) ? "ok" : "FAIL",
+				BadPage);
+		fAIO_DumpHisto(R->AIO);
+	}
+	if (Latency) *Latency = R->AIO->HistoRd;
+
+	fAIO_ReadClose(R);
+	close(fd);
+	free(PatternUnalign);
+
+	return bps;
+}
+
+//-------------------------------------------------------------------------------------------
+// TestStream over a grid of queue depth x block size, prints Gbps and p99
+// write latency per point and the smallest depth within 5% of the best 
+// for each block size
+static void TestSweep(u64 FileLength, u8* FilePath)
+{
+	u32 DepthList[] = { 1, 2, 4, 8, 16, 32, 64, 126 };
+	u32 BlockList[] = { kKB(64), kKB(256), kMB(1), kMB(4) };
+	const u32 DepthCnt = sizeof(DepthList) / sizeof(DepthList[0]);
+	const u32 BlockCnt = sizeof(BlockList) / sizeof(BlockList[0]);
+
+	double	Gbps[DepthCnt][BlockCnt];
+	u64		P99[DepthCnt][BlockCnt];
+
+	bool Quiet	= g_Quiet;
+	g_Quiet		= true;
+
+	fHisto_t* Latency = malloc(sizeof(fHisto_t));
+	for (int b=0; b < BlockCnt; b++)
+	{
+		for (int d=0; d < DepthCnt; d++)
+		{
+			fAIOConfig_t Config	= g_fAIOConfig;
+			Config.BlockSize	= BlockList[b];
+			Config.QueueDepth	= DepthList[d];
+			Config.Adaptive		= false;
+
+			Gbps[d][b]			= TestStream(FileLength, FilePath, &Config, Latency) / 1e9;
+
+			double Pct			= 0.99;
+			fHisto_Percentile(Latency, &Pct, &P99[d][b], 1);
+
+			fprintf(stderr, "Sweep Depth %4i Block %5iKB : %8.3f Gbps p99 %8.3f ms\n", DepthList[d], BlockList[b] / 1024, Gbps[d][b], P99[d][b] / 1e6);
+		}
+	}
+	free(Latency);
+	g_Quiet = Quiet;
+
+	// curve, one column per block size
+	fprintf(stderr, "\nSweep %s Engine %s, Gbps (p99 ms)\n", FilePath, (g_fAIOConfig.Engine == FAIO_ENGINE_URING) ? "io_uring" : "libaio");
+	fprintf(stderr, "  Depth");
+	for (int b=0; b < BlockCnt; b++) fprintf(stderr, " | %14iKB", BlockList[b] / 1024);
+	fprintf(stderr, "\n");
+	for (int d=0; d < DepthCnt; d++)
+	{
+		fprintf(stderr, "  %5i", DepthList[d]);
+		for (int b=0; b < BlockCnt; b++) fprintf(stderr, " | %7.3f (%6.2f)", Gbps[d][b], P99[d][b] / 1e6);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "  Knee ");
+	for (int b=0; b < BlockCnt; b++)
+	{
+		double Best = 0;
+		for (int d=0; d < DepthCnt; d++) Best = (Gbps[d][b] > Best) ? Gbps[d][b] : Best;
+
+		u32 Knee = DepthCnt - 1;
+		for (int d=DepthCnt - 1; d >= 0; d--)
+		{
+			if (Gbps[d][b] >= Best * 0.95) Knee = d;
+		}
+		fprintf(stderr, " | Depth %4i %5.2f", DepthList[Knee], Gbps[Knee][b]);
+	}
+	fprintf(stderr, "\n");
 }
 
 //-------------------------------------------------------------------------------------------
@@ -930,7 +2686,7 @@ static void ListStreams(u8* IPAddress)
 {
 	CycleCalibration();
 
-	Network_t* CnC = NetworkOpen(0, 10000, IPAddress);
+	Network_t* CnC = NetworkOpen(0, PROTOCOL_PORT_CMD, IPAddress);
 	assert(CnC != NULL);
 
 	CmdHeader_t Cmd;
@@ -945,60 +2701,411 @@ static void ListStreams(u8* IPAddress)
 	printf("%-60s | Capture Size\n", "Stream Name");
 	printf("-------------------------------------------------------------+------------------\n");
 
-	// wait for reposonse
-	while (true)
-	{
-		// get each stream 
-		if (!RecvSock(CnC->Sock, (u8*)&Cmd, sizeof(Cmd))) break;
+	// wait for reposonse
+	while (true)
+	{
+		// get each stream 
+		if (!RecvSock(CnC->Sock, (u8*)&Cmd, sizeof(Cmd))) break;
+
+		// list finished
+		if (Cmd.Cmd == CMDHEADER_CMD_END) break;
+
+		printf("%-60s | %10.3f GB\n", Cmd.StreamName, Cmd.StreamSize / 1e9);
+	}
+	printf("-------------------------------------------------------------+------------------\n");
+	printf("\n");
+}
+
+//-------------------------------------------------------------------------------------------
+// get a specific stream 
+static void GetStream(u8* IPAddress, u8* StreamName)
+{
+	CycleCalibration();
+
+	if (!g_Quiet) fprintf(stderr, "GetStream IP[%s] [%s]\n", IPAddress, StreamName);
+
+	Network_t* CnC = NetworkOpen(0, PROTOCOL_PORT_CMD, IPAddress);
+	assert(CnC != NULL);
+
+	CmdHeader_t Cmd;
+	memset(&Cmd, 0, sizeof(Cmd));
+	Cmd.Version = CMDHEADER_VERSION_1_0;
+	Cmd.Cmd		= CMDHEADER_CMD_GET;         
+	strncpy(Cmd.StreamName, StreamName, sizeof(Cmd.StreamName));
+
+	Cmd.Arg[CMDHEADER_ARG_STREAMCNT] = s_StreamCnt;
+
+	// device skips chunks outside the range, edges are trimmed client side
+	Cmd.Arg[CMDHEADER_ARG_TSFROM_LO]	= s_TSFrom;
+	Cmd.Arg[CMDHEADER_ARG_TSFROM_HI]	= s_TSFrom >> 32;
+	Cmd.Arg[CMDHEADER_ARG_TSTO_LO]		= s_TSTo;
+	Cmd.Arg[CMDHEADER_ARG_TSTO_HI]		= s_TSTo >> 32;
+
+	// device picks per chunk, incompressible chunks still come raw
+	Cmd.Arg[CMDHEADER_ARG_COMPRESS]		= s_Compress;
+
+	// devices that support it filter at the source, the client filter still runs 
+	if (s_Filter) strncpy(Cmd.FilterBPF, s_Filter->Expr, sizeof(Cmd.FilterBPF) - 1);
+
+	// multiple patterns are sent as one alternation (p0)|(p1)..
+	for (int p=0; s_Match && (p < s_Match->PatternCnt); p++)
+	{
+		u32 Pos = strlen(Cmd.FilterRE);
+		snprintf(Cmd.FilterRE + Pos, sizeof(Cmd.FilterRE) - Pos, "%s(%s)", (p == 0) ? "" : "|", s_Match->Pattern[p].Regex);
+	}
+
+	// resume asks the device to start after the last durable chunk
+	if ((s_Resume || s_RotateSize || s_RotateNS) && !s_OutputAIO)
+	{
+		fprintf(stderr, "--resume and --rotate-* need --output-file\n");
+		return;
+	}
+	if (s_OutputLZ4 && (!s_OutputAIO || s_OutputZeroCopy || s_Resume || s_RotateSize || s_RotateNS))
+	{
+		fprintf(stderr, "--output-lz4 needs --output-file and does not combine with --zero-copy, --resume or --rotate-*\n");
+		return;
+	}
+	if (s_Pcapng && (s_OutputLZ4 || s_SplitPort))
+	{
+		fprintf(stderr, "--pcapng does not combine with --output-lz4 or --split-port\n");
+		return;
+	}
+	if (s_SplitPort && (!s_OutputAIO || s_OutputZeroCopy || s_OutputLZ4 || s_Resume || s_RotateSize || s_RotateNS || (s_StripeCnt > 1)))
+	{
+		fprintf(stderr, "--split-port needs a single --output-file and does not combine with --zero-copy, --output-lz4, --resume, --rotate-* or striping\n");
+		return;
+	}
+	if (s_OutputAIO && !Checkpoint_Open(&Cmd)) return;
+	if (s_Resumed) Cmd.Arg[CMDHEADER_ARG_SEQNO] = s_Checkpoint.SeqNo + 1;
+
+	// send request
+	send(CnC->Sock, &Cmd, sizeof(Cmd), 0);
+
+	// wait for reposonse
+	if (!RecvSock(CnC->Sock, (u8*)&Cmd, sizeof(Cmd)))
+	{
+		fprintf(stderr, "Failed to connect [%s]\n", StreamName);
+		return;
+	}
+
+	// check resposne
+	if (Cmd.Cmd != CMDHEADER_CMD_OK)
+	{
+		fprintf(stderr, "Failed to find stream [%s]\n", StreamName);
+		return;
+	}
+
+	// capture changed under the checkpoint
+	if (s_Resumed && (Cmd.StreamSize != s_Checkpoint.StreamSize))
+	{
+		fprintf(stderr, "stream size %lli differs from checkpoint %lli, can not resume\n", Cmd.StreamSize, s_Checkpoint.StreamSize);
+		return;
+	}
+	s_Checkpoint.StreamSize = Cmd.StreamSize;
+
+	// download it
+	strncpy(s_MetricsStream, StreamName, sizeof(s_MetricsStream) - 1);
+	if (s_MetricsPort && !s_Metrics) s_Metrics = fMetrics_Open(s_MetricsPort);
+
+	GetStreamData(Cmd.StreamSize, IPAddress);
+
+	// final page stays up long enough for a last scrape
+	if (s_Metrics)
+	{
+		if (s_MetricsLinger) sleep(s_MetricsLinger);
+		fMetrics_Close(s_Metrics);
+		s_Metrics = NULL;
+	}
+
+	// close CnC
+	shutdown(CnC->Sock, 0);
+}
+
+//-------------------------------------------------------------------------------------------
+// full download pipeline against the in process emulator over loopback
+static void BenchE2E(u8* StreamName)
+{
+	CycleCalibration();
+
+	fEmu_t* E = fEmu_Create(&g_fEmuConfig);
+	if (!fEmu_Start(E))
+	{
+		fEmu_Destroy(E);
+		return;
+	}
+
+	// output is discarded unless a file was given
+	if (!s_OutputAIO) s_OutputStdout = false;
+
+	struct rusage Usage0, Usage1;
+	getrusage(RUSAGE_SELF, &Usage0);
+
+	GetStream("127.0.0.1", StreamName);
+
+	getrusage(RUSAGE_SELF, &Usage1);
+	fEmu_Stop(E);
+	fEmu_Dump(E);
+
+	// process cpu less the emulator threads is the client side
+	double CPUUser	= (Usage1.ru_utime.tv_sec - Usage0.ru_utime.tv_sec) + (Usage1.ru_utime.tv_usec - Usage0.ru_utime.tv_usec) / 1e6;
+	double CPUSys	= (Usage1.ru_stime.tv_sec - Usage0.ru_stime.tv_sec) + (Usage1.ru_stime.tv_usec - Usage0.ru_stime.tv_usec) / 1e6;
+	double CPUEmu	= E->StatCPU / 1e9;
+	double CPUClient= CPUUser + CPUSys - CPUEmu;
+
+	fprintf(stderr, "E2E CPU User %.3f Sys %.3f Sec | Emu %.3f Sec Client %.3f Sec (%.3f Sec/GB)\n",
+		CPUUser,
+		CPUSys,
+		CPUEmu,
+		CPUClient,
+		CPUClient * inverse(E->StatByte / 1e9));
+
+	fEmu_Destroy(E);
+}
+
+//-------------------------------------------------------------------------------------------
+// rebuild the pcap from a striped output manifest, to a file or stdout 
+static bool Unstripe(u8* ManifestName, u8* OutputName)
+{
+	FILE* F = fopen(ManifestName, "r");
+	if (F == NULL)
+	{
+		fprintf(stderr, "failed to open manifest [%s] %i %s\n", ManifestName, errno, strerror(errno));
+		return false;
+	}
+
+	u32 Version		= 0;
+	u64 Size		= 0;
+	int FD[OUTPUT_STRIPE_MAX];
+
+	s_StripeCnt		= 0;
+	bool Valid		= (fscanf(F, "fmadio-stripe %i\n", &Version) == 1) && (Version == 1);
+	Valid			= Valid && (fscanf(F, "StripeSize %i\n", &s_StripeSize) == 1) && (s_StripeSize > 0);
+	Valid			= Valid && (fscanf(F, "Size %lli\n", &Size) == 1);
+
+	u8 FileName[1024];
+	while (Valid && (s_StripeCnt < OUTPUT_STRIPE_MAX) && (fscanf(F, "Target %1023[^\n]\n", FileName) == 1))
+	{
+		FD[s_StripeCnt] = open(FileName, O_RDONLY);
+		if (FD[s_StripeCnt] < 0)
+		{
+			fprintf(stderr, "failed to open stripe [%s] %i %s\n", FileName, errno, strerror(errno));
+			Valid = false;
+			break;
+		}
+		s_StripeCnt++;
+	}
+	fclose(F);
+
+	if (!Valid || (s_StripeCnt == 0))
+	{
+		fprintf(stderr, "invalid manifest [%s]\n", ManifestName);
+		for (int t=0; t < s_StripeCnt; t++) close(FD[t]);
+		return false;
+	}
+
+	int OutFD = 1;
+	if (OutputName != NULL)
+	{
+		OutFD = open(OutputName, O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+		if (OutFD < 0)
+		{
+			fprintf(stderr, "failed to create file [%s] %i %s\n", OutputName, errno, strerror(errno));
+			return false;
+		}
+	}
+
+	u8* Buffer = malloc(s_StripeSize);
+	assert(Buffer != NULL);
+
+	u64 Offset = 0;
+	while (Offset < Size)
+	{
+		u32 Piece = Stripe_Piece(Offset, (Size - Offset > s_StripeSize) ? s_StripeSize : Size - Offset);
+
+		int rlen = pread(FD[Stripe_Target(Offset)], Buffer, Piece, Stripe_Offset(Offset));
+		if (rlen != Piece)
+		{
+			fprintf(stderr, "stripe %i short read at %lli %i %s\n", Stripe_Target(Offset), Offset, errno, strerror(errno));
+			break;
+		}
+		int wlen = write(OutFD, Buffer, Piece);
+		if (wlen != Piece)
+		{
+			fprintf(stderr, "write failed %i %s\n", errno, strerror(errno));
+			break;
+		}
+		Offset += Piece;
+	}
+	fprintf(stderr, "Unstripe %i targets %.3f GB\n", s_StripeCnt, Offset / 1e9);
+
+	free(Buffer);
+	for (int t=0; t < s_StripeCnt; t++) close(FD[t]);
+	if (OutFD != 1) close(OutFD);
+
+	return Offset == Size;
+}
+
+//-------------------------------------------------------------------------------------------
+// decode an --output-lz4 file to stdout starting at the frame holding
+// timestamp From. frame 0 is the pcap header and always goes first
+static bool LZ4Cat(u8* FileName, u64 From)
+{
+	int FD = open(FileName, O_RDONLY);
+	if (FD < 0)
+	{
+		fprintf(stderr, "failed to open [%s] %i %s\n", FileName, errno, strerror(errno));
+		return false;
+	}
+	struct stat Stat;
+	fstat(FD, &Stat);
+
+	fLZ4SeekFooter_t Footer;
+	u32 Skip[2];
+	u64 TableOffset = 0;
+	bool Valid = (Stat.st_size >= sizeof(Skip) + sizeof(Footer));
+	Valid = Valid && (pread(FD, &Footer, sizeof(Footer), Stat.st_size - sizeof(Footer)) == sizeof(Footer));
+	Valid = Valid && (Footer.Magic == FLZ4_SEEK_MAGIC) && (Footer.EntryCnt > 0);
+	if (Valid)
+	{
+		u64 TableSize	= (u64)Footer.EntryCnt * sizeof(fLZ4Seek_t) + sizeof(Footer);
+		Valid			= (TableSize + sizeof(Skip) <= Stat.st_size);
+		TableOffset		= Stat.st_size - TableSize - sizeof(Skip);
+	}
+	Valid = Valid && (pread(FD, Skip, sizeof(Skip), TableOffset) == sizeof(Skip));
+	Valid = Valid && (Skip[0] == FLZ4_SKIP_MAGIC) && (Skip[1] == Stat.st_size - TableOffset - sizeof(Skip));
+
+	fLZ4Seek_t* Seek = Valid ? malloc(Footer.EntryCnt * sizeof(fLZ4Seek_t)) : NULL;
+	Valid = Valid && (pread(FD, Seek, Footer.EntryCnt * sizeof(fLZ4Seek_t), TableOffset + sizeof(Skip)) == Footer.EntryCnt * sizeof(fLZ4Seek_t));
+	if (!Valid)
+	{
+		fprintf(stderr, "[%s] has no seek table\n", FileName);
+		free(Seek);
+		close(FD);
+		return false;
+	}
+
+	// last data frame starting at or before From
+	u32 Lo = 1;
+	u32 Hi = Footer.EntryCnt;
+	while (Lo < Hi)
+	{
+		u32 Mid = (Lo + Hi) / 2;
+		if (Seek[Mid].TSFirst <= From) Lo = Mid + 1;
+		else Hi = Mid;
+	}
+	u32 Start = (Lo > 1) ? Lo - 1 : 1;
+
+	u8* Frame	= malloc(FLZ4_FRAME_BOUND(FPACKET_CHUNK_MAX));
+	u8* Raw		= malloc(FPACKET_CHUNK_MAX);
+	assert((Frame != NULL) && (Raw != NULL));
+
+	u64 TotalByte	= 0;
+	u32 Index		= 0;
+	while (Index < Footer.EntryCnt)
+	{
+		fLZ4Seek_t* S = &Seek[Index];
+
+		u32 Used = 0;
+		s32 RawLength = -1;
+		if ((S->FrameLength <= FLZ4_FRAME_BOUND(FPACKET_CHUNK_MAX)) && (pread(FD, Frame, S->FrameLength, S->FileOffset) == S->FrameLength))
+		{
+			RawLength = fLZ4_FrameDecompress(Raw, FPACKET_CHUNK_MAX, Frame, S->FrameLength, &Used);
+		}
+		if ((RawLength != S->RawLength) || (Used != S->FrameLength))
+		{
+			fprintf(stderr, "frame %i at %lli failed to decode\n", Index, S->FileOffset);
+			break;
+		}
+
+		// drop packets before From in the first data frame
+		u32 Pos = 0;
+		while ((Index == Start) && (Pos + sizeof(PCAPPacket_t) <= RawLength))
+		{
+			PCAPPacket_t* Pkt = (PCAPPacket_t*)(Raw + Pos);
+			if (Pkt->Sec * k1E9 + Pkt->NSec >= From) break;
+			Pos += sizeof(PCAPPacket_t) + Pkt->LengthCapture;
+		}
+		if (Pos > RawLength) Pos = RawLength;
 
-		// list finished
-		if (Cmd.Cmd == CMDHEADER_CMD_END) break;
+		int wlen = write(1, Raw + Pos, RawLength - Pos);
+		if (wlen != RawLength - Pos)
+		{
+			fprintf(stderr, "write failed %i %s\n", errno, strerror(errno));
+			break;
+		}
+		TotalByte += wlen;
 
-		printf("%-60s | %10.3f GB\n", Cmd.StreamName, Cmd.StreamSize / 1e9);
+		Index = (Index == 0) ? Start : Index + 1;
 	}
-	printf("-------------------------------------------------------------+------------------\n");
-	printf("\n");
+	fprintf(stderr, "LZ4Cat frames %i of %i from %i %.3f GB\n", Index - Start, Footer.EntryCnt - 1, Start, TotalByte / 1e9);
+
+	free(Raw);
+	free(Frame);
+	free(Seek);
+	close(FD);
+
+	return Index == Footer.EntryCnt;
 }
 
 //-------------------------------------------------------------------------------------------
-// get a specific stream 
-static void GetStream(u8* IPAddress, u8* StreamName)
+// parse the output file list e.g. "/mnt/d0/cap.pcap,/mnt/d1/cap.pcap"
+static bool ParseOutputList(char* List)
 {
-	CycleCalibration();
+	s_StripeCnt = 0;
 
-	if (!g_Quiet) fprintf(stderr, "GetStream IP[%s] [%s]\n", IPAddress, StreamName);
+	char* Str = List;
+	while (*Str)
+	{
+		char* End = strchr(Str, ',');
+		u32 Length = (End != NULL) ? End - Str : strlen(Str);
+		if ((Length == 0) || (Length >= sizeof(s_StripeFileName[0])) || (s_StripeCnt >= OUTPUT_STRIPE_MAX)) return false;
 
-	Network_t* CnC = NetworkOpen(0, 10000, IPAddress);
-	assert(CnC != NULL);
+		memcpy(s_StripeFileName[s_StripeCnt], Str, Length);
+		s_StripeFileName[s_StripeCnt][Length] = 0;
+		s_StripeCnt++;
 
-	CmdHeader_t Cmd;
-	memset(&Cmd, 0, sizeof(Cmd));
-	Cmd.Version = CMDHEADER_VERSION_1_0;
-	Cmd.Cmd		= CMDHEADER_CMD_GET;         
-	strncpy(Cmd.StreamName, StreamName, sizeof(Cmd.StreamName));
+		Str += Length;
+		if (*Str == ',') Str++;
+	}
+	if (s_StripeCnt == 0) return false;
 
-	// send request
-	send(CnC->Sock, &Cmd, sizeof(Cmd), 0);
+	strcpy(s_OutputFileName, s_StripeFileName[0]);
+	return true;
+}
 
-	// wait for reposonse
-	if (!RecvSock(CnC->Sock, (u8*)&Cmd, sizeof(Cmd)))
-	{
-		fprintf(stderr, "Failed to connect [%s]\n", StreamName);
-		return;
-	}
+//-------------------------------------------------------------------------------------------
+// parse a cpu list e.g. "20,21,24-27" 
+static bool ParseCPUList(char* List)
+{
+	s_StreamCPUCnt = 0;
 
-	// check resposne
-	if (Cmd.Cmd != CMDHEADER_CMD_OK)
+	char* Str = List;
+	while (*Str)
 	{
-		fprintf(stderr, "Failed to find stream [%s]\n", StreamName);
-		return;
-	}
+		char* End = NULL;
+		s32 CPULo = strtol(Str, &End, 10);
+		s32 CPUHi = CPULo;
+		if (End == Str) return false;
 
-	// download it
-	GetStreamData(Cmd.StreamSize, IPAddress);
+		if (*End == '-')
+		{
+			Str 	= End + 1;
+			CPUHi 	= strtol(Str, &End, 10);
+			if (End == Str) return false;
+		}
+		if ((CPULo < 0) || (CPUHi < CPULo) || (CPUHi >= CPU_SETSIZE)) return false;
 
-	// close CnC
-	shutdown(CnC->Sock, 0);
+		for (int c=CPULo; c <= CPUHi; c++)
+		{
+			if (s_StreamCPUCnt >= STREAM_MAX) return false;
+			s_StreamCPU[s_StreamCPUCnt++] = c;
+		}
+
+		if (*End == ',') End++;
+		else if (*End != 0) return false;
+		Str = End;
+	}
+	return s_StreamCPUCnt > 0;
 }
 
 //-------------------------------------------------------------------------------------------
@@ -1012,16 +3119,70 @@ static void help(void)
 	fprintf(stderr, "  -q                                        : Quiet mode\n");
 	fprintf(stderr, "  --output-stdout                           : write output to stdout\n");
 	fprintf(stderr, "  --output-disk <filename>                  : write output to disk specified at <filename>\n");
+	fprintf(stderr, "  --output-file <file>,<file>,..            : stripe the output over several files e.g. one per disk, writes <first file>.stripe manifest\n");
+	fprintf(stderr, "  --stripe-size <bytes>                     : bytes per file before moving to the next (default 256KB, multiple of 256KB)\n");
+	fprintf(stderr, "  --unstripe <manifest> [output file]       : rebuild a striped pcap to the output file or stdout\n");
+	fprintf(stderr, "  --pcapng                                  : write pcapng, one interface per capture port\n");
+	fprintf(stderr, "  --pcapng-ports <count>                    : pcapng interfaces, higher ports go on the last one (default 8)\n");
+	fprintf(stderr, "  --pcapng-flags                            : epb_flags option (inbound) on every packet\n");
+	fprintf(stderr, "  --pcapng-comment \"<text>\"                 : pcapng section comment\n");
+	fprintf(stderr, "  --split-port                              : one --output-file per capture port, files are <name>_port<port>.pcap\n");
+	fprintf(stderr, "  --output-lz4                              : write the --output-file as LZ4 frames with a seek table, readable by lz4 -d\n");
+	fprintf(stderr, "  --compress-threads <count>                : compressor threads for --output-lz4 (default one per cpu)\n");
+	fprintf(stderr, "  --lz4-cat <file> [from ns epoch]          : decode an --output-lz4 file to stdout, seeking to the first packet >= from\n");
 
 	fprintf(stderr, "  --list <fmadio device ip>                 : List all the captures on the device\n");
 	fprintf(stderr, "  --get  <fmadio device ip> <capture name>  : download the specified capture\n");
 	fprintf(stderr, "  --test <output size byte>                 : null disk write test, writes <bytes> output as fast as possible\n");
+	fprintf(stderr, "  --test-read                               : read the --test output file back with the prefetching reader and verify it\n");
+	fprintf(stderr, "  --zero-copy                               : write received chunks to disk without copying (--output-file only)\n");
+	fprintf(stderr, "  --streams <count>                         : number of parallel data connections (default 4, max %i)\n", STREAM_MAX);
+	fprintf(stderr, "  --cpus <cpu list>                         : cpus to pin the worker threads to e.g. 20,21,22-27 (default 20+)\n");
+	fprintf(stderr, "  --test-engines                            : run --test on every AIO engine (libaio, io_uring, io_uring+sqpoll)\n");
+	fprintf(stderr, "  --bench-pool <threads>                    : chunk pool micro benchmark, fPool vs spinlock free list\n");
+	fprintf(stderr, "  --bench-convert <chunks>                  : fmad to pcap header conversion correctness + Mpps per packet size mix\n");
+	fprintf(stderr, "  --bench-lz4 <chunks>                      : LZ4 chunk codec round trip, ratio and GB/s per packet size mix\n");
+	fprintf(stderr, "  --compress <lz4|none>                     : ask the device for LZ4 compressed chunks, decompressed by the worker threads\n");
+	fprintf(stderr, "  --filter \"<expr>\"                         : tcpdump style packet filter applied while downloading, must come before --get\n");
+	fprintf(stderr, "  --bench-filter <chunks>                   : filter correctness + Mpps, on the --filter expression or a built in set\n");
+	fprintf(stderr, "  --snaplen <bytes|headers>                 : truncate packets to <bytes>, or after the L2-L4 headers, must come before --get\n");
+	fprintf(stderr, "  --from <ns epoch>                         : only download packets with timestamp >= from, must come before --get\n");
+	fprintf(stderr, "  --to <ns epoch>                           : only download packets with timestamp < to, must come before --get\n");
+	fprintf(stderr, "  --filter-re \"<regex>\"                      : keep packets whose payload matches, repeat for more patterns, must come before --get\n");
+	fprintf(stderr, "  --bench-match <chunks>                    : payload matching correctness + throughput, on the --filter-re patterns or a built in set\n");
+	fprintf(stderr, "  --resume                                  : continue an interrupted --get from <output file>.ckpt, must come before --get\n");
+	fprintf(stderr, "  --checkpoint <sec>                        : seconds between resume checkpoints (default 10, 0 = off)\n");
+	fprintf(stderr, "  --rotate-size <bytes>                     : start a new output file before it exceeds <bytes>, files are <name>_<index>.pcap\n");
+	fprintf(stderr, "  --rotate-time <sec>                       : one output file per <sec> of capture time, files are <name>_<index>.pcap\n");
+	fprintf(stderr, "  --emu                                     : run the capture device emulator, streams emu_64 emu_imix emu_uniform emu_1514\n");
+	fprintf(stderr, "  --emu-size <bytes>                        : emulator capture size per stream (default 4e9)\n");
+	fprintf(stderr, "  --emu-rate <Gbps>                         : emulator send rate over all connections (default unlimited)\n");
+	fprintf(stderr, "  --emu-interleave <rr|random|burst[:n]>    : how the emulator spreads chunks over the connections (default rr, burst 8)\n");
+	fprintf(stderr, "  --emu-delay <usec> <every n chunks>       : emulator stalls a connection before every n-th chunk\n");
+	fprintf(stderr, "  --bench-e2e <stream name>                 : download from an in process emulator, Gbps Mpps + per stage CPU\n");
+	fprintf(stderr, "  --profile                                 : per thread profile of the worker, writer, compressor and AIO threads, printed after --get\n");
+	fprintf(stderr, "  --bench-profile <loops>                   : fProfile Start/Stop cost, profiling on and off\n");
+	fprintf(stderr, "  --bench-histo <samples>                   : latency histogram percentile error vs exact, merge + interval check, record cost\n");
+	fprintf(stderr, "  --metrics-port <port>                     : serve live prometheus metrics on http://127.0.0.1:<port>/metrics\n");
+	fprintf(stderr, "  --metrics-linger <sec>                    : keep serving the final metrics after the download, 0 = stop at once (default 5)\n");
+	fprintf(stderr, "  --aio-engine <libaio|uring>               : disk AIO engine (default libaio)\n");
+	fprintf(stderr, "  --aio-sqpoll                              : io_uring kernel side submission polling\n");
+	fprintf(stderr, "  --aio-block <bytes>                       : disk write block size, 4KB multiple up to 4MB (default 256KB)\n");
+	fprintf(stderr, "  --aio-depth <count>                       : disk writes in flight per output file (default %i, max %i)\n", FAIO_DEPTH_DEFAULT, FAIO_QUEUE_MAX - 2);
+	fprintf(stderr, "  --aio-adaptive                            : tune writes in flight then block size from the measured throughput, up to --aio-depth\n");
+	fprintf(stderr, "  --aio-block-max <bytes>                   : largest block --aio-adaptive may grow to (default 4MB)\n");
+	fprintf(stderr, "  --aio-gather <count>                      : zero copy chunks per vectored disk write, 1 = off (default %i)\n", FAIO_GATHER_MAX);
+	fprintf(stderr, "  --aio-spin <us>                           : AIO write thread + writers spin this long before blocking (default %ius)\n", FAIO_SPIN_US);
+	fprintf(stderr, "  --aio-busy-poll                           : AIO write thread + writers never block, lowest latency, burns a core\n");
+	fprintf(stderr, "  --test-sweep <bytes per point>            : --test over queue depth x block size, prints the Gbps + p99 latency curve\n");
 }
 
 //-------------------------------------------------------------------------------------------
 
 int main(int argc, char* argv[])
 {
+	bool TestEngines = false;
+
 	fprintf(stderr, "fmadio rsync: %s\n", __DATE__);
 	for (int i=1; i < argc; i++)
 	{
@@ -1044,13 +3205,115 @@ int main(int argc, char* argv[])
 		// output stdout 
 		else if (strcmp(argv[i], "--output-file") == 0)
 		{
-			strncpy(s_OutputFileName, argv[i+1], sizeof(s_OutputFileName) );
-			fprintf(stderr, "OutputMode File [%s]\n", s_OutputFileName);
+			if (!ParseOutputList(argv[i+1]))
+			{
+				fprintf(stderr, "invalid output file list [%s]\n", argv[i+1]);
+				return -1;
+			}
+			fprintf(stderr, "OutputMode File [%s]", s_OutputFileName);
+			if (s_StripeCnt > 1) fprintf(stderr, " Striped over %i files", s_StripeCnt);
+			fprintf(stderr, "\n");
 			i += 1;
 
 			s_OutputAIO 	= true;
 			s_OutputStdout 	= false;
 		}
+		else if (strcmp(argv[i], "--stripe-size") == 0)
+		{
+			s_StripeSize = atof(argv[i+1]);
+			if ((s_StripeSize < kKB(256)) || (s_StripeSize % kKB(256)) || (s_StripeSize > kMB(64)))
+			{
+				fprintf(stderr, "stripe size must be a multiple of 256KB up to 64MB\n");
+				return -1;
+			}
+			i += 1;
+		}
+		// rebuild a striped output 
+		else if (strcmp(argv[i], "--unstripe") == 0)
+		{
+			u8* OutputName = ((i + 2 < argc) && (argv[i+2][0] != '-')) ? argv[i+2] : NULL;
+			return Unstripe(argv[i+1], OutputName) ? 0 : -1;
+		}
+		// per thread profile
+		else if (strcmp(argv[i], "--profile") == 0)
+		{
+			g_ProfileEnable = true;
+		}
+		else if (strcmp(argv[i], "--bench-profile") == 0)
+		{
+			fProfile_Bench(atoi(argv[i+1]));
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--bench-histo") == 0)
+		{
+			fHisto_Bench(atof(argv[i+1]));
+			i += 1;
+		}
+		// live metrics endpoint
+		else if (strcmp(argv[i], "--metrics-port") == 0)
+		{
+			s_MetricsPort = atoi(argv[i+1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--metrics-linger") == 0)
+		{
+			s_MetricsLinger = atoi(argv[i+1]);
+			i += 1;
+		}
+		// pcapng output format
+		else if (strcmp(argv[i], "--pcapng") == 0)
+		{
+			s_Pcapng = true;
+		}
+		else if (strcmp(argv[i], "--pcapng-ports") == 0)
+		{
+			s_PcapngPortCnt = atoi(argv[i+1]);
+			if ((s_PcapngPortCnt == 0) || (s_PcapngPortCnt > FPACKET_PORT_MAX))
+			{
+				fprintf(stderr, "pcapng ports must be 1-%i\n", FPACKET_PORT_MAX);
+				return -1;
+			}
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--pcapng-flags") == 0)
+		{
+			s_PcapngOptions |= FPACKET_PCAPNG_FLAGS;
+		}
+		else if (strcmp(argv[i], "--pcapng-comment") == 0)
+		{
+			s_PcapngComment = argv[i+1];
+			if (strlen(s_PcapngComment) > 4096)
+			{
+				fprintf(stderr, "pcapng comment is limited to 4096 bytes\n");
+				return -1;
+			}
+			i += 1;
+		}
+		// per port output files
+		else if (strcmp(argv[i], "--split-port") == 0)
+		{
+			s_SplitPort = true;
+		}
+		// compressed seekable output
+		else if (strcmp(argv[i], "--output-lz4") == 0)
+		{
+			s_OutputLZ4 = true;
+		}
+		else if (strcmp(argv[i], "--compress-threads") == 0)
+		{
+			s_CompressThreadCnt = atoi(argv[i+1]);
+			if ((s_CompressThreadCnt == 0) || (s_CompressThreadCnt > COMPRESS_THREAD_MAX))
+			{
+				fprintf(stderr, "compressor threads must be 1-%i\n", COMPRESS_THREAD_MAX);
+				return -1;
+			}
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--lz4-cat") == 0)
+		{
+			u64 From = ((i + 2 < argc) && (argv[i+2][0] != '-')) ? strtoull(argv[i+2], NULL, 10) : 0;
+			return LZ4Cat(argv[i+1], From) ? 0 : -1;
+		}
 		// list all the captures 
 		else if (strcmp(argv[i], "--list") == 0)
 		{
@@ -1063,14 +3326,344 @@ int main(int argc, char* argv[])
 			GetStream(argv[i + 1], argv[i+2]);
 			i += 2;
 		}
+		// zero copy disk output
+		else if (strcmp(argv[i], "--zero-copy") == 0)
+		{
+			s_OutputZeroCopy = true;
+			fprintf(stderr, "OutputMode ZeroCopy\n");
+		}
+		// number of parallel connections
+		else if (strcmp(argv[i], "--streams") == 0)
+		{
+			s_StreamCnt = atoi(argv[i+1]);
+			if ((s_StreamCnt < 1) || (s_StreamCnt > STREAM_MAX))
+			{
+				fprintf(stderr, "invalid stream count %i (1-%i)\n", s_StreamCnt, STREAM_MAX);
+				return -1;
+			}
+			fprintf(stderr, "Streams %i\n", s_StreamCnt);
+			i += 1;
+		}
+		// worker cpu list
+		else if (strcmp(argv[i], "--cpus") == 0)
+		{
+			if (!ParseCPUList(argv[i+1]))
+			{
+				fprintf(stderr, "invalid cpu list [%s]\n", argv[i+1]);
+				return -1;
+			}
+			i += 1;
+		}
+		// AIO engine 
+		else if (strcmp(argv[i], "--aio-engine") == 0)
+		{
+			if (strcmp(argv[i+1], "libaio") == 0)
+			{
+				g_fAIOConfig.Engine = FAIO_ENGINE_LIBAIO;
+			}
+			else if (strcmp(argv[i+1], "uring") == 0)
+			{
+				g_fAIOConfig.Engine = FAIO_ENGINE_URING;
+			}
+			else
+			{
+				fprintf(stderr, "unknown aio engine [%s]\n", argv[i+1]);
+				return -1;
+			}
+			fprintf(stderr, "AIO Engine [%s]\n", argv[i+1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-block") == 0)
+		{
+			g_fAIOConfig.BlockSize = atof(argv[i+1]);
+			fAIO_ConfigDefault(&g_fAIOConfig);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-depth") == 0)
+		{
+			g_fAIOConfig.QueueDepth = atoi(argv[i+1]);
+			fAIO_ConfigDefault(&g_fAIOConfig);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-adaptive") == 0)
+		{
+			g_fAIOConfig.Adaptive = true;
+		}
+		else if (strcmp(argv[i], "--aio-block-max") == 0)
+		{
+			g_fAIOConfig.BlockMax = atof(argv[i+1]);
+			fAIO_ConfigDefault(&g_fAIOConfig);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-gather") == 0)
+		{
+			g_fAIOConfig.GatherMax = atoi(argv[i+1]);
+			fAIO_ConfigDefault(&g_fAIOConfig);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-spin") == 0)
+		{
+			g_fAIOConfig.SpinUS = atoi(argv[i+1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-busy-poll") == 0)
+		{
+			g_fAIOConfig.SpinUS = FAIO_SPIN_FOREVER;
+		}
+		// depth x block size write curve
+		else if (strcmp(argv[i], "--test-sweep") == 0)
+		{
+			TestSweep(atof(argv[i+1]), s_OutputFileName);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--aio-sqpoll") == 0)
+		{
+			g_fAIOConfig.SQPoll = true;
+			fprintf(stderr, "AIO SQPoll enabled\n");
+		}
+		// benchmark all engines with --test
+		else if (strcmp(argv[i], "--test-engines") == 0)
+		{
+			TestEngines = true;
+		}
+		// chunk pool micro benchmark
+		else if (strcmp(argv[i], "--bench-pool") == 0)
+		{
+			u32 ThreadCnt = atoi(argv[i+1]);
+			if (ThreadCnt == 0)
+			{
+				fprintf(stderr, "bench pool threads must be 1 or more\n");
+				return -1;
+			}
+			fPool_Bench(ThreadCnt, 2e6);
+			i += 1;
+		}
+		// client side packet filter
+		else if (strcmp(argv[i], "--filter") == 0)
+		{
+			s_Filter = fFilter_Compile(argv[i+1]);
+			if (s_Filter == NULL) return -1;
+
+			fprintf(stderr, "Filter [%s] Ops:%i\n", s_Filter->Expr, s_Filter->OpCnt);
+			i += 1;
+		}
+		// resumable downloads
+		else if (strcmp(argv[i], "--resume") == 0)
+		{
+			s_Resume = true;
+		}
+		else if (strcmp(argv[i], "--checkpoint") == 0)
+		{
+			s_CheckpointSec = atoi(argv[i+1]);
+			i += 1;
+		}
+		// output rotation
+		else if (strcmp(argv[i], "--rotate-size") == 0)
+		{
+			s_RotateSize = atof(argv[i+1]);
+			if (s_RotateSize < kMB(1))
+			{
+				fprintf(stderr, "rotate size %lli too small, min 1MB\n", s_RotateSize);
+				return -1;
+			}
+			fprintf(stderr, "Rotate every %.3f GB\n", s_RotateSize / 1e9);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--rotate-time") == 0)
+		{
+			s_RotateNS = atof(argv[i+1]) * 1e9;
+			if (s_RotateNS == 0)
+			{
+				fprintf(stderr, "invalid rotate time [%s]\n", argv[i+1]);
+				return -1;
+			}
+			fprintf(stderr, "Rotate every %.3f Sec of capture\n", s_RotateNS / 1e9);
+			i += 1;
+		}
+		// packet slicing 
+		else if (strcmp(argv[i], "--snaplen") == 0)
+		{
+			if (strcmp(argv[i+1], "headers") == 0)
+			{
+				s_SnapHeaders = true;
+			}
+			else
+			{
+				s_SnapLen = atoi(argv[i+1]);
+				if ((s_SnapLen == 0) || (s_SnapLen > 65535))
+				{
+					fprintf(stderr, "snaplen must be 1-65535 or headers\n");
+					return -1;
+				}
+			}
+			fprintf(stderr, "SnapLen [%s]\n", argv[i+1]);
+			i += 1;
+		}
+		// time range
+		else if ((strcmp(argv[i], "--from") == 0) || (strcmp(argv[i], "--to") == 0))
+		{
+			char* End = NULL;
+			u64 TS = strtoull(argv[i+1], &End, 10);
+			if ((End == argv[i+1]) || (*End != 0))
+			{
+				fprintf(stderr, "invalid timestamp [%s], expecting ns since epoch\n", argv[i+1]);
+				return -1;
+			}
+			if (argv[i][2] == 'f') 	s_TSFrom 	= TS;
+			else 					s_TSTo 		= TS;
+
+			if (s_TSTo && (s_TSTo <= s_TSFrom))
+			{
+				fprintf(stderr, "empty time range [%lli, %lli)\n", s_TSFrom, s_TSTo);
+				return -1;
+			}
+			fprintf(stderr, "TimeRange [%lli, %lli)\n", s_TSFrom, s_TSTo);
+			i += 1;
+		}
+		// payload regex filter
+		else if (strcmp(argv[i], "--filter-re") == 0)
+		{
+			if (s_Match == NULL) s_Match = fMatch_Create();
+			if (!fMatch_Add(s_Match, argv[i+1])) return -1;
+
+			fprintf(stderr, "FilterRE [%s]\n", argv[i+1]);
+			i += 1;
+		}
+		// payload matching check + benchmark
+		else if (strcmp(argv[i], "--bench-match") == 0)
+		{
+			fMatch_Bench(s_Match, atoi(argv[i+1]));
+			i += 1;
+		}
+		// filter check + benchmark
+		else if (strcmp(argv[i], "--bench-filter") == 0)
+		{
+			fFilter_Bench(s_Filter, atoi(argv[i+1]));
+			i += 1;
+		}
+		// capture device emulator
+		else if (strcmp(argv[i], "--emu") == 0)
+		{
+			CycleCalibration();
+
+			fEmu_t* E = fEmu_Create(&g_fEmuConfig);
+			if (!fEmu_Start(E)) return -1;
+			while (true) sleep(1);
+		}
+		else if (strcmp(argv[i], "--emu-size") == 0)
+		{
+			g_fEmuConfig.StreamSize = atof(argv[i+1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--emu-rate") == 0)
+		{
+			g_fEmuConfig.Rate = atof(argv[i+1]);
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--emu-interleave") == 0)
+		{
+			if (strcmp(argv[i+1], "rr") == 0)				g_fEmuConfig.Interleave = FEMU_INTERLEAVE_RR;
+			else if (strcmp(argv[i+1], "random") == 0)		g_fEmuConfig.Interleave = FEMU_INTERLEAVE_RANDOM;
+			else if (strncmp(argv[i+1], "burst", 5) == 0)
+			{
+				g_fEmuConfig.Interleave = FEMU_INTERLEAVE_BURST;
+				if (argv[i+1][5] == ':') g_fEmuConfig.Burst = atoi(argv[i+1] + 6);
+			}
+			else
+			{
+				fprintf(stderr, "unknown emulator interleave [%s]\n", argv[i+1]);
+				return -1;
+			}
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--emu-delay") == 0)
+		{
+			g_fEmuConfig.DelayUS	= atoi(argv[i+1]);
+			g_fEmuConfig.DelayEvery	= atoi(argv[i+2]);
+			i += 2;
+		}
+		// end to end benchmark against the emulator
+		else if (strcmp(argv[i], "--bench-e2e") == 0)
+		{
+			BenchE2E(argv[i+1]);
+			i += 1;
+		}
+		// header conversion kernel check + benchmark
+		else if (strcmp(argv[i], "--bench-convert") == 0)
+		{
+			fPacket_Bench(atoi(argv[i+1]));
+			i += 1;
+		}
+		else if (strcmp(argv[i], "--bench-lz4") == 0)
+		{
+			fLZ4_Bench(atoi(argv[i+1]));
+			i += 1;
+		}
+		// compressed chunk transfer 
+		else if (strcmp(argv[i], "--compress") == 0)
+		{
+			if (strcmp(argv[i+1], "lz4") == 0)
+			{
+				s_Compress = CMDHEADER_COMPRESS_LZ4;
+			}
+			else if (strcmp(argv[i+1], "none") == 0)
+			{
+				s_Compress = CMDHEADER_COMPRESS_NONE;
+			}
+			else
+			{
+				fprintf(stderr, "unknown compression [%s]\n", argv[i+1]);
+				return -1;
+			}
+			fprintf(stderr, "Compress [%s]\n", argv[i+1]);
+			i += 1;
+		}
 		// local disk io perf testing 
 		else if (strcmp(argv[i], "--test") == 0)
 		{
 			u64 GBWrite = atof(argv[i+1]);
 			fprintf(stderr, "Stream Null size %.f GB\n", GBWrite/1e9);
-			TestStream(GBWrite, s_OutputFileName);
+			if (TestEngines)
+			{
+				fAIOConfig_t EngineList[3] =
+				{
+					{ .Engine = FAIO_ENGINE_LIBAIO, .SQPoll = false },
+					{ .Engine = FAIO_ENGINE_URING,  .SQPoll = false },
+					{ .Engine = FAIO_ENGINE_URING,  .SQPoll = true  },
+				};
+				for (int e=0; e < 3; e++)
+				{
+					// block size + depth from the command line
+					fAIOConfig_t Config	= g_fAIOConfig;
+					Config.Engine		= EngineList[e].Engine;
+					Config.SQPoll		= EngineList[e].SQPoll;
+					TestStream(GBWrite, s_OutputFileName, &Config, NULL);
+				}
+			}
+			else
+			{
+				TestStream(GBWrite, s_OutputFileName, &g_fAIOConfig, NULL);
+			}
 			i += 1;
 		}
+		// disk sequential read test 
+		else if (strcmp(argv[i], "--test-read") == 0)
+		{
+			if (TestEngines)
+			{
+				u32 EngineList[2] = { FAIO_ENGINE_LIBAIO, FAIO_ENGINE_URING };
+				for (int e=0; e < 2; e++)
+				{
+					fAIOConfig_t Config	= g_fAIOConfig;
+					Config.Engine		= EngineList[e];
+					TestStreamRead(s_OutputFileName, &Config, NULL);
+				}
+			}
+			else
+			{
+				TestStreamRead(s_OutputFileName, &g_fAIOConfig, NULL);
+			}
+		}
 		else
 		{
 			fprintf(stderr, "unknown command [%s]\n", argv[i]);